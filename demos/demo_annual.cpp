@@ -0,0 +1,183 @@
+// Annual run of a radial field at Daggett, California: hourly sun positions of 2010 from the solar
+// position module, a clear sky dni (Meinel), and one AnnualRunner that sets the scene up once and
+// only retracks the heliostats per hour. The same hours are run without pipelining, which must give
+// the same receiver power, and the first day steps are run the old way, with a new tracer set up and
+// torn down for every step, for the throughput it replaces.
+//
+// usage: demo_annual [--cpu] [number of rays] [number of days]
+#include "core/annual_runner.h"
+#include "core/soltrace_system.h"
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 100.0);
+
+    // rings of heliostats around the tower and the cylindrical receiver on top, heliostats first
+    std::vector<std::shared_ptr<CspElement>> build_field(int num_rings) {
+        std::vector<std::shared_ptr<CspElement>> elements;
+        for (int ring = 0; ring < num_rings; ring++) {
+            const double radius = 60.0 + ring * 25.0;
+            const double spacing = 20.0 + ring * 1.5;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / spacing);
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 5.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(origin + Vec3d(0.0, 0.0, 100.0));
+                e->set_zrot(0.0);
+                auto surface = std::make_shared<SurfaceParabolic>();
+                surface->set_curvature(0.005, 0.005);
+                e->set_surface(surface);
+                e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+                elements.push_back(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        elements.push_back(receiver);
+        return elements;
+    }
+
+    // clear sky dni of Meinel and Meinel from the air mass, W/m2
+    double clear_sky_dni(const Vec3d& sun_vector) {
+        const double sin_elevation = sun_vector.normalized()[2];
+        if (sin_elevation <= 0.0) return 0.0;
+        const double air_mass = 1.0 / sin_elevation;
+        return 1353.0 * std::pow(0.7, std::pow(air_mass, 0.678));
+    }
+
+    template <class Tracer>
+    void setup(Tracer& tracer, const std::vector<std::shared_ptr<CspElement>>& elements) {
+        for (const std::shared_ptr<CspElement>& e : elements)
+            tracer.add_element(e);
+        tracer.set_sun_angle(0.00465);
+        tracer.set_verbose(false);
+    }
+
+    void clean_up(CpuTracer&) {}
+    void clean_up(SolTraceSystem& tracer) { tracer.clean_up(); }
+
+    template <class Tracer>
+    std::vector<AnnualStepResult> run_annual(int num_rays, const std::vector<AnnualStep>& steps, bool pipelined) {
+        const std::vector<std::shared_ptr<CspElement>> elements = build_field(6);
+        Tracer tracer(num_rays);
+        setup(tracer, elements);
+
+        AnnualRunner<Tracer> runner(tracer);
+        for (size_t i = 0; i + 1 < elements.size(); i++)
+            runner.add_heliostat(elements[i], receiver_center);
+        runner.set_pipelined(pipelined);
+        runner.run(steps);
+
+        const AnnualRunStats& stats = runner.get_stats();
+        std::cout << (pipelined ? "pipelined: " : "not pipelined: ") << stats.num_traced << " of " << stats.num_steps
+                  << " steps traced in " << stats.time_total << " s, " << stats.steps_per_second()
+                  << " steps/s (setup " << stats.time_update << " s, trace " << stats.time_trace << " s, tracking "
+                  << stats.time_prepare << " s)" << std::endl;
+        std::cout << "  energy on the receiver " << runner.get_energy() * 1e-6 << " MWh" << std::endl;
+        clean_up(tracer);
+        return runner.get_results();
+    }
+
+    // a new tracer per step: add the elements, initialize, run, clean up
+    template <class Tracer>
+    std::vector<double> run_fresh(int num_rays, const std::vector<AnnualStep>& steps, size_t num_day_steps) {
+        std::vector<double> power;
+        Timer timer;
+        timer.start();
+        for (const AnnualStep& step : steps) {
+            if (power.size() == num_day_steps) break;
+            if (!(step.dni > 0.0 && step.sun_vector[2] > 0.0)) continue;
+
+            const std::vector<std::shared_ptr<CspElement>> elements = build_field(6);
+            for (size_t i = 0; i + 1 < elements.size(); i++)
+                elements[i]->set_aim_point(tracking_aim_point(elements[i]->get_origin(), receiver_center, step.sun_vector));
+            Tracer tracer(num_rays);
+            setup(tracer, elements);
+            tracer.set_sun_vector(step.sun_vector);
+            tracer.set_dni(step.dni);
+            tracer.initialize();
+            tracer.run();
+            power.push_back(tracer.get_receiver_power());
+            clean_up(tracer);
+        }
+        timer.stop();
+        std::cout << "new tracer per step: " << power.size() << " steps in " << timer.get_time_sec() << " s, "
+                  << power.size() / timer.get_time_sec() << " steps/s" << std::endl;
+        return power;
+    }
+
+    template <class Tracer>
+    int run(int num_rays, int num_days) {
+        SolarSite daggett;
+        daggett.latitude = 34.87;
+        daggett.longitude = -116.78;
+
+        std::vector<double> times = hourly_timestamps(2010);
+        times.resize(std::min<size_t>(times.size(), static_cast<size_t>(num_days) * 24));
+        std::vector<AnnualStep> steps = annual_steps(daggett, times, std::vector<double>(times.size(), 0.0));
+        for (AnnualStep& step : steps)
+            step.dni = clear_sky_dni(step.sun_vector);
+
+        const std::vector<AnnualStepResult> pipelined = run_annual<Tracer>(num_rays, steps, true);
+        const std::vector<AnnualStepResult> serial = run_annual<Tracer>(num_rays, steps, false);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < steps.size(); i++)
+            if (pipelined[i].receiver_power != serial[i].receiver_power || pipelined[i].traced != serial[i].traced)
+                mismatches++;
+        std::cout << mismatches << " steps differ between the pipelined and the serial run"
+                  << (mismatches ? "  FAILED" : "") << std::endl;
+
+        // the same day steps, each on a tracer of its own
+        const std::vector<double> fresh = run_fresh<Tracer>(num_rays, steps, 24);
+        size_t fresh_mismatches = 0;
+        for (size_t i = 0, k = 0; i < steps.size() && k < fresh.size(); i++) {
+            if (!pipelined[i].traced) continue;
+            if (std::abs(pipelined[i].receiver_power - fresh[k]) > 1e-6 * std::max(1.0, fresh[k])) fresh_mismatches++;
+            k++;
+        }
+        std::cout << fresh_mismatches << " of " << fresh.size() << " steps differ from a new tracer per step"
+                  << (fresh_mismatches ? "  FAILED" : "") << std::endl;
+
+        // a summer day, hour by hour
+        std::cout << "June 21st, hour (UTC): power (kW)" << std::endl;
+        const size_t june21 = 171 * 24;
+        for (size_t i = june21; i < june21 + 24 && i < pipelined.size(); i++)
+            if (pipelined[i].traced)
+                std::cout << "  " << i - june21 << ": " << pipelined[i].receiver_power * 1e-3 << std::endl;
+
+        return mismatches == 0 && fresh_mismatches == 0 ? 0 : 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool use_cpu = false;
+    std::vector<int> numbers;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--cpu") == 0) use_cpu = true;
+        else numbers.push_back(std::atoi(argv[i]));
+    }
+    const int num_rays = numbers.size() > 0 ? numbers[0] : 100000;
+    const int num_days = numbers.size() > 1 ? numbers[1] : 365;
+
+    return use_cpu ? run<CpuTracer>(num_rays, num_days) : run<SolTraceSystem>(num_rays, num_days);
+}
@@ -0,0 +1,170 @@
+// Compares the binary host BVH with the compressed 8-wide BVH (8 and 16 bit child boxes):
+// memory footprint, build time and traversal speed on a large heliostat field with a
+// triangulated receiver. All trees must return the same closest hit for every ray.
+#include "cpu/bvh.h"
+#include "core/timer.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+
+    OptixAabb bounds_of(const GeometryDataST& g) {
+        float3 lo, hi;
+        if (g.type == GeometryDataST::TRIANGLE_FLAT) {
+            const auto& t = g.getTriangle_Flat();
+            const float3 b = t.v0 + t.e1, c = t.v0 + t.e2;
+            lo = make_float3(fminf(t.v0.x, fminf(b.x, c.x)), fminf(t.v0.y, fminf(b.y, c.y)), fminf(t.v0.z, fminf(b.z, c.z)));
+            hi = make_float3(fmaxf(t.v0.x, fmaxf(b.x, c.x)), fmaxf(t.v0.y, fmaxf(b.y, c.y)), fmaxf(t.v0.z, fmaxf(b.z, c.z)));
+        }
+        else {
+            const auto& r = g.getRectangle_Flat();
+            const float3 ext = make_float3(fabsf(r.x.x), fabsf(r.x.y), fabsf(r.x.z)) * (r.width / 2) +
+                               make_float3(fabsf(r.y.x), fabsf(r.y.y), fabsf(r.y.z)) * (r.height / 2);
+            lo = r.center - ext;
+            hi = r.center + ext;
+        }
+        OptixAabb aabb;
+        aabb.minX = lo.x; aabb.minY = lo.y; aabb.minZ = lo.z;
+        aabb.maxX = hi.x; aabb.maxY = hi.y; aabb.maxZ = hi.z;
+        return aabb;
+    }
+
+    // square field of tilted flat heliostats around a cylinder-shaped triangle mesh receiver
+    std::vector<GeometryDataST> make_scene(int num_heliostats, int mesh_segments) {
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+        std::vector<GeometryDataST> scene;
+
+        const int side = static_cast<int>(std::ceil(std::sqrt(double(num_heliostats))));
+        const float spacing = 12.0f;
+        const float3 aim = make_float3(0.0f, 0.0f, 100.0f);
+        for (int i = 0; i < num_heliostats; i++) {
+            const float3 c = make_float3((i % side - side / 2) * spacing + jitter(rng),
+                                         (i / side - side / 2) * spacing + jitter(rng),
+                                         5.0f);
+            const float3 n = normalize(normalize(aim - c) + make_float3(0.0f, 0.0f, 1.0f));
+            const float3 x = normalize(cross(make_float3(0.0f, 0.0f, 1.0f), n) + make_float3(1e-4f, 0.0f, 0.0f));
+            const float3 y = cross(n, x);
+            GeometryDataST g;
+            g.setRectangle_Flat(GeometryDataST::Rectangle_Flat(c, x, y, 10.0f, 10.0f));
+            scene.push_back(g);
+        }
+
+        const float radius = 8.0f, z0 = 90.0f, height = 20.0f;
+        const int rings = mesh_segments / 4 + 1;
+        for (int r = 0; r < rings; r++) {
+            const float za = z0 + height * r / rings, zb = z0 + height * (r + 1) / rings;
+            for (int s = 0; s < mesh_segments; s++) {
+                const float pa = 2.0f * M_PIf * s / mesh_segments, pb = 2.0f * M_PIf * (s + 1) / mesh_segments;
+                const float3 a0 = make_float3(radius * cosf(pa), radius * sinf(pa), za);
+                const float3 b0 = make_float3(radius * cosf(pb), radius * sinf(pb), za);
+                const float3 a1 = make_float3(a0.x, a0.y, zb);
+                const float3 b1 = make_float3(b0.x, b0.y, zb);
+                GeometryDataST t0, t1;
+                t0.setTriangle_Flat(GeometryDataST::Triangle_Flat(a0, a1, b0));
+                t1.setTriangle_Flat(GeometryDataST::Triangle_Flat(b0, a1, b1));
+                scene.push_back(t0);
+                scene.push_back(t1);
+            }
+        }
+        return scene;
+    }
+
+    // rays from the receiver height toward random points of the field, plus random sky rays
+    std::vector<HostRay> make_rays(int count, float field_half_size) {
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+        std::vector<HostRay> rays(count);
+        for (auto& r : rays) {
+            r.orig = make_float3(u(rng) * field_half_size, u(rng) * field_half_size, 200.0f);
+            const float3 target = make_float3(u(rng) * field_half_size, u(rng) * field_half_size, 0.0f);
+            r.dir = normalize(target - r.orig);
+            r.tmin = 1e-3f;
+            r.tmax = 1e16f;
+        }
+        return rays;
+    }
+
+    template <class Tree>
+    void report(const std::string& name, const Tree& tree, double build_sec, size_t num_prims,
+                const std::vector<HostRay>& rays, const std::vector<GeometryDataST>& scene,
+                const std::vector<BvhHit>& reference, std::vector<BvhHit>& out) {
+        auto test = [&](uint32_t prim, const HostRay& ray, float& t) {
+            float3 n;
+            return intersect_geometry(scene[prim], ray, t, n);
+        };
+
+        Timer timer;
+        timer.start();
+        for (size_t i = 0; i < rays.size(); i++)
+            out[i] = tree.closest_hit(rays[i], test);
+        timer.stop();
+
+        size_t mismatches = 0;
+        if (!reference.empty()) {
+            for (size_t i = 0; i < rays.size(); i++)
+                if (out[i].prim != reference[i].prim || out[i].t != reference[i].t) mismatches++;
+        }
+
+        std::cout << name
+                  << ", memory MB, " << tree.memory_bytes() / (1024.0 * 1024.0)
+                  << ", bytes/prim, " << double(tree.memory_bytes()) / num_prims
+                  << ", nodes, " << tree.nodes().size()
+                  << ", build s, " << build_sec
+                  << ", Mrays/s, " << rays.size() / timer.get_time_sec() * 1e-6
+                  << ", mismatches, " << mismatches << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int num_heliostats = 1000000;
+    int mesh_segments = 256;
+    int num_rays = 1000000;
+    if (argc > 1) num_heliostats = std::stoi(argv[1]);
+    if (argc > 2) mesh_segments = std::stoi(argv[2]);
+    if (argc > 3) num_rays = std::stoi(argv[3]);
+
+    std::vector<GeometryDataST> scene = make_scene(num_heliostats, mesh_segments);
+    std::vector<OptixAabb> aabbs(scene.size());
+    for (size_t i = 0; i < scene.size(); i++) aabbs[i] = bounds_of(scene[i]);
+
+    const float field_half_size = 6.0f * std::sqrt(float(num_heliostats));
+    std::vector<HostRay> rays = make_rays(num_rays, field_half_size);
+    std::cout << "primitives, " << scene.size() << ", rays, " << rays.size() << std::endl;
+
+    Timer timer;
+    Bvh binary;
+    timer.start();
+    binary.build(aabbs);
+    timer.stop();
+    const double binary_build = timer.get_time_sec();
+
+    WideBvh8 wide8;
+    timer.reset();
+    timer.start();
+    wide8.build(binary);
+    timer.stop();
+    const double wide8_build = timer.get_time_sec();
+
+    WideBvh16 wide16;
+    timer.reset();
+    timer.start();
+    wide16.build(binary);
+    timer.stop();
+    const double wide16_build = timer.get_time_sec();
+
+    std::vector<BvhHit> reference(rays.size()), hits(rays.size());
+    report("binary", binary, binary_build, scene.size(), rays, scene, {}, reference);
+    report("wide8, 8-bit", wide8, wide8_build, scene.size(), rays, scene, reference, hits);
+    report("wide8, 16-bit", wide16, wide16_build, scene.size(), rays, scene, reference, hits);
+
+    std::cout << "binary tree depth, " << binary.depth() << ", node size, " << sizeof(BvhNode)
+              << ", wide node size (8/16-bit), " << sizeof(WideBvh8::Node) << "/" << sizeof(WideBvh16::Node) << std::endl;
+    return 0;
+}
@@ -0,0 +1,161 @@
+// Chunked runs: a ray budget beyond what the buffers of one launch may take is traced as chunks
+// of the size a memory planner picks from a memory budget, each chunk a launch on the same
+// buffers going on with the sample sequence of the previous one. The tallies and flux maps of the
+// chunks must average to those of a single launch over all the rays, and the hit points of the
+// chunks one after the other must be the ones of that launch, with the hit point buffer or a hit
+// stream, which leaves out the sun points of the rays that hit nothing. With an output directory
+// the hit points are written chunk by chunk, and those of the single launch next to them.
+//
+// usage: demo_cpu_chunked_run [number of rays] [memory budget, MB] [output directory]
+#include "cpu/cpu_tracer.h"
+#include "core/chunked_runner.h"
+#include "demo_fields.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d sun_vector = Vec3d(0.2, -0.5, 0.8).normalized();
+
+    void setup(CpuTracer& tracer) {
+        for (const std::shared_ptr<CspElement>& e : demo_fields::north_field(sun_vector, 0.9, 2e-3))
+            tracer.add_element(e);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_angle(0.00465);
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 19u);
+        tracer.set_flux_map_resolution(40, 40);
+        tracer.set_receiver_element_power(true);
+    }
+
+    // the hit points of the last run in the layout of the hit point buffer, decoded from a hit stream
+    std::vector<float4> hit_points(const CpuTracer& tracer) {
+        if (tracer.get_hit_stream() == 0) return tracer.get_hit_point_buffer();
+        std::vector<float4> points;
+        std::vector<float> power;
+        decode_hit_records(tracer.get_hit_records(), static_cast<size_t>(tracer.get_sun_points()), tracer.get_max_depth(),
+                           points, power);
+        return points;
+    }
+
+    bool same_hits(const std::vector<float4>& a, const std::vector<float4>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++)
+            if (a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z || a[i].w != b[i].w) return false;
+        return true;
+    }
+
+    // the hit points of every chunk, one after the other
+    void collect_hits(ChunkedRunner<CpuTracer>& runner, std::vector<float4>& hits) {
+        runner.set_chunk_callback([&hits](CpuTracer& tracer, size_t) {
+            const std::vector<float4> chunk = hit_points(tracer);
+            hits.insert(hits.end(), chunk.begin(), chunk.end());
+        });
+    }
+
+    // largest difference of the cells relative to the peak
+    double map_difference(const FluxMap& a, const FluxMap& b) {
+        double difference = 0.0;
+        for (size_t c = 0; c < a.flux.size(); c++)
+            difference = std::max(difference, std::abs(a.flux[c] - b.flux[c]));
+        return difference / b.peak_flux;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const size_t num_rays = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 300000;
+    const size_t budget = static_cast<size_t>((argc > 2 ? std::atof(argv[2]) : 3.0) * 1048576.0);
+    const std::string out_dir = argc > 3 ? std::string(argv[3]) + "/" : "";
+    if (!out_dir.empty()) std::filesystem::create_directories(out_dir);
+
+    // chunks of the hit point buffer
+    CpuTracer chunked(0);
+    setup(chunked);
+    ChunkedRunner<CpuTracer> runner(chunked, num_rays);
+    runner.set_memory_budget(budget);
+    runner.set_element_power(true);
+    std::vector<float4> chunked_hits;
+    collect_hits(runner, chunked_hits);
+    if (!out_dir.empty()) runner.set_hit_output(out_dir + "chunked_hits.csv");
+    const ChunkPlan plan = runner.plan();
+    chunked.initialize();
+    const ChunkedReport report = runner.run();
+
+    // a quarter of the budget as a hit stream fits larger chunks; the same ones here, to compare
+    const size_t stream_capacity = budget / 4 / sizeof(HitRecord);
+    const size_t stream_bytes = stream_capacity * sizeof(HitRecord);
+    const ChunkPlan stream_plan = plan_chunks(num_rays, budget, ray_buffer_bytes(chunked.get_max_depth(), false), stream_bytes);
+    CpuTracer streamed(0);
+    setup(streamed);
+    streamed.set_hit_stream(stream_capacity);
+    ChunkedRunner<CpuTracer> stream_runner(streamed, num_rays);
+    stream_runner.set_memory_budget(stream_bytes + plan.chunk_rays * ray_buffer_bytes(streamed.get_max_depth(), false));
+    std::vector<float4> streamed_hits;
+    collect_hits(stream_runner, streamed_hits);
+    if (!out_dir.empty()) stream_runner.set_hit_output(out_dir + "stream_hits.csv");
+    stream_runner.plan();
+    streamed.initialize();
+    const ChunkedReport stream_report = stream_runner.run();
+
+    // one launch over all the rays of the plan, far past the budget
+    CpuTracer single(static_cast<int>(plan.num_rays));
+    setup(single);
+    single.initialize();
+    single.run();
+    if (!out_dir.empty()) single.write_hp_output(out_dir + "single_hits.csv");
+    const double single_power = single.get_receiver_power();
+    const size_t single_bytes = plan.num_rays * ray_buffer_bytes(single.get_max_depth(), true);
+
+    CpuTracer single_stream(static_cast<int>(plan.num_rays));
+    setup(single_stream);
+    single_stream.set_hit_stream(stream_capacity);
+    single_stream.initialize();
+    single_stream.run();
+    if (!out_dir.empty()) single_stream.write_hp_output(out_dir + "single_stream_hits.csv");
+
+    const double power_difference = std::abs(report.receiver_power - single_power) / single_power;
+    const double stream_difference = std::abs(stream_report.receiver_power - single_power) / single_power;
+    const double flux_difference = map_difference(report.flux_maps[0], single.get_flux_map());
+    const double stream_flux_difference = map_difference(stream_report.flux_maps[0], single.get_flux_map());
+    double element_difference = 0.0;
+    for (size_t e = 0; e < report.element_power.size(); e++)
+        element_difference += std::abs(report.element_power[e] - single.get_receiver_element_power()[e]);
+    const bool same_chunked_hits = same_hits(chunked_hits, hit_points(single));
+    const bool same_stream_hits = same_hits(streamed_hits, hit_points(single_stream));
+
+    std::cout << std::fixed << std::setprecision(2)
+              << num_rays << " rays in a budget of " << budget / 1048576.0 << " MB: " << plan.num_chunks << " chunks of "
+              << plan.chunk_rays << " rays, " << plan.chunk_bytes() / 1048576.0 << " MB, " << plan.num_rays << " rays in all\n"
+              << "with a hit stream of " << stream_plan.fixed_bytes / 1048576.0 << " MB it would be " << stream_plan.num_chunks
+              << " chunks of " << stream_plan.chunk_rays << " rays, " << stream_plan.chunk_bytes() / 1048576.0 << " MB\n"
+              << "single launch " << single_bytes / 1048576.0 << " MB\n"
+              << "receiver power " << single_power * 1e-3 << " kW, chunked " << report.receiver_power * 1e-3
+              << " kW, streamed " << stream_report.receiver_power * 1e-3 << " kW, " << report.num_hits_receiver
+              << " receiver hits against " << single.get_num_hits_receiver() << "\n"
+              << std::scientific << std::setprecision(2) << "relative differences: power " << power_difference << " and "
+              << stream_difference << ", flux " << flux_difference << " and " << stream_flux_difference << "\n"
+              << "hit points of the chunks " << (same_chunked_hits && same_stream_hits ? "match" : "do NOT match")
+              << " the single launch" << std::endl;
+
+    bool ok = plan.num_chunks > 1 && plan.chunk_bytes() <= budget && plan.num_rays >= num_rays
+           && plan.num_rays < num_rays + plan.num_chunks;
+    ok &= stream_plan.chunk_bytes() <= budget && stream_plan.chunk_rays > plan.chunk_rays;
+    ok &= report.num_chunks == plan.num_chunks && report.num_rays == plan.num_rays;
+    ok &= stream_report.plan.chunk_rays == plan.chunk_rays && stream_report.num_rays == plan.num_rays;
+    // the power of a ray differs in the last bits between a chunk and the single launch
+    ok &= power_difference <= 1e-5 && stream_difference <= 1e-5;
+    ok &= flux_difference <= 1e-5 && stream_flux_difference <= 1e-5;
+    ok &= element_difference <= 1e-5 * single_power;
+    ok &= report.num_hits_receiver == single.get_num_hits_receiver();
+    ok &= same_chunked_hits && same_stream_hits;
+
+    std::cout << (ok ? "chunked runs match the single launch" : "chunked runs do NOT match the single launch") << std::endl;
+    return ok ? 0 : 1;
+}
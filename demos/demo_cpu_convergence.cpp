@@ -0,0 +1,109 @@
+// Convergence driven runs: batches of rays are traced until the relative standard error of the
+// receiver power or of the peak flux reaches a target, instead of guessing the number of rays. A
+// loose target must stop with fewer rays than a tight one, every run must meet its target, and the
+// estimates must agree with a long reference run within their errors. The peak flux follows the
+// flux map of the receiver, so a run writing a hit stream instead of the hit point buffer must
+// converge as well.
+//
+// usage: demo_cpu_convergence [rays per batch] [target, percent]
+#include "cpu/cpu_tracer.h"
+#include "core/convergence_runner.h"
+#include "demo_fields.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    void print(const char* name, const ConvergenceReport& r) {
+        std::cout << std::setw(18) << name << std::setw(10) << r.num_batches << std::setw(12) << r.num_rays
+                  << std::setprecision(2) << std::setw(14) << r.receiver_power * 1e-3
+                  << std::setprecision(3) << std::setw(10) << 100.0 * r.power_error
+                  << std::setprecision(1) << std::setw(14) << r.peak_flux * 1e-3
+                  << std::setprecision(3) << std::setw(10) << 100.0 * r.peak_error
+                  << std::setw(10) << r.time_total << (r.converged ? "" : "  not converged") << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int batch_rays = argc > 1 ? std::atoi(argv[1]) : 1000;
+    const double target = (argc > 2 ? std::atof(argv[2]) : 0.5) * 1e-2;
+    const Vec3d sun_vector = Vec3d(0.2, -0.5, 0.8).normalized();
+
+    auto setup = [&](CpuTracer& tracer) {
+        for (const std::shared_ptr<CspElement>& e : demo_fields::north_field(sun_vector, 0.9, 2e-3))
+            tracer.add_element(e);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_angle(0.00465);
+        tracer.set_sun_sampling(CpuSunSampling::FOOTPRINTS);
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 7u);
+        tracer.set_flux_map_resolution(8, 8);
+    };
+    CpuTracer tracer(batch_rays);
+    setup(tracer);
+    tracer.initialize();
+
+    ConvergenceRunner<CpuTracer> runner(tracer);
+    runner.set_flux_map();
+    runner.set_min_batches(8);
+    runner.set_max_rays(static_cast<size_t>(batch_rays) * 2000);
+
+    std::cout << batch_rays << " rays per batch\n" << std::fixed
+              << std::setw(18) << "target" << std::setw(10) << "batches" << std::setw(12) << "rays"
+              << std::setw(14) << "power [kW]" << std::setw(10) << "err [%]"
+              << std::setw(14) << "peak [kW/m2]" << std::setw(10) << "err [%]" << std::setw(10) << "time [s]" << std::endl;
+
+    // every run goes on with the sample sequence of the previous one, so the runs are independent
+    runner.set_target(ConvergenceTarget::RECEIVER_POWER, target);
+    const ConvergenceReport power = runner.run();
+    print("power", power);
+
+    runner.set_target(ConvergenceTarget::RECEIVER_POWER, 0.25 * target);
+    const ConvergenceReport tight = runner.run();
+    print("power, tight", tight);
+
+    runner.set_target(ConvergenceTarget::PEAK_FLUX, 4.0 * target);
+    const ConvergenceReport peak = runner.run();
+    print("peak flux", peak);
+
+    // reference: a fixed budget far beyond the targets
+    runner.set_target(ConvergenceTarget::RECEIVER_POWER, 0.0);
+    runner.set_max_rays(std::max(tight.num_rays, peak.num_rays) * 8);
+    const ConvergenceReport reference = runner.run();
+    print("reference", reference);
+
+    // the flux of a batch comes from the flux map, so a hit stream in place of the hit point buffer
+    // converges the same
+    CpuTracer streamed(batch_rays);
+    setup(streamed);
+    streamed.set_hit_stream(static_cast<size_t>(batch_rays) * streamed.get_max_depth());
+    streamed.initialize();
+    ConvergenceRunner<CpuTracer> stream_runner(streamed);
+    stream_runner.set_flux_map();
+    stream_runner.set_min_batches(8);
+    stream_runner.set_max_rays(static_cast<size_t>(batch_rays) * 2000);
+    stream_runner.set_target(ConvergenceTarget::PEAK_FLUX, 4.0 * target);
+    const ConvergenceReport stream_peak = stream_runner.run();
+    print("peak, hit stream", stream_peak);
+
+    bool ok = power.converged && tight.converged && peak.converged;
+    ok &= power.power_error <= target && tight.power_error <= 0.25 * target && peak.peak_error <= 4.0 * target;
+    ok &= power.num_rays < tight.num_rays;
+    ok &= stream_peak.converged && stream_peak.peak_error <= 4.0 * target;
+
+    // within four standard errors of the reference
+    const double power_gap = std::abs(tight.receiver_power - reference.receiver_power)
+        / std::hypot(tight.power_error * tight.receiver_power, reference.power_error * reference.receiver_power);
+    const double peak_gap = std::abs(peak.peak_flux - reference.flux[peak.peak_cell])
+        / std::hypot(peak.peak_error * peak.peak_flux, reference.flux_error[peak.peak_cell]);
+    std::cout << std::setprecision(2) << "power " << power_gap << " and peak flux " << peak_gap
+              << " standard errors from the reference" << std::endl;
+    ok &= power_gap < 4.0 && peak_gap < 4.0;
+
+    std::cout << (ok ? "convergence runs meet their targets" : "convergence runs do NOT meet their targets") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// Flux map of a cylindrical receiver filled during the trace: the side of the cylinder unwrapped
+// into azimuth by height cells in the frame of the receiver, azimuth from base_x towards base_z,
+// each cell normalized by the area of the side it covers. The map must match the unwrapping of
+// scripts/post_processing/flux_map_calculator.py on the receiver hits, hold the power of every
+// hit but the ones on the caps, and, with the field all around the tower, light every azimuth.
+//
+// usage: demo_cpu_cylinder_flux_map [number of rays] [azimuth cells] [height cells]
+#include "cpu/cpu_tracer.h"
+#include "core/flux_map.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 100.0);
+    const double receiver_diameter = 16.0;
+    const double receiver_height = 20.0;
+
+    // rings of flat heliostats all around the tower and the cylinder on top of it, its axis
+    // base_z x base_x vertical
+    void build_scene(CpuTracer& tracer, const Vec3d& sun_vector) {
+        for (int ring = 0; ring < 3; ring++) {
+            const double radius = 60.0 + ring * 25.0;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / (20.0 + ring * 1.5));
+            const double offset = ring % 2 ? M_PI / num_on_ring : 0.0;
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = offset + 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 5.0);
+                const Vec3d normal = (sun_vector.normalized() + (receiver_center - origin).normalized()).normalized();
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(origin + normal * 100.0);
+                e->set_zrot(0.0);
+                e->set_surface(std::make_shared<SurfaceFlat>());
+                e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+                e->set_slope_error(2e-3);
+                tracer.add_element(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(receiver_diameter, receiver_height));
+        receiver->set_receiver(true);
+        tracer.add_element(receiver);
+    }
+
+    // FluxMapCalculator._project_to_cylindrical_receiver and calculate_flux_map, with the power of
+    // each hit in place of the uniform power per ray; flux[ix][iy] there is flux[iy * nx + ix] here
+    std::vector<double> calculator_flux_map(const std::vector<float4>& hits, const std::vector<float>& power,
+                                            const Vec3d& base_x, const Vec3d& base_z, int nx, int ny,
+                                            double& cap_power) {
+        const double radius = 0.5 * receiver_diameter;
+        const Vec3d axis = base_z.cross(base_x);
+        const double bin_area = (2.0 * M_PI * radius / nx) * (receiver_height / ny);
+
+        std::vector<double> flux(static_cast<size_t>(nx) * ny, 0.0);
+        cap_power = 0.0;
+        for (size_t i = 0; i < hits.size(); i++) {
+            if (hits[i].x != 2.0f) continue;
+            const Vec3d p = Vec3d(hits[i].y, hits[i].z, hits[i].w) - receiver_center;
+            const double x = p.dot(base_x);
+            const double z = p.dot(base_z);
+            if (x * x + z * z < 0.998 * radius * radius) {
+                cap_power += power[i];
+                continue;
+            }
+            const double theta = std::fmod(std::atan2(z, x) + 2.0 * M_PI, 2.0 * M_PI);
+            const double height = p.dot(axis);
+            const int bx = std::clamp(static_cast<int>(std::floor(theta * nx / (2.0 * M_PI))), 0, nx - 1);
+            const int by = std::clamp(static_cast<int>(std::floor((height + receiver_height / 2) * ny / receiver_height)), 0, ny - 1);
+            flux[static_cast<size_t>(by) * nx + bx] += power[i] / bin_area;
+        }
+        return flux;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const int nx = argc > 2 ? std::atoi(argv[2]) : 72;
+    const int ny = argc > 3 ? std::atoi(argv[3]) : 20;
+    const Vec3d sun_vector = Vec3d(0.3, -0.4, 0.9).normalized();
+
+    CpuTracer tracer(num_rays);
+    build_scene(tracer, sun_vector);
+    tracer.set_sun_vector(sun_vector);
+    tracer.set_sun_angle(0.00465);
+    tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 13u);
+    tracer.set_flux_map_resolution(nx, ny);
+    tracer.initialize();
+    tracer.run();
+
+    const FluxMap& map = tracer.get_flux_map();
+    double cap_power = 0.0;
+    const std::vector<double> reference = calculator_flux_map(tracer.get_hit_point_buffer(), tracer.get_hit_power_buffer(),
+                                                              map.grid.axis_u, map.grid.axis_u.cross(map.grid.axis_v),
+                                                              nx, ny, cap_power);
+
+    double difference = 0.0;
+    double reference_total = 0.0;
+    for (size_t c = 0; c < reference.size(); c++) {
+        difference += std::abs(map.flux[c] - reference[c]) * map.grid.cell_area();
+        reference_total += reference[c] * map.grid.cell_area();
+    }
+
+    // the sun side of the field sends the most light, but no azimuth is dark
+    std::vector<double> azimuth_power(nx, 0.0);
+    for (int iy = 0; iy < ny; iy++)
+        for (int ix = 0; ix < nx; ix++)
+            azimuth_power[ix] += map.flux[static_cast<size_t>(iy) * nx + ix] * map.grid.cell_area();
+    const auto [dimmest, brightest] = std::minmax_element(azimuth_power.begin(), azimuth_power.end());
+    const double receiver_power = tracer.get_receiver_power();
+
+    std::cout << std::fixed << std::setprecision(3)
+              << nx << " x " << ny << " cells of " << map.grid.cell_area() << " m2 over " << map.grid.width
+              << " m around and " << map.grid.height << " m up\n"
+              << std::setprecision(2)
+              << "receiver power " << receiver_power * 1e-3 << " kW, flux map " << map.total_power * 1e-3
+              << " kW, caps " << cap_power * 1e-3 << " kW, calculator " << reference_total * 1e-3 << " kW\n"
+              << "peak flux " << map.peak_flux * 1e-3 << " kW/m2, mean " << map.total_power / (map.grid.width * map.grid.height) * 1e-3
+              << " kW/m2, azimuth columns from " << *dimmest * 1e-3 << " to " << *brightest * 1e-3 << " kW\n"
+              << "cells that differ from the calculator " << std::setprecision(6)
+              << difference / map.total_power * 100.0 << " % of the power" << std::endl;
+
+    bool ok = map.grid.shape == FLUX_MAP_CYLINDER && map.total_power > 0.0;
+    ok &= std::abs(map.total_power + cap_power - receiver_power) <= 1e-6 * receiver_power;
+    ok &= difference <= 1e-3 * map.total_power;   // only hits right on a cell edge may land next door
+    ok &= *dimmest > 0.0;
+
+    std::cout << (ok ? "in-trace cylindrical flux map matches the calculator" : "in-trace cylindrical flux map does NOT match the calculator")
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// Receiver flux maps filled during the trace: every receiver hit goes straight into a grid in the
+// frame of its flat receiver, one tile per thread merged after the run, instead of binning the hit
+// point buffer afterwards. The map must match the binned hit points, hold the receiver power, and
+// a receiver split into two triangles must collect the power of the rectangle.
+//
+// usage: demo_cpu_flux_map [number of rays] [cells per side]
+#include "cpu/cpu_tracer.h"
+#include "core/annual_runner.h"
+#include "core/flux_map.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+#include "core/timer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 60.0);
+    const Vec3d receiver_normal = Vec3d(0.0, 1.0, -0.6).normalized();
+    const double receiver_size = 12.0;
+
+    std::shared_ptr<CspElement> receiver_element(std::shared_ptr<Aperture> aperture) {
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + receiver_normal * 10.0);
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceFlat>());
+        receiver->set_aperture(aperture);
+        receiver->set_receiver(true);
+        return receiver;
+    }
+
+    // two rings of 6 m heliostats north of the tower, aimed at a square receiver or at the two
+    // triangles that make it up
+    std::vector<std::shared_ptr<CspElement>> build_field(const Vec3d& sun_vector, bool triangles) {
+        std::vector<std::shared_ptr<CspElement>> elements;
+        for (int ring = 0; ring < 2; ring++) {
+            const double radius = 40.0 + ring * 9.0;
+            const int num_on_ring = static_cast<int>(M_PI * radius / 8.0);
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = M_PI * (k + 0.5 * (1 + ring % 2)) / (num_on_ring + 1);
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 3.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(tracking_aim_point(origin, receiver_center, sun_vector));
+                e->set_zrot(0.0);
+                e->set_surface(std::make_shared<SurfaceFlat>());
+                e->set_aperture(std::make_shared<ApertureRectangle>(6.0, 6.0));
+                e->set_slope_error(2e-3);
+                e->set_reflectivity(0.9);
+                elements.push_back(e);
+            }
+        }
+
+        const double h = 0.5 * receiver_size;
+        if (triangles) {
+            // counterclockwise in the receiver frame, so both face the field like the rectangle
+            elements.push_back(receiver_element(std::make_shared<ApertureTriangle>(
+                Vec3d(-h, -h, 0.0), Vec3d(h, -h, 0.0), Vec3d(h, h, 0.0))));
+            elements.push_back(receiver_element(std::make_shared<ApertureTriangle>(
+                Vec3d(-h, -h, 0.0), Vec3d(h, h, 0.0), Vec3d(-h, h, 0.0))));
+        }
+        else {
+            elements.push_back(receiver_element(std::make_shared<ApertureRectangle>(receiver_size, receiver_size)));
+        }
+        return elements;
+    }
+
+    void setup(CpuTracer& tracer, const Vec3d& sun_vector, bool triangles, int cells) {
+        for (const std::shared_ptr<CspElement>& e : build_field(sun_vector, triangles))
+            tracer.add_element(e);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_angle(0.00465);
+        tracer.set_sun_sampling(CpuSunSampling::FOOTPRINTS);
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 11u);
+        tracer.set_flux_map_resolution(cells, cells);
+        tracer.initialize();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 500000;
+    const int cells = argc > 2 ? std::atoi(argv[2]) : 50;
+    // high enough for the shadow of the tower receiver to fall short of the field: the triangles are
+    // single sided and let the sun through from behind, where the rectangle shades the heliostats
+    const Vec3d sun_vector = Vec3d(0.1, -0.2, 1.0).normalized();
+
+    CpuTracer tracer(num_rays);
+    setup(tracer, sun_vector, false, cells);
+    tracer.run();
+    const FluxMap& map = tracer.get_flux_map();
+
+    // the same cells from the hit point buffer, as the post processing did it
+    Timer bin_timer;
+    bin_timer.start();
+    std::vector<double> binned;
+    bin_receiver_flux(map.grid, tracer.get_hit_point_buffer(), tracer.get_hit_power_buffer(), binned);
+    bin_timer.stop();
+
+    double difference = 0.0;
+    double binned_total = 0.0;
+    for (size_t c = 0; c < binned.size(); c++) {
+        difference += std::abs(map.flux[c] - binned[c]) * map.grid.cell_area();
+        binned_total += binned[c] * map.grid.cell_area();
+    }
+    const double receiver_power = tracer.get_receiver_power();
+
+    std::cout << std::fixed << std::setprecision(3)
+              << map.grid.nu << " x " << map.grid.nv << " cells of " << map.grid.cell_area() << " m2 on element " << map.element << "\n"
+              << "trace " << tracer.get_time_trace() << " s, binning the hit points afterwards " << bin_timer.get_time_sec() << " s\n"
+              << std::setprecision(2)
+              << "receiver power " << receiver_power * 1e-3 << " kW, flux map " << map.total_power * 1e-3
+              << " kW, binned " << binned_total * 1e-3 << " kW\n"
+              << "peak flux " << map.peak_flux * 1e-3 << " kW/m2, cells that differ from the binning "
+              << std::setprecision(6) << difference / map.total_power * 100.0 << " % of the power" << std::endl;
+
+    bool ok = map.total_power > 0.0;
+    ok &= std::abs(map.total_power - receiver_power) <= 1e-6 * receiver_power;
+    ok &= difference <= 1e-3 * map.total_power;   // only hits right on a cell edge may land next door
+
+    // two triangles: the bounding rectangle of each, half of it empty, and the rectangle's power between them
+    CpuTracer split(num_rays);
+    setup(split, sun_vector, true, cells);
+    split.run();
+    const std::vector<FluxMap>& maps = split.get_flux_maps();
+    ok &= maps.size() == 2;
+    if (maps.size() == 2) {
+        size_t empty = 0;
+        for (double f : maps[0].flux) empty += f == 0.0;
+        const double total = maps[0].total_power + maps[1].total_power;
+        std::cout << std::setprecision(2) << "two triangles: " << maps[0].total_power * 1e-3 << " + "
+                  << maps[1].total_power * 1e-3 << " kW, " << empty << " empty cells of the first" << std::endl;
+        ok &= std::abs(total - map.total_power) <= 1e-3 * map.total_power;
+        ok &= empty >= maps[0].flux.size() / 2 - static_cast<size_t>(cells);
+    }
+
+    std::cout << (ok ? "in-trace flux maps match the binned hit points" : "in-trace flux maps do NOT match the binned hit points")
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+// Hit records appended to a compact stream instead of the fixed hit point buffer: the buffer keeps
+// max_depth slots for every sun ray, used or not, where the stream only holds the interactions that
+// happened, each with its ray, depth and element. The rays that miss the field and the paths that
+// end early leave nothing behind, so on a field lit over the whole sun plane the stream takes a
+// fraction of the memory. The stream must give the receiver power and, decoded, the hit points of
+// the fixed buffer; one too small for the run overflows, and the passes that trace the rest again
+// must end up with the same records without depositing their power twice.
+//
+// usage: demo_cpu_hit_stream [number of rays] [stinput file]
+#include "cpu/cpu_tracer.h"
+#include "core/hit_stream.h"
+#include "core/annual_runner.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 80.0);
+    const Vec3d sun_vector = Vec3d(0.2, -0.5, 0.85).normalized();
+
+    // a radially staggered field of 8 m heliostats all around a tower with a cylindrical receiver
+    void build_field(CpuTracer& tracer) {
+        for (int ring = 0; ring < 6; ring++) {
+            const double radius = 50.0 + ring * 14.0;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / 16.0);
+            const double offset = ring % 2 ? M_PI / num_on_ring : 0.0;
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = offset + 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 4.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(tracking_aim_point(origin, receiver_center, sun_vector));
+                e->set_zrot(0.0);
+                e->set_surface(std::make_shared<SurfaceFlat>());
+                e->set_aperture(std::make_shared<ApertureRectangle>(8.0, 8.0));
+                e->set_slope_error(2e-3);
+                e->set_reflectivity(0.9);
+                tracer.add_element(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(14.0, 16.0));
+        receiver->set_receiver(true);
+        tracer.add_element(receiver);
+    }
+
+    struct Run {
+        double power = 0.0;
+        double flux_power = 0.0;
+        int passes = 0;
+        std::vector<float4> hit_points;
+        std::vector<float> hit_power;
+        std::vector<HitRecord> records;
+        double time = 0.0;
+    };
+
+    // capacity 0 writes the fixed hit point buffer
+    Run trace(int num_rays, const std::string& stinput, size_t capacity, CpuTraceMode mode) {
+        CpuTracer tracer(num_rays);
+        if (stinput.empty()) {
+            build_field(tracer);
+            tracer.set_sun_vector(sun_vector);
+            tracer.set_sun_angle(0.00465);
+        }
+        else if (!tracer.read_st_input(stinput.c_str())) {
+            throw std::runtime_error("Failed to read " + stinput);
+        }
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 29u);
+        tracer.set_trace_mode(mode);
+        tracer.set_flux_map_resolution(36, 12);
+        tracer.set_hit_stream(capacity);
+        tracer.initialize();
+        tracer.run();
+
+        Run r;
+        r.power = tracer.get_receiver_power();
+        for (const FluxMap& map : tracer.get_flux_maps()) r.flux_power += map.total_power;
+        r.passes = tracer.get_hit_stream_passes();
+        r.hit_points = tracer.get_hit_point_buffer();
+        r.hit_power = tracer.get_hit_power_buffer();
+        r.records = tracer.get_hit_records();
+        std::sort(r.records.begin(), r.records.end(), [](const HitRecord& a, const HitRecord& b) {
+            return std::tie(a.ray, a.depth) < std::tie(b.ray, b.depth);
+        });
+        r.time = tracer.get_time_trace();
+        return r;
+    }
+
+    bool same_records(const std::vector<HitRecord>& a, const std::vector<HitRecord>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].ray != b[i].ray || a[i].depth != b[i].depth || a[i].tag != b[i].tag || a[i].element != b[i].element
+                || a[i].power != b[i].power || a[i].position.x != b[i].position.x || a[i].position.y != b[i].position.y
+                || a[i].position.z != b[i].position.z)
+                return false;
+        }
+        return true;
+    }
+
+    // every slot of the fixed buffer, but the sun point of the rays that hit nothing, decodes from the stream
+    size_t count_mismatches(const Run& fixed, const std::vector<float4>& points, const std::vector<float>& power, int max_depth) {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < fixed.hit_points.size(); i++) {
+            const float4& f = fixed.hit_points[i];
+            const float4& s = points[i];
+            const bool missed = i % max_depth == 0 && fixed.hit_points[i + 1].x == 0.0f && fixed.hit_points[i + 1].y == 0.0f;
+            if (missed) {
+                mismatches += s.x != 0.0f || s.y != 0.0f || s.z != 0.0f || s.w != 0.0f;
+                continue;
+            }
+            mismatches += f.x != s.x || f.y != s.y || f.z != s.z || f.w != s.w || fixed.hit_power[i] != power[i];
+        }
+        return mismatches;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const std::string stinput = argc > 2 ? argv[2] : "";
+    const int max_depth = static_cast<int>(MAX_TRACE_DEPTH);
+
+    const Run fixed = trace(num_rays, stinput, 0, CpuTraceMode::RECURSIVE);
+    const Run stream = trace(num_rays, stinput, static_cast<size_t>(num_rays) * max_depth, CpuTraceMode::RECURSIVE);
+    // a fifth of the records fit, the rest comes from the passes after the overflow
+    const size_t small_capacity = std::max<size_t>(stream.records.size() / 5, max_depth);
+    const Run resumed = trace(num_rays, stinput, small_capacity, CpuTraceMode::RECURSIVE);
+    const Run resumed_wavefront = trace(num_rays, stinput, small_capacity, CpuTraceMode::WAVEFRONT);
+
+    std::vector<float4> points;
+    std::vector<float> power;
+    decode_hit_records(stream.records, static_cast<size_t>(num_rays), max_depth, points, power);
+    const size_t mismatches = count_mismatches(fixed, points, power, max_depth);
+
+    size_t rays_with_hits = 0;
+    for (const HitRecord& r : stream.records) rays_with_hits += r.depth == 0;
+    const double fixed_mb = fixed.hit_points.size() * (sizeof(float4) + sizeof(float)) / 1048576.0;
+    const double stream_mb = stream.records.size() * sizeof(HitRecord) / 1048576.0;
+    const double small_mb = small_capacity * sizeof(HitRecord) / 1048576.0;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << num_rays << " rays, " << rays_with_hits << " hit the field, " << stream.records.size() << " records of "
+              << fixed.hit_points.size() << " slots\n"
+              << "hit point buffer " << fixed_mb << " MB, hit stream " << stream_mb << " MB ("
+              << fixed_mb / stream_mb << " x less), " << sizeof(HitRecord) << " bytes a record\n"
+              << "receiver power " << fixed.power * 1e-3 << " kW, stream " << stream.power * 1e-3 << " kW, "
+              << mismatches << " decoded slots differ\n"
+              << "stream of " << small_capacity << " records (" << small_mb << " MB): " << resumed.passes
+              << " passes recursive, " << resumed_wavefront.passes << " wavefront, receiver power "
+              << resumed.power * 1e-3 << " kW, flux maps " << resumed.flux_power * 1e-3 << " kW\n"
+              << std::setprecision(3) << "trace fixed " << fixed.time << " s, stream " << stream.time << " s, resumed "
+              << resumed.time << " s" << std::endl;
+
+    const double tolerance = 1e-9 * fixed.power;
+    bool ok = fixed.power > 0.0 && stream.passes == 1 && stream.hit_points.empty();
+    ok &= std::abs(stream.power - fixed.power) <= tolerance && mismatches == 0;
+    ok &= stream_mb < fixed_mb;
+    ok &= resumed.passes > 1 && resumed_wavefront.passes > 1;
+    ok &= same_records(resumed.records, stream.records) && same_records(resumed_wavefront.records, stream.records);
+    ok &= std::abs(resumed.power - fixed.power) <= tolerance && std::abs(resumed_wavefront.power - fixed.power) <= tolerance;
+    // deposited once, in the first pass
+    ok &= std::abs(resumed.flux_power - fixed.flux_power) <= 1e-9 * fixed.flux_power
+       && std::abs(resumed_wavefront.flux_power - fixed.flux_power) <= 1e-9 * fixed.flux_power;
+
+    std::cout << (ok ? "hit stream matches the hit point buffer" : "hit stream does NOT match the hit point buffer") << std::endl;
+    return ok ? 0 : 1;
+}
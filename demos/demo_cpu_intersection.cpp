@@ -0,0 +1,154 @@
+// Checks the batched host intersection kernels against the scalar reference
+// (bit-exact hit distances for every SIMD level) and reports their throughput.
+#include "cpu/simd_intersection.h"
+#include "core/timer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    std::mt19937 rng(42);
+
+    float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    }
+
+    float3 random_vec(float lo, float hi) {
+        return make_float3(uniform(lo, hi), uniform(lo, hi), uniform(lo, hi));
+    }
+
+    // primitives scattered in a 100 m box, roughly facing +z
+    std::vector<GeometryDataST> make_primitives(GeometryDataST::Type type, int count) {
+        std::vector<GeometryDataST> prims(count);
+        for (auto& g : prims) {
+            float3 c = random_vec(-50.0f, 50.0f);
+            float3 x = normalize(make_float3(1.0f, uniform(-0.3f, 0.3f), uniform(-0.3f, 0.3f)));
+            float3 z = normalize(cross(x, make_float3(0.0f, 1.0f, 0.0f)));
+            float3 y = cross(z, x);
+            float w = uniform(1.0f, 10.0f), h = uniform(1.0f, 10.0f);
+
+            switch (type) {
+            case GeometryDataST::PARALLELOGRAM:
+                g.setParallelogram(GeometryDataST::Parallelogram(x * w, y * h, c));
+                break;
+            case GeometryDataST::RECTANGLE_FLAT:
+                g.setRectangle_Flat(GeometryDataST::Rectangle_Flat(c, x, y, w, h));
+                break;
+            case GeometryDataST::CYLINDER_Y:
+                g.setCylinder_Y(GeometryDataST::Cylinder_Y(c, w * 0.5f, h * 0.5f, x, z));
+                break;
+            case GeometryDataST::RECTANGLE_PARABOLIC:
+                g.setRectangleParabolic(GeometryDataST::Rectangle_Parabolic(x * w, y * h, c, uniform(0.0f, 0.05f), uniform(0.0f, 0.05f)));
+                break;
+            default:
+                g.setTriangle_Flat(GeometryDataST::Triangle_Flat(c, c + y * h, c + x * w));
+                break;
+            }
+        }
+        return prims;
+    }
+
+    std::vector<HostRay> make_rays(int count) {
+        std::vector<HostRay> rays(count);
+        for (auto& r : rays) {
+            r.orig = random_vec(-60.0f, 60.0f);
+            r.dir = normalize(random_vec(-1.0f, 1.0f));
+            r.tmin = 1e-4f;
+            r.tmax = 1e16f;
+        }
+        return rays;
+    }
+
+    bool same_bits(float a, float b) {
+        uint32_t ua, ub;
+        std::memcpy(&ua, &a, 4);
+        std::memcpy(&ub, &b, 4);
+        return ua == ub;
+    }
+
+    template <class SoA>
+    bool run_type(const char* name, GeometryDataST::Type type, const SoA& (*pick)(const GeometrySoA&),
+                  int num_prims, int num_rays) {
+        std::vector<GeometryDataST> prims = make_primitives(type, num_prims);
+        GeometrySoA scene = GeometrySoA::build(prims);
+        const SoA& soa = pick(scene);
+        std::vector<HostRay> rays = make_rays(num_rays);
+
+        // scalar reference
+        std::vector<float> reference(static_cast<size_t>(num_rays) * num_prims);
+        Timer ref_timer;
+        ref_timer.start();
+        for (int r = 0; r < num_rays; r++) {
+            for (int p = 0; p < num_prims; p++) {
+                float t;
+                float3 n;
+                reference[static_cast<size_t>(r) * num_prims + p] =
+                    intersect_geometry(prims[p], rays[r], t, n) ? t : INFINITY;
+            }
+        }
+        ref_timer.stop();
+        const double tests = double(num_rays) * num_prims;
+        std::cout << name << ", reference, " << tests / ref_timer.get_time_sec() * 1e-6 << " Mtests/s" << std::endl;
+
+        bool ok = true;
+        std::vector<float> t_out(soa.padded_size());
+        for (SimdLevel level : { SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512 }) {
+            if (static_cast<int>(level) > static_cast<int>(best_simd_level())) continue;
+
+            size_t mismatches = 0, hits = 0;
+            for (int r = 0; r < num_rays; r++) {
+                intersect_batch(soa, rays[r], t_out.data(), level);
+                for (int p = 0; p < num_prims; p++) {
+                    const float expected = reference[static_cast<size_t>(r) * num_prims + p];
+                    if (!same_bits(t_out[p], expected)) mismatches++;
+                    if (expected != INFINITY) hits++;
+                }
+            }
+
+            Timer timer;
+            timer.start();
+            size_t closest = 0;
+            for (int r = 0; r < num_rays; r++) {
+                if (closest_hit(soa, rays[r], level).valid()) closest++;
+            }
+            timer.stop();
+
+            std::cout << name << ", " << simd_level_name(level)
+                      << ", " << tests / timer.get_time_sec() * 1e-6 << " Mtests/s"
+                      << ", hits " << hits << ", rays with a hit " << closest
+                      << ", mismatches " << mismatches << std::endl;
+            ok = ok && mismatches == 0;
+        }
+        return ok;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int num_prims = 1000;
+    int num_rays = 2000;
+    if (argc > 1) num_prims = std::stoi(argv[1]);
+    if (argc > 2) num_rays = std::stoi(argv[2]);
+
+    std::cout << "widest compiled level: " << simd_level_name(best_simd_level()) << std::endl;
+
+    bool ok = true;
+    ok &= run_type<ParallelogramSoA>("parallelogram", GeometryDataST::PARALLELOGRAM,
+                                     [](const GeometrySoA& s) -> const ParallelogramSoA& { return s.parallelograms; }, num_prims, num_rays);
+    ok &= run_type<RectangleFlatSoA>("rectangle_flat", GeometryDataST::RECTANGLE_FLAT,
+                                     [](const GeometrySoA& s) -> const RectangleFlatSoA& { return s.rectangles_flat; }, num_prims, num_rays);
+    ok &= run_type<CylinderYSoA>("cylinder_y", GeometryDataST::CYLINDER_Y,
+                                 [](const GeometrySoA& s) -> const CylinderYSoA& { return s.cylinders; }, num_prims, num_rays);
+    ok &= run_type<RectangleParabolicSoA>("rectangle_parabolic", GeometryDataST::RECTANGLE_PARABOLIC,
+                                          [](const GeometrySoA& s) -> const RectangleParabolicSoA& { return s.rectangles_parabolic; }, num_prims, num_rays);
+    ok &= run_type<TriangleFlatSoA>("triangle_flat", GeometryDataST::TRIANGLE_FLAT,
+                                    [](const GeometrySoA& s) -> const TriangleFlatSoA& { return s.triangles; }, num_prims, num_rays);
+
+    std::cout << (ok ? "all kernels agree with the scalar reference" : "MISMATCH against the scalar reference") << std::endl;
+    return ok ? 0 : 1;
+}
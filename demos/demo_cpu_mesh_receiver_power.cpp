@@ -0,0 +1,205 @@
+// Power per facet of a mesh receiver, summed during the trace: every receiver hit adds its power to
+// the element it landed on, in partials per thread reduced after the run, so the absorbed power of
+// each triangle comes out as an array the size of the mesh instead of a dump of every hit. The
+// facets of ../data/sphere.obj, scaled up on top of a tower, are the receiver, each one an element
+// with a triangle aperture as in demo_read_mesh. The sums must match the hits assigned back to the
+// triangles geometrically, add up to the receiver power, and export as VTK cell data.
+//
+// usage: demo_cpu_mesh_receiver_power [number of rays] [obj file]
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 30.0);
+    const double receiver_radius = 3.0;
+
+    struct Triangle {
+        Vec3d v0, v1, v2;
+    };
+
+    // triangles of an obj file, v and f lines only, "v/vt/vn" face tokens keep their vertex index
+    std::vector<Triangle> read_obj(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) throw std::runtime_error("Failed to open file: " + filename);
+
+        std::vector<Vec3d> vertices;
+        std::vector<Triangle> triangles;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream iss(line);
+            std::string prefix;
+            iss >> prefix;
+            if (prefix == "v") {
+                double x, y, z;
+                iss >> x >> y >> z;
+                vertices.emplace_back(x, y, z);
+            }
+            else if (prefix == "f") {
+                int id[3];
+                for (int k = 0; k < 3; k++) {
+                    std::string token;
+                    iss >> token;
+                    id[k] = std::stoi(token.substr(0, token.find('/'))) - 1;
+                }
+                triangles.push_back({ vertices[id[0]], vertices[id[1]], vertices[id[2]] });
+            }
+        }
+        return triangles;
+    }
+
+    // one receiver element per facet at the center of the mesh; the vertices go into the frame of
+    // the element so that the facet lands where the mesh has it, front side out
+    void add_mesh_receiver(CpuTracer& tracer, const std::vector<Triangle>& mesh) {
+        for (const Triangle& t : mesh) {
+            auto e = std::make_shared<CspElement>();
+            e->set_origin(receiver_center);
+            e->set_aim_point(receiver_center + Vec3d(0.0, 0.0, 1.0));
+            e->set_zrot(0.0);
+            e->update_euler_angles();
+            const Matrix33d to_local = e->get_rotation_matrix().transpose();
+            e->set_aperture(std::make_shared<ApertureTriangle>(to_local * (t.v0 * receiver_radius),
+                                                               to_local * (t.v1 * receiver_radius),
+                                                               to_local * (t.v2 * receiver_radius)));
+            e->set_surface(std::make_shared<SurfaceFlat>());
+            e->set_receiver(true);
+            tracer.add_element(e);
+        }
+    }
+
+    // a ring of heliostats around the tower, aimed at the center of the sphere
+    void add_field(CpuTracer& tracer, const Vec3d& sun_vector) {
+        const int num_heliostats = 24;
+        for (int k = 0; k < num_heliostats; k++) {
+            const double phi = 2.0 * M_PI * k / num_heliostats;
+            const Vec3d origin(25.0 * std::cos(phi), 25.0 * std::sin(phi), 2.0);
+            const Vec3d normal = (sun_vector.normalized() + (receiver_center - origin).normalized()).normalized();
+            auto e = std::make_shared<CspElement>();
+            e->set_origin(origin);
+            e->set_aim_point(origin + normal * 10.0);
+            e->set_zrot(0.0);
+            e->set_surface(std::make_shared<SurfaceFlat>());
+            e->set_aperture(std::make_shared<ApertureRectangle>(4.0, 4.0));
+            e->set_slope_error(3e-3);
+            tracer.add_element(e);
+        }
+    }
+
+    // the post processing this replaces: each receiver hit goes to the facet whose plane it lies
+    // on and whose edges hold it, first the mesh facets in element order
+    std::vector<double> assign_hits_to_facets(const std::vector<float4>& hits, const std::vector<float>& power,
+                                              const std::vector<Triangle>& facets, size_t first_facet,
+                                              size_t num_elements, double& unassigned) {
+        std::vector<double> facet_power(num_elements, 0.0);
+        unassigned = 0.0;
+        for (size_t i = 0; i < hits.size(); i++) {
+            if (hits[i].x != 2.0f) continue;
+            const Vec3d p(hits[i].y, hits[i].z, hits[i].w);
+            size_t best = facets.size();
+            double best_distance = 1e-3;
+            for (size_t f = 0; f < facets.size(); f++) {
+                const Vec3d e1 = facets[f].v1 - facets[f].v0;
+                const Vec3d e2 = facets[f].v2 - facets[f].v0;
+                const Vec3d n = e1.cross(e2);
+                const Vec3d d = p - facets[f].v0;
+                const double distance = std::abs(d.dot(n)) / n.norm();
+                if (distance >= best_distance) continue;
+                // barycentric coordinates of the point projected on the plane
+                const double inv = 1.0 / n.dot(n);
+                const double b1 = d.cross(e2).dot(n) * inv;
+                const double b2 = e1.cross(d).dot(n) * inv;
+                const double tol = 1e-6;
+                if (b1 < -tol || b2 < -tol || b1 + b2 > 1.0 + tol) continue;
+                best = f;
+                best_distance = distance;
+            }
+            if (best < facets.size()) facet_power[first_facet + best] += power[i];
+            else unassigned += power[i];
+        }
+        return facet_power;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 500000;
+    const std::string mesh_file = argc > 2 ? argv[2] : "../data/sphere.obj";
+    const Vec3d sun_vector = Vec3d(0.2, -0.3, 1.0).normalized();
+
+    const std::vector<Triangle> mesh = read_obj(mesh_file);
+    CpuTracer tracer(num_rays);
+    add_field(tracer, sun_vector);
+    add_mesh_receiver(tracer, mesh);
+    tracer.set_sun_vector(sun_vector);
+    tracer.set_sun_angle(0.00465);
+    tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 17u);
+    tracer.set_receiver_element_power(true);
+    tracer.initialize();
+    tracer.run();
+
+    const std::vector<double>& element_power = tracer.get_receiver_element_power();
+    const size_t first_facet = element_power.size() - mesh.size();   // one stage, the facets come last
+
+    // the facets in world coordinates, where add_mesh_receiver put them
+    std::vector<Triangle> facets;
+    for (const Triangle& t : mesh)
+        facets.push_back({ receiver_center + t.v0 * receiver_radius, receiver_center + t.v1 * receiver_radius,
+                           receiver_center + t.v2 * receiver_radius });
+    double unassigned = 0.0;
+    const std::vector<double> assigned = assign_hits_to_facets(tracer.get_hit_point_buffer(), tracer.get_hit_power_buffer(),
+                                                               facets, first_facet, element_power.size(), unassigned);
+
+    double total = 0.0, difference = 0.0, mirror_power = 0.0, peak = 0.0;
+    size_t lit = 0;
+    for (size_t e = 0; e < element_power.size(); e++) {
+        total += element_power[e];
+        difference += std::abs(element_power[e] - assigned[e]);
+        if (e < first_facet) mirror_power += element_power[e];
+        lit += element_power[e] > 0.0;
+        peak = std::max(peak, element_power[e]);
+    }
+    const double receiver_power = tracer.get_receiver_power();
+
+    const std::string out_dir = "out_mesh_receiver_power/";
+    std::filesystem::create_directories(out_dir);
+    const std::string vtk_file = out_dir + "receiver_power.vtk";
+    bool ok = tracer.write_receiver_power_vtk(vtk_file);
+
+    // one polygon and one power value per facet
+    size_t num_polygons = 0;
+    std::ifstream vtk(vtk_file);
+    std::string word;
+    while (vtk >> word)
+        if (word == "CELL_DATA") vtk >> num_polygons;
+
+    const double dump_mb = tracer.get_hit_point_buffer().size() * (sizeof(float4) + sizeof(float)) / 1048576.0;
+    const double array_kb = element_power.size() * sizeof(double) / 1024.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << mesh.size() << " facets, " << lit << " lit, peak " << peak * 1e-3 << " kW\n"
+              << "receiver power " << receiver_power * 1e-3 << " kW, per facet " << total * 1e-3
+              << " kW, assigned from the hits " << (receiver_power - unassigned) * 1e-3 << " kW\n"
+              << "facets that differ from the assignment " << std::setprecision(6) << difference / total * 100.0 << " % of the power\n"
+              << std::setprecision(2) << "hit dump " << dump_mb << " MB, power array " << array_kb << " kB, "
+              << num_polygons << " polygons in " << vtk_file << std::endl;
+
+    ok &= total > 0.0 && mirror_power == 0.0 && lit > 0;
+    ok &= std::abs(total - receiver_power) <= 1e-6 * receiver_power;
+    ok &= unassigned <= 1e-4 * receiver_power;
+    ok &= difference <= 1e-3 * total;   // only hits right on a shared edge may go to the neighbour
+    ok &= num_polygons == mesh.size();
+
+    std::cout << (ok ? "per-facet receiver power matches the hits assigned to the mesh"
+                     : "per-facet receiver power does NOT match the hits assigned to the mesh") << std::endl;
+    return ok ? 0 : 1;
+}
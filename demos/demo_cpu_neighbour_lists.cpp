@@ -0,0 +1,161 @@
+// Shading and blocking neighbour lists against the full BVH traversal on a dense radial field, where
+// the heliostats shade and block each other. Two tracers trace the same rays, one with the lists;
+// the receiver power and the hit points of every path are compared. The sun then moves over a day
+// with the heliostats tracking it, which leaves the blocking lists as they are, and a few heliostats
+// are moved, which recomputes only the lists they touch.
+//
+// usage: demo_cpu_neighbour_lists [number of rays] [number of rings]
+#include "cpu/cpu_tracer.h"
+#include "core/annual_runner.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 100.0);
+
+    // rings of 10 m heliostats 13 m apart and 12 m between the rings
+    std::vector<std::shared_ptr<CspElement>> build_field(int num_rings) {
+        std::vector<std::shared_ptr<CspElement>> elements;
+        for (int ring = 0; ring < num_rings; ring++) {
+            const double radius = 50.0 + ring * 12.0;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / 13.0);
+            const double offset = ring % 2 ? M_PI / num_on_ring : 0.0;
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = offset + 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 5.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(origin + Vec3d(0.0, 0.0, 100.0));
+                e->set_zrot(0.0);
+                auto surface = std::make_shared<SurfaceParabolic>();
+                surface->set_curvature(0.005, 0.005);
+                e->set_surface(surface);
+                e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+                elements.push_back(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        elements.push_back(receiver);
+        return elements;
+    }
+
+    void track(const std::vector<std::shared_ptr<CspElement>>& elements, const Vec3d& sun_vector) {
+        for (const std::shared_ptr<CspElement>& e : elements) {
+            if (e->is_receiver()) continue;
+            e->set_aim_point(tracking_aim_point(e->get_origin(), receiver_center, sun_vector));
+            e->update_euler_angles();
+        }
+    }
+
+    // paths whose hit points differ by a tag or by more than a millimeter
+    size_t compare_paths(const CpuTracer& a, const CpuTracer& b) {
+        const std::vector<float4>& ha = a.get_hit_point_buffer();
+        const std::vector<float4>& hb = b.get_hit_point_buffer();
+        const size_t depth = ha.size() / a.get_ray_power_buffer().size();
+        size_t differ = 0;
+        for (size_t path = 0; path * depth < ha.size(); path++) {
+            bool same = true;
+            for (size_t d = 0; d < depth; d++) {
+                const float4& p = ha[path * depth + d];
+                const float4& q = hb[path * depth + d];
+                if (p.x != q.x) {
+                    same = false;
+                    continue;
+                }
+                const double distance = std::sqrt(double(p.y - q.y) * (p.y - q.y) + double(p.z - q.z) * (p.z - q.z)
+                                                  + double(p.w - q.w) * (p.w - q.w));
+                same &= distance < 1e-3;
+            }
+            differ += !same;
+        }
+        return differ;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 1 << 19;
+    const int num_rings = argc > 2 ? std::atoi(argv[2]) : 16;
+
+    const std::vector<std::shared_ptr<CspElement>> elements = build_field(num_rings);
+    CpuTracer full(num_rays), listed(num_rays);
+    for (CpuTracer* tracer : { &full, &listed }) {
+        for (const std::shared_ptr<CspElement>& e : elements)
+            tracer->add_element(e);
+        tracer->set_sun_angle(0.00465);
+        tracer->set_sun_sampling(CpuSunSampling::FOOTPRINTS);
+        tracer->set_trace_mode(CpuTraceMode::RECURSIVE);
+    }
+    listed.set_neighbour_lists(true);
+    std::cout << elements.size() - 1 << " heliostats, " << num_rays << " rays" << std::endl;
+
+    // the sun over a day at 35 degrees north: declination 0, hour angles from -60 to 60 degrees
+    const double latitude = 35.0 * M_PI / 180.0;
+    std::cout << std::fixed << "\n" << std::setw(8) << "hour" << std::setw(10) << "shading" << std::setw(10) << "blocking"
+              << std::setw(10) << "rebuilt" << std::setw(12) << "power [%]" << std::setw(12) << "paths [%]"
+              << std::setw(12) << "full [s]" << std::setw(12) << "lists [s]" << std::endl;
+    bool ok = true;
+    bool initialized = false;
+    for (int step = 0; step <= 8; step++) {
+        const double hour_angle = (-60.0 + 15.0 * step) * M_PI / 180.0;
+        const Vec3d sun_vector(-std::sin(hour_angle), -std::sin(latitude) * std::cos(hour_angle),
+                               std::cos(latitude) * std::cos(hour_angle));
+        track(elements, sun_vector);
+
+        // the last step moves every 50th heliostat by half a meter
+        if (step == 8) {
+            for (size_t i = 0; i + 1 < elements.size(); i += 50) {
+                elements[i]->set_origin(elements[i]->get_origin() + Vec3d(0.5, 0.0, 0.0));
+                elements[i]->set_aim_point(tracking_aim_point(elements[i]->get_origin(), receiver_center, sun_vector));
+                elements[i]->update_euler_angles();
+            }
+        }
+
+        for (CpuTracer* tracer : { &full, &listed }) {
+            tracer->set_sun_vector(sun_vector);
+            if (initialized) tracer->update();
+            else tracer->initialize();
+            tracer->run();
+        }
+        initialized = true;
+
+        const NeighbourLists& lists = listed.get_neighbour_lists();
+        const double power_full = full.get_receiver_power();
+        const double power_listed = listed.get_receiver_power();
+        const double power_diff = std::abs(power_listed - power_full) / power_full;
+        const size_t differ = compare_paths(full, listed);
+
+        std::cout << std::setprecision(1) << std::setw(8) << 12.0 + (-60.0 + 15.0 * step) / 15.0
+                  << std::setw(10) << lists.mean_shading() << std::setw(10) << lists.mean_blocking()
+                  << std::setw(10) << lists.num_blocking_rebuilt()
+                  << std::setprecision(4) << std::setw(12) << 100.0 * power_diff
+                  << std::setw(12) << 100.0 * differ / num_rays
+                  << std::setprecision(3) << std::setw(12) << full.get_time_trace()
+                  << std::setw(12) << listed.get_time_trace() << std::endl;
+
+        // tracking leaves the spheres, and so the blocking lists, as they are
+        if (step > 0 && step < 8) ok &= lists.num_blocking_rebuilt() == 0;
+        if (step == 8) ok &= lists.num_blocking_rebuilt() > 0 && lists.num_blocking_rebuilt() < elements.size() / 4;
+        // a ray grazing the edge of an element can go either way in the two traversals
+        ok &= power_diff < 1e-3 && differ < static_cast<size_t>(num_rays) / 1000;
+    }
+
+    std::cout << (ok ? "neighbour lists match the full traversal" : "neighbour lists do NOT match the full traversal")
+              << std::endl;
+    return ok ? 0 : 1;
+}
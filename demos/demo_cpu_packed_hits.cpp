@@ -0,0 +1,194 @@
+// Packed hits: every hit as the element it landed on and its u and v on the aperture of the
+// element, 16 bits each, 8 bytes where the hit point buffer takes 16 and loses the element. The
+// field mixes flat and parabolic heliostats, a virtual stage crosses the reflected rays and the
+// receiver is a capped cylinder, so every kind of frame packs hits. Decoded with the frames, a
+// hit lands on its surface within the quantization step of its frame from where it was traced,
+// far below the size of a mirror; the float intersection of a parabolic mirror leaves the traced
+// point off the surface by a fraction of a millimeter, which the packing puts back on it. A
+// packed hit file must give back the same hits; it is kept in the output directory when one is
+// given, and removed otherwise.
+//
+// usage: demo_cpu_packed_hits [number of rays] [output directory]
+#include "cpu/cpu_tracer.h"
+#include "core/packed_hits.h"
+#include "core/annual_runner.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 80.0);
+    const Vec3d sun_direction = Vec3d(0.2, -0.5, 0.85).normalized();
+    const double mirror_size = 8.0;
+
+    // flat heliostats on the inner rings, parabolic ones on the outer, a horizontal virtual plane
+    // under the receiver and a cylindrical receiver, one stage each
+    void build_field(CpuTracer& tracer) {
+        for (int ring = 0; ring < 4; ring++) {
+            const double radius = 50.0 + ring * 14.0;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / 16.0);
+            const double offset = ring % 2 ? M_PI / num_on_ring : 0.0;
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = offset + 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 4.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(tracking_aim_point(origin, receiver_center, sun_direction));
+                e->set_zrot(0.0);
+                if (ring < 2) {
+                    e->set_surface(std::make_shared<SurfaceFlat>());
+                }
+                else {
+                    auto surface = std::make_shared<SurfaceParabolic>();
+                    const double c = 1.0 / (2.0 * (receiver_center - origin).norm());
+                    surface->set_curvature(c, c);
+                    e->set_surface(surface);
+                }
+                e->set_aperture(std::make_shared<ApertureRectangle>(mirror_size, mirror_size));
+                e->set_slope_error(2e-3);
+                e->set_reflectivity(0.9);
+                e->set_stage(0);
+                tracer.add_element(e);
+            }
+        }
+
+        auto plane = std::make_shared<CspElement>();
+        plane->set_origin(Vec3d(0.0, 0.0, 40.0));
+        plane->set_aim_point(Vec3d(0.0, 0.0, 50.0));
+        plane->set_zrot(0.0);
+        plane->set_surface(std::make_shared<SurfaceFlat>());
+        plane->set_aperture(std::make_shared<ApertureRectangle>(200.0, 200.0));
+        plane->set_stage(1);
+        tracer.add_element(plane);
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(14.0, 16.0));
+        receiver->set_receiver(true);
+        receiver->set_stage(2);
+        tracer.add_element(receiver);
+    }
+
+    // decoding error of the hits of one kind of frame
+    struct Precision {
+        std::string name;
+        size_t hits = 0;
+        double max_error = 0.0;     // m
+        double sum_error = 0.0;
+        double max_off = 0.0;       // distance of the traced hits from their surface, m
+        double resolution = 0.0;    // largest quantization step over the frames, m
+        size_t beyond = 0;          // hits decoded farther than the step of their frame from their spot on the surface
+    };
+
+    Vec3d position(const float4& hit) { return Vec3d(hit.y, hit.z, hit.w); }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 500000;
+    const std::string out_dir = argc > 2 ? argv[2] : "";
+    if (!out_dir.empty()) std::filesystem::create_directories(out_dir);
+
+    CpuTracer tracer(num_rays);
+    build_field(tracer);
+    tracer.set_sun_vector(sun_direction);
+    tracer.set_sun_angle(0.00465);
+    tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 31u);
+    tracer.set_stage_flags(1, STAGE_VIRTUAL);
+    tracer.set_hit_stream(static_cast<size_t>(num_rays) * tracer.get_max_depth());
+    tracer.initialize();
+    tracer.run();
+
+    const int max_depth = tracer.get_max_depth();
+    const HitFrames frames = tracer.get_hit_frames();
+    const std::vector<HitRecord>& records = tracer.get_hit_records();
+    const std::vector<PackedHit> packed = tracer.get_packed_hits();
+    const std::vector<float4> decoded = unpack_hits(frames, packed);
+
+    // the sun points, the flat and the parabolic mirrors, the virtual plane and the receiver
+    std::vector<Precision> kinds = { { "sun plane" }, { "flat mirrors" }, { "parabolic mirrors" }, { "virtual plane" },
+                                     { "receiver cylinder" } };
+    size_t wrong_tags = 0;
+    for (const HitRecord& r : records) {
+        const size_t index = static_cast<size_t>(max_depth) * r.ray + r.depth;
+        const HitFrame& frame = frames.frame(r.element);
+        const int kind = r.tag == 0 ? 0 : r.tag == 1 ? (frame.shape == HIT_FRAME_PARABOLIC ? 2 : 1) : r.tag == 3 ? 3 : 4;
+        const Vec3d traced(r.position.x, r.position.y, r.position.z);
+        const double error = (position(decoded[index]) - traced).norm();
+        // the spot on the surface the hit packs, without quantization
+        double u, v;
+        frame.local(traced, u, v);
+        const Vec3d on_surface = frame.world(u, v);
+
+        Precision& p = kinds[kind];
+        p.hits++;
+        p.max_error = std::max(p.max_error, error);
+        p.sum_error += error;
+        p.max_off = std::max(p.max_off, (on_surface - traced).norm());
+        p.resolution = std::max(p.resolution, frame.resolution());
+        // the decoded point is a float too
+        p.beyond += (position(decoded[index]) - on_surface).norm() > frame.resolution() + 2e-5;
+        wrong_tags += decoded[index].x != static_cast<float>(r.tag) || packed[index].element != r.element;
+    }
+
+    size_t empty = 0;
+    for (const PackedHit& h : packed) empty += h.element == PACKED_HIT_EMPTY;
+
+    // a packed hit file gives back the hits
+    const std::string filename = out_dir.empty()
+        ? (std::filesystem::temp_directory_path() / "demo_cpu_packed_hits.bin").string()
+        : (std::filesystem::path(out_dir) / "packed_hits.bin").string();
+    tracer.write_packed_hits(filename);
+    const uintmax_t file_size = std::filesystem::file_size(filename);
+    PackedHitFile file;
+    read_packed_hits(filename, file);
+    const std::vector<float4> reread = unpack_hits(file.frames, file.hits);
+    size_t file_mismatches = file.num_rays != static_cast<size_t>(num_rays) || file.max_depth != max_depth
+                           || reread.size() != decoded.size();
+    for (size_t i = 0; i < std::min(reread.size(), decoded.size()); i++) {
+        const float4& a = reread[i];
+        const float4& b = decoded[i];
+        file_mismatches += a.x != b.x || a.y != b.y || a.z != b.z || a.w != b.w;
+    }
+    if (out_dir.empty()) std::filesystem::remove(filename);
+
+    const size_t slots = packed.size();
+    std::cout << num_rays << " rays, " << records.size() << " hits in " << slots << " slots, " << empty << " empty\n"
+              << std::fixed << std::setprecision(2) << "hit point buffer " << slots * sizeof(float4) / 1048576.0
+              << " MB, packed " << slots * sizeof(PackedHit) / 1048576.0 << " MB, " << sizeof(PackedHit)
+              << " bytes a hit, file " << file_size / 1048576.0 << " MB\n"
+              << "decoding error against the traced hits, mirrors " << mirror_size << " m:\n";
+    for (const Precision& p : kinds) {
+        std::cout << "  " << std::left << std::setw(18) << p.name << std::right << std::setw(9) << p.hits << " hits"
+                  << std::scientific << std::setprecision(2) << ", max " << p.max_error << " m, mean "
+                  << (p.hits ? p.sum_error / p.hits : 0.0) << " m, step " << p.resolution << " m, traced off the surface "
+                  << p.max_off << " m, max / mirror "
+                  << p.max_error / mirror_size << std::fixed << "\n";
+    }
+    std::cout << wrong_tags << " hits decode to another tag or element, " << file_mismatches
+              << " differ after the packed hit file" << std::endl;
+
+    bool ok = !records.empty() && wrong_tags == 0 && file_mismatches == 0;
+    ok &= empty == slots - records.size();
+    for (const Precision& p : kinds) {
+        ok &= p.hits > 0 && p.beyond == 0;
+        // well below the size of a mirror
+        ok &= p.max_error < 1e-3 * mirror_size;
+    }
+
+    std::cout << (ok ? "packed hits decode to the traced hits" : "packed hits do NOT decode to the traced hits") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+// Traces a heliostat field with the CPU tracer three ways: path by path in launch order, as a
+// wavefront in launch order, and as a wavefront sorted by direction octant and Morton code of
+// the origin before every bounce. All three must fill the same hit point buffer; the demo prints
+// the throughput and the cache misses of each bounce so the cost of the sort can be compared
+// against what it saves in traversal.
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+
+    // square field of parabolic heliostats tracking a cylindrical receiver on a tower at the origin,
+    // each one aimed along the bisector of the sun vector and the direction to the receiver
+    void add_field(CpuTracer& tracer, int num_heliostats, const Vec3d& sun_vector) {
+        const int side = static_cast<int>(std::ceil(std::sqrt(double(num_heliostats))));
+        const double spacing = 12.0;
+        const Vec3d receiver_center(0.0, 0.0, 100.0);
+
+        for (int i = 0; i < num_heliostats; i++) {
+            double x = (i % side - side / 2) * spacing;
+            double y = (i / side - side / 2) * spacing + spacing / 2;   // keep the tower base free
+
+            const Vec3d origin(x, y, 5.0);
+            const Vec3d normal = (sun_vector.normalized() + (receiver_center - origin).normalized()).normalized();
+
+            auto e = std::make_shared<CspElement>();
+            e->set_origin(origin);
+            e->set_aim_point(origin + normal * 100.0);
+            e->set_zrot(0.0);
+
+            auto surface = std::make_shared<SurfaceParabolic>();
+            surface->set_curvature(0.005, 0.005);
+            e->set_surface(surface);
+            e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+            tracer.add_element(e);
+        }
+
+        // vertical cylinder, 16 m diameter and 20 m high
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        tracer.add_element(receiver);
+    }
+
+    struct RunResult {
+        std::vector<float4> hit_points;
+        double time = 0.0;
+    };
+
+    RunResult run_case(const std::string& name, CpuTraceMode mode, bool sort, int num_rays, int num_heliostats) {
+        const Vec3d sun_vector(0.2, -0.3, 1.0);
+        CpuTracer tracer(num_rays);
+        add_field(tracer, num_heliostats, sun_vector);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_angle(0.00465);
+        tracer.set_trace_mode(mode);
+        tracer.set_ray_sorting(sort);
+        tracer.initialize();
+        tracer.run();
+
+        RunResult result;
+        result.hit_points = tracer.get_hit_point_buffer();
+        result.time = tracer.get_time_trace();
+
+        std::cout << "\n" << name << ": " << tracer.get_time_trace() << " s, "
+                  << num_rays / tracer.get_time_trace() / 1e6 << " M sun rays/s, "
+                  << tracer.get_num_hits_receiver() << " receiver hits";
+        if (tracer.get_cache_misses() >= 0)
+            std::cout << ", cache misses " << tracer.get_cache_misses() << " / " << tracer.get_cache_references();
+        std::cout << std::endl;
+
+        for (const CpuBounceStats& s : tracer.get_bounce_stats()) {
+            std::cout << "  bounce " << s.depth
+                      << std::setw(10) << s.num_rays << " rays"
+                      << "  sort " << std::setw(8) << std::fixed << std::setprecision(4) << s.sort_time << " s"
+                      << "  trace " << std::setw(8) << s.trace_time << " s"
+                      << std::setw(8) << std::setprecision(2) << (s.trace_time > 0 ? s.num_rays / s.trace_time / 1e6 : 0.0) << " M rays/s";
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+            if (s.cache_misses >= 0)
+                std::cout << "  misses " << s.cache_misses << " ("
+                          << (s.cache_references > 0 ? 100.0 * s.cache_misses / s.cache_references : 0.0) << "% of refs)";
+            std::cout << std::endl;
+        }
+        return result;
+    }
+
+    size_t count_mismatches(const std::vector<float4>& a, const std::vector<float4>& b) {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < a.size(); i++)
+            if (std::memcmp(&a[i], &b[i], sizeof(float4)) != 0) mismatches++;
+        return mismatches;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int num_rays = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    int num_heliostats = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    std::cout << num_rays << " sun rays, " << num_heliostats << " heliostats" << std::endl;
+
+    RunResult recursive = run_case("recursive", CpuTraceMode::RECURSIVE, false, num_rays, num_heliostats);
+    RunResult unsorted = run_case("wavefront, launch order", CpuTraceMode::WAVEFRONT, false, num_rays, num_heliostats);
+    RunResult sorted = run_case("wavefront, sorted", CpuTraceMode::WAVEFRONT, true, num_rays, num_heliostats);
+
+    size_t m1 = count_mismatches(recursive.hit_points, unsorted.hit_points);
+    size_t m2 = count_mismatches(recursive.hit_points, sorted.hit_points);
+    std::cout << "\nhit point mismatches: wavefront " << m1 << ", sorted wavefront " << m2 << std::endl;
+    std::cout << "sorted vs launch order speedup: " << unsorted.time / sorted.time << "x" << std::endl;
+
+    return (m1 == 0 && m2 == 0) ? 0 : 1;
+}
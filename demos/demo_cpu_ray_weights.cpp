@@ -0,0 +1,157 @@
+// Weighted rays against the roulette on a small north field of mirrors that reflect 90% of the light.
+// With RAY_WEIGHTED every ray leaves a mirror with its power times the reflectivity; with RAY_ROULETTE
+// it goes on with all its power nine times out of ten, which is the count based estimator: the
+// receiver sees rays of the sun ray power only. Both are traced over the same independent blocks of
+// sun samples; they must agree on the mean receiver power and flux map, and the weighted one must
+// spread less from block to block.
+//
+// usage: demo_cpu_ray_weights [rays per block] [number of blocks] [reflectivity]
+#include "cpu/cpu_tracer.h"
+#include "core/annual_runner.h"
+#include "demo_fields.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    using demo_fields::receiver_center;
+    using demo_fields::receiver_normal;
+    using demo_fields::receiver_size;
+    const int NUM_BINS = 6;
+
+    // power of every receiver hit binned over the receiver plane, W/m2
+    std::vector<double> flux_map(const CpuTracer& tracer) {
+        const Vec3d axis_u(1.0, 0.0, 0.0);
+        const Vec3d axis_v = receiver_normal.cross(axis_u);
+        const double bin = receiver_size / NUM_BINS;
+        std::vector<double> flux(NUM_BINS * NUM_BINS, 0.0);
+
+        const std::vector<float4>& hits = tracer.get_hit_point_buffer();
+        const std::vector<float>& power = tracer.get_hit_power_buffer();
+        for (size_t i = 0; i < hits.size(); i++) {
+            if (hits[i].x != 2.0f) continue;
+            const Vec3d p = Vec3d(hits[i].y, hits[i].z, hits[i].w) - receiver_center;
+            const int u = static_cast<int>(std::floor((p.dot(axis_u) + 0.5 * receiver_size) / bin));
+            const int v = static_cast<int>(std::floor((p.dot(axis_v) + 0.5 * receiver_size) / bin));
+            if (u < 0 || u >= NUM_BINS || v < 0 || v >= NUM_BINS) continue;
+            flux[v * NUM_BINS + u] += power[i] / (bin * bin);
+        }
+        return flux;
+    }
+
+    // mean and variance over the blocks of the receiver power and of every bin of the flux map
+    struct Estimate {
+        double mean_power = 0.0;
+        double var_power = 0.0;
+        std::vector<double> mean_flux;
+        std::vector<double> var_flux;
+        double time = 0.0;
+    };
+
+    Estimate run_blocks(CpuTracer& tracer, RayWeighting weighting, int num_rays, int num_blocks) {
+        tracer.set_ray_weighting(weighting);
+        Estimate e;
+        e.mean_flux.assign(NUM_BINS * NUM_BINS, 0.0);
+        e.var_flux.assign(NUM_BINS * NUM_BINS, 0.0);
+        std::vector<double> powers;
+        std::vector<std::vector<double>> maps;
+        for (int b = 0; b < num_blocks; b++) {
+            tracer.set_sample_offset(static_cast<unsigned long long>(b) * num_rays);
+            tracer.run();
+            e.time += tracer.get_time_trace();
+            powers.push_back(tracer.get_receiver_power());
+            maps.push_back(flux_map(tracer));
+        }
+        for (int b = 0; b < num_blocks; b++) {
+            e.mean_power += powers[b] / num_blocks;
+            for (size_t k = 0; k < e.mean_flux.size(); k++) e.mean_flux[k] += maps[b][k] / num_blocks;
+        }
+        for (int b = 0; b < num_blocks; b++) {
+            e.var_power += (powers[b] - e.mean_power) * (powers[b] - e.mean_power) / (num_blocks - 1);
+            for (size_t k = 0; k < e.var_flux.size(); k++)
+                e.var_flux[k] += (maps[b][k] - e.mean_flux[k]) * (maps[b][k] - e.mean_flux[k]) / (num_blocks - 1);
+        }
+        return e;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const int num_blocks = argc > 2 ? std::max(2, std::atoi(argv[2])) : 16;
+    const double reflectivity = argc > 3 ? std::atof(argv[3]) : 0.9;
+    const Vec3d sun_vector = Vec3d(0.2, -0.5, 0.8).normalized();
+
+    CpuTracer tracer(num_rays);
+    for (const std::shared_ptr<CspElement>& e : demo_fields::north_field(sun_vector, reflectivity, 1.5e-3))
+        tracer.add_element(e);
+    tracer.set_sun_vector(sun_vector);
+    tracer.set_sun_angle(0.00465);
+    tracer.set_sun_sampling(CpuSunSampling::FOOTPRINTS);
+    tracer.initialize();
+
+    // every receiver hit of a weighted ray carries the sun ray power times one reflectivity per mirror
+    tracer.set_ray_weighting(RAY_WEIGHTED);
+    tracer.run();
+    bool ok = true;
+    {
+        const std::vector<float4>& hits = tracer.get_hit_point_buffer();
+        const std::vector<float>& power = tracer.get_hit_power_buffer();
+        const std::vector<float>& ray_power = tracer.get_ray_power_buffer();
+        const size_t depth = hits.size() / num_rays;
+        size_t checked = 0, wrong = 0;
+        for (size_t path = 0; path < static_cast<size_t>(num_rays); path++) {
+            double expected = ray_power[path];
+            for (size_t d = 1; d < depth; d++) {
+                const float4& h = hits[path * depth + d];
+                if (h.x == 2.0f) {
+                    wrong += std::abs(power[path * depth + d] - expected) > 1e-5 * expected;
+                    checked++;
+                }
+                if (h.x == 1.0f) expected *= reflectivity;
+            }
+        }
+        std::cout << checked << " receiver hits, " << wrong << " with a power other than the reflected one" << std::endl;
+        ok &= checked > 0 && wrong == 0;
+    }
+
+    const Estimate weighted = run_blocks(tracer, RAY_WEIGHTED, num_rays, num_blocks);
+    const Estimate roulette = run_blocks(tracer, RAY_ROULETTE, num_rays, num_blocks);
+
+    // over the bins that see light: largest gap of the means in standard errors, summed variances
+    double max_gap = 0.0, var_flux_weighted = 0.0, var_flux_roulette = 0.0;
+    for (size_t k = 0; k < weighted.mean_flux.size(); k++) {
+        const double se = std::sqrt((weighted.var_flux[k] + roulette.var_flux[k]) / num_blocks);
+        if (!(se > 0.0)) continue;
+        max_gap = std::max(max_gap, std::abs(weighted.mean_flux[k] - roulette.mean_flux[k]) / se);
+        var_flux_weighted += weighted.var_flux[k];
+        var_flux_roulette += roulette.var_flux[k];
+    }
+    const double se_power = std::sqrt((weighted.var_power + roulette.var_power) / num_blocks);
+    const double gap_power = std::abs(weighted.mean_power - roulette.mean_power) / se_power;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << num_blocks << " blocks of " << num_rays << " rays, reflectivity " << std::setprecision(2) << reflectivity << "\n"
+              << std::setw(10) << "" << std::setw(16) << "power [kW]" << std::setw(16) << "std [kW]"
+              << std::setw(20) << "flux variance" << std::setw(12) << "time [s]" << "\n";
+    for (const auto& row : { std::make_pair("weighted", &weighted), std::make_pair("roulette", &roulette) }) {
+        std::cout << std::setw(10) << row.first << std::setprecision(3)
+                  << std::setw(16) << row.second->mean_power * 1e-3 << std::setw(16) << std::sqrt(row.second->var_power) * 1e-3
+                  << std::setw(20) << (row.second == &weighted ? var_flux_weighted : var_flux_roulette)
+                  << std::setw(12) << row.second->time << "\n";
+    }
+    std::cout << std::setprecision(2) << "means differ by " << gap_power << " standard errors in power, at most "
+              << max_gap << " in a flux bin" << std::endl;
+
+    // same mean within the noise, less spread with the weights
+    ok &= gap_power < 4.0 && max_gap < 5.0;
+    ok &= weighted.var_power < roulette.var_power && var_flux_weighted < var_flux_roulette;
+
+    std::cout << (ok ? "weighted rays match the roulette with less variance"
+                     : "weighted rays do NOT match the roulette with less variance") << std::endl;
+    return ok ? 0 : 1;
+}
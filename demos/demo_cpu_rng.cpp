@@ -0,0 +1,157 @@
+// Checks of the counter based generator shared by the raygen program and the host tracer
+// (shaders/Philox.h): the known answers of Philox4x32-10 from Random123, the uniformity of the
+// numbers (chi-square over 256 bins), the correlation between neighbouring rays and bounces, and
+// the sun directions of a CpuTracer run drawn again from the stream of every ray. The cost of a draw
+// is timed; there is no state to set up, so it is the whole cost of a new stream.
+#include "shaders/Philox.h"
+#include "core/timer.h"
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    struct KnownAnswer {
+        uint4 ctr;
+        uint2 key;
+        uint4 expected;
+    };
+
+    // kat_vectors of Random123 for philox4x32 with 10 rounds
+    const KnownAnswer KNOWN_ANSWERS[] = {
+        { { 0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u }, { 0x00000000u, 0x00000000u },
+          { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } },
+        { { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu }, { 0xffffffffu, 0xffffffffu },
+          { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } },
+        { { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u }, { 0xa4093822u, 0x299f31d0u },
+          { 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } },
+    };
+
+    bool check_known_answers() {
+        bool ok = true;
+        for (const KnownAnswer& k : KNOWN_ANSWERS) {
+            const uint4 r = philox4x32_10(k.ctr, k.key);
+            const bool match = r.x == k.expected.x && r.y == k.expected.y && r.z == k.expected.z && r.w == k.expected.w;
+            std::cout << std::hex << std::setfill('0') << "ctr " << std::setw(8) << k.ctr.x << " key " << std::setw(8)
+                      << k.key.x << ": " << std::setw(8) << r.x << " " << std::setw(8) << r.y << " " << std::setw(8)
+                      << r.z << " " << std::setw(8) << r.w << std::dec << std::setfill(' ')
+                      << (match ? "" : "  FAILED") << std::endl;
+            ok &= match;
+        }
+        return ok;
+    }
+
+    // chi-square of 256 bins for the four numbers of num_rays consecutive rays at one bounce
+    bool check_uniformity(unsigned long long seed, unsigned int bounce, int num_rays) {
+        const int num_bins = 256;
+        std::vector<size_t> counts(num_bins, 0);
+        bool in_range = true;
+        for (int i = 0; i < num_rays; i++) {
+            const float4 u = random_uniform4(seed, i, bounce);
+            for (float x : { u.x, u.y, u.z, u.w }) {
+                in_range &= x > 0.0f && x <= 1.0f;
+                counts[std::min(num_bins - 1, static_cast<int>((x - 1e-9f) * num_bins))]++;
+            }
+        }
+        const double expected = 4.0 * num_rays / num_bins;
+        double chi2 = 0.0;
+        for (size_t c : counts)
+            chi2 += (c - expected) * (c - expected) / expected;
+
+        // 0.1% critical value of the chi-square distribution (Wilson-Hilferty)
+        const int dof = num_bins - 1;
+        const double h = 2.0 / (9.0 * dof);
+        const double critical = dof * std::pow(1.0 - h + 3.09 * std::sqrt(h), 3.0);
+        const bool ok = chi2 < critical && in_range;
+        std::cout << "bounce " << bounce << ": chi2 " << chi2 << " (" << dof << " dof, 0.1% critical " << critical << ")"
+                  << (in_range ? "" : ", number outside (0, 1]") << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+
+    // correlation of the first number of a stream with that of the neighbouring ray and bounce
+    bool check_correlation(unsigned long long seed, int num_rays) {
+        double s_ray = 0.0, s_bounce = 0.0, s_seed = 0.0;
+        for (int i = 0; i < num_rays; i++) {
+            const double a = random_uniform4(seed, i, 0).x - 0.5;
+            s_ray += a * (random_uniform4(seed, i + 1, 0).x - 0.5);
+            s_bounce += a * (random_uniform4(seed, i, 1).x - 0.5);
+            s_seed += a * (random_uniform4(seed + 1, i, 0).x - 0.5);
+        }
+        // correlation of independent uniforms has the standard deviation 1 / sqrt(n)
+        const double scale = 12.0 / num_rays;
+        const double limit = 4.0 / std::sqrt(double(num_rays));
+        const bool ok = std::abs(s_ray * scale) < limit && std::abs(s_bounce * scale) < limit && std::abs(s_seed * scale) < limit;
+        std::cout << "correlation with the next ray " << s_ray * scale << ", the next bounce " << s_bounce * scale
+                  << ", the next seed " << s_seed * scale << " (limit " << limit << ")" << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+
+    // the sun direction of every ray of a host run from the stream of the ray, as the raygen program draws it
+    bool check_tracer(int num_rays) {
+        CpuTracer tracer(num_rays);
+        auto e = std::make_shared<CspElement>();
+        e->set_origin(Vec3d(0.0, 0.0, 0.0));
+        e->set_aim_point(Vec3d(0.0, 0.0, 100.0));
+        e->set_zrot(0.0);
+        e->set_surface(std::make_shared<SurfaceFlat>());
+        e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+        tracer.add_element(e);
+        const float half_angle = 0.00465f;
+        tracer.set_sun_vector(Vec3d(0.0, 0.0, 1.0));
+        tracer.set_sun_angle(half_angle);
+        tracer.set_sample_offset(1000);
+        tracer.initialize();
+        tracer.run();
+
+        // sampleRayDirectionInCone_Pillbox of shaders/sun.cu
+        const float3 w = make_float3(0.0f, 0.0f, -1.0f);
+        const float3 u = normalize(cross(make_float3(1, 0, 0), w));
+        const float3 v = cross(w, u);
+        const float cos_theta = cosf(half_angle);
+        size_t mismatches = 0;
+        for (int i = 0; i < num_rays; i++) {
+            const float4 r = random_uniform4(123456ULL, 1000ULL + i, 0);
+            const float phi = 2.0f * M_PIf * r.x;
+            const float z = cos_theta + (1.0f - cos_theta) * r.y;
+            const float rr = sqrtf(1.0f - z * z);
+            const float3 dir = normalize(rr * (cosf(phi) * u + sinf(phi) * v) + z * w);
+            const float3 got = tracer.get_sun_dir_buffer()[i];
+            if (got.x != dir.x || got.y != dir.y || got.z != dir.z) mismatches++;
+        }
+        std::cout << "CPU tracer: " << mismatches << " of " << num_rays << " sun directions differ from the ray streams"
+                  << (mismatches ? "  FAILED" : "") << std::endl;
+        return mismatches == 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+    bool ok = check_known_answers();
+    for (unsigned int bounce : { 0u, 1u, 4u })
+        ok &= check_uniformity(123456ULL, bounce, num_rays);
+    ok &= check_correlation(123456ULL, num_rays);
+    ok &= check_tracer(num_rays / 10);
+
+    // a new stream per ray costs one block of ten rounds
+    float sum = 0.0f;
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < num_rays; i++) {
+        const float4 u = random_uniform4(123456ULL, i, 0);
+        sum += u.x + u.y + u.z + u.w;
+    }
+    timer.stop();
+    std::cout << timer.get_time_sec() / num_rays * 1e9 << " ns per ray for four numbers (mean "
+              << sum / (4.0 * num_rays) << ")" << std::endl;
+
+    std::cout << (ok ? "generator checks passed" : "generator checks FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Thread scaling of the CPU tracer from one thread to every logical cpu, with the work-stealing
+// scheduler and with static partitioning of the same batches. Threads are pinned node by node, so
+// on a 2-socket machine the second half of the curve crosses the socket boundary. Every run must
+// produce the hit point buffer of the single-threaded run.
+#include "cpu/cpu_tracer.h"
+#include "cpu/work_stealing.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+
+    // square field of parabolic heliostats tracking a cylindrical receiver on a tower at the origin
+    void add_field(CpuTracer& tracer, int num_heliostats, const Vec3d& sun_vector) {
+        const int side = static_cast<int>(std::ceil(std::sqrt(double(num_heliostats))));
+        const double spacing = 12.0;
+        const Vec3d receiver_center(0.0, 0.0, 100.0);
+
+        for (int i = 0; i < num_heliostats; i++) {
+            double x = (i % side - side / 2) * spacing;
+            double y = (i / side - side / 2) * spacing + spacing / 2;
+
+            const Vec3d origin(x, y, 5.0);
+            const Vec3d normal = (sun_vector.normalized() + (receiver_center - origin).normalized()).normalized();
+
+            auto e = std::make_shared<CspElement>();
+            e->set_origin(origin);
+            e->set_aim_point(origin + normal * 100.0);
+            e->set_zrot(0.0);
+
+            auto surface = std::make_shared<SurfaceParabolic>();
+            surface->set_curvature(0.005, 0.005);
+            e->set_surface(surface);
+            e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+            tracer.add_element(e);
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        tracer.add_element(receiver);
+    }
+
+    size_t count_mismatches(const std::vector<float4>& a, const std::vector<float4>& b) {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < a.size(); i++)
+            if (std::memcmp(&a[i], &b[i], sizeof(float4)) != 0) mismatches++;
+        return mismatches;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int num_rays = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    int num_heliostats = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    const CpuTopology topo = CpuTopology::detect();
+    const int max_threads = static_cast<int>(topo.cpus.size());
+    std::cout << num_rays << " sun rays, " << num_heliostats << " heliostats, "
+              << max_threads << " cpus on " << topo.num_nodes << " NUMA node(s)" << std::endl;
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    const Vec3d sun_vector(0.2, -0.3, 1.0);
+    CpuTracer tracer(num_rays);
+    add_field(tracer, num_heliostats, sun_vector);
+    tracer.set_sun_vector(sun_vector);
+    tracer.set_sun_angle(0.00465);
+    tracer.initialize();
+
+    const CpuTraceMode modes[] = { CpuTraceMode::RECURSIVE, CpuTraceMode::WAVEFRONT };
+    const char* mode_names[] = { "recursive", "wavefront (sorted)" };
+
+    bool all_match = true;
+    for (int m = 0; m < 2; m++) {
+        tracer.set_trace_mode(modes[m]);
+        std::cout << "\n" << mode_names[m] << "\n"
+                  << "threads  static [s]  stealing [s]  M rays/s  speedup  efficiency  steals (remote)" << std::endl;
+
+        std::vector<float4> reference;
+        double base_time = 0.0;
+        for (int threads : thread_counts) {
+            tracer.set_num_threads(threads);
+
+            tracer.set_work_stealing(false);
+            tracer.run();
+            const double static_time = tracer.get_time_trace();
+
+            tracer.set_work_stealing(true);
+            tracer.run();
+            const double time = tracer.get_time_trace();
+
+            if (reference.empty()) {
+                reference = tracer.get_hit_point_buffer();
+                base_time = time;
+            }
+            const size_t mismatches = count_mismatches(reference, tracer.get_hit_point_buffer());
+            all_match = all_match && mismatches == 0;
+
+            size_t steals = 0, remote = 0;
+            const WorkStealingScheduler* scheduler = tracer.get_scheduler();
+            for (int t = 0; t < scheduler->num_threads(); t++) {
+                steals += scheduler->get_stats(t).steals;
+                remote += scheduler->get_stats(t).remote_steals;
+            }
+
+            std::cout << std::setw(7) << threads
+                      << std::fixed << std::setprecision(4)
+                      << std::setw(12) << static_time
+                      << std::setw(14) << time
+                      << std::setprecision(2)
+                      << std::setw(10) << num_rays / time / 1e6
+                      << std::setw(9) << base_time / time
+                      << std::setw(11) << 100.0 * base_time / time / threads << "%"
+                      << std::setw(9) << steals << " (" << remote << ")";
+            if (mismatches) std::cout << "  " << mismatches << " hit point mismatches";
+            std::cout << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Stage-ordered tracing on the toy parabolic scene: three mirrors in the first stage and a flat
+// receiver in the second. A ray is only tested against the elements of its stage and handed to the
+// next one when it leaves the stage, so with this scene, where nothing in one stage shades the
+// other, the stages must give the receiver power of the same elements traced as one flat stage.
+// A virtual stage between the mirrors and the receiver records every ray crossing it and changes
+// nothing else; a virtual stage that only part of the rays cross loses the others, unless it traces
+// through.
+//
+// usage: demo_cpu_stages [stinput file] [number of rays]
+#include "cpu/cpu_tracer.h"
+#include "core/stinput_reader.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    struct Result {
+        double power = 0.0;          // receiver power, W
+        double power_error = 0.0;    // standard error of the sum of the receiver hits, W
+        size_t receiver_hits = 0;
+        size_t virtual_hits = 0;
+        size_t unrecorded = 0;       // receiver hits of a path that did not cross the virtual stage
+        size_t wrong_power = 0;      // virtual hits whose power is not the one arriving at the receiver
+    };
+
+    // a flat plane parallel to the ground at height z, in its own virtual stage
+    std::shared_ptr<CspElement> virtual_plane(const Vec3d& center, double width, double height, unsigned int stage) {
+        auto e = std::make_shared<CspElement>();
+        e->set_origin(center);
+        e->set_aim_point(center + Vec3d(0.0, 0.0, 10.0));
+        e->set_zrot(0.0);
+        e->set_surface(std::make_shared<SurfaceFlat>());
+        e->set_aperture(std::make_shared<ApertureRectangle>(width, height));
+        e->set_stage(stage);
+        return e;
+    }
+
+    Result trace(const StInputReader& reader, int num_rays, CpuTraceMode mode,
+                 const std::vector<unsigned int>& stage_flags, bool flat,
+                 std::shared_ptr<CspElement> extra = nullptr) {
+        CpuTracer tracer(num_rays);
+        tracer.set_sun_vector(reader.sun_vector());
+        tracer.set_sun_angle(reader.sun_angle());
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 3u);
+        tracer.set_trace_mode(mode);
+        for (unsigned int s = 0; s < stage_flags.size(); s++)
+            tracer.set_stage_flags(s, stage_flags[s]);
+
+        // the receivers move one stage down to make room for the extra stage
+        for (const std::shared_ptr<CspElement>& e : reader.elements()) {
+            auto copy = std::make_shared<CspElement>(*e);
+            copy->set_stage(flat ? 0u : (extra && e->is_receiver() ? e->get_stage() + 1 : e->get_stage()));
+            tracer.add_element(copy);
+        }
+        if (extra) tracer.add_element(extra);
+        tracer.initialize();
+        tracer.run();
+
+        Result r;
+        r.power = tracer.get_receiver_power();
+        const std::vector<float4>& hits = tracer.get_hit_point_buffer();
+        const std::vector<float>& power = tracer.get_hit_power_buffer();
+        const size_t depth = hits.size() / num_rays;
+        double sum_sq = 0.0;
+        for (size_t path = 0; path < static_cast<size_t>(num_rays); path++) {
+            float virtual_power = -1.0f;
+            for (size_t d = 1; d < depth; d++) {
+                const size_t i = path * depth + d;
+                if (hits[i].x == HIT_TAG_VIRTUAL) {
+                    r.virtual_hits++;
+                    virtual_power = power[i];
+                }
+                if (hits[i].x == 2.0f) {
+                    r.receiver_hits++;
+                    sum_sq += double(power[i]) * power[i];
+                    if (virtual_power < 0.0f) r.unrecorded++;
+                    else if (virtual_power != power[i]) r.wrong_power++;
+                }
+            }
+        }
+        r.power_error = std::sqrt(sum_sq);
+        return r;
+    }
+
+    void print(const char* name, const Result& r) {
+        std::cout << std::setw(24) << name << std::setw(14) << std::setprecision(2) << r.power
+                  << std::setw(12) << r.power_error << std::setw(12) << r.receiver_hits
+                  << std::setw(12) << r.virtual_hits << std::endl;
+    }
+
+    // within four standard errors
+    bool same(const Result& a, const Result& b) {
+        return std::abs(a.power - b.power) <= 4.0 * std::hypot(a.power_error, b.power_error);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* stinput_file = argc > 1 ? argv[1] : "../data/toy_problem_parabolic.stinput";
+    const int num_rays = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+    StInputReader reader;
+    if (!reader.read(stinput_file)) {
+        std::cout << "cannot read " << stinput_file << std::endl;
+        return 1;
+    }
+
+    // two MULTIHIT stages, the receiver alone in the second one
+    const std::vector<unsigned int>& flags = reader.stage_flags();
+    size_t num_receivers = 0;
+    for (const std::shared_ptr<CspElement>& e : reader.elements())
+        num_receivers += e->is_receiver() && e->get_stage() == 1;
+    bool ok = flags.size() == 2 && flags[0] == STAGE_MULTIHIT && flags[1] == STAGE_MULTIHIT
+        && reader.elements().size() == 4 && num_receivers == 1;
+    std::cout << reader.elements().size() << " elements in " << flags.size() << " stages, "
+              << num_receivers << " receiver in the last one" << std::endl;
+
+    std::cout << std::fixed << std::setw(24) << "" << std::setw(14) << "power [W]" << std::setw(12) << "error [W]"
+              << std::setw(12) << "receiver" << std::setw(12) << "virtual" << std::endl;
+
+    const Result flat = trace(reader, num_rays, CpuTraceMode::WAVEFRONT, {}, true);
+    print("one flat stage", flat);
+    const Result staged = trace(reader, num_rays, CpuTraceMode::WAVEFRONT, flags, false);
+    print("stages", staged);
+    const Result recursive = trace(reader, num_rays, CpuTraceMode::RECURSIVE, flags, false);
+    print("stages, recursive", recursive);
+    ok &= staged.receiver_hits > 0 && same(flat, staged);
+    ok &= recursive.power == staged.power && recursive.receiver_hits == staged.receiver_hits;
+
+    // a virtual plane halfway up, over every reflected ray
+    const std::vector<unsigned int> with_virtual = { flags[0], STAGE_VIRTUAL, flags[1] };
+    const Result recorded = trace(reader, num_rays, CpuTraceMode::WAVEFRONT, with_virtual, false,
+                                  virtual_plane(Vec3d(0.0, 2.0, 5.0), 12.0, 12.0, 1));
+    print("virtual stage", recorded);
+    ok &= same(recorded, staged) && recorded.unrecorded == 0 && recorded.wrong_power == 0;
+    ok &= recorded.virtual_hits >= recorded.receiver_hits;
+
+    // a virtual plane over the light of the west mirror only: the rays of the two others miss the
+    // stage and are lost, unless it traces through
+    const Vec3d west_center(-3.5, 2.0, 5.0);
+    const Result partial = trace(reader, num_rays, CpuTraceMode::WAVEFRONT, with_virtual, false,
+                                 virtual_plane(west_center, 4.5, 12.0, 1));
+    print("partial virtual stage", partial);
+    const std::vector<unsigned int> trace_through = { flags[0], STAGE_VIRTUAL | STAGE_TRACETHROUGH, flags[1] };
+    const Result through = trace(reader, num_rays, CpuTraceMode::WAVEFRONT, trace_through, false,
+                                 virtual_plane(west_center, 4.5, 12.0, 1));
+    print("... tracing through", through);
+    ok &= partial.unrecorded == 0 && partial.power < 0.5 * staged.power && partial.power > 0.2 * staged.power;
+    ok &= same(through, staged) && through.virtual_hits == partial.virtual_hits && through.unrecorded > 0;
+
+    std::cout << (ok ? "stage-ordered tracing matches the flat scene" : "stage-ordered tracing does NOT match the flat scene")
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+// Annual study of a radial field through a SunPositionCache. The first pass traces the grid nodes
+// around the hourly sun positions of 2010 at Daggett as they come up and answers the hours from
+// them; the second pass opens the same file again, as a later study of the same field would, and
+// answers every hour without tracing. A sample of hours is traced directly to see how far the
+// interpolated receiver power is from the traced one. The values of a node are the receiver power
+// per unit dni and the efficiency of every heliostat.
+//
+// usage: demo_cpu_sun_cache [number of rays] [grid step in degrees] [cache file]
+#include "core/sun_position_cache.h"
+#include "core/annual_runner.h"
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 100.0);
+    const double HELIOSTAT_SIZE = 10.0;
+
+    std::vector<std::shared_ptr<CspElement>> build_field(int num_rings) {
+        std::vector<std::shared_ptr<CspElement>> elements;
+        for (int ring = 0; ring < num_rings; ring++) {
+            const double radius = 60.0 + ring * 25.0;
+            const double spacing = 20.0 + ring * 1.5;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / spacing);
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 5.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(origin + Vec3d(0.0, 0.0, 100.0));
+                e->set_zrot(0.0);
+                auto surface = std::make_shared<SurfaceParabolic>();
+                surface->set_curvature(0.005, 0.005);
+                e->set_surface(surface);
+                e->set_aperture(std::make_shared<ApertureRectangle>(HELIOSTAT_SIZE, HELIOSTAT_SIZE));
+                elements.push_back(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        elements.push_back(receiver);
+        return elements;
+    }
+
+    double clear_sky_dni(const Vec3d& sun_vector) {
+        const double sin_elevation = sun_vector.normalized()[2];
+        if (sin_elevation <= 0.0) return 0.0;
+        return 1353.0 * std::pow(0.7, std::pow(1.0 / sin_elevation, 0.678));
+    }
+
+    // one tracer for the whole study, the heliostats retracked for every sun vector
+    class FieldTracer {
+    public:
+        FieldTracer(int num_rays) : m_tracer(num_rays), m_elements(build_field(6)), m_initialized(false), m_num_traces(0) {
+            for (const std::shared_ptr<CspElement>& e : m_elements)
+                m_tracer.add_element(e);
+            m_tracer.set_sun_angle(0.00465);
+            m_tracer.set_dni(1.0);
+        }
+
+        const std::vector<std::shared_ptr<CspElement>>& elements() const { return m_elements; }
+        const std::vector<unsigned int>& stage_flags() const { return m_tracer.get_stage_flags(); }
+        size_t num_heliostats() const { return m_elements.size() - 1; }
+        size_t num_traces() const { return m_num_traces; }
+
+        // receiver power per unit dni, then the part of the sun on every heliostat that reaches the receiver
+        void trace(const Vec3d& sun_vector, float* values) {
+            for (size_t i = 0; i < num_heliostats(); i++) {
+                CspElement& e = *m_elements[i];
+                e.set_aim_point(tracking_aim_point(e.get_origin(), receiver_center, sun_vector));
+                e.update_euler_angles();
+            }
+            m_tracer.set_sun_vector(sun_vector);
+            if (m_initialized) m_tracer.update();
+            else m_tracer.initialize();
+            m_initialized = true;
+            m_tracer.run();
+            m_num_traces++;
+
+            // the path goes to the heliostat nearest to its first hit, they are 20 m apart and 10 m wide
+            std::vector<double> power(num_heliostats(), 0.0);
+            const std::vector<float4>& hits = m_tracer.get_hit_point_buffer();
+            const std::vector<float>& ray_power = m_tracer.get_ray_power_buffer();
+            const size_t depth = hits.size() / ray_power.size();
+            for (size_t path = 0; path < ray_power.size(); path++) {
+                const float4 first = hits[path * depth + 1];
+                if (first.x != 1.0f) continue;
+                bool received = false;
+                for (size_t d = 2; d < depth; d++)
+                    received |= hits[path * depth + d].x == 2.0f;
+                if (!received) continue;
+                size_t nearest = 0;
+                double best = 1e30;
+                for (size_t i = 0; i < num_heliostats(); i++) {
+                    const Vec3d& o = m_elements[i]->get_origin();
+                    const double d2 = (Vec3d(first.y, first.z, first.w) - o).dot(Vec3d(first.y, first.z, first.w) - o);
+                    if (d2 < best) {
+                        best = d2;
+                        nearest = i;
+                    }
+                }
+                power[nearest] += ray_power[path];
+            }
+            values[0] = static_cast<float>(m_tracer.get_receiver_power());
+            for (size_t i = 0; i < num_heliostats(); i++)
+                values[1 + i] = static_cast<float>(power[i] / (HELIOSTAT_SIZE * HELIOSTAT_SIZE));
+        }
+
+    private:
+        CpuTracer m_tracer;
+        std::vector<std::shared_ptr<CspElement>> m_elements;
+        bool m_initialized;
+        size_t m_num_traces;
+    };
+
+    // energy on the receiver over the day hours, every hour answered by the cache
+    double annual_energy(SunPositionCache& cache, FieldTracer& field, const std::vector<AnnualStep>& steps) {
+        std::vector<float> values(cache.get_num_values());
+        double energy = 0.0;
+        for (const AnnualStep& step : steps) {
+            if (!(step.dni > 0.0 && step.sun_vector[2] > 0.0)) continue;
+            double azimuth, elevation;
+            SunPositionCache::sun_angles(step.sun_vector, azimuth, elevation);
+            cache.evaluate(azimuth, elevation, values.data(),
+                           [&](const Vec3d& sun, float* v) { field.trace(sun, v); });
+            energy += values[0] * step.dni;   // one hour
+        }
+        return energy;
+    }
+
+    void print_stats(const char* what, const SunPositionCache& cache, double seconds, size_t traces) {
+        const SunCacheStats& s = cache.get_stats();
+        std::cout << what << ": " << s.hits << " hits, " << s.interpolated << " interpolated, " << s.misses
+                  << " misses, " << s.stores << " nodes traced (" << traces << " traces) in " << seconds << " s, "
+                  << cache.get_num_stored() << " nodes in the file" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const double step = argc > 2 ? std::atof(argv[2]) : 2.0;
+    const std::string path = argc > 3 ? argv[3] : "sun_cache_demo.bin";
+    std::remove(path.c_str());
+
+    SolarSite daggett;
+    daggett.latitude = 34.87;
+    daggett.longitude = -116.78;
+    const std::vector<double> times = hourly_timestamps(2010);
+    std::vector<AnnualStep> steps = annual_steps(daggett, times, std::vector<double>(times.size(), 0.0));
+    for (AnnualStep& s : steps)
+        s.dni = clear_sky_dni(s.sun_vector);
+
+    FieldTracer field(num_rays);
+    const uint64_t hash = scene_hash(field.elements(), field.stage_flags(), static_cast<uint64_t>(num_rays));
+    const size_t num_values = 1 + field.num_heliostats();
+
+    // first study: the nodes are traced as the hours need them
+    double energy_first, energy_second;
+    {
+        SunPositionCache cache(path, hash, num_values, step, step);
+        Timer timer;
+        timer.start();
+        energy_first = annual_energy(cache, field, steps);
+        timer.stop();
+        print_stats("first study", cache, timer.get_time_sec(), field.num_traces());
+    }
+
+    // a later study of the same field, from the file
+    bool ok = true;
+    {
+        const size_t traces = field.num_traces();
+        SunPositionCache cache(path, hash, num_values, step, step);
+        Timer timer;
+        timer.start();
+        energy_second = annual_energy(cache, field, steps);
+        timer.stop();
+        print_stats("second study", cache, timer.get_time_sec(), field.num_traces() - traces);
+        ok &= cache.get_stats().misses == 0 && field.num_traces() == traces && energy_first == energy_second;
+    }
+    std::cout << "energy on the receiver " << energy_first * 1e-6 << " MWh, from the file " << energy_second * 1e-6
+              << " MWh" << std::endl;
+
+    // interpolated against traced, every 97th day hour; the hours close to a node take it as it is
+    {
+        SunPositionCache cache(path, hash, num_values, step, step);
+        cache.set_tolerance(0.25 * step);
+        std::vector<float> cached(num_values), traced(num_values);
+        double sum_error = 0.0, max_error = 0.0;
+        int count = 0, day_hour = 0;
+        for (const AnnualStep& s : steps) {
+            if (!(s.dni > 0.0 && s.sun_vector[2] > 0.0) || day_hour++ % 97) continue;
+            cache.lookup(s.sun_vector, cached.data());
+            field.trace(s.sun_vector, traced.data());
+            const double error = std::abs(cached[0] - traced[0]) / traced[0];
+            sum_error += error;
+            max_error = std::max(max_error, error);
+            count++;
+        }
+        std::cout << "receiver power interpolated on the " << step << " degree grid against traced, over " << count
+                  << " hours: mean " << 100.0 * sum_error / count << " %, max " << 100.0 * max_error << " % ("
+                  << cache.get_stats().hits << " within " << 0.25 * step << " degrees of a node)" << std::endl;
+
+        // the file of another scene is refused
+        bool refused = false;
+        try {
+            SunPositionCache other(path, hash + 1, num_values, step, step);
+        }
+        catch (const std::runtime_error&) {
+            refused = true;
+        }
+        std::cout << "cache of another scene " << (refused ? "refused" : "accepted  FAILED") << std::endl;
+        ok &= refused;
+    }
+
+    std::remove(path.c_str());
+    std::cout << (ok ? "sun cache checks passed" : "sun cache checks FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+// Sun sampling over the heliostat footprints against the uniform sun parallelogram on a sparse
+// radial field. A long uniform run is the reference for the receiver power and a coarse flux map on
+// the receiver; both methods are then run with the same number of rays, and the spread of the
+// receiver power over consecutive blocks of rays gives the standard error each method reaches.
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const Vec3d receiver_center(0.0, 0.0, 100.0);
+    const int FLUX_BINS_AZIMUTH = 12;
+    const int FLUX_BINS_HEIGHT = 4;
+
+    // rings of heliostats around the tower, the spacing on a ring grows with the radius
+    int add_radial_field(CpuTracer& tracer, int num_rings, const Vec3d& sun_vector) {
+        int count = 0;
+        for (int ring = 0; ring < num_rings; ring++) {
+            const double radius = 60.0 + ring * 25.0;
+            const double spacing = 20.0 + ring * 1.5;
+            const int num_on_ring = static_cast<int>(2.0 * M_PI * radius / spacing);
+            const double offset = ring % 2 ? M_PI / num_on_ring : 0.0;
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = offset + 2.0 * M_PI * k / num_on_ring;
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 5.0);
+                const Vec3d normal = (sun_vector.normalized() + (receiver_center - origin).normalized()).normalized();
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(origin + normal * 100.0);
+                e->set_zrot(0.0);
+                auto surface = std::make_shared<SurfaceParabolic>();
+                surface->set_curvature(0.005, 0.005);
+                e->set_surface(surface);
+                e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+                tracer.add_element(e);
+                count++;
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + Vec3d(0.0, -1.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(16.0, 20.0));
+        receiver->set_receiver(true);
+        tracer.add_element(receiver);
+        return count;
+    }
+
+    struct Estimate {
+        double power = 0.0;                       // receiver power of the whole run
+        double std_error = 0.0;                   // standard error of one block
+        std::vector<double> flux_map;             // receiver power per bin (azimuth x height)
+    };
+
+    // receiver power split by blocks of consecutive rays; the block estimate is scaled by the
+    // number of blocks so that each one estimates the total power from block_size rays
+    Estimate evaluate(const CpuTracer& tracer, int num_blocks) {
+        const std::vector<float4>& hits = tracer.get_hit_point_buffer();
+        const std::vector<float>& power = tracer.get_ray_power_buffer();
+        const size_t num_rays = power.size();
+        const int max_depth = static_cast<int>(hits.size() / num_rays);
+
+        Estimate e;
+        e.flux_map.assign(FLUX_BINS_AZIMUTH * FLUX_BINS_HEIGHT, 0.0);
+        std::vector<double> blocks(num_blocks, 0.0);
+        for (size_t path = 0; path < num_rays; path++) {
+            for (int d = 1; d < max_depth; d++) {
+                const float4& hp = hits[path * max_depth + d];
+                if (hp.x != 2.0f) continue;
+
+                const double azimuth = std::atan2(hp.z - receiver_center[1], hp.y - receiver_center[0]);
+                const double height = hp.w - receiver_center[2];
+                const int ia = std::min(FLUX_BINS_AZIMUTH - 1, static_cast<int>((azimuth + M_PI) / (2.0 * M_PI) * FLUX_BINS_AZIMUTH));
+                const int ih = std::min(FLUX_BINS_HEIGHT - 1, std::max(0, static_cast<int>((height + 10.0) / 20.0 * FLUX_BINS_HEIGHT)));
+                e.flux_map[ih * FLUX_BINS_AZIMUTH + ia] += power[path];
+                blocks[path * num_blocks / num_rays] += power[path];
+                e.power += power[path];
+                break;
+            }
+        }
+
+        double sum = 0.0, sum_sq = 0.0;
+        for (double b : blocks) {
+            sum += b * num_blocks;
+            sum_sq += (b * num_blocks) * (b * num_blocks);
+        }
+        const double mean = sum / num_blocks;
+        e.std_error = std::sqrt(std::max(0.0, (sum_sq / num_blocks - mean * mean) * num_blocks / (num_blocks - 1)));
+        return e;
+    }
+
+    // relative L1 distance of two flux maps
+    double flux_map_difference(const std::vector<double>& a, const std::vector<double>& b) {
+        double diff = 0.0, total = 0.0;
+        for (size_t i = 0; i < a.size(); i++) {
+            diff += std::abs(a[i] - b[i]);
+            total += std::abs(a[i]);
+        }
+        return total > 0.0 ? diff / total : 0.0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    const int num_rings = argc > 2 ? std::atoi(argv[2]) : 20;
+    const int num_blocks = 32;
+    const int reference_factor = 16;
+
+    const Vec3d sun_vector(0.2, -0.3, 1.0);
+    CpuTracer tracer(num_rays * reference_factor);
+    const int num_heliostats = add_radial_field(tracer, num_rings, sun_vector);
+    tracer.set_sun_vector(sun_vector);
+    tracer.set_sun_angle(0.00465);
+    tracer.set_dni(1000.0);
+    tracer.initialize();
+
+    const SunPlane& plane = tracer.get_sun_plane();
+    const double plane_area = double(plane.u_max - plane.u_min) * double(plane.v_max - plane.v_min);
+    const double footprint_area = tracer.get_sun_footprints().total_area();
+    std::cout << num_heliostats << " heliostats, sun plane " << plane_area << " m2, footprints "
+              << footprint_area << " m2 (" << 100.0 * footprint_area / plane_area << "%)" << std::endl;
+
+    // reference: uniform sampling with reference_factor times more rays
+    tracer.set_sun_sampling(CpuSunSampling::PARALLELOGRAM);
+    tracer.run();
+    const Estimate reference = evaluate(tracer, num_blocks);
+
+    tracer.set_sun_points(num_rays);
+    tracer.update();
+
+    const CpuSunSampling modes[] = { CpuSunSampling::PARALLELOGRAM, CpuSunSampling::FOOTPRINTS };
+    const char* mode_names[] = { "parallelogram", "footprints" };
+    Estimate estimates[2];
+    double times[2];
+    for (int m = 0; m < 2; m++) {
+        tracer.set_sun_sampling(modes[m]);
+        tracer.run();
+        estimates[m] = evaluate(tracer, num_blocks);
+        times[m] = tracer.get_time_trace();
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "reference (" << num_rays * reference_factor << " rays): receiver power " << reference.power / 1e3 << " kW\n\n"
+              << std::setw(14) << "sampling" << std::setw(14) << "power [kW]" << std::setw(12) << "diff [%]"
+              << std::setw(14) << "block err [%]" << std::setw(14) << "flux map [%]" << std::setw(10) << "time [s]" << std::endl;
+    bool ok = true;
+    for (int m = 0; m < 2; m++) {
+        const Estimate& e = estimates[m];
+        // both estimate the same power: the difference to the reference must stay within the error
+        // of the two runs, each the block error shrunk by the number of blocks
+        const double run_error = e.std_error / std::sqrt(double(num_blocks));
+        const double reference_error = reference.std_error / std::sqrt(double(num_blocks));
+        ok = ok && std::abs(e.power - reference.power) <= 4.0 * std::hypot(run_error, reference_error);
+
+        std::cout << std::setw(14) << mode_names[m]
+                  << std::setw(14) << e.power / 1e3
+                  << std::setprecision(3)
+                  << std::setw(12) << 100.0 * (e.power - reference.power) / reference.power
+                  << std::setw(14) << 100.0 * e.std_error / reference.power
+                  << std::setw(14) << 100.0 * flux_map_difference(reference.flux_map, e.flux_map)
+                  << std::setw(10) << times[m]
+                  << std::setprecision(1) << std::endl;
+    }
+
+    // the variance falls as 1 / rays, so the ratio of variances is the ratio of rays for the same error
+    const double ratio = estimates[0].std_error * estimates[0].std_error /
+                         std::max(1e-30, estimates[1].std_error * estimates[1].std_error);
+    std::cout << std::setprecision(2) << "\nvariance ratio: footprints need " << 1.0 / ratio
+              << "x the rays of the parallelogram for the same error" << std::endl;
+    std::cout << (ok ? "receiver power matches the reference" : "receiver power does NOT match the reference") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// Checks the incremental sun plane (SunPlaneTree) against the brute force evaluation over all AABB
+// corners, which follows the former GPU reduction kernels: after the initial build, after single
+// element moves, after a batch of moves picked up by sync() and after a change of sun vector.
+// Also times the brute force pass, the vectorized build and the O(log N) update.
+#include "cpu/sun_plane.h"
+#include "core/timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+
+    OptixAabb random_box(std::mt19937& rng, float field_half_size) {
+        std::uniform_real_distribution<float> pos(-field_half_size, field_half_size);
+        std::uniform_real_distribution<float> size(0.5f, 6.0f);
+        std::uniform_real_distribution<float> height(0.0f, 10.0f);
+        OptixAabb b;
+        b.minX = pos(rng); b.minY = pos(rng); b.minZ = height(rng);
+        b.maxX = b.minX + size(rng); b.maxY = b.minY + size(rng); b.maxZ = b.minZ + size(rng);
+        return b;
+    }
+
+    // the tree takes the in-plane coordinates without projecting onto the plane first, so the
+    // bounds may differ from the brute force ones by a few ulps of the plane distance
+    bool same_plane(const SunPlane& a, const SunPlane& b, const std::string& label) {
+        const float scale = std::max({ 1.0f, std::abs(a.distance), std::abs(a.u_min), std::abs(a.u_max),
+                                       std::abs(a.v_min), std::abs(a.v_max) });
+        const float tol = 1e-5f * scale;
+        const bool ok = a.distance == b.distance &&
+                        std::abs(a.u_min - b.u_min) <= tol && std::abs(a.u_max - b.u_max) <= tol &&
+                        std::abs(a.v_min - b.v_min) <= tol && std::abs(a.v_max - b.v_max) <= tol;
+        if (!ok) {
+            std::cout << label << ": MISMATCH\n"
+                      << "  brute force d " << a.distance << " u [" << a.u_min << ", " << a.u_max << "] v [" << a.v_min << ", " << a.v_max << "]\n"
+                      << "  tree        d " << b.distance << " u [" << b.u_min << ", " << b.u_max << "] v [" << b.v_min << ", " << b.v_max << "]" << std::endl;
+        }
+        return ok;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_elements = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const int num_updates = argc > 2 ? std::atoi(argv[2]) : 200;
+    const float field_half_size = 800.0f;
+    const float sun_angle = 0.00465f;
+
+    std::mt19937 rng(42);
+    std::vector<OptixAabb> aabbs(num_elements);
+    for (OptixAabb& b : aabbs) b = random_box(rng, field_half_size);
+    float3 sun_vector = normalize(make_float3(0.2f, -0.3f, 1.0f));
+
+    bool ok = true;
+
+    Timer brute_timer;
+    brute_timer.start();
+    SunPlane reference = compute_sun_plane(aabbs, sun_vector, sun_angle);
+    brute_timer.stop();
+
+    SunPlaneTree tree;
+    Timer build_timer;
+    build_timer.start();
+    tree.build(aabbs, sun_vector, sun_angle);
+    build_timer.stop();
+    ok &= same_plane(reference, tree.plane(), "build");
+
+    // single element moves, checked after every one; half of them move an element to the border
+    // of the field so the bounds actually change
+    std::uniform_int_distribution<int> pick(0, num_elements - 1);
+    double update_time = 0.0;
+    for (int k = 0; k < num_updates; k++) {
+        const int i = pick(rng);
+        aabbs[i] = random_box(rng, k % 2 ? field_half_size * 1.2f : field_half_size * 0.5f);
+
+        Timer t;
+        t.start();
+        tree.update(i, aabbs[i]);
+        t.stop();
+        update_time += t.get_time_sec();
+
+        ok &= same_plane(compute_sun_plane(aabbs, sun_vector, sun_angle), tree.plane(), "update " + std::to_string(k));
+    }
+
+    // a batch of moves picked up by sync, as GeometryManager does after update_geometry_info
+    for (int k = 0; k < 64; k++) {
+        const int i = pick(rng);
+        aabbs[i] = random_box(rng, field_half_size);
+    }
+    Timer sync_timer;
+    sync_timer.start();
+    const size_t changed = tree.sync(aabbs, sun_vector, sun_angle);
+    sync_timer.stop();
+    ok &= same_plane(compute_sun_plane(aabbs, sun_vector, sun_angle), tree.plane(), "sync");
+
+    // new sun vector, every extent changes and sync rebuilds
+    sun_vector = normalize(make_float3(-0.6f, 0.1f, 0.8f));
+    const size_t rebuilt = tree.sync(aabbs, sun_vector, sun_angle);
+    ok &= same_plane(compute_sun_plane(aabbs, sun_vector, sun_angle), tree.plane(), "new sun vector");
+
+    std::cout << num_elements << " elements" << std::endl;
+    std::cout << "brute force        : " << brute_timer.get_time_sec() * 1e3 << " ms" << std::endl;
+    std::cout << "tree build         : " << build_timer.get_time_sec() * 1e3 << " ms" << std::endl;
+    std::cout << "single update      : " << update_time / std::max(1, num_updates) * 1e6 << " us" << std::endl;
+    std::cout << "sync               : " << sync_timer.get_time_sec() * 1e3 << " ms, " << changed << " elements changed" << std::endl;
+    std::cout << "sync, new sun      : " << rebuilt << " elements recomputed" << std::endl;
+    std::cout << (ok ? "all sun planes match the brute force result" : "sun plane mismatch") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+// Statistical check of the sunshape sampler against the profiles it was built from. First a user
+// table, a limb-darkened disk with a power-law circumsolar aureole as it would appear in the USER
+// SHAPE DATA block of a stinput file; then the Buie sunshape over a sweep of circumsolar ratios.
+// The angles of the sampled directions are histogrammed and compared with the probabilities
+// integrated from the profile (chi-square and Kolmogorov-Smirnov distance), for the sampler called
+// directly and for the sun directions of a CpuTracer run. The cost of a sample is timed for alias
+// tables of different sizes and against the pillbox cone.
+#include "core/sun_shape.h"
+#include "core/timer.h"
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const int NUM_HIST_BINS = 60;
+
+    // disk of 4.65 mrad with limb darkening, then an aureole falling like angle^-2.2 to 43.6 mrad
+    void solar_profile(std::vector<double>& angles_mrad, std::vector<double>& intensity, double csr) {
+        for (int i = 0; i <= 20; i++) {
+            const double t = 4.65 * i / 20.0;
+            angles_mrad.push_back(t);
+            intensity.push_back(std::cos(0.326 * t) / std::cos(0.308 * t));
+        }
+        const double edge = intensity.back() * csr / (1.0 - csr) * 20.0;
+        for (int i = 1; i <= 20; i++) {
+            const double t = 4.65 + (43.6 - 4.65) * i / 20.0;
+            angles_mrad.push_back(t);
+            intensity.push_back(edge * std::pow(t / 4.65, -2.2));
+        }
+    }
+
+    // angle between two unit vectors, accurate for small angles
+    double angle_between(const float3& a, const float3& b) {
+        const double cx = double(a.y) * b.z - double(a.z) * b.y;
+        const double cy = double(a.z) * b.x - double(a.x) * b.z;
+        const double cz = double(a.x) * b.y - double(a.y) * b.x;
+        const double d = double(a.x) * b.x + double(a.y) * b.y + double(a.z) * b.z;
+        return std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), d);
+    }
+
+    // sampleRayDirectionInCone_Pillbox of shaders/sun.cu for given random numbers
+    float3 pillbox_direction(const float3& dir, float half_angle, float r1, float r2) {
+        float3 w = normalize(dir);
+        float3 u = normalize(cross(std::fabs(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
+        float3 v = cross(w, u);
+        float cos_theta = cosf(half_angle);
+        float phi = 2.0f * M_PIf * r1;
+        float z = cos_theta + (1.0f - cos_theta) * r2;
+        float r = sqrtf(1.0f - z * z);
+        return normalize(r * (cosf(phi) * u + sinf(phi) * v) + z * w);
+    }
+
+    std::vector<double> sample_angles(const SunShape& shape, const float3& dir, int num_samples, unsigned seed) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        const SunShapeData data = shape.data();
+        std::vector<double> angles(num_samples);
+        for (int i = 0; i < num_samples; i++) {
+            const float r1 = 1.0f - uniform(rng);   // (0, 1] like curand_uniform
+            const float r2 = 1.0f - uniform(rng);
+            angles[i] = angle_between(sample_sun_shape_direction(data, dir, r1, r2), dir);
+        }
+        return angles;
+    }
+
+    // chi-square of the histogram of the angles and the largest gap between the empirical and the
+    // table CDF at the bin edges
+    bool check(const std::string& label, const SunShape& shape, const std::vector<double>& angles) {
+        const double width = shape.max_angle() / double(NUM_HIST_BINS);
+        std::vector<size_t> counts(NUM_HIST_BINS, 0);
+        size_t outside = 0;
+        for (double theta : angles) {
+            const int b = static_cast<int>(theta / width);
+            if (b >= NUM_HIST_BINS) {
+                // rounding of the direction at the outer edge
+                if (theta > shape.max_angle() * (1.0 + 1e-4)) outside++;
+                counts[NUM_HIST_BINS - 1]++;
+            }
+            else {
+                counts[b]++;
+            }
+        }
+
+        const double n = double(angles.size());
+        double chi2 = 0.0, ks = 0.0, cdf_table = 0.0, cdf_sample = 0.0;
+        int dof = -1;
+        for (int b = 0; b < NUM_HIST_BINS; b++) {
+            const double p = shape.probability(b * width, (b + 1) * width);
+            const double expected = p * n;
+            if (expected > 0.0) {
+                chi2 += (counts[b] - expected) * (counts[b] - expected) / expected;
+                dof++;
+            }
+            cdf_table += p;
+            cdf_sample += counts[b] / n;
+            ks = std::max(ks, std::abs(cdf_table - cdf_sample));
+        }
+
+        // 0.1% critical value of the chi-square distribution (Wilson-Hilferty)
+        const double z = 3.09;
+        const double h = 2.0 / (9.0 * dof);
+        const double critical = dof * std::pow(1.0 - h + z * std::sqrt(h), 3.0);
+        // 0.1% critical value of the Kolmogorov-Smirnov distance
+        const double ks_critical = 1.95 / std::sqrt(n);
+
+        const bool ok = chi2 < critical && ks < ks_critical && outside == 0;
+        std::cout << label << ": chi2 " << chi2 << " (" << dof << " dof, 0.1% critical " << critical << "), KS "
+                  << ks << " (critical " << ks_critical << "), " << outside << " outside the table"
+                  << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_samples = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    const double csr = argc > 2 ? std::atof(argv[2]) : 0.05;
+
+    std::vector<double> angles_mrad, intensity;
+    solar_profile(angles_mrad, intensity, csr);
+    auto shape = std::make_shared<TabulatedSunShape>(angles_mrad, intensity);
+    std::cout << angles_mrad.size() << " table points, CSR " << csr << ", alias table of " << shape->num_bins()
+              << " bins up to " << shape->max_angle() * 1e3 << " mrad" << std::endl;
+
+    bool ok = true;
+    const float3 dir = normalize(make_float3(-0.2f, 0.3f, -1.0f));
+
+    // sampler called directly
+    ok &= check("sampler    ", *shape, sample_angles(*shape, dir, num_samples, 7));
+
+    // sun directions of the host tracer, one heliostat is enough
+    {
+        CpuTracer tracer(num_samples);
+        auto e = std::make_shared<CspElement>();
+        e->set_origin(Vec3d(0.0, 0.0, 0.0));
+        e->set_aim_point(Vec3d(0.0, 0.0, 100.0));
+        e->set_zrot(0.0);
+        e->set_surface(std::make_shared<SurfaceFlat>());
+        e->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+        tracer.add_element(e);
+        tracer.set_sun_vector(Vec3d(-dir.x, -dir.y, -dir.z));
+        tracer.set_sun_shape(shape);
+        tracer.initialize();
+        tracer.run();
+
+        const std::vector<float3>& sun_dirs = tracer.get_sun_dir_buffer();
+        std::vector<double> angles(sun_dirs.size());
+        for (size_t i = 0; i < sun_dirs.size(); i++)
+            angles[i] = angle_between(sun_dirs[i], dir);
+        ok &= check("CPU tracer ", *shape, angles);
+    }
+
+    // cost per sample does not depend on the size of the table
+    for (int bins : { 16, 1024, 65536 }) {
+        TabulatedSunShape table(angles_mrad, intensity, bins);
+        const SunShapeData data = table.data();
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<float> r(2048);
+        for (float& x : r) x = 1.0f - uniform(rng);
+
+        float sum = 0.0f;
+        Timer timer;
+        timer.start();
+        for (int i = 0; i < num_samples; i++)
+            sum += sample_sun_shape_angle(data, r[i & 2047]);
+        timer.stop();
+        std::cout << bins << " bins: " << timer.get_time_sec() / num_samples * 1e9 << " ns per sample"
+                  << " (checksum " << sum / num_samples * 1e3 << " mrad)" << std::endl;
+    }
+
+    // Buie over a CSR sweep: the first get() builds the table, the next ones share it
+    std::cout << "\nBuie sunshape" << std::endl;
+    for (double csr : { 0.0, 0.02, 0.05, 0.1, 0.2, 0.3, 0.5 }) {
+        Timer build_timer;
+        build_timer.start();
+        std::shared_ptr<const BuieSunShape> buie = BuieSunShape::get(csr);
+        build_timer.stop();
+        Timer cached_timer;
+        cached_timer.start();
+        const bool shared = BuieSunShape::get(csr) == buie;
+        cached_timer.stop();
+
+        const double aureole = buie->probability(4.65e-3, buie->max_angle());
+        const bool csr_ok = std::abs(aureole - csr) < 1e-6 && shared;
+        std::cout << "CSR " << csr << ": aureole share " << aureole << ", table " << build_timer.get_time_sec() * 1e3
+                  << " ms, cached " << cached_timer.get_time_sec() * 1e6 << " us" << (shared ? "" : ", NOT shared")
+                  << (csr_ok ? "" : "  FAILED") << std::endl;
+        ok &= csr_ok;
+        ok &= check("  sampler  ", *buie, sample_angles(*buie, dir, num_samples / 2, 13));
+    }
+
+    // direction sampling, pillbox cone against the Buie table
+    {
+        std::shared_ptr<const BuieSunShape> buie = BuieSunShape::get(0.05);
+        const SunShapeData data = buie->data();
+        std::mt19937 rng(17);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<float> r(2048);
+        for (float& x : r) x = 1.0f - uniform(rng);
+
+        float sum_pillbox = 0.0f, sum_buie = 0.0f;
+        Timer pillbox_timer, buie_timer;
+        pillbox_timer.start();
+        for (int i = 0; i < num_samples; i++)
+            sum_pillbox += pillbox_direction(dir, 0.00465f, r[i & 2047], r[(i + 1) & 2047]).x;
+        pillbox_timer.stop();
+        buie_timer.start();
+        for (int i = 0; i < num_samples; i++)
+            sum_buie += sample_sun_shape_direction(data, dir, r[i & 2047], r[(i + 1) & 2047]).x;
+        buie_timer.stop();
+        std::cout << "direction: pillbox " << pillbox_timer.get_time_sec() / num_samples * 1e9 << " ns, Buie "
+                  << buie_timer.get_time_sec() / num_samples * 1e9 << " ns per sample (checksums "
+                  << sum_pillbox / num_samples << ", " << sum_buie / num_samples << ")" << std::endl;
+    }
+
+    std::cout << (ok ? "sampled sunshape matches the table" : "sampled sunshape does NOT match the table") << std::endl;
+    return ok ? 0 : 1;
+}
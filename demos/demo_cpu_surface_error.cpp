@@ -0,0 +1,139 @@
+// Slope and specularity errors of a flat mirror against their analytic spread. A point sun lights a
+// 10 m flat mirror at 45 degrees and a flat receiver 10 m away, edge-on to the sun, catches the
+// reflection. The angle between every reflected ray and the ideal reflection, split along two axes,
+// must be gaussian with sigma = sqrt(4 slope^2 + specularity^2) per axis, so the radial angle follows
+// a Rayleigh law: P(angle < k sigma) = 1 - exp(-k^2 / 2).
+//
+// usage: demo_cpu_surface_error [number of rays] [slope error, mrad] [specularity error, mrad]
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const double DISTANCE = 10.0;
+
+    struct Spread {
+        size_t count = 0;
+        double sigma_u = 0.0;       // rms angle along each axis
+        double sigma_v = 0.0;
+        double mean_u = 0.0;
+        double mean_v = 0.0;
+        double within_1 = 0.0;      // fraction of the radial angles below one and two sigma
+        double within_2 = 0.0;
+        double max_angle = 0.0;
+    };
+
+    Spread trace(int num_rays, double slope_error, double specularity_error, double sigma) {
+        const Vec3d sun_vector(std::sin(M_PI / 4), 0.0, std::cos(M_PI / 4));
+        const Vec3d reflected(-sun_vector[0], 0.0, sun_vector[2]);
+
+        auto mirror = std::make_shared<CspElement>();
+        mirror->set_origin(Vec3d(0.0, 0.0, 0.0));
+        mirror->set_aim_point(Vec3d(0.0, 0.0, 100.0));
+        mirror->set_zrot(0.0);
+        mirror->set_surface(std::make_shared<SurfaceFlat>());
+        mirror->set_aperture(std::make_shared<ApertureRectangle>(10.0, 10.0));
+        mirror->set_slope_error(slope_error);
+        mirror->set_specularity_error(specularity_error);
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(reflected * DISTANCE);
+        receiver->set_aim_point(Vec3d(0.0, 0.0, 0.0));
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceFlat>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(11.0, 11.0));
+        receiver->set_receiver(true);
+
+        CpuTracer tracer(num_rays);
+        tracer.add_element(mirror);
+        tracer.add_element(receiver);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_angle(0.0);
+        tracer.set_sun_sampling(CpuSunSampling::FOOTPRINTS);
+        tracer.initialize();
+        tracer.run();
+
+        // two axes across the ideal reflection: y, and the one in the plane of incidence
+        const Vec3d axis_v(0.0, 1.0, 0.0);
+        const Vec3d axis_u = axis_v.cross(reflected).normalized();
+
+        Spread s;
+        double sum_u = 0.0, sum_v = 0.0, sum_uu = 0.0, sum_vv = 0.0;
+        size_t within_1 = 0, within_2 = 0;
+        const std::vector<float4>& hits = tracer.get_hit_point_buffer();
+        const size_t depth = hits.size() / num_rays;
+        for (size_t path = 0; path < static_cast<size_t>(num_rays); path++) {
+            const float4& on_mirror = hits[path * depth + 1];
+            const float4& on_receiver = hits[path * depth + 2];
+            if (on_mirror.x != 1.0f || on_receiver.x != 2.0f) continue;
+
+            const Vec3d d = (Vec3d(on_receiver.y, on_receiver.z, on_receiver.w)
+                             - Vec3d(on_mirror.y, on_mirror.z, on_mirror.w)).normalized();
+            const double along = d.dot(reflected);
+            const double u = std::atan2(d.dot(axis_u), along);
+            const double v = std::atan2(d.dot(axis_v), along);
+            const double angle = std::acos(std::min(1.0, along));
+            sum_u += u;
+            sum_v += v;
+            sum_uu += u * u;
+            sum_vv += v * v;
+            within_1 += angle < sigma;
+            within_2 += angle < 2.0 * sigma;
+            s.max_angle = std::max(s.max_angle, angle);
+            s.count++;
+        }
+        if (s.count == 0) return s;
+        s.mean_u = sum_u / s.count;
+        s.mean_v = sum_v / s.count;
+        s.sigma_u = std::sqrt(sum_uu / s.count);
+        s.sigma_v = std::sqrt(sum_vv / s.count);
+        s.within_1 = static_cast<double>(within_1) / s.count;
+        s.within_2 = static_cast<double>(within_2) / s.count;
+        return s;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const double slope_error = (argc > 2 ? std::atof(argv[2]) : 2.0) * 1e-3;
+    const double specularity_error = (argc > 3 ? std::atof(argv[3]) : 1.0) * 1e-3;
+    const double sigma = std::sqrt(4.0 * slope_error * slope_error + specularity_error * specularity_error);
+
+    // ideal mirror: every ray goes exactly along the reflection
+    const Spread ideal = trace(num_rays, 0.0, 0.0, 1.0);
+    std::cout << "ideal mirror: " << ideal.count << " rays on the receiver, largest angle "
+              << ideal.max_angle * 1e3 << " mrad" << std::endl;
+    bool ok = ideal.count > 0 && ideal.max_angle < 1e-4;
+
+    const Spread s = trace(num_rays, slope_error, specularity_error, sigma);
+    const double expected_1 = 1.0 - std::exp(-0.5);
+    const double expected_2 = 1.0 - std::exp(-2.0);
+    std::cout << std::fixed << std::setprecision(4)
+              << "slope " << slope_error * 1e3 << " mrad, specularity " << specularity_error * 1e3
+              << " mrad: sigma " << sigma * 1e3 << " mrad per axis, " << s.count << " rays\n"
+              << "  rms angle      u " << s.sigma_u * 1e3 << "  v " << s.sigma_v * 1e3 << " mrad\n"
+              << "  mean angle     u " << s.mean_u * 1e3 << "  v " << s.mean_v * 1e3 << " mrad\n"
+              << "  within 1 sigma " << s.within_1 << " (Rayleigh " << expected_1 << ")\n"
+              << "  within 2 sigma " << s.within_2 << " (Rayleigh " << expected_2 << ")" << std::endl;
+
+    // a few standard errors of the estimates for the number of rays
+    const double n = static_cast<double>(std::max<size_t>(1, s.count));
+    ok &= std::abs(s.sigma_u / sigma - 1.0) < 5.0 / std::sqrt(2.0 * n) + 1e-3;
+    ok &= std::abs(s.sigma_v / sigma - 1.0) < 5.0 / std::sqrt(2.0 * n) + 1e-3;
+    ok &= std::abs(s.mean_u) < 5.0 * sigma / std::sqrt(n) && std::abs(s.mean_v) < 5.0 * sigma / std::sqrt(n);
+    ok &= std::abs(s.within_1 - expected_1) < 5.0 * std::sqrt(expected_1 * (1.0 - expected_1) / n);
+    ok &= std::abs(s.within_2 - expected_2) < 5.0 * std::sqrt(expected_2 * (1.0 - expected_2) / n);
+
+    std::cout << (ok ? "surface error matches the analytic spread" : "surface error does NOT match the analytic spread")
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// Wavefront tracing with a run time depth: a mirror lined channel with a receiver at its bottom,
+// lit by a slanted sun, so the light bounces from wall to wall on its way down. The path depth
+// only limits how many bounces reach the receiver: with enough of it all the light entering the
+// opening arrives, which is dni times the opening area times the cosine of the sun. Both trace
+// modes give the same hit points at every depth, and the wavefront times its passes per bounce.
+//
+// usage: demo_cpu_wavefront [number of rays]
+#include "cpu/cpu_tracer.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    const double channel_width = 1.0;    // between the walls, along x
+    const double channel_length = 1.0;   // along y
+    const double channel_height = 20.0;
+
+    std::shared_ptr<CspElement> flat_element(const Vec3d& origin, const Vec3d& normal, double width, double height) {
+        auto e = std::make_shared<CspElement>();
+        e->set_origin(origin);
+        e->set_aim_point(origin + normal * 10.0);
+        e->set_zrot(0.0);
+        e->set_surface(std::make_shared<SurfaceFlat>());
+        e->set_aperture(std::make_shared<ApertureRectangle>(width, height));
+        return e;
+    }
+
+    // two facing walls, reflectivity 1, and the receiver closing the bottom of the channel
+    std::vector<std::shared_ptr<CspElement>> build_channel() {
+        const double x = 0.5 * channel_width;
+        const double z = 0.5 * channel_height;
+        std::vector<std::shared_ptr<CspElement>> elements = {
+            flat_element(Vec3d(-x, 0.0, z), Vec3d(1.0, 0.0, 0.0), channel_height, channel_length),
+            flat_element(Vec3d(x, 0.0, z), Vec3d(-1.0, 0.0, 0.0), channel_height, channel_length)
+        };
+        auto receiver = flat_element(Vec3d(0.0, 0.0, 0.0), Vec3d(0.0, 0.0, 1.0), channel_width, channel_length);
+        receiver->set_receiver(true);
+        elements.push_back(receiver);
+        return elements;
+    }
+
+    struct Run {
+        double power = 0.0;
+        int receiver_hits = 0;
+        std::vector<float4> hit_points;
+        std::vector<CpuBounceStats> bounces;
+        double time = 0.0;
+    };
+
+    Run trace(const Vec3d& sun_vector, int num_rays, int max_depth, CpuTraceMode mode) {
+        CpuTracer tracer(num_rays);
+        for (const std::shared_ptr<CspElement>& e : build_channel())
+            tracer.add_element(e);
+        tracer.set_sun_vector(sun_vector);
+        tracer.set_sun_sampler(SAMPLER_SOBOL_OWEN, 5u);
+        tracer.set_trace_mode(mode);
+        tracer.set_max_depth(max_depth);
+        tracer.initialize();
+        tracer.run();
+
+        Run r;
+        r.power = tracer.get_receiver_power();
+        r.receiver_hits = tracer.get_num_hits_receiver();
+        r.hit_points = tracer.get_hit_point_buffer();
+        r.bounces = tracer.get_bounce_stats();
+        r.time = tracer.get_time_trace();
+        return r;
+    }
+
+    bool same_hits(const Run& a, const Run& b) {
+        if (a.hit_points.size() != b.hit_points.size()) return false;
+        for (size_t i = 0; i < a.hit_points.size(); i++) {
+            const float4& p = a.hit_points[i];
+            const float4& q = b.hit_points[i];
+            if (p.x != q.x || p.y != q.y || p.z != q.z || p.w != q.w) return false;
+        }
+        return true;
+    }
+
+    void print_bounces(const Run& r) {
+        std::cout << std::setw(8) << "bounce" << std::setw(10) << "rays" << std::setw(12) << "generate"
+                  << std::setw(12) << "sort" << std::setw(12) << "intersect" << std::setw(12) << "shade"
+                  << std::setw(12) << "compact" << "   [ms]" << std::endl;
+        for (const CpuBounceStats& b : r.bounces)
+            std::cout << std::setw(8) << b.depth << std::setw(10) << b.num_rays << std::setprecision(3)
+                      << std::setw(12) << 1e3 * b.generate_time << std::setw(12) << 1e3 * b.sort_time
+                      << std::setw(12) << 1e3 * b.intersect_time << std::setw(12) << 1e3 * b.shade_time
+                      << std::setw(12) << 1e3 * b.compact_time << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_rays = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+    // the light crosses the channel every channel_width / 0.3 m of descent, 6 bounces down the walls
+    const Vec3d sun_vector = Vec3d(0.3, 0.0, 1.0).normalized();
+    const double expected = 1000.0 * channel_width * channel_length * sun_vector[2];
+
+    std::cout << std::fixed << std::setw(8) << "depth" << std::setw(14) << "power [W]" << std::setw(12) << "receiver"
+              << std::setw(10) << "bounces" << std::setw(12) << "time [s]" << std::endl;
+    bool ok = true;
+    double previous_power = 0.0;
+    Run deepest;
+    for (int max_depth : { 3, 5, 7, 9, 12 }) {
+        const Run wavefront = trace(sun_vector, num_rays, max_depth, CpuTraceMode::WAVEFRONT);
+        const Run recursive = trace(sun_vector, num_rays, max_depth, CpuTraceMode::RECURSIVE);
+        std::cout << std::setw(8) << max_depth << std::setprecision(2) << std::setw(14) << wavefront.power
+                  << std::setw(12) << wavefront.receiver_hits << std::setw(10) << wavefront.bounces.size()
+                  << std::setprecision(3) << std::setw(12) << wavefront.time << std::endl;
+
+        ok &= same_hits(wavefront, recursive) && wavefront.power == recursive.power;
+        ok &= wavefront.power >= previous_power && static_cast<int>(wavefront.bounces.size()) <= max_depth;
+        previous_power = wavefront.power;
+        deepest = wavefront;
+    }
+
+    // every ray entering the opening reaches the receiver once the depth holds all its bounces
+    std::cout << std::setprecision(2) << "expected " << expected << " W" << std::endl;
+    ok &= std::abs(deepest.power - expected) < 0.01 * expected;
+
+    std::cout << std::endl;
+    print_bounces(deepest);
+
+    std::cout << (ok ? "wavefront tracing matches the recursive paths at every depth"
+                     : "wavefront tracing does NOT match the recursive paths") << std::endl;
+    return ok ? 0 : 1;
+}
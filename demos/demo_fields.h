@@ -0,0 +1,53 @@
+#pragma once
+// Fields shared by the CPU demos.
+#include "core/CspElement.h"
+#include "core/annual_runner.h"
+#include "core/Surface.h"
+#include "core/Aperture.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace demo_fields {
+
+    const OptixCSP::Vec3d receiver_center(0.0, 0.0, 60.0);
+    const OptixCSP::Vec3d receiver_normal = OptixCSP::Vec3d(0.0, 1.0, -0.6).normalized();
+    const double receiver_size = 12.0;
+
+    /// Three rings of 6 m flat heliostats north of the tower, aimed at a flat receiver_size square
+    /// receiver for sun_vector; the receiver is the last element.
+    inline std::vector<std::shared_ptr<OptixCSP::CspElement>> north_field(const OptixCSP::Vec3d& sun_vector,
+                                                                        double reflectivity, double slope_error) {
+        using namespace OptixCSP;
+        std::vector<std::shared_ptr<CspElement>> elements;
+        for (int ring = 0; ring < 3; ring++) {
+            const double radius = 40.0 + ring * 9.0;
+            const int num_on_ring = static_cast<int>(M_PI * radius / 8.0);
+            for (int k = 0; k < num_on_ring; k++) {
+                const double phi = M_PI * (k + 0.5 * (1 + ring % 2)) / (num_on_ring + 1);
+                const Vec3d origin(radius * std::cos(phi), radius * std::sin(phi), 3.0);
+
+                auto e = std::make_shared<CspElement>();
+                e->set_origin(origin);
+                e->set_aim_point(tracking_aim_point(origin, receiver_center, sun_vector));
+                e->set_zrot(0.0);
+                e->set_surface(std::make_shared<SurfaceFlat>());
+                e->set_aperture(std::make_shared<ApertureRectangle>(6.0, 6.0));
+                e->set_slope_error(slope_error);
+                e->set_reflectivity(reflectivity);
+                elements.push_back(e);
+            }
+        }
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(receiver_center);
+        receiver->set_aim_point(receiver_center + receiver_normal * 10.0);
+        receiver->set_zrot(0.0);
+        receiver->set_surface(std::make_shared<SurfaceFlat>());
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(receiver_size, receiver_size));
+        receiver->set_receiver(true);
+        elements.push_back(receiver);
+        return elements;
+    }
+}
@@ -230,6 +230,8 @@ int main(int argc, char* argv[]) {
 
     system.set_sun_angle(sun_angle);
 	system.set_sun_vector(sun_vector);
+    // absorbed power per mesh triangle, summed during the trace
+    system.set_receiver_element_power(true);
 
     ///////////////////////////////////
     // STEP 3  Initialize the system //
@@ -260,6 +262,7 @@ int main(int argc, char* argv[]) {
 
     system.write_hp_output(out_dir + "sun_error_hit_points_" + to_string(num_rays) + "_rays.csv");
     system.write_simulation_json(out_dir + "sun_error_summary_" + to_string(num_rays) + "_rays.json");
+    system.write_receiver_power_vtk(out_dir + "receiver_power_" + to_string(num_rays) + "_rays.vtk");
 
     /////////////////////////////////////////
     // STEP 6  Be a good citizen, clean up //
@@ -0,0 +1,130 @@
+// Checks of the solar position module (core/solar_position.h): the reference position of the NREL
+// SPA report (Reda and Andreas, NREL/TP-560-34302, table A4.1), the declination at the solstices
+// and the equinox, the LDH vector of a stinput file against the full position at solar noon, and
+// the batch against the one timestamp call. The batch is timed over a year of hours for many sites.
+#include "core/solar_position.h"
+#include "core/timer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+    bool check(const char* what, double value, double expected, double tolerance) {
+        const bool ok = std::abs(value - expected) <= tolerance;
+        std::cout << what << ": " << value << " (reference " << expected << ", tolerance " << tolerance << ")"
+                  << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+
+    // Golden, Colorado, 2003-10-17 12:30:30 local time (UT - 7 h), 820 mbar and 11 C
+    bool check_spa_reference() {
+        SolarSite site;
+        site.latitude = 39.742476;
+        site.longitude = -105.1786;
+        site.pressure = 820.0;
+        site.temperature = 11.0;
+        const SolarPosition p = solar_position(site, unix_time_utc(2003, 10, 17, 19.0 + 30.5 / 60.0));
+        bool ok = check("SPA reference zenith", p.zenith, 50.11162, 0.02);
+        ok &= check("SPA reference azimuth", p.azimuth, 194.34024, 0.02);
+        ok &= check("SPA reference declination", p.declination, -9.31434, 0.02);
+        ok &= check("SPA reference hour angle", p.hour_angle, 11.10590, 0.02);
+        return ok;
+    }
+
+    // extreme of the declination over the days around a date, at every hour
+    double declination_extreme(int year, int month, int day, double sign) {
+        SolarSite site;
+        double extreme = -90.0;
+        for (int h = -72; h <= 72; h++) {
+            const double d = solar_position(site, unix_time_utc(year, month, day, 12.0 + h)).declination;
+            extreme = std::max(extreme, sign * d);
+        }
+        return sign * extreme;
+    }
+
+    bool check_seasons() {
+        // obliquity of the ecliptic in 2010, 23.4393 degrees
+        bool ok = check("declination at the June solstice 2010", declination_extreme(2010, 6, 21, 1.0), 23.4393, 0.01);
+        ok &= check("declination at the December solstice 2010", declination_extreme(2010, 12, 21, -1.0), -23.4393, 0.01);
+        // March equinox 2010 at 17:32 UT
+        SolarSite site;
+        ok &= check("declination at the March equinox 2010",
+                    solar_position(site, unix_time_utc(2010, 3, 20, 17.0 + 32.0 / 60.0)).declination, 0.0, 0.01);
+        return ok;
+    }
+
+    // the LDH vector at solar noon against the position at the time the hour angle goes through zero
+    bool check_ldh(double latitude, int day_of_year) {
+        SolarSite site;
+        site.latitude = latitude;
+        double t = unix_time_utc(2010, 1, 1) + (day_of_year - 1 + 0.5) * 86400.0;
+        for (int i = 0; i < 4; i++)
+            t -= solar_position(site, t).hour_angle / 15.0 * 3600.0;
+        const Vec3d expected = sun_vector(solar_position(site, t));
+        const Vec3d ldh = sun_vector_ldh(latitude, day_of_year, 12.0);
+        const double angle = std::acos(std::min(1.0, ldh.dot(expected) / (ldh.norm() * expected.norm()))) * 180.0 / M_PI;
+
+        // in the morning the sun is in the east
+        const bool east = sun_vector_ldh(latitude, day_of_year, 9.0)[0] > 0.0;
+        const bool ok = angle < 0.02 && east;
+        std::cout << "LDH latitude " << latitude << ", day " << day_of_year << ": " << angle
+                  << " degrees from the position at solar noon" << (east ? "" : ", morning sun not in the east")
+                  << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+
+    bool check_batch(const SolarSite& site, const std::vector<double>& times) {
+        const std::vector<SolarPosition> one_thread = solar_positions(site, times, 1);
+        const std::vector<SolarPosition> all_threads = solar_positions(site, times);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < times.size(); i++) {
+            const SolarPosition p = solar_position(site, times[i]);
+            for (const SolarPosition& q : { one_thread[i], all_threads[i] })
+                if (p.zenith != q.zenith || p.azimuth != q.azimuth || p.declination != q.declination ||
+                    p.hour_angle != q.hour_angle)
+                    mismatches++;
+        }
+        std::cout << "batch: " << mismatches << " of " << 2 * times.size() << " positions differ from the single calls"
+                  << (mismatches ? "  FAILED" : "") << std::endl;
+        return mismatches == 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int num_sites = argc > 1 ? std::atoi(argv[1]) : 100;
+
+    bool ok = check_spa_reference();
+    ok &= check_seasons();
+    for (double latitude : { 34.87, -23.5, 60.0 })
+        for (int day : { 1, 80, 172, 355 })
+            ok &= check_ldh(latitude, day);
+
+    SolarSite daggett;
+    daggett.latitude = 34.87;
+    daggett.longitude = -116.78;
+    const std::vector<double> year = hourly_timestamps(2010);
+    ok &= year.size() == 8760 && hourly_timestamps(2012).size() == 8784;
+    ok &= check_batch(daggett, year);
+
+    // a year of hours for num_sites sites, one call per site
+    std::vector<double> times;
+    for (int s = 0; s < num_sites; s++)
+        times.insert(times.end(), year.begin(), year.end());
+    std::vector<SolarPosition> positions(times.size());
+    for (int threads : { 1, 0 }) {
+        Timer timer;
+        timer.start();
+        solar_positions(daggett, times.data(), times.size(), positions.data(), threads);
+        timer.stop();
+        std::cout << (threads == 1 ? "one thread: " : "all threads: ") << times.size() << " positions in "
+                  << timer.get_time_sec() * 1e3 << " ms, " << timer.get_time_sec() / times.size() * 1e9
+                  << " ns per position" << std::endl;
+    }
+
+    std::cout << (ok ? "solar position checks passed" : "solar position checks FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
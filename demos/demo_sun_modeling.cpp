@@ -1,108 +1,282 @@
+// Sun modeling: a 1 x 1 flat element facing a vertical sun with a wide pillbox cone, a 2 x 2
+// receiver 10 m above it. The GPU run writes the hit points and the sun directions.
+//
+// Then the sun samplers are compared on the host tracer, which draws the same samples as the
+// raygen program (shaders/SamplerData.h). With the sun tilted by 5 degrees, for a point sun and for
+// the sun of 4.65 mrad: the error of the fraction of sun rays reaching the receiver against the
+// number of rays, as the RMS over replicates around a long reference run, and the fitted rate.
+// Replicate r starts at sample r * N, a skip-ahead that costs nothing. A run cut into chunks that
+// go on with each other is checked to trace exactly the rays of the single run.
+//
+// usage: demo_sun_modeling [--cpu] [halton|sobol|stratified] [max rays of the sweep]
+//        --cpu skips the GPU run, the sampler name picks the one of the GPU run
 #include "core/soltrace_system.h"
+#include "cpu/cpu_tracer.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <stdexcept>
-#include <cstdlib>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 
 using namespace std;
 using namespace OptixCSP;
 
-int main(int argc, char* argv[]) {
-    int num_rays = 1000000;
-    // Create the simulation system.
-    SolTraceSystem system(num_rays);
-
-    // Element 1
-    Vec3d origin_e1(0, 0, 0); // origin of the element
-    Vec3d aim_point_e1(0, 0, 1);  // aim point of the element
-    auto e1 = std::make_shared<CspElement>();
-    e1->set_origin(origin_e1);
-    e1->set_aim_point(aim_point_e1); // Aim direction
-    e1->set_zrot(0); // Set the rotation around the Z-axis
-
-    auto surface_e1 = std::make_shared<SurfaceFlat>();
-    e1->set_surface(surface_e1);
-
-
-    ////////////////////////////////////////
-    // STEP 1.3 create rectangle aperture //
-    ////////////////////////////////////////
-    double dim_x = 1.0;
-    double dim_y = 1.0;
-    auto aperture_e1 = std::make_shared<ApertureRectangle>(dim_x, dim_y);
-    e1->set_aperture(aperture_e1);
-
-    system.add_element(e1); // Add the receiver to the system
-
-
-    double receiver_dim_x;
-    double receiver_dim_y;
-    receiver_dim_x = 2.0; // width of the receiver
-    receiver_dim_y = 2.0; // height of the receiver
-    Vec3d receiver_origin(0, 0, 10.0); // origin of the receiver
-    Vec3d receiver_aim_point(0, 0, -1); // aim point of the receiver
-
-    auto e4 = std::make_shared<CspElement>();
-    e4->set_origin(receiver_origin);
-    e4->set_aim_point(receiver_aim_point); // Aim direction
-    e4->set_zrot(0.0); // No rotation for the receiver
-
-
-    auto receiver_aperture = std::make_shared<ApertureRectangle>(receiver_dim_x, receiver_dim_y);
-    e4->set_aperture(receiver_aperture);
-
-    ///////////////////////////////////
-    // STEP 2.3 create flat surface //
-    ///////////////////////////////////
-    auto receiver_surface = std::make_shared<SurfaceFlat>();
-    e4->set_surface(receiver_surface);
-
-    ////////////////////////////////////////////
-    // STEP 2.4 Add the element to the system //
-    ///////////////////////////////////////////
-    system.add_element(e4); // Add the receiver to the system
-
-
-    
-    Vec3d sun_vector(0.0, 0.0, 100.0); // sun vector
-    // set up sun angle 
-    double sun_angle = 0.465; // 0.00465; // sun angle
-    system.set_sun_angle(sun_angle);
-	system.set_sun_vector(sun_vector);
-
-    ///////////////////////////////////
-    // STEP 3  Initialize the system //
-    ///////////////////////////////////
-    system.initialize();
-
-    ////////////////////////////
-    // STEP 4  Run Ray Trace //
-    ///////////////////////////
-    // TODO: set up different sun position trace // 
-    system.run();
-
-    //////////////////////////
-    // STEP 5  Post process //
-    //////////////////////////
-	std::string out_dir = "out_sun_modeling/";
-	// check if out_dir exists, if not create it 
-    if (std::filesystem::exists(out_dir)) {
-        std::cout << "Output directory already exists " << out_dir << ", rewriting results\n" << std::endl;
-    } else if (!std::filesystem::create_directory(std::filesystem::path(out_dir))) {
-        std::cerr << "Error creating directory " << out_dir << std::endl;
-        return 1;
+namespace {
+    const SamplerType SAMPLERS[] = { SAMPLER_HALTON, SAMPLER_SOBOL_OWEN, SAMPLER_STRATIFIED };
+    const char* SAMPLER_NAMES[] = { "halton", "sobol", "stratified" };
+
+    // element and receiver of the demo, the sun is a pillbox cone of sun_angle around sun_vector
+    template <typename System>
+    void build_scene(System& system, const Vec3d& sun_vector, double sun_angle) {
+        // Element 1
+        Vec3d origin_e1(0, 0, 0); // origin of the element
+        Vec3d aim_point_e1(0, 0, 1);  // aim point of the element
+        auto e1 = std::make_shared<CspElement>();
+        e1->set_origin(origin_e1);
+        e1->set_aim_point(aim_point_e1); // Aim direction
+        e1->set_zrot(0); // Set the rotation around the Z-axis
+
+        auto surface_e1 = std::make_shared<SurfaceFlat>();
+        e1->set_surface(surface_e1);
+
+        ////////////////////////////////////////
+        // STEP 1.3 create rectangle aperture //
+        ////////////////////////////////////////
+        double dim_x = 1.0;
+        double dim_y = 1.0;
+        auto aperture_e1 = std::make_shared<ApertureRectangle>(dim_x, dim_y);
+        e1->set_aperture(aperture_e1);
+
+        system.add_element(e1); // Add the receiver to the system
+
+        double receiver_dim_x;
+        double receiver_dim_y;
+        receiver_dim_x = 2.0; // width of the receiver
+        receiver_dim_y = 2.0; // height of the receiver
+        Vec3d receiver_origin(0, 0, 10.0); // origin of the receiver
+        Vec3d receiver_aim_point(0, 0, -1); // aim point of the receiver
+
+        auto e4 = std::make_shared<CspElement>();
+        e4->set_origin(receiver_origin);
+        e4->set_aim_point(receiver_aim_point); // Aim direction
+        e4->set_zrot(0.0); // No rotation for the receiver
+        e4->set_receiver(true);
+
+        auto receiver_aperture = std::make_shared<ApertureRectangle>(receiver_dim_x, receiver_dim_y);
+        e4->set_aperture(receiver_aperture);
+
+        ///////////////////////////////////
+        // STEP 2.3 create flat surface //
+        ///////////////////////////////////
+        auto receiver_surface = std::make_shared<SurfaceFlat>();
+        e4->set_surface(receiver_surface);
+
+        ////////////////////////////////////////////
+        // STEP 2.4 Add the element to the system //
+        ///////////////////////////////////////////
+        system.add_element(e4); // Add the receiver to the system
+
+        system.set_sun_angle(sun_angle);
+        system.set_sun_vector(sun_vector);
     }
 
-    system.write_hp_output(out_dir + "hit_points.csv");
-	system.write_sun_output(out_dir + "sun_direction_gaussian_old.csv");
+    int run_gpu(SamplerType sampler, int num_rays) {
+        // Create the simulation system.
+        SolTraceSystem system(num_rays);
+        Vec3d sun_vector(0.0, 0.0, 100.0); // sun vector
+        // set up sun angle
+        double sun_angle = 0.465; // 0.00465; // sun angle
+        build_scene(system, sun_vector, sun_angle);
+        system.set_sun_sampler(sampler);
+
+        ///////////////////////////////////
+        // STEP 3  Initialize the system //
+        ///////////////////////////////////
+        system.initialize();
 
-    /////////////////////////////////////////
-    // STEP 6  Be a good citizen, clean up //
-    /////////////////////////////////////////
-    system.clean_up();
+        ////////////////////////////
+        // STEP 4  Run Ray Trace //
+        ///////////////////////////
+        // TODO: set up different sun position trace //
+        system.run();
 
+        //////////////////////////
+        // STEP 5  Post process //
+        //////////////////////////
+        std::string out_dir = "out_sun_modeling/";
+        // check if out_dir exists, if not create it
+        if (std::filesystem::exists(out_dir)) {
+            std::cout << "Output directory already exists " << out_dir << ", rewriting results\n" << std::endl;
+        } else if (!std::filesystem::create_directory(std::filesystem::path(out_dir))) {
+            std::cerr << "Error creating directory " << out_dir << std::endl;
+            return 1;
+        }
 
+        system.write_hp_output(out_dir + "hit_points.csv");
+        system.write_sun_output(out_dir + "sun_direction_gaussian_old.csv");
 
-    return 0;
-}
\ No newline at end of file
+        /////////////////////////////////////////
+        // STEP 6  Be a good citizen, clean up //
+        /////////////////////////////////////////
+        system.clean_up();
+        return 0;
+    }
+
+    // fraction of the sun rays of a host run that reach the receiver
+    double receiver_fraction(CpuTracer& tracer) {
+        tracer.run();
+        return double(tracer.get_num_hits_receiver()) / tracer.get_sun_dir_buffer().size();
+    }
+
+    // sun tilted by 5 degrees: the receiver shades part of the element and catches part of its reflection
+    std::unique_ptr<CpuTracer> make_tracer(int num_rays, double sun_angle) {
+        auto tracer = std::make_unique<CpuTracer>(num_rays);
+        build_scene(*tracer, Vec3d(0.0, std::sin(5.0 * M_PI / 180.0), std::cos(5.0 * M_PI / 180.0)), sun_angle);
+        tracer->initialize();
+        return tracer;
+    }
+
+    // RMS relative error of the receiver fraction against the number of rays for every sampler,
+    // returns false when one of them is not within 1% of the reference at the most rays
+    bool convergence(double sun_angle, int min_rays, int max_rays, int num_replicates) {
+        // reference from a long scrambled Sobol run
+        const int num_reference = 16 * max_rays;
+        std::unique_ptr<CpuTracer> reference_tracer = make_tracer(num_reference, sun_angle);
+        reference_tracer->set_sun_sampler(SAMPLER_SOBOL_OWEN, 12345);
+        const double reference = receiver_fraction(*reference_tracer);
+        reference_tracer.reset();
+
+        std::vector<int> ray_counts;
+        for (int n = min_rays; n <= max_rays; n *= 4)
+            ray_counts.push_back(n);
+        std::vector<double> errors[3];
+        for (int s = 0; s < 3; s++) {
+            errors[s].assign(ray_counts.size(), 0.0);
+            for (size_t k = 0; k < ray_counts.size(); k++) {
+                std::unique_ptr<CpuTracer> tracer = make_tracer(ray_counts[k], sun_angle);
+                for (int r = 0; r < num_replicates; r++) {
+                    tracer->set_sun_sampler(SAMPLERS[s], static_cast<unsigned int>(r + 1));
+                    tracer->set_sample_offset(static_cast<unsigned long long>(r) * ray_counts[k]);
+                    const double e = receiver_fraction(*tracer) / reference - 1.0;
+                    errors[s][k] += e * e / num_replicates;
+                }
+                errors[s][k] = std::sqrt(errors[s][k]);
+            }
+        }
+
+        std::cout << "\nsun angle " << sun_angle * 1e3 << " mrad: receiver fraction " << reference << " from "
+                  << num_reference << " rays, RMS relative error over " << num_replicates << " replicates" << std::endl;
+        std::cout << std::setw(10) << "rays";
+        for (int s = 0; s < 3; s++) std::cout << std::setw(14) << SAMPLER_NAMES[s];
+        std::cout << std::endl;
+        for (size_t k = 0; k < ray_counts.size(); k++) {
+            std::cout << std::setw(10) << ray_counts[k];
+            for (int s = 0; s < 3; s++) std::cout << std::setw(14) << std::setprecision(4) << errors[s][k];
+            std::cout << std::endl;
+        }
+
+        // least squares slope of log(error) against log(rays), -0.5 for plain Monte Carlo
+        bool ok = true;
+        std::cout << std::setw(10) << "rate";
+        for (int s = 0; s < 3; s++) {
+            double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+            const double m = double(ray_counts.size());
+            for (size_t k = 0; k < ray_counts.size(); k++) {
+                const double x = std::log(double(ray_counts[k]));
+                const double y = std::log(errors[s][k]);
+                sx += x; sy += y; sxx += x * x; sxy += x * y;
+            }
+            std::cout << std::setw(14) << std::setprecision(3) << (m * sxy - sx * sy) / (m * sxx - sx * sx);
+            ok &= errors[s].back() < 0.01;
+        }
+        std::cout << std::endl;
+        if (!ok)
+            std::cout << "error above 1% at " << ray_counts.back() << " rays  FAILED" << std::endl;
+        return ok;
+    }
+
+    // chunks of a run that go on with each other trace the rays of the single run; the strata
+    // are set to the whole run, they follow the size of a launch otherwise
+    bool check_chunks(SamplerType sampler, int num_rays, int num_chunks) {
+        std::unique_ptr<CpuTracer> whole = make_tracer(num_rays, 0.00465);
+        whole->set_sun_sampler(sampler, 7, num_rays);
+        whole->run();
+
+        const int chunk = num_rays / num_chunks;
+        std::unique_ptr<CpuTracer> part = make_tracer(chunk, 0.00465);
+        part->set_sun_sampler(sampler, 7, num_rays);
+        std::vector<float3> dirs;
+        std::vector<float4> hits;
+        for (int c = 0; c < num_chunks; c++) {
+            part->set_sample_offset(static_cast<unsigned long long>(c) * chunk);
+            part->run();
+            dirs.insert(dirs.end(), part->get_sun_dir_buffer().begin(), part->get_sun_dir_buffer().end());
+            hits.insert(hits.end(), part->get_hit_point_buffer().begin(), part->get_hit_point_buffer().end());
+        }
+
+        return dirs.size() == whole->get_sun_dir_buffer().size()
+            && std::memcmp(dirs.data(), whole->get_sun_dir_buffer().data(), dirs.size() * sizeof(float3)) == 0
+            && std::memcmp(hits.data(), whole->get_hit_point_buffer().data(), hits.size() * sizeof(float4)) == 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool gpu = true;
+    SamplerType gpu_sampler = SAMPLER_HALTON;
+    int max_rays = 1 << 18;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--cpu") == 0) gpu = false;
+        else if (std::strcmp(argv[i], "halton") == 0) gpu_sampler = SAMPLER_HALTON;
+        else if (std::strcmp(argv[i], "sobol") == 0) gpu_sampler = SAMPLER_SOBOL_OWEN;
+        else if (std::strcmp(argv[i], "stratified") == 0) gpu_sampler = SAMPLER_STRATIFIED;
+        else max_rays = std::atoi(argv[i]);
+    }
+
+    if (gpu && run_gpu(gpu_sampler, 1000000) != 0)
+        return 1;
+
+    // point sun, only the position on the sun plane matters; then the sun of 4.65 mrad
+    bool ok = true;
+    for (double sun_angle : { 0.0, 0.00465 })
+        ok &= convergence(sun_angle, 1 << 10, max_rays, 16);
+
+    // cost of a sun plane position and of the direction numbers
+    std::cout << "\nns per sample (position, direction)" << std::endl;
+    const int num_timed = 1 << 22;
+    for (int s = 0; s < 3; s++) {
+        SamplerData data = { SAMPLERS[s], 3u, 1ULL << 20, 1u, 1u };
+        set_sampler_strata(data, 1u << 20);
+        float sum = 0.0f;
+        Timer position_timer, direction_timer;
+        position_timer.start();
+        for (int i = 0; i < num_timed; i++)
+            sum += sample_sun_plane(data, data.sample_offset + i).x;
+        position_timer.stop();
+        direction_timer.start();
+        if (SAMPLERS[s] != SAMPLER_HALTON) {
+            for (int i = 0; i < num_timed; i++)
+                sum += sample_sun_direction(data, data.sample_offset + i).y;
+        }
+        direction_timer.stop();
+        std::cout << std::setw(12) << SAMPLER_NAMES[s] << std::setw(10) << std::setprecision(3)
+                  << position_timer.get_time_sec() / num_timed * 1e9;
+        if (SAMPLERS[s] != SAMPLER_HALTON)
+            std::cout << std::setw(10) << direction_timer.get_time_sec() / num_timed * 1e9;
+        else
+            std::cout << std::setw(10) << "-";
+        std::cout << "   (checksum " << sum / num_timed << ")" << std::endl;
+    }
+
+    std::cout << std::endl;
+    for (int s = 0; s < 3; s++) {
+        const bool same = check_chunks(SAMPLERS[s], 1 << 16, 4);
+        std::cout << SAMPLER_NAMES[s] << ": 4 chunks " << (same ? "trace the same rays as one run" : "DIFFER from one run") << std::endl;
+        ok &= same;
+    }
+    return ok ? 0 : 1;
+}
@@ -107,31 +107,29 @@ class FluxMapCalculator:
         return local_points[:, 0], local_points[:, 1]
     
     def _project_to_cylindrical_receiver(self, hit_points: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
-        """Project points onto cylindrical receiver"""
+        """Unwrap points on the side of a cylindrical receiver, the cells of the native flux map:
+        azimuth in [0, 2 pi) from base_x towards base_z, height along the axis from the center"""
         # Translate points relative to cylinder center
         translated_pts = hit_points - self.receiver.center
-        
-        # Calculate cylinder axis
-        cylinder_axis = np.cross(self.receiver.base_z, self.receiver.base_x)
-        
-        # Project points onto cylinder surface
-        projection = translated_pts - np.outer(np.dot(translated_pts, cylinder_axis), cylinder_axis)
-        
-        # Calculate cylindrical coordinates
-        theta = np.arctan2(translated_pts[:, 1], translated_pts[:, 0])
+
+        # Cylinder frame, the axis is base_z x base_x
+        base_x = self.receiver.base_x / np.linalg.norm(self.receiver.base_x)
+        base_z = self.receiver.base_z / np.linalg.norm(self.receiver.base_z)
+        cylinder_axis = np.cross(base_z, base_x)
+
+        # Calculate cylindrical coordinates in that frame
+        x_local = np.dot(translated_pts, base_x)
+        z_local = np.dot(translated_pts, base_z)
+        theta = np.mod(np.arctan2(z_local, x_local), 2 * np.pi)
         z = np.dot(translated_pts, cylinder_axis)
-        
-        # Filter out points on caps
-        cap_tolerance = 1e-6
-        is_on_cap = np.logical_or(
-            np.abs(z - np.min(z)) < cap_tolerance,
-            np.abs(z - np.max(z)) < cap_tolerance
-        )
+
+        # Filter out points on caps, inside the radius
+        is_on_cap = x_local**2 + z_local**2 < 0.998 * self.receiver.radius**2
         valid_points = ~is_on_cap
-        
+
         # Return valid points
         return theta[valid_points], z[valid_points]
-    
+
     def calculate_flux_map(self, hit_points: np.ndarray) -> np.ndarray:
         """
         Calculate flux map from hit points
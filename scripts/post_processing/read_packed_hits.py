@@ -0,0 +1,104 @@
+import numpy as np
+import csv
+import sys
+
+# packed hit files written by write_packed_hits (src/core/packed_hits.h): every hit is the element
+# it landed on and its u, v on the frame of the element, 16 bits each
+
+HIT_NO_ELEMENT = 0xffffffff     # the sun point, on the frame of the sun plane
+PACKED_HIT_EMPTY = 0xfffffffe   # no hit in the slot
+PACKED_HIT_STEPS = 65535.0
+
+HIT_FRAME_FLAT = 0
+HIT_FRAME_PARABOLIC = 1
+HIT_FRAME_CYLINDER = 2
+
+FRAME_DTYPE = np.dtype([
+    ("center", "<f8", 3), ("axis_u", "<f8", 3), ("axis_v", "<f8", 3), ("normal", "<f8", 3),
+    ("width", "<f8"), ("height", "<f8"), ("radius", "<f8"), ("curv_u", "<f8"), ("curv_v", "<f8"),
+    ("shape", "<u4"), ("tag", "<u4")])
+
+HIT_DTYPE = np.dtype([("element", "<u4"), ("u", "<u2"), ("v", "<u2")])
+
+
+def read_packed_hits(filename):
+    """Read a packed hit file: the number of rays, max_depth, the frames of the elements with the
+    one of the sun plane last, and the num_rays * max_depth hits, the hit of ray and depth at
+    max_depth * ray + depth."""
+    with open(filename, "rb") as f:
+        if f.read(8) != b"CSPHITS1":
+            raise ValueError(f"{filename} is not a packed hit file")
+        num_rays = int(np.fromfile(f, "<u8", 1)[0])
+        max_depth, num_frames = (int(x) for x in np.fromfile(f, "<u4", 2))
+        frames = np.fromfile(f, FRAME_DTYPE, num_frames + 1)
+        hits = np.fromfile(f, HIT_DTYPE, num_rays * max_depth)
+    if len(frames) != num_frames + 1 or len(hits) != num_rays * max_depth:
+        raise ValueError(f"{filename} ends before its hits do")
+    return {"num_rays": num_rays, "max_depth": max_depth, "frames": frames, "hits": hits}
+
+
+def decode_packed_hits(data):
+    """Tags and world positions of the hits, as the hit point buffer has them: tag 0 for the sun
+    points, 1 the mirrors, 2 the receivers, 3 the elements of a virtual stage; zero for an empty
+    slot."""
+    frames = data["frames"]
+    hits = data["hits"]
+    element = hits["element"].astype(np.int64)
+    empty = element == PACKED_HIT_EMPTY
+    # the sun plane is the last frame
+    index = np.where(element == HIT_NO_ELEMENT, len(frames) - 1, element)
+    index[empty] = 0
+    f = frames[index]
+
+    u = hits["u"] / PACKED_HIT_STEPS
+    v = hits["v"] / PACKED_HIT_STEPS
+    y = (v - 0.5) * f["height"]
+
+    # flat and parabolic frames
+    x = (u - 0.5) * f["width"]
+    sag = np.where(f["shape"] == HIT_FRAME_PARABOLIC, 0.5 * (f["curv_u"] * x * x + f["curv_v"] * y * y), 0.0)
+    positions = f["center"] + f["axis_u"] * x[:, None] + f["axis_v"] * y[:, None] + f["normal"] * sag[:, None]
+
+    # cylinders: the side unwrapped, the caps past its rims
+    cylinder = f["shape"] == HIT_FRAME_CYLINDER
+    if np.any(cylinder):
+        fc = f[cylinder]
+        yc = y[cylinder]
+        theta = 2.0 * np.pi * u[cylinder]
+        half_height = 0.5 * fc["height"] - fc["radius"]
+        on_cap = np.abs(yc) > half_height
+        rho = np.where(on_cap, np.maximum(0.0, fc["radius"] - (np.abs(yc) - half_height)), fc["radius"])
+        h = np.where(on_cap, np.copysign(half_height, yc), yc)
+        positions[cylinder] = (fc["center"] + fc["axis_u"] * (rho * np.cos(theta))[:, None]
+                               + fc["normal"] * (rho * np.sin(theta))[:, None] + fc["axis_v"] * h[:, None])
+
+    tags = f["tag"].astype(np.float64)
+    tags[empty] = 0.0
+    positions[empty] = 0.0
+    return tags, positions, empty
+
+
+def write_hits_csv(data, output_filename):
+    """Write every hit that is not empty: its ray, depth, element, tag and position."""
+    tags, positions, empty = decode_packed_hits(data)
+    max_depth = data["max_depth"]
+    with open(output_filename, "w", newline="") as out:
+        writer = csv.writer(out)
+        writer.writerow(["ray", "depth", "element", "tag", "loc_x", "loc_y", "loc_z"])
+        for i in np.flatnonzero(~empty):
+            element = int(data["hits"]["element"][i])
+            writer.writerow([i // max_depth, i % max_depth, -1 if element == HIT_NO_ELEMENT else element,
+                             int(tags[i]), *positions[i]])
+
+
+if __name__ == "__main__":
+    filename = sys.argv[1] if len(sys.argv) > 1 else "out_packed_hits/packed_hits.bin"
+    data = read_packed_hits(filename)
+    tags, positions, empty = decode_packed_hits(data)
+    print(f"{data['num_rays']} rays, max depth {data['max_depth']}, {len(data['frames']) - 1} elements, "
+          f"{np.count_nonzero(~empty)} hits")
+    for tag, name in enumerate(["sun", "mirror", "receiver", "virtual"]):
+        print(f"  {name}: {np.count_nonzero(tags[~empty] == tag)} hits")
+    if len(sys.argv) > 2:
+        write_hits_csv(data, sys.argv[2])
+        print(f"hits written to {sys.argv[2]}")
@@ -23,6 +23,10 @@ CspElement::CspElement() {
     m_surface = nullptr;
     m_aperture = nullptr;
     m_receiver = false;
+    m_slope_error = 0.0;
+    m_specularity_error = 0.0;
+    m_reflectivity = 1.0;
+    m_stage = 0;
 }
 
 // set and get origin 
@@ -187,6 +191,16 @@ GeometryDataST CspElement::toDeviceGeometryData() const {
     return geometry_data;
 }
 
+// the receivers absorb the power that reaches them, only the mirrors reflect part of it
+MaterialData CspElement::toDeviceMaterialData() const {
+    MaterialData material_data = {};
+    if (m_receiver)
+        material_data.receiver = { 0.95f, 0.0f, 0.0f, 0.0f };
+    else
+        material_data.mirror = { static_cast<float>(m_reflectivity), 0.0f, static_cast<float>(m_slope_error), static_cast<float>(m_specularity_error) };
+    return material_data;
+}
+
 
 // we also need to implement the bounding box computation
 // for a case like a rectangle aperture,
@@ -207,26 +221,30 @@ void CspElement::compute_bounding_box() {
         double width = m_aperture->get_width();
         double height = m_aperture->get_height();
 
-        // compute the four corners of the rectangle locally
-        Vec3d corner1 = Vec3d(-width / 2, -height / 2, 0.0);
-        Vec3d corner2 = Vec3d( width / 2, -height / 2, 0.0);
-        Vec3d corner3 = Vec3d( width / 2,  height / 2, 0.0);
-        Vec3d corner4 = Vec3d(-width / 2,  height / 2, 0.0);
-
-        // transform the corners to the global frame
-        Vec3d corner1_global = rotation_matrix * corner1 + m_origin;
-        Vec3d corner2_global = rotation_matrix * corner2 + m_origin;
-        Vec3d corner3_global = rotation_matrix * corner3 + m_origin;
-        Vec3d corner4_global = rotation_matrix * corner4 + m_origin;
-
-        // now update the bounding box, need to find the min and max x, y, z
-        m_lower_box_bound[0] = fmin(fmin(corner1_global[0], corner2_global[0]), fmin(corner3_global[0], corner4_global[0]));
-        m_lower_box_bound[1] = fmin(fmin(corner1_global[1], corner2_global[1]), fmin(corner3_global[1], corner4_global[1]));
-        m_lower_box_bound[2] = fmin(fmin(corner1_global[2], corner2_global[2]), fmin(corner3_global[2], corner4_global[2]));
-
-        m_upper_box_bound[0] = fmax(fmax(corner1_global[0], corner2_global[0]), fmax(corner3_global[0], corner4_global[0]));
-        m_upper_box_bound[1] = fmax(fmax(corner1_global[1], corner2_global[1]), fmax(corner3_global[1], corner4_global[1]));
-        m_upper_box_bound[2] = fmax(fmax(corner1_global[2], corner2_global[2]), fmax(corner3_global[2], corner4_global[2]));
+        // the sag of a parabolic surface lifts the surface off the aperture plane, at most at the
+        // corners or at the edge midpoints of a saddle; the box holds the rectangle at both heights
+        const double c1 = m_surface->get_curvature_1();
+        const double c2 = m_surface->get_curvature_2();
+        const double sag_x = 0.5 * c1 * (width / 2) * (width / 2);
+        const double sag_y = 0.5 * c2 * (height / 2) * (height / 2);
+        const double z_low = fmin(sag_x, 0.0) + fmin(sag_y, 0.0);
+        const double z_high = fmax(sag_x, 0.0) + fmax(sag_y, 0.0);
+
+        // transform the corners of the local box to the global frame and find the min and max x, y, z
+        for (int i = 0; i < 3; i++) {
+            m_lower_box_bound[i] = std::numeric_limits<double>::max();
+            m_upper_box_bound[i] = std::numeric_limits<double>::lowest();
+        }
+        for (int corner = 0; corner < 8; corner++) {
+            Vec3d local = Vec3d((corner & 1) ? width / 2 : -width / 2,
+                                (corner & 2) ? height / 2 : -height / 2,
+                                (corner & 4) ? z_high : z_low);
+            Vec3d global = rotation_matrix * local + m_origin;
+            for (int i = 0; i < 3; i++) {
+                m_lower_box_bound[i] = fmin(m_lower_box_bound[i], global[i]);
+                m_upper_box_bound[i] = fmax(m_upper_box_bound[i], global[i]);
+            }
+        }
     }
 
     // slightly different for the cylinder, we want to know the radius and half height
@@ -10,6 +10,7 @@
 #include "Aperture.h"
 #include "utils/math_util.h"
 #include "shaders/GeometryDataST.h"
+#include "shaders/MaterialDataST.h"
 
 namespace OptixCSP {
 
@@ -67,6 +68,18 @@ namespace OptixCSP {
         void set_aperture(const std::shared_ptr<Aperture>& aperture);
         void set_surface(const std::shared_ptr<Surface>& surface);
 
+        // rms slope and specularity errors of a mirror (in radians), 0 reflects ideally
+        void set_slope_error(double slope_error) { m_slope_error = slope_error; }
+        void set_specularity_error(double specularity_error) { m_specularity_error = specularity_error; }
+        double get_slope_error() const { return m_slope_error; }
+        double get_specularity_error() const { return m_specularity_error; }
+        // fraction of the incident power a mirror reflects, 1 by default
+        void set_reflectivity(double reflectivity) { m_reflectivity = reflectivity; }
+        double get_reflectivity() const { return m_reflectivity; }
+        // stage the element is traced in, 0 by default; the flags of the stages are set on the tracer
+        void set_stage(unsigned int stage) { m_stage = stage; }
+        unsigned int get_stage() const { return m_stage; }
+
         // set orientation based on aimpoint and zrot
         void update_euler_angles(const Vec3d& aim_point, const double zrot);
 	    // set orientation based on the CspElement's aim point and zrot
@@ -87,6 +100,9 @@ namespace OptixCSP {
         // convert to device data available to GPU
         GeometryDataST toDeviceGeometryData() const override; 
 
+        // optical properties for the closest-hit programs
+        MaterialData toDeviceMaterialData() const;
+
         // we also need to implement the bounding box computation
         // for a case like a rectangle aperture,
         // once we have the origin, euler angles, rotatioin matrix
@@ -107,5 +123,10 @@ namespace OptixCSP {
         std::shared_ptr<Surface> m_surface;
         std::shared_ptr<Aperture> m_aperture;
 
+        double m_slope_error;        // rms, radians
+        double m_specularity_error;  // rms, radians
+        double m_reflectivity;
+        unsigned int m_stage;
+
     };
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#include "annual_runner.h"
+
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+std::vector<AnnualStep> OptixCSP::annual_steps(const SolarSite& site, const std::vector<double>& unix_times,
+                                               const std::vector<double>& dni, int num_threads) {
+    if (dni.size() != unix_times.size())
+        throw std::runtime_error("Annual steps need one dni per timestamp.");
+
+    const std::vector<SolarPosition> positions = solar_positions(site, unix_times, num_threads);
+    std::vector<AnnualStep> steps(unix_times.size());
+    for (size_t i = 0; i < steps.size(); i++) {
+        steps[i].time = unix_times[i];
+        steps[i].sun_vector = sun_vector(positions[i]);
+        steps[i].dni = dni[i];
+    }
+    return steps;
+}
+
+Vec3d OptixCSP::tracking_aim_point(const Vec3d& origin, const Vec3d& target, const Vec3d& sun_vector) {
+    const Vec3d to_target = target - origin;
+    const double distance = to_target.norm();
+    const Vec3d normal = (to_target / distance + sun_vector.normalized()).normalized();
+    return origin + normal * distance;
+}
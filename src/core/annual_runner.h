@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cmath>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "vec3d.h"
+#include "timer.h"
+#include "CspElement.h"
+#include "solar_position.h"
+
+namespace OptixCSP {
+
+    /// one time step of an annual run
+    struct AnnualStep {
+        double time = 0.0;      // timestamp, carried over to the result
+        Vec3d sun_vector;       // toward the sun, z up
+        double dni = 0.0;       // W/m2
+    };
+
+    struct AnnualStepResult {
+        double time = 0.0;
+        double receiver_power = 0.0;    // W
+        bool traced = false;            // false for the steps skipped at night or without dni
+    };
+
+    /// timings of the last AnnualRunner::run, in seconds
+    struct AnnualRunStats {
+        size_t num_steps = 0;
+        size_t num_traced = 0;
+        double time_prepare = 0.0;      // heliostat tracking, overlapped with the trace when pipelined
+        double time_update = 0.0;       // initialize() or update() of the tracer
+        double time_trace = 0.0;        // run() and the receiver power
+        double time_total = 0.0;
+
+        double steps_per_second() const { return time_total > 0.0 ? num_traced / time_total : 0.0; }
+    };
+
+    /// Steps of a site from UTC timestamps and the dni at each of them, the sun vectors are
+    /// computed for all the timestamps in one call to solar_positions.
+    std::vector<AnnualStep> annual_steps(const SolarSite& site, const std::vector<double>& unix_times,
+                                         const std::vector<double>& dni, int num_threads = 0);
+
+    /// Aim point of a heliostat at origin that reflects the sun onto target: the normal bisects
+    /// the directions toward the sun and the target, at the distance of the target.
+    Vec3d tracking_aim_point(const Vec3d& origin, const Vec3d& target, const Vec3d& sun_vector);
+
+    /**
+     * @class AnnualRunner
+     * @brief Traces a list of sun positions with one tracer, SolTraceSystem or CpuTracer. The scene
+     * is set up once, on the first step with sun; every later step only moves the heliostats and
+     * the sun and calls update(), which refits the acceleration structure. Steps with the sun at
+     * or below min_elevation or without dni are not traced and keep a power of 0.
+     *
+     * When pipelined, the heliostats of the next step are aimed while the current step is traced.
+     * The tracers work on the geometry collected by update(), so the elements are free to move
+     * during a trace.
+     */
+    template <class Tracer>
+    class AnnualRunner {
+    public:
+        explicit AnnualRunner(Tracer& tracer)
+            : m_tracer(tracer), m_min_elevation(0.0), m_min_dni(0.0), m_pipelined(true), m_initialized(false) {}
+
+        /// heliostat of the tracer, aimed at target for every step
+        void add_heliostat(std::shared_ptr<CspElement> element, const Vec3d& target) {
+            m_heliostats.push_back(element);
+            m_targets.push_back(target);
+        }
+
+        /// elevation of the sun in degrees below which a step is night
+        void set_min_elevation(double elevation) { m_min_elevation = elevation; }
+        /// dni in W/m2 at or below which a step is skipped
+        void set_min_dni(double dni) { m_min_dni = dni; }
+        void set_pipelined(bool pipelined) { m_pipelined = pipelined; }
+
+        /// trace all the steps, one result per step in the same order
+        const std::vector<AnnualStepResult>& run(const std::vector<AnnualStep>& steps) {
+            Timer total;
+            total.start();
+            m_stats = AnnualRunStats();
+            m_stats.num_steps = steps.size();
+            m_results.assign(steps.size(), AnnualStepResult());
+
+            const double min_sin_elevation = std::sin(m_min_elevation * M_PI / 180.0);
+            std::vector<size_t> day;
+            for (size_t i = 0; i < steps.size(); i++) {
+                m_results[i].time = steps[i].time;
+                const Vec3d& s = steps[i].sun_vector;
+                if (steps[i].dni > m_min_dni && s.norm() > 0.0 && s[2] / s.norm() > min_sin_elevation)
+                    day.push_back(i);
+            }
+
+            if (!day.empty())
+                aim_heliostats(steps[day[0]].sun_vector);
+            for (size_t k = 0; k < day.size(); k++) {
+                const AnnualStep& step = steps[day[k]];
+
+                Timer timer;
+                timer.start();
+                m_tracer.set_sun_vector(step.sun_vector);
+                m_tracer.set_dni(step.dni);
+                if (m_initialized) {
+                    m_tracer.update();
+                }
+                else {
+                    m_tracer.initialize();
+                    m_initialized = true;
+                }
+                timer.stop();
+                m_stats.time_update += timer.get_time_sec();
+
+                // the heliostats of the next step are aimed during the trace of this one
+                std::future<double> next;
+                const bool has_next = k + 1 < day.size();
+                const Vec3d next_sun = has_next ? steps[day[k + 1]].sun_vector : Vec3d();
+                if (has_next && m_pipelined)
+                    next = std::async(std::launch::async, [this, next_sun]() { return aim_heliostats(next_sun); });
+
+                timer.reset();
+                timer.start();
+                m_tracer.run();
+                m_results[day[k]].receiver_power = m_tracer.get_receiver_power();
+                m_results[day[k]].traced = true;
+                timer.stop();
+                m_stats.time_trace += timer.get_time_sec();
+                m_stats.num_traced++;
+
+                if (has_next)
+                    m_stats.time_prepare += m_pipelined ? next.get() : aim_heliostats(next_sun);
+            }
+
+            total.stop();
+            m_stats.time_total = total.get_time_sec();
+            return m_results;
+        }
+
+        const std::vector<AnnualStepResult>& get_results() const { return m_results; }
+        const AnnualRunStats& get_stats() const { return m_stats; }
+
+        /// sum of the receiver power times the time to the next step, in Wh
+        double get_energy() const {
+            double energy = 0.0;
+            for (size_t i = 0; i + 1 < m_results.size(); i++)
+                energy += m_results[i].receiver_power * (m_results[i + 1].time - m_results[i].time) / 3600.0;
+            if (m_results.size() > 1)
+                energy += m_results.back().receiver_power * (m_results.back().time - m_results[m_results.size() - 2].time) / 3600.0;
+            return energy;
+        }
+
+    private:
+        // returns the seconds it took
+        double aim_heliostats(const Vec3d& sun_vector) {
+            Timer timer;
+            timer.start();
+            for (size_t i = 0; i < m_heliostats.size(); i++) {
+                CspElement& e = *m_heliostats[i];
+                e.update_element(tracking_aim_point(e.get_origin(), m_targets[i], sun_vector), e.get_zrot());
+            }
+            timer.stop();
+            return timer.get_time_sec();
+        }
+
+        Tracer& m_tracer;
+        std::vector<std::shared_ptr<CspElement>> m_heliostats;
+        std::vector<Vec3d> m_targets;
+        double m_min_elevation;
+        double m_min_dni;
+        bool m_pipelined;
+        bool m_initialized;
+
+        std::vector<AnnualStepResult> m_results;
+        AnnualRunStats m_stats;
+    };
+}
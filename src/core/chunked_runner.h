@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "timer.h"
+#include "flux_map.h"
+#include "hit_stream.h"
+#include "utils/util_output.hpp"
+
+namespace OptixCSP {
+
+    /// Chunks a run is traced in, all of chunk_rays sun rays, so that the tracer keeps its buffers
+    /// and the power of a sun ray from one chunk to the next; the rays round up to whole chunks.
+    struct ChunkPlan {
+        size_t num_rays = 0;        // traced by all the chunks, at least the rays asked for
+        size_t chunk_rays = 0;
+        size_t num_chunks = 0;
+        size_t bytes_per_ray = 0;   // of the buffers sized by the number of sun rays
+        size_t fixed_bytes = 0;     // of the buffers that are not, the hit stream
+
+        size_t chunk_bytes() const { return fixed_bytes + chunk_rays * bytes_per_ray; }
+    };
+
+    /// Bytes per sun ray of the buffers a tracer sizes by its number of sun rays: the direction and
+    /// power of the ray and, without a hit stream, its max_depth hit points and their power.
+    inline size_t ray_buffer_bytes(int max_depth, bool hit_point_buffer) {
+        size_t bytes = sizeof(float3) + sizeof(float);
+        if (hit_point_buffer) bytes += static_cast<size_t>(max_depth) * (sizeof(float4) + sizeof(float));
+        return bytes;
+    }
+
+    /// As few chunks as fit memory_budget bytes of buffers each, evened out over num_rays; a chunk is
+    /// one launch, at most INT_MAX rays. Throws when not even one ray fits.
+    inline ChunkPlan plan_chunks(size_t num_rays, size_t memory_budget, size_t bytes_per_ray, size_t fixed_bytes = 0) {
+        if (num_rays == 0)
+            throw std::runtime_error("A chunked run traces at least one ray.");
+        if (memory_budget < fixed_bytes + bytes_per_ray)
+            throw std::runtime_error("A memory budget of " + std::to_string(memory_budget) + " bytes does not hold one ray, "
+                                     + std::to_string(fixed_bytes + bytes_per_ray) + " bytes.");
+        const size_t max_chunk = std::min<size_t>((memory_budget - fixed_bytes) / bytes_per_ray, INT_MAX);
+
+        ChunkPlan plan;
+        plan.num_chunks = (num_rays + max_chunk - 1) / max_chunk;
+        plan.chunk_rays = (num_rays + plan.num_chunks - 1) / plan.num_chunks;
+        plan.num_rays = plan.chunk_rays * plan.num_chunks;
+        plan.bytes_per_ray = bytes_per_ray;
+        plan.fixed_bytes = fixed_bytes;
+        return plan;
+    }
+
+    struct ChunkedReport {
+        ChunkPlan plan;
+        size_t num_chunks = 0;              // traced
+        size_t num_rays = 0;                // traced
+        double receiver_power = 0.0;        // mean over the chunks, W
+        long long num_hits_receiver = 0;    // all the chunks
+        std::vector<FluxMap> flux_maps;     // mean over the chunks, empty without flux maps
+        std::vector<double> element_power;  // mean over the chunks, W, with set_element_power
+        double time_trace = 0.0;            // seconds in run() of the tracer
+        double time_total = 0.0;            // wall time of the whole run, seconds
+    };
+
+    /**
+     * @class ChunkedRunner
+     * @brief Traces more rays than the buffers of one launch hold with one tracer, SolTraceSystem or
+     * CpuTracer: the rays are split into chunks of the size plan() picks from a memory budget, each
+     * one run() of the tracer on the same buffers going on with the sample sequence of the previous
+     * one. Every chunk is an estimate over its own rays, so with chunks of equal size the receiver
+     * power, flux maps and element power of the whole run are their means, and the same as one launch
+     * over all the rays would give. The hit points can be written chunk by chunk to one csv file.
+     *
+     * plan() sets the number of sun points of the tracer to the chunk, so it comes before the tracer
+     * is initialized, and the tracer is initialized, and updated after a change, before run().
+     */
+    template <class Tracer>
+    class ChunkedRunner {
+    public:
+        ChunkedRunner(Tracer& tracer, size_t num_rays)
+            : m_tracer(tracer), m_num_rays(num_rays), m_memory_budget(0), m_element_power(false) {}
+
+        /// bytes the buffers of one chunk may take, 0, the default, for as few chunks as the launch size allows
+        void set_memory_budget(size_t bytes) { m_memory_budget = bytes; }
+        /// average get_receiver_element_power over the chunks, needs set_receiver_element_power on the tracer
+        void set_element_power(bool enable) { m_element_power = enable; }
+        /// write the hit points of every chunk to filename once it is traced, the file write_hp_output
+        /// writes after a single launch over all the rays; empty, the default, writes none
+        void set_hit_output(const std::string& filename) { m_hit_output = filename; }
+        /// called with the tracer and the index of the chunk once it is traced, to read its buffers
+        /// before the next chunk overwrites them
+        void set_chunk_callback(std::function<void(Tracer&, size_t)> callback) { m_chunk_callback = std::move(callback); }
+
+        /// chunks for the budget, the depth and the hit stream of the tracer; sets the number of sun
+        /// points of the tracer to the chunk
+        const ChunkPlan& plan() {
+            const size_t stream_bytes = m_tracer.get_hit_stream() * sizeof(HitRecord);
+            const size_t bytes_per_ray = ray_buffer_bytes(m_tracer.get_max_depth(), m_tracer.get_hit_stream() == 0);
+            const size_t budget = m_memory_budget > 0 ? m_memory_budget
+                                                      : stream_bytes + static_cast<size_t>(INT_MAX) * bytes_per_ray;
+            m_plan = plan_chunks(m_num_rays, budget, bytes_per_ray, stream_bytes);
+            m_tracer.set_sun_points(static_cast<int>(m_plan.chunk_rays));
+            return m_plan;
+        }
+
+        /// trace the chunks from the current sample offset of the tracer
+        const ChunkedReport& run() {
+            if (m_plan.chunk_rays == 0 || static_cast<size_t>(m_tracer.get_sun_points()) != m_plan.chunk_rays)
+                throw std::runtime_error("The tracer does not launch the chunks of the plan, plan() before initializing it.");
+
+            Timer total;
+            total.start();
+            m_report = ChunkedReport();
+            m_report.plan = m_plan;
+
+            HitPointCsvWriter writer;
+            if (!m_hit_output.empty() && !writer.open(m_hit_output))
+                throw std::runtime_error("Failed to open " + m_hit_output);
+
+            double power = 0.0;
+            for (size_t chunk = 0; chunk < m_plan.num_chunks; chunk++) {
+                Timer timer;
+                timer.start();
+                m_tracer.run();
+                timer.stop();
+                m_report.time_trace += timer.get_time_sec();
+
+                power += m_tracer.get_receiver_power();
+                m_report.num_hits_receiver += m_tracer.get_num_hits_receiver();
+                add_flux_maps(m_tracer.get_flux_maps());
+                if (m_element_power)
+                    add(m_report.element_power, m_tracer.get_receiver_element_power());
+                if (!m_hit_output.empty())
+                    write_hits(writer);
+                if (m_chunk_callback)
+                    m_chunk_callback(m_tracer, chunk);
+
+                m_report.num_chunks++;
+                m_report.num_rays += m_plan.chunk_rays;
+                m_tracer.set_sample_offset(m_tracer.get_sample_offset() + m_plan.chunk_rays);
+            }
+            writer.close();
+
+            // the means of the chunks
+            const double scale = 1.0 / m_report.num_chunks;
+            m_report.receiver_power = power * scale;
+            for (double& p : m_report.element_power) p *= scale;
+            for (FluxMap& map : m_report.flux_maps) {
+                map.total_power *= scale;
+                map.peak_flux = 0.0;
+                for (double& f : map.flux) {
+                    f *= scale;
+                    map.peak_flux = std::max(map.peak_flux, f);
+                }
+            }
+
+            total.stop();
+            m_report.time_total = total.get_time_sec();
+            return m_report;
+        }
+
+        const ChunkPlan& get_plan() const { return m_plan; }
+        const ChunkedReport& get_report() const { return m_report; }
+
+    private:
+        static void add(std::vector<double>& sum, const std::vector<double>& values) {
+            sum.resize(values.size(), 0.0);
+            for (size_t i = 0; i < values.size(); i++) sum[i] += values[i];
+        }
+
+        void add_flux_maps(const std::vector<FluxMap>& maps) {
+            if (m_report.flux_maps.empty()) {
+                m_report.flux_maps = maps;
+                return;
+            }
+            for (size_t m = 0; m < maps.size(); m++) {
+                add(m_report.flux_maps[m].flux, maps[m].flux);
+                m_report.flux_maps[m].total_power += maps[m].total_power;
+            }
+        }
+
+        // the records of a hit stream laid out as the hit point buffer first
+        void write_hits(HitPointCsvWriter& writer) {
+            const int max_depth = m_tracer.get_max_depth();
+            if (m_tracer.get_hit_stream() == 0) {
+                writer.append(m_tracer.get_hit_point_buffer(), max_depth);
+                return;
+            }
+            std::vector<float4> hit_points;
+            std::vector<float> hit_power;
+            decode_hit_records(m_tracer.get_hit_records(), m_plan.chunk_rays, max_depth, hit_points, hit_power);
+            writer.append(hit_points, max_depth);
+        }
+
+        Tracer& m_tracer;
+        size_t m_num_rays;
+        size_t m_memory_budget;
+        bool m_element_power;
+        std::string m_hit_output;
+        std::function<void(Tracer&, size_t)> m_chunk_callback;
+        ChunkPlan m_plan;
+        ChunkedReport m_report;
+    };
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "vec3d.h"
+#include "timer.h"
+#include "shaders/Soltrace.h"
+#include "flux_map.h"
+
+namespace OptixCSP {
+
+    /// Running mean and variance of a sequence, Welford's update.
+    class RunningStats {
+    public:
+        void add(double x) {
+            m_count++;
+            const double delta = x - m_mean;
+            m_mean += delta / m_count;
+            m_m2 += delta * (x - m_mean);
+        }
+
+        size_t count() const { return m_count; }
+        double mean() const { return m_mean; }
+        /// sample variance, 0 below two values
+        double variance() const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.0; }
+        /// standard error of the mean
+        double standard_error() const { return m_count > 1 ? std::sqrt(variance() / m_count) : 0.0; }
+
+    private:
+        size_t m_count = 0;
+        double m_mean = 0.0;
+        double m_m2 = 0.0;
+    };
+
+    /// Estimate whose relative standard error ConvergenceRunner::run brings to the target.
+    enum class ConvergenceTarget {
+        RECEIVER_POWER,     // total receiver power
+        PEAK_FLUX,          // flux of the cell with the highest mean, needs a flux map
+        BOTH
+    };
+
+    struct ConvergenceReport {
+        bool converged = false;
+        size_t num_batches = 0;
+        size_t num_rays = 0;            // all the batches
+        double receiver_power = 0.0;    // mean over the batches, W
+        double power_error = 0.0;       // relative standard error
+        double peak_flux = 0.0;         // W/m2, 0 without a flux map
+        double peak_error = 0.0;        // relative standard error
+        size_t peak_cell = 0;
+        std::vector<double> flux;       // mean flux of every cell, W/m2
+        std::vector<double> flux_error; // standard error of every cell, W/m2
+        double time_trace = 0.0;        // seconds in run() of the tracer
+        double time_total = 0.0;        // wall time of the whole run, seconds
+    };
+
+    /**
+     * @class ConvergenceRunner
+     * @brief Traces batches of rays with one tracer, SolTraceSystem or CpuTracer, until the relative
+     * standard error of the receiver power, of the peak flux or of both falls to a target. Each batch
+     * is one run() of the tracer, its number of sun points, going on with the sample sequence of the
+     * previous one; the batch results are folded into running means and variances, so the estimate
+     * is the mean over the batches and its error is measured between them.
+     *
+     * The flux of a batch is the flux map the tracer fills during its run, so it does not depend on
+     * the hit point buffer and holds with a hit stream.
+     *
+     * The tracer has to be initialized, and updated after a change, before run(). The batch size is
+     * the compromise: small batches stop closer to the target, large ones keep the launch overhead low.
+     */
+    template <class Tracer>
+    class ConvergenceRunner {
+    public:
+        explicit ConvergenceRunner(Tracer& tracer)
+            : m_tracer(tracer), m_target(ConvergenceTarget::RECEIVER_POWER), m_relative_error(0.005),
+              m_min_batches(4), m_max_rays(0), m_flux_map(-1) {}
+
+        /// stop once the relative standard error of target is at most relative_error
+        void set_target(ConvergenceTarget target, double relative_error) {
+            m_target = target;
+            m_relative_error = relative_error;
+        }
+        /// batches traced before the error is trusted, at least 2
+        void set_min_batches(size_t num) { m_min_batches = std::max<size_t>(2, num); }
+        /// give up after this many rays, 0 for no limit
+        void set_max_rays(size_t num) { m_max_rays = num; }
+        /// follow the flux map of receiver, in element order, needed for PEAK_FLUX; the tracer fills
+        /// it with the resolution set by set_flux_map_resolution before it was initialized
+        void set_flux_map(size_t receiver = 0) { m_flux_map = static_cast<long long>(receiver); }
+
+        /// trace batches from the current sample offset of the tracer until the target is met
+        const ConvergenceReport& run() {
+            Timer total;
+            total.start();
+            m_report = ConvergenceReport();
+            if (m_target != ConvergenceTarget::RECEIVER_POWER && m_flux_map < 0)
+                throw std::runtime_error("A peak flux target needs a flux map, set_flux_map before run().");
+
+            const size_t batch_rays = static_cast<size_t>(m_tracer.get_sun_points());
+            RunningStats power;
+            std::vector<RunningStats> cells;
+
+            while (true) {
+                Timer timer;
+                timer.start();
+                m_tracer.run();
+                timer.stop();
+                m_report.time_trace += timer.get_time_sec();
+
+                power.add(m_tracer.get_receiver_power());
+                if (m_flux_map >= 0) {
+                    const std::vector<double>& flux = m_tracer.get_flux_map(static_cast<size_t>(m_flux_map)).flux;
+                    cells.resize(flux.size());
+                    for (size_t c = 0; c < flux.size(); c++) cells[c].add(flux[c]);
+                }
+                m_report.num_batches++;
+                m_report.num_rays += batch_rays;
+                m_tracer.set_sample_offset(m_tracer.get_sample_offset() + batch_rays);
+
+                summarize(power, cells);
+                if (m_report.num_batches >= m_min_batches && met()) {
+                    m_report.converged = true;
+                    break;
+                }
+                if (m_max_rays > 0 && m_report.num_rays + batch_rays > m_max_rays) break;
+            }
+
+            total.stop();
+            m_report.time_total = total.get_time_sec();
+            return m_report;
+        }
+
+        const ConvergenceReport& get_report() const { return m_report; }
+
+    private:
+        void summarize(const RunningStats& power, const std::vector<RunningStats>& cells) {
+            m_report.receiver_power = power.mean();
+            m_report.power_error = relative(power.standard_error(), power.mean());
+
+            m_report.flux.resize(cells.size());
+            m_report.flux_error.resize(cells.size());
+            m_report.peak_flux = 0.0;
+            m_report.peak_error = 0.0;
+            for (size_t c = 0; c < cells.size(); c++) {
+                m_report.flux[c] = cells[c].mean();
+                m_report.flux_error[c] = cells[c].standard_error();
+                if (cells[c].mean() > m_report.peak_flux) {
+                    m_report.peak_flux = cells[c].mean();
+                    m_report.peak_cell = c;
+                }
+            }
+            if (!cells.empty())
+                m_report.peak_error = relative(cells[m_report.peak_cell].standard_error(), m_report.peak_flux);
+        }
+
+        // an estimate of 0 never converges, nothing reached the receiver yet
+        static double relative(double error, double mean) {
+            return mean > 0.0 ? error / mean : HUGE_VAL;
+        }
+
+        bool met() const {
+            const bool power_met = m_report.power_error <= m_relative_error;
+            const bool peak_met = m_flux_map >= 0 && m_report.peak_error <= m_relative_error;
+            switch (m_target) {
+            case ConvergenceTarget::RECEIVER_POWER: return power_met;
+            case ConvergenceTarget::PEAK_FLUX:      return peak_met;
+            default:                                return power_met && peak_met;
+            }
+        }
+
+        Tracer& m_tracer;
+        ConvergenceTarget m_target;
+        double m_relative_error;
+        size_t m_min_batches;
+        size_t m_max_rays;
+        long long m_flux_map;   // receiver of the flux map, -1 for none
+        ConvergenceReport m_report;
+    };
+}
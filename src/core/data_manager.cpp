@@ -10,7 +10,10 @@
 
 using namespace OptixCSP;
 
-dataManager::dataManager() : launch_params_D(nullptr) {
+dataManager::dataManager() : launch_params_D(nullptr), material_data_array_D(nullptr), stage_data_array_D(nullptr),
+	flux_power_D(nullptr), flux_map_index_D(nullptr), flux_grids_D(nullptr), flux_num_cells(0),
+	element_power_D(nullptr), flux_num_elements(0), hit_records_D(nullptr), hit_count_D(nullptr), hit_first_lost_D(nullptr),
+	sun_shape_prob_D(nullptr), sun_shape_alias_D(nullptr) {
 	
     // Initialize launch parameters with default values
 	launch_params_H.width = 10;
@@ -18,6 +21,7 @@ dataManager::dataManager() : launch_params_D(nullptr) {
 	launch_params_H.max_depth = 5;
 
 	launch_params_H.hit_point_buffer = nullptr;
+	launch_params_H.hit_power_buffer = nullptr;
 	launch_params_H.sun_dir_buffer = nullptr;
 	launch_params_H.sun_vector = make_float3(0.0f, 0.0f, 10.0f);
 	launch_params_H.max_sun_angle = 0.0f;
@@ -26,6 +30,16 @@ dataManager::dataManager() : launch_params_D(nullptr) {
 	launch_params_H.sun_v1 = make_float3(0.0f, 0.0f, 0.0f);
 	launch_params_H.sun_v2 = make_float3(0.0f, 0.0f, 0.0f);
 	launch_params_H.sun_v3 = make_float3(0.0f, 0.0f, 0.0f);
+
+	launch_params_H.sun_shape = { 0, 0.0f, nullptr, nullptr };
+	launch_params_H.sampler = { SAMPLER_HALTON, 0u, 0ULL, 1u, 1u };
+	launch_params_H.material_data_array = nullptr;
+	launch_params_H.stage_data_array = nullptr;
+	launch_params_H.num_stages = 0;
+	launch_params_H.ray_power = 0.0f;
+	launch_params_H.ray_weighting = RAY_WEIGHTED;
+	launch_params_H.flux_map = { nullptr, nullptr, nullptr, 0u, 0u, nullptr };
+	launch_params_H.hit_stream = { nullptr, nullptr, nullptr, 0ULL, 0u };
 }
 
 dataManager::~dataManager() {
@@ -57,6 +71,30 @@ void dataManager::allocateGeometryDataArray(std::vector<GeometryDataST> geometry
 
 }
 
+void dataManager::allocateSunShape(std::shared_ptr<const SunShape> sun_shape) {
+
+	if (sun_shape == sun_shape_H) return;
+	sun_shape_H = sun_shape;
+
+	CUDA_CHECK(cudaFree(sun_shape_prob_D));
+	CUDA_CHECK(cudaFree(sun_shape_alias_D));
+
+	sun_shape_prob_D = nullptr;
+	sun_shape_alias_D = nullptr;
+	launch_params_H.sun_shape = { 0, 0.0f, nullptr, nullptr };
+	if (!sun_shape) return;
+
+	const size_t num_bins = sun_shape->num_bins();
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_shape_prob_D), num_bins * sizeof(float)));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_shape_alias_D), num_bins * sizeof(int)));
+	CUDA_CHECK(cudaMemcpy(sun_shape_prob_D, sun_shape->alias_prob().data(), num_bins * sizeof(float), cudaMemcpyHostToDevice));
+	CUDA_CHECK(cudaMemcpy(sun_shape_alias_D, sun_shape->alias_index().data(), num_bins * sizeof(int), cudaMemcpyHostToDevice));
+
+	launch_params_H.sun_shape = sun_shape->data();
+	launch_params_H.sun_shape.alias_prob = sun_shape_prob_D;
+	launch_params_H.sun_shape.alias_index = sun_shape_alias_D;
+}
+
 void dataManager::updateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array_H) {
 
 	if (geometry_data_array_D == nullptr) {
@@ -70,10 +108,127 @@ void dataManager::updateGeometryDataArray(std::vector<GeometryDataST> geometry_d
 
 }
 
+void dataManager::allocateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H) {
+
+	CUDA_CHECK(cudaFree(material_data_array_D));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&material_data_array_D),
+		material_data_array_H.size() * sizeof(MaterialData)));
+	CUDA_CHECK(cudaMemcpy(material_data_array_D, material_data_array_H.data(),
+		material_data_array_H.size() * sizeof(MaterialData), cudaMemcpyHostToDevice));
+	launch_params_H.material_data_array = material_data_array_D;
+}
+
+void dataManager::updateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H) {
+
+	if (material_data_array_D == nullptr) {
+		throw std::runtime_error("Material data array is not allocated.");
+	}
+
+	CUDA_CHECK(cudaMemcpy(material_data_array_D, material_data_array_H.data(),
+		material_data_array_H.size() * sizeof(MaterialData), cudaMemcpyHostToDevice));
+}
+
+void dataManager::allocateStageDataArray(const std::vector<StageData>& stage_data_array_H) {
+
+	CUDA_CHECK(cudaFree(stage_data_array_D));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&stage_data_array_D),
+		stage_data_array_H.size() * sizeof(StageData)));
+	CUDA_CHECK(cudaMemcpy(stage_data_array_D, stage_data_array_H.data(),
+		stage_data_array_H.size() * sizeof(StageData), cudaMemcpyHostToDevice));
+	launch_params_H.stage_data_array = stage_data_array_D;
+	launch_params_H.num_stages = static_cast<unsigned int>(stage_data_array_H.size());
+}
+
+void dataManager::allocateFluxMaps(const FluxMapLayout& layout) {
+
+	CUDA_CHECK(cudaFree(flux_power_D));
+	CUDA_CHECK(cudaFree(flux_map_index_D));
+	CUDA_CHECK(cudaFree(flux_grids_D));
+	CUDA_CHECK(cudaFree(element_power_D));
+	flux_power_D = nullptr;
+	flux_map_index_D = nullptr;
+	flux_grids_D = nullptr;
+	element_power_D = nullptr;
+	flux_num_cells = 0;
+	flux_num_elements = 0;
+	launch_params_H.flux_map = { nullptr, nullptr, nullptr, 0u, 0u, nullptr };
+
+	if (layout.element_power) {
+		flux_num_elements = layout.num_elements();
+		CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&element_power_D), flux_num_elements * sizeof(float)));
+		CUDA_CHECK(cudaMemset(element_power_D, 0, flux_num_elements * sizeof(float)));
+		launch_params_H.flux_map.element_power = element_power_D;
+	}
+	if (!layout.enabled()) return;
+
+	flux_num_cells = layout.num_cells();
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&flux_power_D), flux_num_cells * sizeof(float)));
+	CUDA_CHECK(cudaMemset(flux_power_D, 0, flux_num_cells * sizeof(float)));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&flux_map_index_D), layout.map_index.size() * sizeof(int)));
+	CUDA_CHECK(cudaMemcpy(flux_map_index_D, layout.map_index.data(),
+		layout.map_index.size() * sizeof(int), cudaMemcpyHostToDevice));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&flux_grids_D), layout.device_grids.size() * sizeof(FluxMapGrid)));
+	CUDA_CHECK(cudaMemcpy(flux_grids_D, layout.device_grids.data(),
+		layout.device_grids.size() * sizeof(FluxMapGrid), cudaMemcpyHostToDevice));
+	launch_params_H.flux_map = { flux_power_D, flux_map_index_D, flux_grids_D,
+		static_cast<unsigned int>(layout.nu), static_cast<unsigned int>(layout.nv), element_power_D };
+}
+
+void dataManager::clearFluxMaps() {
+	if (element_power_D != nullptr)
+		CUDA_CHECK(cudaMemset(element_power_D, 0, flux_num_elements * sizeof(float)));
+	if (flux_power_D == nullptr) return;
+	CUDA_CHECK(cudaMemset(flux_power_D, 0, flux_num_cells * sizeof(float)));
+}
+
+void dataManager::allocateHitStream(size_t capacity) {
+	CUDA_CHECK(cudaFree(hit_records_D));
+	CUDA_CHECK(cudaFree(hit_count_D));
+	CUDA_CHECK(cudaFree(hit_first_lost_D));
+	hit_records_D = nullptr;
+	hit_count_D = nullptr;
+	hit_first_lost_D = nullptr;
+	launch_params_H.hit_stream = { nullptr, nullptr, nullptr, 0ULL, 0u };
+	if (capacity == 0) return;
+
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&hit_records_D), capacity * sizeof(HitRecord)));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&hit_count_D), sizeof(unsigned long long)));
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&hit_first_lost_D), sizeof(unsigned int)));
+	launch_params_H.hit_stream = { hit_records_D, hit_count_D, hit_first_lost_D, capacity, 0u };
+	clearHitStream(0u);
+}
+
+void dataManager::clearHitStream(unsigned int ray_offset) {
+	if (hit_records_D == nullptr) return;
+	CUDA_CHECK(cudaMemset(hit_count_D, 0, sizeof(unsigned long long)));
+	CUDA_CHECK(cudaMemset(hit_first_lost_D, 0xff, sizeof(unsigned int)));
+	launch_params_H.hit_stream.ray_offset = ray_offset;
+}
+
 void dataManager::cleanup() {
 	CUDA_CHECK(cudaFree(launch_params_D));
 	launch_params_D = nullptr;
 
 	CUDA_CHECK(cudaFree(geometry_data_array_D));
 	geometry_data_array_D = nullptr;
+
+	CUDA_CHECK(cudaFree(material_data_array_D));
+	material_data_array_D = nullptr;
+	launch_params_H.material_data_array = nullptr;
+
+	CUDA_CHECK(cudaFree(stage_data_array_D));
+	stage_data_array_D = nullptr;
+	launch_params_H.stage_data_array = nullptr;
+	launch_params_H.num_stages = 0;
+
+	allocateFluxMaps(FluxMapLayout());
+	allocateHitStream(0);
+
+	CUDA_CHECK(cudaFree(sun_shape_prob_D));
+	sun_shape_prob_D = nullptr;
+	CUDA_CHECK(cudaFree(sun_shape_alias_D));
+	sun_shape_alias_D = nullptr;
+	sun_shape_H.reset();
+	launch_params_H.sun_shape = { 0, 0.0f, nullptr, nullptr };
+	launch_params_H.sampler = { SAMPLER_HALTON, 0u, 0ULL, 1u, 1u };
 }
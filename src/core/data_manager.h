@@ -2,6 +2,9 @@
 
 #include "shaders/Soltrace.h"
 #include "CspElement.h"
+#include "sun_shape.h"
+#include "flux_map.h"
+#include <memory>
 #include <vector>
 
 namespace OptixCSP {
@@ -17,6 +20,29 @@ namespace OptixCSP {
 
         // device pointer to geometry data
         GeometryDataST* geometry_data_array_D;
+        // device pointer to the optics of the elements
+        MaterialData* material_data_array_D;
+        // device pointer to the element ranges and flags of the stages
+        StageData* stage_data_array_D;
+
+        // device buffers of the receiver flux maps
+        float* flux_power_D;
+        int* flux_map_index_D;
+        FluxMapGrid* flux_grids_D;
+        size_t flux_num_cells;
+        // device buffer of the receiver power per element, flux_num_elements entries
+        float* element_power_D;
+        size_t flux_num_elements;
+
+        // device buffers of the hit stream: the records, the slots reserved and the first ray lost
+        HitRecord* hit_records_D;
+        unsigned long long* hit_count_D;
+        unsigned int* hit_first_lost_D;
+
+        // device copy of the sunshape alias table
+        std::shared_ptr<const SunShape> sun_shape_H;
+        float* sun_shape_prob_D;
+        int* sun_shape_alias_D;
 
         dataManager();
         ~dataManager();
@@ -33,8 +59,35 @@ namespace OptixCSP {
         // then launch_params_D.geometry_data_array = geometry_data_array_D gets a copy.
         void allocateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array);
 
+        // copy the alias table of the sunshape to the device and point launch_params_H.sun_shape at it,
+        // nothing to do when the same table is already there
+        void allocateSunShape(std::shared_ptr<const SunShape> sun_shape);
+
         // update geometry_data_array_D on the device
         // then launch_params_D.geometry_data_array = geometry_data_array_D gets a copy.
         void updateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array_H);
+
+        // create material_data_array_D on the device and point launch_params_H.material_data_array at it
+        void allocateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H);
+
+        // copy the optics to material_data_array_D again
+        void updateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H);
+
+        // create stage_data_array_D on the device and point launch_params_H.stage_data_array at it
+        void allocateStageDataArray(const std::vector<StageData>& stage_data_array_H);
+
+        // create the flux map buffers of layout on the device and point launch_params_H.flux_map at
+        // them, or turn the maps off when the layout has none; called again when the receivers moved
+        void allocateFluxMaps(const FluxMapLayout& layout);
+
+        // zero the power of every flux map cell and element
+        void clearFluxMaps();
+
+        // create a hit stream of capacity records on the device and point launch_params_H.hit_stream
+        // at it, or turn it off when the capacity is 0
+        void allocateHitStream(size_t capacity);
+
+        // empty the hit stream for a launch whose ray 0 is ray ray_offset of the run
+        void clearHitStream(unsigned int ray_offset);
     };
 }
\ No newline at end of file
@@ -0,0 +1,226 @@
+#include "flux_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+    Vec3d to_vec3d(const float3& v) { return Vec3d(v.x, v.y, v.z); }
+
+    // the rectangle itself, in the frame of its aperture
+    FluxGrid rectangle_grid(const GeometryDataST::Rectangle_Flat& r) {
+        FluxGrid grid;
+        grid.center = to_vec3d(r.center);
+        grid.axis_u = to_vec3d(r.x).normalized();
+        grid.axis_v = to_vec3d(r.y).normalized();
+        grid.width = r.width;
+        grid.height = r.height;
+        return grid;
+    }
+
+    // bounding rectangle of the triangle, u along its first edge
+    FluxGrid triangle_grid(const GeometryDataST::Triangle_Flat& t) {
+        const Vec3d v0 = to_vec3d(t.v0);
+        const Vec3d e1 = to_vec3d(t.e1);
+        const Vec3d e2 = to_vec3d(t.e2);
+        FluxGrid grid;
+        grid.axis_u = e1.normalized();
+        grid.axis_v = to_vec3d(t.normal).cross(grid.axis_u).normalized();
+
+        const double u[3] = { 0.0, e1.dot(grid.axis_u), e2.dot(grid.axis_u) };
+        const double v[3] = { 0.0, e1.dot(grid.axis_v), e2.dot(grid.axis_v) };
+        const double u_min = std::min({ u[0], u[1], u[2] }), u_max = std::max({ u[0], u[1], u[2] });
+        const double v_min = std::min({ v[0], v[1], v[2] }), v_max = std::max({ v[0], v[1], v[2] });
+        grid.center = v0 + grid.axis_u * (0.5 * (u_min + u_max)) + grid.axis_v * (0.5 * (v_min + v_max));
+        grid.width = u_max - u_min;
+        grid.height = v_max - v_min;
+        return grid;
+    }
+
+    // the side of the cylinder, v along its axis base_z x base_x
+    FluxGrid cylinder_grid(const GeometryDataST::Cylinder_Y& c) {
+        FluxGrid grid;
+        grid.shape = FLUX_MAP_CYLINDER;
+        grid.center = to_vec3d(c.center);
+        grid.axis_u = to_vec3d(c.base_x).normalized();
+        grid.axis_v = to_vec3d(c.base_z).cross(grid.axis_u).normalized();
+        grid.radius = c.radius;
+        grid.width = 2.0 * M_PI * c.radius;
+        grid.height = 2.0 * c.half_height;
+        return grid;
+    }
+
+    float3 to_float3(const Vec3d& v) {
+        return make_float3(static_cast<float>(v[0]), static_cast<float>(v[1]), static_cast<float>(v[2]));
+    }
+}
+
+// flux_map_cell in double
+int FluxGrid::cell(const Vec3d& p) const {
+    const Vec3d d = p - center;
+    double u;
+    if (shape == FLUX_MAP_CYLINDER) {
+        const double x = d.dot(axis_u);
+        const double z = d.dot(axis_u.cross(axis_v));
+        if (x * x + z * z < 0.998 * radius * radius) return -1;
+        const double theta = std::atan2(z, x);
+        u = (theta < 0.0 ? theta + 2.0 * M_PI : theta) / (2.0 * M_PI);
+        if (u >= 1.0) u = 0.0;
+    }
+    else {
+        u = d.dot(axis_u) / width + 0.5;
+    }
+    double v = d.dot(axis_v) / height + 0.5;
+    if (shape == FLUX_MAP_CYLINDER)
+        v = std::clamp(v, 0.0, 0.999999);
+    if (!(u >= 0.0 && u < 1.0 && v >= 0.0 && v < 1.0)) return -1;
+    const int iu = std::min(nu - 1, static_cast<int>(u * nu));
+    const int iv = std::min(nv - 1, static_cast<int>(v * nv));
+    return iv * nu + iu;
+}
+
+void OptixCSP::bin_receiver_flux(const FluxGrid& grid, const std::vector<float4>& hit_points,
+                                 const std::vector<float>& hit_power, std::vector<double>& flux) {
+    if (hit_power.size() != hit_points.size())
+        throw std::runtime_error("Flux binning needs one power per hit point.");
+
+    flux.assign(static_cast<size_t>(grid.nu) * grid.nv, 0.0);
+    const double inv_area = 1.0 / grid.cell_area();
+    for (size_t i = 0; i < hit_points.size(); i++) {
+        const float4& h = hit_points[i];
+        if (h.x != 2.0f) continue;
+        const int c = grid.cell(Vec3d(h.y, h.z, h.w));
+        if (c >= 0) flux[c] += hit_power[i] * inv_area;
+    }
+}
+
+FluxMapLayout OptixCSP::layout_flux_maps(const std::vector<std::shared_ptr<CspElement>>& elements,
+                                         const std::vector<GeometryDataST>& geometry, int nu, int nv,
+                                         bool element_power) {
+    if (geometry.size() != elements.size())
+        throw std::runtime_error("Flux map layout needs the geometry of every element.");
+
+    FluxMapLayout layout;
+    layout.nu = std::max(0, nu);
+    layout.nv = std::max(0, nv);
+    layout.map_index.assign(elements.size(), -1);
+    layout.element_power = element_power;
+    if (layout.nu == 0 || layout.nv == 0) return layout;
+
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (!elements[i]->is_receiver()) continue;
+        FluxGrid grid;
+        if (geometry[i].type == GeometryDataST::RECTANGLE_FLAT)
+            grid = rectangle_grid(geometry[i].getRectangle_Flat());
+        else if (geometry[i].type == GeometryDataST::TRIANGLE_FLAT)
+            grid = triangle_grid(geometry[i].getTriangle_Flat());
+        else if (geometry[i].type == GeometryDataST::CYLINDER_Y)
+            grid = cylinder_grid(geometry[i].getCylinder_Y());
+        else
+            continue;
+        grid.nu = layout.nu;
+        grid.nv = layout.nv;
+
+        layout.map_index[i] = static_cast<int>(layout.grids.size());
+        layout.elements.push_back(i);
+        layout.grids.push_back(grid);
+        layout.device_grids.push_back({ to_float3(grid.center), to_float3(grid.axis_u), to_float3(grid.axis_v),
+                                        static_cast<float>(grid.width), static_cast<float>(grid.height),
+                                        static_cast<float>(grid.radius), grid.shape });
+    }
+    return layout;
+}
+
+std::vector<FluxMap> OptixCSP::make_flux_maps(const FluxMapLayout& layout, const std::vector<double>& cell_power) {
+    if (cell_power.size() != layout.num_cells())
+        throw std::runtime_error("Flux maps need the power of every cell.");
+
+    const size_t num_cells = layout.cells_per_map();
+    std::vector<FluxMap> maps(layout.grids.size());
+    for (size_t m = 0; m < maps.size(); m++) {
+        FluxMap& map = maps[m];
+        map.element = layout.elements[m];
+        map.grid = layout.grids[m];
+        map.flux.resize(num_cells);
+        const double inv_area = 1.0 / map.grid.cell_area();
+        for (size_t c = 0; c < num_cells; c++) {
+            const double power = cell_power[m * num_cells + c];
+            map.flux[c] = power * inv_area;
+            map.total_power += power;
+            map.peak_flux = std::max(map.peak_flux, map.flux[c]);
+        }
+    }
+    return maps;
+}
+
+bool OptixCSP::write_receiver_power_vtk(const std::string& filename, const std::vector<std::shared_ptr<CspElement>>& elements,
+                                        const std::vector<GeometryDataST>& geometry, const std::vector<double>& element_power) {
+    if (geometry.size() != elements.size() || element_power.size() != elements.size())
+        throw std::runtime_error("Receiver power export needs the geometry and the power of every element.");
+
+    // corners of every flat receiver, in the order of its edges
+    std::vector<std::vector<Vec3d>> polygons;
+    std::vector<size_t> polygon_element;
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (!elements[i]->is_receiver()) continue;
+        if (geometry[i].type == GeometryDataST::TRIANGLE_FLAT) {
+            const GeometryDataST::Triangle_Flat& t = geometry[i].getTriangle_Flat();
+            const Vec3d v0 = to_vec3d(t.v0);
+            polygons.push_back({ v0, v0 + to_vec3d(t.e1), v0 + to_vec3d(t.e2) });
+        }
+        else if (geometry[i].type == GeometryDataST::RECTANGLE_FLAT) {
+            const FluxGrid r = rectangle_grid(geometry[i].getRectangle_Flat());
+            const Vec3d u = r.axis_u * (0.5 * r.width);
+            const Vec3d v = r.axis_v * (0.5 * r.height);
+            polygons.push_back({ r.center - u - v, r.center + u - v, r.center + u + v, r.center - u + v });
+        }
+        else {
+            continue;
+        }
+        polygon_element.push_back(i);
+    }
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return false;
+    }
+
+    size_t num_points = 0;
+    for (const std::vector<Vec3d>& p : polygons) num_points += p.size();
+    out << "# vtk DataFile Version 3.0\n"
+        << "receiver power per element\n"
+        << "ASCII\n"
+        << "DATASET POLYDATA\n"
+        << "POINTS " << num_points << " double\n";
+    out.precision(9);
+    for (const std::vector<Vec3d>& p : polygons)
+        for (const Vec3d& v : p)
+            out << v[0] << " " << v[1] << " " << v[2] << "\n";
+
+    out << "POLYGONS " << polygons.size() << " " << num_points + polygons.size() << "\n";
+    size_t next_point = 0;
+    for (const std::vector<Vec3d>& p : polygons) {
+        out << p.size();
+        for (size_t k = 0; k < p.size(); k++) out << " " << next_point++;
+        out << "\n";
+    }
+
+    out << "CELL_DATA " << polygons.size() << "\n"
+        << "SCALARS power double 1\nLOOKUP_TABLE default\n";
+    for (size_t e : polygon_element) out << element_power[e] << "\n";
+    out << "SCALARS flux double 1\nLOOKUP_TABLE default\n";
+    for (size_t k = 0; k < polygons.size(); k++) {
+        const std::vector<Vec3d>& p = polygons[k];
+        Vec3d twice_area(0.0, 0.0, 0.0);
+        for (size_t j = 1; j + 1 < p.size(); j++) twice_area = twice_area + (p[j] - p[0]).cross(p[j + 1] - p[0]);
+        out << element_power[polygon_element[k]] / (0.5 * twice_area.norm()) << "\n";
+    }
+    out << "SCALARS element int 1\nLOOKUP_TABLE default\n";
+    for (size_t e : polygon_element) out << e << "\n";
+    return true;
+}
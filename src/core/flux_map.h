@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vec3d.h"
+#include "CspElement.h"
+#include "shaders/GeometryDataST.h"
+#include "shaders/FluxMapData.h"
+
+namespace OptixCSP {
+
+    /// Grid of flux cells over a receiver, centered at center and spanned by the unit axes u and v,
+    /// the frame of FluxMapGrid. A cylinder grid unwraps the side: u is the azimuth from axis_u and
+    /// width the circumference, so the cells keep the area of the surface they cover.
+    struct FluxGrid {
+        Vec3d center;
+        Vec3d axis_u;
+        Vec3d axis_v;
+        double width = 1.0;     // along u, m
+        double height = 1.0;    // along v, m
+        double radius = 0.0;    // of a cylinder, m
+        FluxMapShape shape = FLUX_MAP_FLAT;
+        int nu = 1;
+        int nv = 1;
+
+        double cell_area() const { return width * height / (static_cast<double>(nu) * nv); }
+        /// cell holding point p, row by row along u, -1 outside the grid or on a cap of the cylinder
+        int cell(const Vec3d& p) const;
+    };
+
+    /// Flux in W/m2 of every cell of the grid, row by row along u, from the receiver hits (tag 2) of
+    /// a hit point buffer and the power of the rays arriving there.
+    void bin_receiver_flux(const FluxGrid& grid, const std::vector<float4>& hit_points,
+                           const std::vector<float>& hit_power, std::vector<double>& flux);
+
+    /// Flux map of one receiver, filled during the trace.
+    struct FluxMap {
+        size_t element = 0;         // index of the receiver in the element list, in stage order
+        FluxGrid grid;
+        std::vector<double> flux;   // W/m2 of every cell, row by row along u
+        double peak_flux = 0.0;     // W/m2
+        double total_power = 0.0;   // W, the power of the receiver hits that landed in the grid
+    };
+
+    /// Flux maps of the receivers of a scene, the rectangles, triangles and cylinders: which element
+    /// deposits into which grid, and the grids in the frame of the receivers.
+    struct FluxMapLayout {
+        int nu = 0;
+        int nv = 0;
+        std::vector<int> map_index;             // per element, index of its map, -1 for the others
+        std::vector<size_t> elements;           // per map, its element
+        std::vector<FluxGrid> grids;            // per map
+        std::vector<FluxMapGrid> device_grids;  // the same grids for the trace
+        bool element_power = false;             // sum the receiver hits per element as well
+
+        bool enabled() const { return !grids.empty(); }
+        size_t num_elements() const { return map_index.size(); }
+        size_t cells_per_map() const { return static_cast<size_t>(nu) * nv; }
+        size_t num_cells() const { return grids.size() * cells_per_map(); }
+    };
+
+    /// Layout of nu by nv cell maps over the receivers among elements, geometry is their
+    /// device geometry, in the same order. No maps with nu or nv at 0; element_power sums the power
+    /// of every receiver element with or without them.
+    FluxMapLayout layout_flux_maps(const std::vector<std::shared_ptr<CspElement>>& elements,
+                                   const std::vector<GeometryDataST>& geometry, int nu, int nv,
+                                   bool element_power = false);
+
+    /// Flux maps from the power the cells of every map collected, layout.num_cells() values.
+    std::vector<FluxMap> make_flux_maps(const FluxMapLayout& layout, const std::vector<double>& cell_power);
+
+    /// Write the flat receivers among elements as polygons of a legacy VTK polydata file, the
+    /// facets of a mesh receiver as they are, with the power every one absorbed (element_power, W,
+    /// indexed like elements) and its flux (W/m2) as cell data, for ParaView and the like.
+    bool write_receiver_power_vtk(const std::string& filename, const std::vector<std::shared_ptr<CspElement>>& elements,
+                                  const std::vector<GeometryDataST>& geometry, const std::vector<double>& element_power);
+}
@@ -1,9 +1,10 @@
 #include "geometry_manager.h"
 #include "shaders/GeometryDataST.h"
-#include "sun_utils.h"
 #include "soltrace_state.h"
 #include "utils/util_check.hpp"
 #include "data_manager.h"
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 #include <optix_stubs.h>
 
@@ -15,12 +16,14 @@ void GeometryManager::collect_geometry_info(const std::vector<std::shared_ptr<Cs
     m_aabb_list_H.clear(); // Clear the existing AABB list
     m_sbt_index_H.clear(); // Clear the existing SBT index list
 	m_geometry_data_array_H.clear(); // Clear the existing geometry data array
+	m_material_data_array_H.clear();
 
 	m_obj_counts = static_cast<uint32_t>(element_list.size()); // Number of objects in the scene
 
 	// Resize
 	m_aabb_list_H.resize(m_obj_counts);
 	m_geometry_data_array_H.resize(m_obj_counts);
+	m_material_data_array_H.resize(m_obj_counts);
     m_sbt_index_H.resize(m_obj_counts);
 
 
@@ -94,64 +97,54 @@ void GeometryManager::collect_geometry_info(const std::vector<std::shared_ptr<Cs
 		m_aabb_list_H[i] = aabb; // Store the AABB in the list
         m_sbt_index_H[i] = sbt_offset; // Store the SBT index
         m_geometry_data_array_H[i] = element_list[i]->toDeviceGeometryData();
+        m_material_data_array_H[i] = element_list[i]->toDeviceMaterialData();
     }
 
+    collect_stage_data(element_list);
+
     // print out computed minimum distance 
 	std::cout << "Minimum distance to sun plane: " << m_sun_plane_distance << std::endl;
 }
 
+// the elements come ordered by stage, so every stage is a range of the element arrays; the stages
+// without flags are MULTIHIT, which makes a scene that never set any a single flat stage
+void GeometryManager::collect_stage_data(const std::vector<std::shared_ptr<CspElement>>& element_list) {
+    uint32_t num_stages = std::max<uint32_t>(1u, static_cast<uint32_t>(m_stage_flags.size()));
+    for (uint32_t i = 0; i < m_obj_counts; i++) {
+        const uint32_t stage = element_list[i]->get_stage();
+        if (i > 0 && stage < element_list[i - 1]->get_stage())
+            throw std::runtime_error("Elements are not ordered by stage.");
+        num_stages = std::max(num_stages, stage + 1);
+    }
+    if (num_stages > MAX_STAGES)
+        throw std::runtime_error("Too many stages, at most " + std::to_string(MAX_STAGES) + ".");
+
+    m_stage_data_H.assign(num_stages, StageData{ 0u, 0u, STAGE_MULTIHIT });
+    for (uint32_t s = 0; s < num_stages; s++) {
+        if (s < m_stage_flags.size()) m_stage_data_H[s].flags = m_stage_flags[s];
+    }
+    for (uint32_t i = 0; i < m_obj_counts; i++)
+        m_stage_data_H[element_list[i]->get_stage()].num_elements++;
+    for (uint32_t s = 1; s < num_stages; s++)
+        m_stage_data_H[s].first_element = m_stage_data_H[s - 1].first_element + m_stage_data_H[s - 1].num_elements;
+}
 
-void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
 
-    m_sun_plane_distance = -1;
-    float3 sun_vector = params.sun_vector;
-
-    float* sun_plane_dist_D;
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_plane_dist_D), sizeof(float)));
-    CUDA_CHECK(cudaMemset(sun_plane_dist_D, 0, sizeof(float)));
-
-    compute_d_on_gpu(reinterpret_cast<const OptixAabb*>(m_aabb_list_D), m_obj_counts, sun_vector, sun_plane_dist_D);
-
-    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(&m_sun_plane_distance),
-                         reinterpret_cast<void*>(sun_plane_dist_D),
-                         sizeof(float),
-                         cudaMemcpyDeviceToHost));
-
-    float3 sun_u, sun_v;
-    float3 axis = (abs(sun_vector.x) < 0.9f) ? make_float3(1.0f, 0.0f, 0.0f) : make_float3(0.0f, 1.0f, 0.0f);
-    sun_u = normalize(cross(axis, sun_vector));
-    sun_v = normalize(cross(sun_vector, sun_u));
-    // allocate uv bounds on device, float array of size four
-    float sun_uv_bounds[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-    // allocate memory for the sun_u_bounds on device
-    float* sun_uv_bounds_D;
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_uv_bounds_D), 4 * sizeof(float)));
-
-    compute_uv_bounds_on_gpu(reinterpret_cast<const OptixAabb*>(m_aabb_list_D),
-        m_obj_counts,
-        m_sun_plane_distance,
-        sun_vector,
-        sun_u,
-        sun_v,
-        tan(params.max_sun_angle),
-        sun_uv_bounds_D);
-
-    // Copy the computed bounds back to the host
-    cudaMemcpy(sun_uv_bounds, sun_uv_bounds_D, 4 * sizeof(float), cudaMemcpyDeviceToHost);
-
-    float u_min = sun_uv_bounds[0];
-    float u_max = sun_uv_bounds[1];
-    float v_min = sun_uv_bounds[2];
-    float v_max = sun_uv_bounds[3];
-
-    params.sun_v0 = u_min * sun_u + v_min * sun_v + m_sun_plane_distance * sun_vector;
-    params.sun_v1 = u_max * sun_u + v_min * sun_v + m_sun_plane_distance * sun_vector;
-    params.sun_v2 = u_max * sun_u + v_max * sun_v + m_sun_plane_distance * sun_vector;
-    params.sun_v3 = u_min * sun_u + v_max * sun_v + m_sun_plane_distance * sun_vector;
-
-    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(sun_plane_dist_D)));
-    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(sun_uv_bounds_D)));
+void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
 
+    // over the elements of the first stage only, the sun rays are traced against them
+    const size_t num_sun_elements = get_num_sun_elements();
+    m_sun_plane_updated = num_sun_elements == m_aabb_list_H.size()
+        ? m_sun_plane_tree.sync(m_aabb_list_H, params.sun_vector, params.max_sun_angle)
+        : m_sun_plane_tree.sync(std::vector<OptixAabb>(m_aabb_list_H.begin(), m_aabb_list_H.begin() + num_sun_elements),
+                                params.sun_vector, params.max_sun_angle);
+    SunPlane plane = m_sun_plane_tree.plane();
+    m_sun_plane_distance = plane.distance;
+
+    params.sun_v0 = plane.v0;
+    params.sun_v1 = plane.v1;
+    params.sun_v2 = plane.v2;
+    params.sun_v3 = plane.v3;
 }
 
 void GeometryManager::create_geometries(LaunchParams& params) {
@@ -166,64 +159,166 @@ void GeometryManager::create_geometries(LaunchParams& params) {
 	compute_sun_plane_H(params);
 
     // populate aabb_input_flags vector, size of types, no rebuild
-    std::vector<uint32_t> aabb_input_flags(NUM_OPTICAL_ENTITY_TYPES);
-    for (int i = 0; i < NUM_OPTICAL_ENTITY_TYPES; i++) {
-        aabb_input_flags[i] = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
-    }
+    m_aabb_input_flags.assign(NUM_OPTICAL_ENTITY_TYPES, OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
 
 	// device vector for SBT index, no need to rebuild
-    CUdeviceptr d_sbt_index;
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_sbt_index), m_obj_counts * sizeof(uint32_t)));
-    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_sbt_index),
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_sbt_index_D), m_obj_counts * sizeof(uint32_t)));
+    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(m_sbt_index_D),
                           m_sbt_index_H.data(),
         m_obj_counts * sizeof(uint32_t),
                           cudaMemcpyHostToDevice));
 
-    // Configure the input for the GAS build process.
-    m_aabb_input.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
-    m_aabb_input.customPrimitiveArray.aabbBuffers = &m_aabb_list_D;
-    m_aabb_input.customPrimitiveArray.flags = aabb_input_flags.data();
-    m_aabb_input.customPrimitiveArray.numSbtRecords = NUM_OPTICAL_ENTITY_TYPES;
-    m_aabb_input.customPrimitiveArray.numPrimitives = m_obj_counts;
-    m_aabb_input.customPrimitiveArray.sbtIndexOffsetBuffer = d_sbt_index;
-    m_aabb_input.customPrimitiveArray.sbtIndexOffsetSizeInBytes = sizeof(uint32_t);
-    m_aabb_input.customPrimitiveArray.primitiveIndexOffset = 0;
-
     // Set up acceleration structure (AS) build options.
     m_accel_build_options = {
         OPTIX_BUILD_FLAG_ALLOW_UPDATE,        // allow update
         OPTIX_BUILD_OPERATION_BUILD           // operation type, build a new aceleration structure
     };
 
-    OptixAccelBufferSizes gas_buffer_sizes;     // sizes for temp and output buffers.
+    // One GAS per stage over its range of the AABB list. The primitive index offset keeps
+    // optixGetPrimitiveIndex() the index of the element, into geometry_data_array and material_data_array.
+    const size_t num_stages = m_stage_data_H.size();
+    m_stage_aabb_D.assign(num_stages, 0);
+    m_aabb_inputs.assign(num_stages, OptixBuildInput{});
+    m_gas_handles.assign(num_stages, 0);
+    m_gas_output_buffers.assign(num_stages, 0);
+    m_gas_output_buffer_sizes.assign(num_stages, 0);
+
+    for (size_t s = 0; s < num_stages; s++) {
+        const StageData& stage = m_stage_data_H[s];
+        if (stage.num_elements == 0) continue;   // no instance, a ray in this stage misses
+
+        m_stage_aabb_D[s] = m_aabb_list_D + stage.first_element * sizeof(OptixAabb);
+
+        // Configure the input for the GAS build process.
+        OptixBuildInput& aabb_input = m_aabb_inputs[s];
+        aabb_input.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
+        aabb_input.customPrimitiveArray.aabbBuffers = &m_stage_aabb_D[s];
+        aabb_input.customPrimitiveArray.flags = m_aabb_input_flags.data();
+        aabb_input.customPrimitiveArray.numSbtRecords = NUM_OPTICAL_ENTITY_TYPES;
+        aabb_input.customPrimitiveArray.numPrimitives = stage.num_elements;
+        aabb_input.customPrimitiveArray.sbtIndexOffsetBuffer = m_sbt_index_D + stage.first_element * sizeof(uint32_t);
+        aabb_input.customPrimitiveArray.sbtIndexOffsetSizeInBytes = sizeof(uint32_t);
+        aabb_input.customPrimitiveArray.primitiveIndexOffset = stage.first_element;
+
+        OptixAccelBufferSizes gas_buffer_sizes;     // sizes for temp and output buffers.
+
+        // Query the memory usage required for building the GAS.
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context,
+                                                 &m_accel_build_options,
+                                                 &aabb_input,
+                                                 1,
+                                                 &gas_buffer_sizes));
+
+        // one scratch for every build and update, as large as the largest of them
+        ensure_temp_buffer(std::max(gas_buffer_sizes.tempSizeInBytes, gas_buffer_sizes.tempUpdateSizeInBytes));
+        m_gas_output_buffer_sizes[s] = gas_buffer_sizes.outputSizeInBytes;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_gas_output_buffers[s]), m_gas_output_buffer_sizes[s]));
+
+        // Build the GAS.
+        OPTIX_CHECK(optixAccelBuild(m_state.context,								  // OptiX context
+            m_state.stream,                                  // CUDA stream (default is 0)
+            &m_accel_build_options,
+            &aabb_input,
+            1,
+            m_temp_buffer,
+            m_temp_buffer_size,
+            m_gas_output_buffers[s],
+            m_gas_output_buffer_sizes[s],
+            &m_gas_handles[s],                               // Output handle for the GAS
+            nullptr,                                        // Emitted properties (not used here)
+            0));                                           // Number of emitted properties
+    }
+
+    // One instance per stage with an identity transform, its visibility mask bit is 1 << stage so
+    // a ray traced with that mask only sees the elements of its stage.
+    std::vector<OptixInstance> instances;
+    for (size_t s = 0; s < num_stages; s++) {
+        if (m_stage_data_H[s].num_elements == 0) continue;
+        OptixInstance instance = {};
+        const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                                     0.0f, 1.0f, 0.0f, 0.0f,
+                                     0.0f, 0.0f, 1.0f, 0.0f };
+        std::copy(identity, identity + 12, instance.transform);
+        instance.instanceId = static_cast<unsigned int>(s);
+        instance.sbtOffset = 0;     // every GAS uses the same NUM_OPTICAL_ENTITY_TYPES records
+        instance.visibilityMask = 1u << s;
+        instance.flags = OPTIX_INSTANCE_FLAG_NONE;
+        instance.traversableHandle = m_gas_handles[s];
+        instances.push_back(instance);
+    }
 
-    // Query the memory usage required for building the GAS.
-	OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context, 
-                                             &m_accel_build_options, 
-                                             &m_aabb_input,
-                                             1,
-                                             &gas_buffer_sizes));
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_instances_D), instances.size() * sizeof(OptixInstance)));
+    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(m_instances_D), instances.data(),
+                          instances.size() * sizeof(OptixInstance), cudaMemcpyHostToDevice));
 
-    m_temp_buffer_size   = gas_buffer_sizes.tempSizeInBytes;
-    m_output_buffer_size = gas_buffer_sizes.outputSizeInBytes;
+    m_instance_input = {};
+    m_instance_input.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+    m_instance_input.instanceArray.instances = m_instances_D;
+    m_instance_input.instanceArray.numInstances = static_cast<unsigned int>(instances.size());
 
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_temp_buffer),   m_temp_buffer_size));
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_output_buffer), m_output_buffer_size));
+    m_ias_build_options = {
+        OPTIX_BUILD_FLAG_ALLOW_UPDATE,
+        OPTIX_BUILD_OPERATION_BUILD
+    };
 
-    // Build the GAS.
-	OPTIX_CHECK(optixAccelBuild(m_state.context,								  // OptiX context
-		m_state.stream,                                  // CUDA stream (default is 0)
-        &m_accel_build_options,
-        &m_aabb_input,
+    OptixAccelBufferSizes ias_buffer_sizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context, &m_ias_build_options, &m_instance_input, 1, &ias_buffer_sizes));
+    ensure_temp_buffer(std::max(ias_buffer_sizes.tempSizeInBytes, ias_buffer_sizes.tempUpdateSizeInBytes));
+    m_ias_output_buffer_size = ias_buffer_sizes.outputSizeInBytes;
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_ias_output_buffer), m_ias_output_buffer_size));
+
+    // Build the IAS, the handle of the launch.
+    OPTIX_CHECK(optixAccelBuild(m_state.context,
+        m_state.stream,
+        &m_ias_build_options,
+        &m_instance_input,
         1,
         m_temp_buffer,
         m_temp_buffer_size,
-        m_output_buffer,
-        m_output_buffer_size,
-		&m_state.gas_handle,                             // Output handle for the GAS
-		nullptr,                                        // Emitted properties (not used here)
-		0));                                           // Number of emitted properties
-    
+        m_ias_output_buffer,
+        m_ias_output_buffer_size,
+        &m_state.ias_handle,
+        nullptr,
+        0));
+}
+
+void GeometryManager::cleanup() {
+    for (CUdeviceptr& buffer : m_gas_output_buffers) {
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(buffer)));
+        buffer = 0;
+    }
+    m_gas_output_buffers.clear();
+    m_gas_output_buffer_sizes.clear();
+    m_gas_handles.clear();
+
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_ias_output_buffer)));
+    m_ias_output_buffer = 0;
+    m_ias_output_buffer_size = 0;
+    m_state.ias_handle = 0;
+
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_instances_D)));
+    m_instances_D = 0;
+
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_aabb_list_D)));
+    m_aabb_list_D = 0;
+    m_stage_aabb_D.clear();
+    m_aabb_inputs.clear();
+
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_sbt_index_D)));
+    m_sbt_index_D = 0;
+
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_temp_buffer)));
+    m_temp_buffer = 0;
+    m_temp_buffer_size = 0;
+}
+
+// the scratch of the builds only grows, the builds run one after the other on the same stream
+void GeometryManager::ensure_temp_buffer(size_t size) {
+    if (size <= m_temp_buffer_size) return;
+    CUDA_CHECK(cudaStreamSynchronize(m_state.stream));
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_temp_buffer)));
+    m_temp_buffer_size = size;
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_temp_buffer), m_temp_buffer_size));
 }
 
 
@@ -232,42 +327,46 @@ void GeometryManager::update_geometry_info(const std::vector<std::shared_ptr<Csp
 	// Recollect geometry info
 	collect_geometry_info(element_list, params);
 
-    // update device aabb list
+    // update device aabb list, the stage ranges point into it
 	CUDA_CHECK(cudaMemcpyAsync(
 		reinterpret_cast<void*>(m_aabb_list_D),
 		m_aabb_list_H.data(),
 		m_aabb_list_H.size() * sizeof(OptixAabb),
 		cudaMemcpyHostToDevice, m_state.stream));
 
-    std::vector<uint32_t> aabb_input_flags(NUM_OPTICAL_ENTITY_TYPES);
-    for (int i = 0; i < NUM_OPTICAL_ENTITY_TYPES; i++) {
-        aabb_input_flags[i] = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
-    }
-
-	m_aabb_input.customPrimitiveArray.flags = aabb_input_flags.data();
-
-
-    CUDA_CHECK(cudaMemcpyAsync(
-        reinterpret_cast<void*>(m_aabb_input.customPrimitiveArray.aabbBuffers[0]),
-        m_aabb_list_H.data(),
-        m_aabb_list_H.size() * sizeof(OptixAabb),
-        cudaMemcpyHostToDevice, m_state.stream));
-
     m_accel_build_options.operation = OPTIX_BUILD_OPERATION_UPDATE; // set to update 
 
-    OPTIX_CHECK(optixAccelBuild(m_state.context,								  // OptiX context
-        m_state.stream,                                  // CUDA stream (default is 0)
-        &m_accel_build_options,
-        &m_aabb_input,
+    // refit the GAS of every stage
+    for (size_t s = 0; s < m_aabb_inputs.size(); s++) {
+        if (m_gas_handles[s] == 0) continue;
+        OPTIX_CHECK(optixAccelBuild(m_state.context,								  // OptiX context
+            m_state.stream,                                  // CUDA stream (default is 0)
+            &m_accel_build_options,
+            &m_aabb_inputs[s],
+            1,
+            m_temp_buffer,
+            m_temp_buffer_size,
+            m_gas_output_buffers[s],
+            m_gas_output_buffer_sizes[s],
+            &m_gas_handles[s],                               // Output handle for the GAS
+            nullptr,                                        // Emitted properties (not used here)
+            0));                                           // Number of emitted properties
+    }
+
+    // then the IAS over them, the instances did not change but their bounds did
+    m_ias_build_options.operation = OPTIX_BUILD_OPERATION_UPDATE;
+    OPTIX_CHECK(optixAccelBuild(m_state.context,
+        m_state.stream,
+        &m_ias_build_options,
+        &m_instance_input,
         1,
         m_temp_buffer,
         m_temp_buffer_size,
-        m_output_buffer,
-        m_output_buffer_size,
-        &m_state.gas_handle,                             // Output handle for the GAS
-        nullptr,                                        // Emitted properties (not used here)
-        0));                                           // Number of emitted properties
-
+        m_ias_output_buffer,
+        m_ias_output_buffer_size,
+        &m_state.ias_handle,
+        nullptr,
+        0));
 
 	compute_sun_plane_H(params);
-}
\ No newline at end of file
+}
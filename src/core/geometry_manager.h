@@ -6,6 +6,7 @@
 #include "shaders/Soltrace.h"
 #include "CspElement.h"
 #include "soltrace_state.h"
+#include "cpu/sun_plane.h"
 
 namespace OptixCSP {
 
@@ -13,7 +14,8 @@ namespace OptixCSP {
 	/**
 	 * @class geometryManager
 	 * @brief Given the geoemtry of the elements, populate the list of aabb,
-	 * compute the sun plane, and build the GAS (Geometry Acceleration Structure) for ray tracing.
+	 * compute the sun plane, and build the GAS (Geometry Acceleration Structure) for ray tracing:
+	 * one GAS per stage under an IAS with one instance per stage.
 	 */
 	class GeometryManager {
 	public:
@@ -27,40 +29,81 @@ namespace OptixCSP {
 		void collect_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
 			LaunchParams& params);
 
-		/// build the GAS (Geometry Acceleration Structure) using the AABB list, populate optix state
+		/// build the GAS (Geometry Acceleration Structure) of every stage using the AABB list and the
+		/// IAS over them, populate optix state
 		void create_geometries(LaunchParams& params);
 
 
-		/// update the GAS (Geometry Acceleration Structure) using the AABB list, populate optix state
+		/// update the GAS (Geometry Acceleration Structure) of every stage and the IAS using the AABB list, populate optix state
 		void update_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
 			LaunchParams& params);
 
+		/// free the device buffers of the GAS, the IAS, the instances, the AABBs and the SBT index
+		void cleanup();
+
 		/// return the list of geometry data vector
 		std::vector<GeometryDataST>& get_geometry_data_array() { return m_geometry_data_array_H; }
+		/// return the optics of every element, in the order of the geometry data
+		std::vector<MaterialData>& get_material_data_array() { return m_material_data_array_H; }
+
+		/// return the host aabb list and the sbt offset (OpticalEntityType) of every element
+		const std::vector<OptixAabb>& get_aabb_list() const { return m_aabb_list_H; }
+		const std::vector<uint32_t>& get_sbt_index_list() const { return m_sbt_index_H; }
 
-		// compute sun plane 
+		/// StageFlags of every stage, the stages past the end are MULTIHIT
+		void set_stage_flags(const std::vector<unsigned int>& flags) { m_stage_flags = flags; }
+		/// element range and flags of every stage; the elements have to be ordered by stage
+		const std::vector<StageData>& get_stage_data() const { return m_stage_data_H; }
+		/// the sun rays start in the first stage: number of elements at the front of the lists the sun
+		/// plane covers, all of them when the first stage is empty
+		size_t get_num_sun_elements() const {
+			return m_stage_data_H.empty() || m_stage_data_H[0].num_elements == 0 ? m_aabb_list_H.size() : m_stage_data_H[0].num_elements;
+		}
+
+		/// compute the sun plane on the host; after an update only the elements whose AABB
+		/// changed are recomputed, unless the sun vector or angle changed as well
 		void compute_sun_plane_H(LaunchParams& params);
+		/// elements whose sun plane extent the last compute_sun_plane_H recomputed
+		size_t get_sun_plane_updated() const { return m_sun_plane_updated; }
 
 
 	private:
+		void collect_stage_data(const std::vector<std::shared_ptr<CspElement>>& element_list);
+		void ensure_temp_buffer(size_t size);
+
 		SoltraceState& m_state;
 		float m_sun_plane_distance = -1.0f; // distance of the sun plane from the origin
+		size_t m_sun_plane_updated = 0;     // extents recomputed by the last compute_sun_plane_H
 		uint32_t m_obj_counts;
 
 		// data related to the geometry and the scene on the host side
 		std::vector<OptixAabb>      m_aabb_list_H;           // aabb list
 		std::vector<GeometryDataST> m_geometry_data_array_H; // geometry data
+		std::vector<MaterialData>   m_material_data_array_H; // optics
 		std::vector<uint32_t>       m_sbt_index_H;           // sbt offset index
+		SunPlaneTree                m_sun_plane_tree;        // per-element sun plane extents
+		std::vector<unsigned int>   m_stage_flags;           // StageFlags set by the system
+		std::vector<StageData>      m_stage_data_H;          // element range and flags of every stage
 
-		// members related to building GAS
-		OptixBuildInput        m_aabb_input = {};                   // needed after the first build
+		// members related to building GAS, one per stage
+		std::vector<OptixBuildInput> m_aabb_inputs;         // needed after the first build
+		std::vector<uint32_t>  m_aabb_input_flags;          // referenced by the build inputs
 		OptixAccelBuildOptions m_accel_build_options = {};  // needed after the first build
 		CUdeviceptr            m_aabb_list_D{};          // device pointer to the aabb list
+		CUdeviceptr            m_sbt_index_D{};          // sbt offset of every element, referenced by the build inputs
+		std::vector<CUdeviceptr> m_stage_aabb_D;         // start of the aabbs of every stage in m_aabb_list_D
 
+		std::vector<OptixTraversableHandle> m_gas_handles;   // 0 for a stage without elements
+		std::vector<CUdeviceptr> m_gas_output_buffers;       // output buffer of every GAS
+		std::vector<size_t>      m_gas_output_buffer_sizes;
+		CUdeviceptr m_temp_buffer{};     // temporary buffer for building every GAS and the IAS
+		size_t m_temp_buffer_size = 0;     // size of that scratch
 
-		CUdeviceptr m_output_buffer{};   // output buffer
-		CUdeviceptr m_temp_buffer{};     // temporary buffer for building GAS
-		size_t m_output_buffer_size = 0;   // size of that scratch
-		size_t m_temp_buffer_size = 0;     // size of the output buffer
+		// members related to building the IAS
+		OptixBuildInput        m_instance_input = {};
+		OptixAccelBuildOptions m_ias_build_options = {};
+		CUdeviceptr            m_instances_D{};          // one OptixInstance per stage with elements
+		CUdeviceptr            m_ias_output_buffer{};
+		size_t                 m_ias_output_buffer_size = 0;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "hit_stream.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace OptixCSP;
+
+HitStreamPlanner::HitStreamPlanner(size_t num_rays, size_t capacity)
+    : m_num_rays(num_rays), m_capacity(capacity), m_begin(0), m_end(num_rays), m_pass(0), m_reserved(0), m_traced(0) {
+    if (capacity == 0)
+        throw std::runtime_error("A hit stream holds at least one record.");
+}
+
+void HitStreamPlanner::finish_pass(uint64_t reserved, size_t first_lost) {
+    const size_t end = std::min(first_lost, m_end);
+    m_reserved += reserved;
+    m_traced += m_end - m_begin;
+
+    size_t window;
+    if (end > m_begin) {
+        // a tenth of the stream spare for the rays with longer paths than the mean
+        const double per_ray = static_cast<double>(m_reserved) / m_traced;
+        window = per_ray > 0.0 ? static_cast<size_t>(0.9 * m_capacity / per_ray) : m_num_rays;
+    }
+    else {
+        if (m_end - m_begin == 1)
+            throw std::runtime_error("The path of ray " + std::to_string(m_begin) + " has more records than the hit stream holds ("
+                                     + std::to_string(m_capacity) + ").");
+        window = (m_end - m_begin) / 2;
+    }
+
+    m_begin = end;
+    m_end = std::min(m_num_rays, m_begin + std::max<size_t>(window, 1));
+    m_pass++;
+}
+
+void OptixCSP::decode_hit_records(const std::vector<HitRecord>& records, size_t num_rays, int max_depth,
+                                  std::vector<float4>& hit_points, std::vector<float>& hit_power) {
+    hit_points.assign(num_rays * max_depth, make_float4(0.0f, 0.0f, 0.0f, 0.0f));
+    hit_power.assign(num_rays * max_depth, 0.0f);
+    for (const HitRecord& r : records) {
+        if (r.ray >= num_rays || r.depth >= max_depth) continue;
+        const size_t index = static_cast<size_t>(max_depth) * r.ray + r.depth;
+        hit_points[index] = make_float4(static_cast<float>(r.tag), r.position);
+        hit_power[index] = r.power;
+    }
+}
+
+double OptixCSP::hit_record_receiver_power(const std::vector<HitRecord>& records) {
+    double power = 0.0;
+    for (const HitRecord& r : records)
+        if (r.tag == 2) power += r.power;
+    return power;
+}
+
+int OptixCSP::count_receiver_records(const std::vector<HitRecord>& records) {
+    int count = 0;
+    for (const HitRecord& r : records)
+        count += r.tag == 2;
+    return count;
+}
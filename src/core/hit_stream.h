@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "shaders/HitStreamData.h"
+
+namespace OptixCSP {
+
+    /// Passes of a run writing a hit stream of capacity records. The first pass traces every ray, so
+    /// the receiver tallies are complete after it; when its stream overflowed, each later pass traces
+    /// again the rays from the lowest one that lost a record on, only to collect their records: as
+    /// many rays as the records per ray seen so far let fit, half as many after a pass that could not
+    /// keep a single ray. The sun samples and bounce randoms of a ray only depend on its number, so a
+    /// ray traced again takes the same path.
+    class HitStreamPlanner {
+    public:
+        HitStreamPlanner(size_t num_rays, size_t capacity);
+
+        /// rays [begin, end) of the current pass
+        size_t begin() const { return m_begin; }
+        size_t end() const { return m_end; }
+        /// 0 for the first pass, which deposits the receiver power
+        int pass() const { return m_pass; }
+        bool done() const { return m_begin >= m_num_rays; }
+
+        /// the current pass reserved that many slots and lost records of first_lost and the rays
+        /// after it, num_rays when none; its records below first_lost are kept, the next pass starts
+        /// there. Throws when a single path has more records than the stream holds.
+        void finish_pass(uint64_t reserved, size_t first_lost);
+
+    private:
+        size_t m_num_rays;
+        size_t m_capacity;
+        size_t m_begin;
+        size_t m_end;
+        int m_pass;
+        uint64_t m_reserved;     // slots the passes asked for, over m_traced rays
+        size_t m_traced;
+    };
+
+    /// Fixed layout of the records of a stream: a hit point buffer of num_rays * max_depth entries,
+    /// (tag, position) at max_depth * ray + depth, and the power arriving there. The slots of the
+    /// records a stream does not hold, the rays that hit nothing included, stay zero.
+    void decode_hit_records(const std::vector<HitRecord>& records, size_t num_rays, int max_depth,
+                            std::vector<float4>& hit_points, std::vector<float>& hit_power);
+
+    /// summed power of the receiver records (tag 2)
+    double hit_record_receiver_power(const std::vector<HitRecord>& records);
+    /// number of receiver records (tag 2)
+    int count_receiver_records(const std::vector<HitRecord>& records);
+}
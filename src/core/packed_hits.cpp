@@ -0,0 +1,332 @@
+#include "packed_hits.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+    const char PACKED_HIT_MAGIC[8] = { 'C', 'S', 'P', 'H', 'I', 'T', 'S', '1' };
+
+    Vec3d to_vec3d(const float3& v) { return Vec3d(v.x, v.y, v.z); }
+
+    float3 to_float3(const Vec3d& v) {
+        return make_float3(static_cast<float>(v[0]), static_cast<float>(v[1]), static_cast<float>(v[2]));
+    }
+
+    uint16_t quantize(double t) {
+        return static_cast<uint16_t>(std::lround(std::clamp(t, 0.0, 1.0) * PACKED_HIT_STEPS));
+    }
+
+    HitFrame rectangle_frame(const GeometryDataST::Rectangle_Flat& r) {
+        HitFrame frame;
+        frame.center = to_vec3d(r.center);
+        frame.axis_u = to_vec3d(r.x).normalized();
+        frame.axis_v = to_vec3d(r.y).normalized();
+        frame.normal = frame.axis_u.cross(frame.axis_v).normalized();
+        frame.width = r.width;
+        frame.height = r.height;
+        return frame;
+    }
+
+    // bounding rectangle of the triangle, u along its first edge, as its flux grid
+    HitFrame triangle_frame(const GeometryDataST::Triangle_Flat& t) {
+        const Vec3d v0 = to_vec3d(t.v0);
+        const Vec3d e1 = to_vec3d(t.e1);
+        const Vec3d e2 = to_vec3d(t.e2);
+        HitFrame frame;
+        frame.normal = to_vec3d(t.normal).normalized();
+        frame.axis_u = e1.normalized();
+        frame.axis_v = frame.normal.cross(frame.axis_u).normalized();
+
+        const double u[3] = { 0.0, e1.dot(frame.axis_u), e2.dot(frame.axis_u) };
+        const double v[3] = { 0.0, e1.dot(frame.axis_v), e2.dot(frame.axis_v) };
+        const double u_min = std::min({ u[0], u[1], u[2] }), u_max = std::max({ u[0], u[1], u[2] });
+        const double v_min = std::min({ v[0], v[1], v[2] }), v_max = std::max({ v[0], v[1], v[2] });
+        frame.center = v0 + frame.axis_u * (0.5 * (u_min + u_max)) + frame.axis_v * (0.5 * (v_min + v_max));
+        frame.width = u_max - u_min;
+        frame.height = v_max - v_min;
+        return frame;
+    }
+
+    // the side unwrapped and the caps past its rims, v along the axis base_z x base_x
+    HitFrame cylinder_frame(const GeometryDataST::Cylinder_Y& c) {
+        HitFrame frame;
+        frame.shape = HIT_FRAME_CYLINDER;
+        frame.center = to_vec3d(c.center);
+        frame.axis_u = to_vec3d(c.base_x).normalized();
+        frame.axis_v = to_vec3d(c.base_z).cross(frame.axis_u).normalized();
+        frame.normal = frame.axis_u.cross(frame.axis_v);
+        frame.radius = c.radius;
+        frame.width = 2.0 * M_PI * c.radius;
+        frame.height = 2.0 * (c.half_height + c.radius);
+        return frame;
+    }
+
+    // v1 and v2 are the edges from the anchor corner scaled by their inverse squared length, the
+    // normal is e2 x e1 as the intersection has it
+    HitFrame parabolic_frame(const float3& v1, const float3& v2, const float3& anchor, double curv_u, double curv_v) {
+        const Vec3d s1 = to_vec3d(v1), s2 = to_vec3d(v2);
+        const double l1 = 1.0 / s1.norm(), l2 = 1.0 / s2.norm();
+        HitFrame frame;
+        frame.shape = curv_u != 0.0 || curv_v != 0.0 ? HIT_FRAME_PARABOLIC : HIT_FRAME_FLAT;
+        frame.axis_u = s1 * l1;
+        frame.axis_v = s2 * l2;
+        frame.normal = frame.axis_v.cross(frame.axis_u).normalized();
+        frame.center = to_vec3d(anchor) + frame.axis_u * (0.5 * l1) + frame.axis_v * (0.5 * l2);
+        frame.width = l1;
+        frame.height = l2;
+        frame.curv_u = curv_u;
+        frame.curv_v = curv_v;
+        return frame;
+    }
+
+    void write_vec(std::ofstream& out, const Vec3d& v) {
+        const double d[3] = { v[0], v[1], v[2] };
+        out.write(reinterpret_cast<const char*>(d), sizeof(d));
+    }
+
+    Vec3d read_vec(std::ifstream& in) {
+        double d[3];
+        in.read(reinterpret_cast<char*>(d), sizeof(d));
+        return Vec3d(d[0], d[1], d[2]);
+    }
+
+    template <class T> void write_value(std::ofstream& out, T value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <class T> T read_value(std::ifstream& in) {
+        T value{};
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+
+    void write_frame(std::ofstream& out, const HitFrame& frame) {
+        write_vec(out, frame.center);
+        write_vec(out, frame.axis_u);
+        write_vec(out, frame.axis_v);
+        write_vec(out, frame.normal);
+        for (double d : { frame.width, frame.height, frame.radius, frame.curv_u, frame.curv_v })
+            write_value(out, d);
+        write_value<uint32_t>(out, frame.shape);
+        write_value<uint32_t>(out, static_cast<uint32_t>(frame.tag));
+    }
+
+    HitFrame read_frame(std::ifstream& in) {
+        HitFrame frame;
+        frame.center = read_vec(in);
+        frame.axis_u = read_vec(in);
+        frame.axis_v = read_vec(in);
+        frame.normal = read_vec(in);
+        frame.width = read_value<double>(in);
+        frame.height = read_value<double>(in);
+        frame.radius = read_value<double>(in);
+        frame.curv_u = read_value<double>(in);
+        frame.curv_v = read_value<double>(in);
+        frame.shape = static_cast<HitFrameShape>(read_value<uint32_t>(in));
+        frame.tag = static_cast<int>(read_value<uint32_t>(in));
+        return frame;
+    }
+}
+
+void HitFrame::local(const Vec3d& p, double& u, double& v) const {
+    const Vec3d d = p - center;
+    const double y = d.dot(axis_v);
+    if (shape != HIT_FRAME_CYLINDER) {
+        u = d.dot(axis_u) / width + 0.5;
+        v = y / height + 0.5;
+        return;
+    }
+
+    const double x = d.dot(axis_u);
+    const double z = d.dot(normal);
+    const double theta = std::atan2(z, x);
+    u = (theta < 0.0 ? theta + 2.0 * M_PI : theta) / (2.0 * M_PI);
+
+    // on the side or on the cap it is closer to, a cap past the rim by the distance from it
+    const double half_height = 0.5 * height - radius;
+    const double rho = std::sqrt(x * x + z * z);
+    double s = y;
+    if (std::abs(std::abs(y) - half_height) < std::abs(rho - radius))
+        s = std::copysign(half_height + std::max(0.0, radius - rho), y);
+    v = s / height + 0.5;
+}
+
+Vec3d HitFrame::world(double u, double v) const {
+    const double y = (v - 0.5) * height;
+    if (shape != HIT_FRAME_CYLINDER) {
+        const double x = (u - 0.5) * width;
+        Vec3d p = center + axis_u * x + axis_v * y;
+        if (shape == HIT_FRAME_PARABOLIC)
+            p = p + normal * (0.5 * (curv_u * x * x + curv_v * y * y));
+        return p;
+    }
+
+    const double theta = 2.0 * M_PI * u;
+    const double half_height = 0.5 * height - radius;
+    double rho = radius, h = y;
+    if (std::abs(y) > half_height) {
+        rho = std::max(0.0, radius - (std::abs(y) - half_height));
+        h = std::copysign(half_height, y);
+    }
+    return center + axis_u * (rho * std::cos(theta)) + normal * (rho * std::sin(theta)) + axis_v * h;
+}
+
+double HitFrame::resolution() const {
+    double du = 0.5 * width / PACKED_HIT_STEPS;
+    double dv = 0.5 * height / PACKED_HIT_STEPS;
+    // a step on a parabolic frame also moves along the normal, by the slope at the rim
+    if (shape == HIT_FRAME_PARABOLIC) {
+        du *= std::sqrt(1.0 + std::pow(0.5 * curv_u * width, 2));
+        dv *= std::sqrt(1.0 + std::pow(0.5 * curv_v * height, 2));
+    }
+    return std::sqrt(du * du + dv * dv);
+}
+
+HitFrames OptixCSP::make_hit_frames(const std::vector<std::shared_ptr<CspElement>>& elements,
+                                    const std::vector<GeometryDataST>& geometry, const std::vector<StageData>& stages,
+                                    const float3& sun_v0, const float3& sun_v1, const float3& sun_v3) {
+    if (geometry.size() != elements.size())
+        throw std::runtime_error("Hit frames need the geometry of every element.");
+
+    HitFrames frames;
+    frames.elements.resize(elements.size());
+    for (size_t i = 0; i < elements.size(); i++) {
+        const GeometryDataST& g = geometry[i];
+        HitFrame& frame = frames.elements[i];
+        switch (g.type) {
+        case GeometryDataST::RECTANGLE_FLAT:
+            frame = rectangle_frame(g.getRectangle_Flat());
+            break;
+        case GeometryDataST::TRIANGLE_FLAT:
+            frame = triangle_frame(g.getTriangle_Flat());
+            break;
+        case GeometryDataST::CYLINDER_Y:
+            frame = cylinder_frame(g.getCylinder_Y());
+            break;
+        case GeometryDataST::RECTANGLE_PARABOLIC: {
+            const GeometryDataST::Rectangle_Parabolic& r = g.getRectangleParabolic();
+            frame = parabolic_frame(r.v1, r.v2, r.anchor, r.curv_x, r.curv_y);
+            break;
+        }
+        case GeometryDataST::PARALLELOGRAM: {
+            const GeometryDataST::Parallelogram& p = g.getParallelogram();
+            frame = parabolic_frame(p.v1, p.v2, p.anchor, 0.0, 0.0);
+            break;
+        }
+        default:
+            throw std::runtime_error("Element " + std::to_string(i) + " has no geometry to pack its hits on.");
+        }
+        frame.tag = elements[i]->is_receiver() ? 2 : 1;
+    }
+
+    for (const StageData& stage : stages) {
+        if (!(stage.flags & STAGE_VIRTUAL)) continue;
+        for (unsigned int i = stage.first_element; i < stage.first_element + stage.num_elements && i < elements.size(); i++)
+            frames.elements[i].tag = static_cast<int>(HIT_TAG_VIRTUAL);
+    }
+
+    const Vec3d v0 = to_vec3d(sun_v0);
+    const Vec3d e1 = to_vec3d(sun_v1) - v0;
+    const Vec3d e2 = to_vec3d(sun_v3) - v0;
+    frames.sun.center = v0 + (e1 + e2) * 0.5;
+    frames.sun.axis_u = e1.normalized();
+    frames.sun.axis_v = e2.normalized();
+    frames.sun.normal = frames.sun.axis_u.cross(frames.sun.axis_v).normalized();
+    frames.sun.width = e1.norm();
+    frames.sun.height = e2.norm();
+    frames.sun.tag = 0;
+    return frames;
+}
+
+PackedHit OptixCSP::pack_hit(const HitFrames& frames, uint32_t element, const float3& p) {
+    double u, v;
+    frames.frame(element).local(to_vec3d(p), u, v);
+    return { element, quantize(u), quantize(v) };
+}
+
+float4 OptixCSP::unpack_hit(const HitFrames& frames, const PackedHit& hit) {
+    if (hit.element == PACKED_HIT_EMPTY) return make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+    const HitFrame& frame = frames.frame(hit.element);
+    const Vec3d p = frame.world(hit.u / PACKED_HIT_STEPS, hit.v / PACKED_HIT_STEPS);
+    return make_float4(static_cast<float>(frame.tag), to_float3(p));
+}
+
+std::vector<PackedHit> OptixCSP::pack_hit_records(const HitFrames& frames, const std::vector<HitRecord>& records,
+                                                  size_t num_rays, int max_depth) {
+    std::vector<PackedHit> hits(num_rays * max_depth, PackedHit{ PACKED_HIT_EMPTY, 0, 0 });
+    for (const HitRecord& r : records) {
+        if (r.ray >= num_rays || r.depth >= max_depth) continue;
+        hits[static_cast<size_t>(max_depth) * r.ray + r.depth] = pack_hit(frames, r.element, r.position);
+    }
+    return hits;
+}
+
+std::vector<float4> OptixCSP::unpack_hits(const HitFrames& frames, const std::vector<PackedHit>& hits) {
+    std::vector<float4> hit_points(hits.size());
+    for (size_t i = 0; i < hits.size(); i++)
+        hit_points[i] = unpack_hit(frames, hits[i]);
+    return hit_points;
+}
+
+bool OptixCSP::write_packed_hits(const std::string& filename, const PackedHitFile& file) {
+    if (file.hits.size() != file.num_rays * file.max_depth)
+        throw std::runtime_error("A packed hit file holds max_depth hits for every ray.");
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return false;
+    }
+
+    out.write(PACKED_HIT_MAGIC, sizeof(PACKED_HIT_MAGIC));
+    write_value<uint64_t>(out, file.num_rays);
+    write_value<uint32_t>(out, static_cast<uint32_t>(file.max_depth));
+    write_value<uint32_t>(out, static_cast<uint32_t>(file.frames.elements.size()));
+    for (const HitFrame& frame : file.frames.elements)
+        write_frame(out, frame);
+    write_frame(out, file.frames.sun);
+    for (const PackedHit& h : file.hits) {
+        write_value(out, h.element);
+        write_value(out, h.u);
+        write_value(out, h.v);
+    }
+    return out.good();
+}
+
+bool OptixCSP::read_packed_hits(const std::string& filename, PackedHitFile& file) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for reading." << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(PACKED_HIT_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, PACKED_HIT_MAGIC, sizeof(magic)) != 0)
+        throw std::runtime_error(filename + " is not a packed hit file.");
+
+    file = PackedHitFile();
+    file.num_rays = read_value<uint64_t>(in);
+    file.max_depth = static_cast<int>(read_value<uint32_t>(in));
+    const uint32_t num_frames = read_value<uint32_t>(in);
+    file.frames.elements.resize(num_frames);
+    for (HitFrame& frame : file.frames.elements)
+        frame = read_frame(in);
+    file.frames.sun = read_frame(in);
+
+    file.hits.resize(file.num_rays * file.max_depth);
+    for (PackedHit& h : file.hits) {
+        h.element = read_value<uint32_t>(in);
+        h.u = read_value<uint16_t>(in);
+        h.v = read_value<uint16_t>(in);
+    }
+    if (!in)
+        throw std::runtime_error(filename + " ends before its hits do.");
+    return true;
+}
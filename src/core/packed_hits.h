@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vec3d.h"
+#include "CspElement.h"
+#include "shaders/GeometryDataST.h"
+#include "shaders/StageData.h"
+#include "shaders/HitStreamData.h"
+
+namespace OptixCSP {
+
+    /// A hit as the element it landed on and where on it: u and v in [0, 1] over the frame of the
+    /// element, quantized to 16 bits each. 8 bytes where the hit point buffer takes a float4, and
+    /// it keeps the element; the tag follows from the element.
+    struct PackedHit {
+        uint32_t element;   // in stage order, HIT_NO_ELEMENT for the sun point, PACKED_HIT_EMPTY for no hit
+        uint16_t u;
+        uint16_t v;
+    };
+
+    /// element of the slots of a packed layout no hit was recorded in
+    const uint32_t PACKED_HIT_EMPTY = 0xfffffffeu;
+    const double PACKED_HIT_STEPS = 65535.0;
+
+    enum HitFrameShape : uint32_t {
+        HIT_FRAME_FLAT = 0,         // the plane of the aperture
+        HIT_FRAME_PARABOLIC = 1,    // the plane of the aperture and the sag (curv_u u^2 + curv_v v^2) / 2 along the normal
+        HIT_FRAME_CYLINDER = 2      // u the azimuth from axis_u, v along axis_v with the caps unrolled past the rim
+    };
+
+    /// Frame of an element its hits are packed in, centered at center and spanned by the unit axes
+    /// u and v, width and height the extent of the aperture along them. The side of a cylinder is
+    /// unwrapped as its flux map is, and each cap follows it along v out to its center, the can
+    /// unrolled: height is twice the half height and the radius.
+    struct HitFrame {
+        Vec3d center;
+        Vec3d axis_u;
+        Vec3d axis_v;
+        Vec3d normal;           // of the plane of a flat or parabolic frame
+        double width = 0.0;     // along u, m, the circumference of a cylinder
+        double height = 0.0;    // along v, m
+        double radius = 0.0;    // of a cylinder, m
+        double curv_u = 0.0;    // of a parabolic frame, 1/m
+        double curv_v = 0.0;
+        HitFrameShape shape = HIT_FRAME_FLAT;
+        int tag = 1;            // of the hits, as in the hit point buffer
+
+        /// u and v of point p, in [0, 1] on the aperture
+        void local(const Vec3d& p, double& u, double& v) const;
+        /// the point at u and v
+        Vec3d world(double u, double v) const;
+        /// largest distance between a point of the frame and the one its quantized u and v decode
+        /// to, half a step along both axes, m
+        double resolution() const;
+    };
+
+    /// Frames of the elements of a scene, in stage order, and of the sun plane the sun points are on.
+    struct HitFrames {
+        std::vector<HitFrame> elements;
+        HitFrame sun;
+
+        const HitFrame& frame(uint32_t element) const { return element == HIT_NO_ELEMENT ? sun : elements.at(element); }
+    };
+
+    /// Frames of elements from their device geometry, in the same order, and the stages they are
+    /// in: the mirrors tag their hits 1, the receivers 2 and the elements of a virtual stage 3.
+    /// sun_v0, sun_v1 and sun_v3 are the corner of the sun plane and its neighbours along the edges.
+    HitFrames make_hit_frames(const std::vector<std::shared_ptr<CspElement>>& elements,
+                              const std::vector<GeometryDataST>& geometry, const std::vector<StageData>& stages,
+                              const float3& sun_v0, const float3& sun_v1, const float3& sun_v3);
+
+    /// point p of element, HIT_NO_ELEMENT for a sun point, quantized on its frame
+    PackedHit pack_hit(const HitFrames& frames, uint32_t element, const float3& p);
+    /// the tag and position of a packed hit as the hit point buffer has them, zero for an empty slot
+    float4 unpack_hit(const HitFrames& frames, const PackedHit& hit);
+
+    /// Fixed layout of the records of a hit stream packed, num_rays * max_depth hits, the record
+    /// of ray and depth at max_depth * ray + depth; the slots no record fills are PACKED_HIT_EMPTY.
+    std::vector<PackedHit> pack_hit_records(const HitFrames& frames, const std::vector<HitRecord>& records,
+                                            size_t num_rays, int max_depth);
+    /// the hit point buffer of a packed layout
+    std::vector<float4> unpack_hits(const HitFrames& frames, const std::vector<PackedHit>& hits);
+
+    /// Packed hits with the frames that decode them, as a packed hit file holds them.
+    struct PackedHitFile {
+        size_t num_rays = 0;
+        int max_depth = 0;
+        HitFrames frames;
+        std::vector<PackedHit> hits;    // num_rays * max_depth
+    };
+
+    /// Write a packed hit file, little endian: the magic "CSPHITS1", the number of rays (uint64),
+    /// max_depth and the number of element frames (uint32), the frames of the elements and of the
+    /// sun plane (17 doubles, the shape and the tag as uint32 each), then the hits.
+    bool write_packed_hits(const std::string& filename, const PackedHitFile& file);
+    /// Read a packed hit file; false when it cannot be opened, throws when it is not one.
+    bool read_packed_hits(const std::string& filename, PackedHitFile& file);
+}
@@ -112,8 +112,8 @@ void pipelineManager::createPipeline()
 {
     m_state.pipeline_compile_options = {
         false,                                                  // usesMotionBlur: Disable motion blur.
-        OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS,          // traversableGraphFlags: Allow only a single GAS.
-        2,    /* RadiancePRD uses 5 payloads */                 // numPayloadValues
+        OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING, // traversableGraphFlags: one IAS over the GAS of every stage.
+        NUM_PAYLOAD_VALUES,    /* PerRayData: path, depth, power, stage, origin, direction */  // numPayloadValues
         5,    /* Parallelogram intersection uses 5 attrs */     // numAttributeValues 
         OPTIX_EXCEPTION_FLAG_NONE,                              // exceptionFlags
         "params"                                                // pipelineLaunchParamsVariableName
@@ -128,8 +128,9 @@ void pipelineManager::createPipeline()
 
     // Link program groups to pipeline
     OptixPipelineLinkOptions pipeline_link_options = {};
-    // TODO max trace belong to who? 
-    pipeline_link_options.maxTraceDepth = MAX_TRACE_DEPTH; // Maximum recursion depth for ray tracing.
+    // Only the raygen program traces: it loops over the segments of a path, so the stack does not
+    // grow with the number of bounces or stages and the depth is a launch parameter.
+    pipeline_link_options.maxTraceDepth = 1;
 
     // Create the OptiX pipeline by linking the program groups.
     OPTIX_CHECK(optixPipelineCreate(
@@ -156,7 +157,7 @@ void pipelineManager::createPipeline()
     // Compute stack sizes based on the maximum trace depth and other settings.
     OPTIX_CHECK(optixUtilComputeStackSizes(
         &stack_sizes,                      // Input stack sizes.
-        MAX_TRACE_DEPTH,                         // Maximum trace depth.
+        1,                                 // Maximum trace depth: no recursion.
         0,                                 // maxCCDepth: Maximum depth of continuation callables (none in this case).
         0,                                 // maxDCDepth: Maximum depth of direct callables (none in this case).
         &direct_callable_stack_size_from_traversal, // Output: Stack size for callable traversal.
@@ -169,7 +170,7 @@ void pipelineManager::createPipeline()
         direct_callable_stack_size_from_traversal,    // Stack size for direct callable traversal.
         direct_callable_stack_size_from_state,        // Stack size for direct callable state.
         continuation_stack_size,                      // Stack size for continuation stack.
-        1                                            // maxTraversableDepth: Maximum depth of traversable hierarchy.
+        2                                            // maxTraversableDepth: the IAS and the GAS of a stage.
     ));
 }
 
@@ -0,0 +1,167 @@
+#include "solar_position.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+using namespace OptixCSP;
+
+namespace {
+    const double PI = 3.14159265358979323846;
+    const double RAD = PI / 180.0;
+    const double TWO_PI = 2.0 * PI;
+    const double EARTH_MEAN_RADIUS = 6371.01;       // km
+    const double ASTRONOMICAL_UNIT = 149597890.0;   // km
+    const double UNIX_EPOCH_JD = 2440587.5;
+    const double J2000_JD = 2451545.0;
+
+    // timestamps of a block; the working arrays of a block stay in the first level cache
+    const size_t BLOCK = 256;
+
+    // days since 1970-01-01 of a date of the proleptic Gregorian calendar (Hinnant's days_from_civil)
+    long long days_from_civil(long long y, unsigned int m, unsigned int d) {
+        y -= m <= 2;
+        const long long era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+        const unsigned int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + static_cast<long long>(doe) - 719468;
+    }
+
+    // Bennett's refraction of an apparent elevation, as NREL SPA applies it, in degrees; nothing
+    // below the horizon, where the sun is down anyway
+    double refraction(double elevation, double pressure, double temperature) {
+        const double r = (pressure / 1010.0) * (283.0 / (273.0 + temperature)) * 1.02 /
+                         (60.0 * std::tan(RAD * (elevation + 10.3 / (elevation + 5.11))));
+        return elevation >= -0.8333 ? r : 0.0;
+    }
+
+    // The PSA algorithm over n timestamps, one step over the whole block at a time, in the same
+    // order of operations as solar_position so that both give the same bits. The trigonometric
+    // calls are the scalar ones of the standard library.
+    void solar_block(const SolarSite& site, const double* unix_times, size_t n, SolarPosition* out) {
+        double elapsed[BLOCK], hours[BLOCK], lambda[BLOCK], epsilon[BLOCK];
+        double ra[BLOCK], decl[BLOCK], ha[BLOCK], zenith[BLOCK], azimuth[BLOCK];
+
+        // days since J2000.0 and the UT hours of the day
+        for (size_t i = 0; i < n; i++) {
+            const double days = unix_times[i] / 86400.0;
+            elapsed[i] = days + (UNIX_EPOCH_JD - J2000_JD);
+            hours[i] = (days - std::floor(days)) * 24.0;
+        }
+
+        // ecliptic longitude and obliquity of the ecliptic
+        for (size_t i = 0; i < n; i++) {
+            const double omega = 2.1429 - 0.0010394594 * elapsed[i];
+            const double mean_longitude = 4.8950630 + 0.017202791698 * elapsed[i];
+            const double mean_anomaly = 6.2400600 + 0.0172019699 * elapsed[i];
+            lambda[i] = mean_longitude + 0.03341607 * std::sin(mean_anomaly) + 0.00034894 * std::sin(2.0 * mean_anomaly) -
+                        0.0001134 - 0.0000203 * std::sin(omega);
+            epsilon[i] = 0.4090928 - 6.2140e-9 * elapsed[i] + 0.0000396 * std::cos(omega);
+        }
+
+        // celestial coordinates
+        for (size_t i = 0; i < n; i++) {
+            const double sin_lambda = std::sin(lambda[i]);
+            const double a = std::atan2(std::cos(epsilon[i]) * sin_lambda, std::cos(lambda[i]));
+            ra[i] = a < 0.0 ? a + TWO_PI : a;
+            decl[i] = std::asin(std::sin(epsilon[i]) * sin_lambda);
+        }
+
+        // local coordinates, with the parallax of the site
+        const double sin_lat = std::sin(site.latitude * RAD);
+        const double cos_lat = std::cos(site.latitude * RAD);
+        for (size_t i = 0; i < n; i++) {
+            const double gmst = 6.6974243242 + 0.0657098283 * elapsed[i] + hours[i];
+            const double lmst = (gmst * 15.0 + site.longitude) * RAD;
+            ha[i] = lmst - ra[i];
+            const double cos_ha = std::cos(ha[i]);
+            const double z = std::acos(cos_lat * cos_ha * std::cos(decl[i]) + std::sin(decl[i]) * sin_lat);
+            const double az = std::atan2(-std::sin(ha[i]), std::tan(decl[i]) * cos_lat - sin_lat * cos_ha);
+            azimuth[i] = az < 0.0 ? az + TWO_PI : az;
+            zenith[i] = z + EARTH_MEAN_RADIUS / ASTRONOMICAL_UNIT * std::sin(z);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            double z = zenith[i] / RAD;
+            if (site.pressure > 0.0)
+                z -= refraction(90.0 - z, site.pressure, site.temperature);
+            const double h = std::remainder(ha[i], TWO_PI);
+            out[i].zenith = z;
+            out[i].azimuth = azimuth[i] / RAD;
+            out[i].declination = decl[i] / RAD;
+            out[i].hour_angle = h / RAD;
+        }
+    }
+}
+
+double OptixCSP::unix_time_utc(int year, int month, int day, double hour) {
+    return static_cast<double>(days_from_civil(year, month, day)) * 86400.0 + hour * 3600.0;
+}
+
+std::vector<double> OptixCSP::hourly_timestamps(int year, double offset_hours) {
+    const double start = unix_time_utc(year, 1, 1);
+    const size_t num_hours = static_cast<size_t>(days_from_civil(year + 1, 1, 1) - days_from_civil(year, 1, 1)) * 24;
+    std::vector<double> times(num_hours);
+    for (size_t i = 0; i < num_hours; i++)
+        times[i] = start + (static_cast<double>(i) + offset_hours) * 3600.0;
+    return times;
+}
+
+SolarPosition OptixCSP::solar_position(const SolarSite& site, double unix_time) {
+    SolarPosition p;
+    solar_block(site, &unix_time, 1, &p);
+    return p;
+}
+
+void OptixCSP::solar_positions(const SolarSite& site, const double* unix_times, size_t count,
+                               SolarPosition* positions, int num_threads) {
+    const size_t num_blocks = (count + BLOCK - 1) / BLOCK;
+    if (num_threads <= 0) num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    num_threads = static_cast<int>(std::min<size_t>(num_threads, num_blocks));
+
+    std::atomic<size_t> next_block(0);
+    auto worker = [&]() {
+        for (size_t b = next_block++; b < num_blocks; b = next_block++) {
+            const size_t first = b * BLOCK;
+            solar_block(site, unix_times + first, std::min(BLOCK, count - first), positions + first);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+std::vector<SolarPosition> OptixCSP::solar_positions(const SolarSite& site, const std::vector<double>& unix_times,
+                                                     int num_threads) {
+    std::vector<SolarPosition> positions(unix_times.size());
+    solar_positions(site, unix_times.data(), unix_times.size(), positions.data(), num_threads);
+    return positions;
+}
+
+Vec3d OptixCSP::sun_vector(const SolarPosition& position) {
+    const double zenith = position.zenith * RAD;
+    const double azimuth = position.azimuth * RAD;
+    return Vec3d(std::sin(zenith) * std::sin(azimuth), std::sin(zenith) * std::cos(azimuth), std::cos(zenith));
+}
+
+Vec3d OptixCSP::sun_vector_ldh(double latitude, double day_of_year, double solar_hour) {
+    // the declination at that hour of the day, at Greenwich, of 2010; the hour angle comes straight
+    // from the solar time, so the equation of time and the longitude drop out
+    SolarSite greenwich;
+    const double t = unix_time_utc(2010, 1, 1) + ((day_of_year - 1.0) * 24.0 + solar_hour) * 3600.0;
+    const double decl = solar_position(greenwich, t).declination * RAD;
+
+    const double lat = latitude * RAD;
+    const double ha = (solar_hour - 12.0) * 15.0 * RAD;
+    // horizontal frame of the site: east, north, up
+    const double east = -std::cos(decl) * std::sin(ha);
+    const double north = std::cos(lat) * std::sin(decl) - std::sin(lat) * std::cos(decl) * std::cos(ha);
+    const double up = std::sin(lat) * std::sin(decl) + std::cos(lat) * std::cos(decl) * std::cos(ha);
+    return Vec3d(east, north, up);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "vec3d.h"
+
+namespace OptixCSP {
+
+    /// Site of a plant. Angles in degrees, longitude positive toward east. A pressure of 0 leaves
+    /// out the atmospheric refraction and gives the geometric position.
+    struct SolarSite {
+        double latitude = 0.0;
+        double longitude = 0.0;
+        double pressure = 0.0;      // mbar
+        double temperature = 15.0;  // degrees Celsius
+    };
+
+    /// Position of the sun center seen from a site, in degrees.
+    struct SolarPosition {
+        double zenith = 0.0;        // topocentric, from the vertical
+        double azimuth = 0.0;       // from north, positive toward east, in [0, 360)
+        double declination = 0.0;
+        double hour_angle = 0.0;    // local, negative in the morning
+    };
+
+    /// seconds since 1970-01-01 00:00 UTC of a UTC date and time of day in hours
+    double unix_time_utc(int year, int month, int day, double hour = 0.0);
+
+    /// one timestamp per hour of a year, 8760 or 8784 of them, offset_hours into every hour
+    std::vector<double> hourly_timestamps(int year, double offset_hours = 0.5);
+
+    /**
+     * Solar position with the PSA algorithm (Blanco-Muriel et al., Solar Energy 70, 2001): the sun
+     * within 0.01 degrees, with parallax, from a timestamp in UTC seconds. The full NREL SPA is ten
+     * times as accurate, but it needs the tables of periodic terms, and the rest is already far
+     * below the 4.65 mrad of the sun disk.
+     */
+    SolarPosition solar_position(const SolarSite& site, double unix_time);
+
+    /// Solar positions of count timestamps. The timestamps are split in blocks over num_threads
+    /// threads (0 for every cpu); within a block every step of the algorithm runs over the whole
+    /// block. The math calls stay scalar, the results are those of solar_position.
+    void solar_positions(const SolarSite& site, const double* unix_times, size_t count, SolarPosition* positions,
+                         int num_threads = 0);
+    std::vector<SolarPosition> solar_positions(const SolarSite& site, const std::vector<double>& unix_times,
+                                               int num_threads = 0);
+
+    /// unit vector toward the sun, x toward east, y toward north and z up
+    Vec3d sun_vector(const SolarPosition& position);
+
+    /// Sun vector of the LDH option of a stinput file: latitude in degrees, day of the year (1 is
+    /// January 1st) and solar time in hours, 12 at solar noon. The declination comes from the PSA
+    /// ephemeris of a year without a leap day.
+    Vec3d sun_vector_ldh(double latitude, double day_of_year, double solar_hour);
+}
@@ -12,8 +12,7 @@ namespace OptixCSP
     struct SoltraceState
     {
         OptixDeviceContext          context = 0;
-        OptixTraversableHandle      gas_handle = {};
-        CUdeviceptr                 d_gas_output_buffer = {};
+        OptixTraversableHandle      ias_handle = {};    // one instance over the GAS of every stage
 
         OptixModule                 geometry_module = 0;
         OptixModule                 shading_module = 0;
@@ -4,15 +4,19 @@
 #include "pipeline_manager.h"
 #include "soltrace_type.h"
 #include "CspElement.h"
+#include "stinput_reader.h"
 #include "timer.h"
 
 #include "utils/util_record.hpp"
 #include "utils/util_check.hpp"
 #include "utils/math_util.h"
+#include "utils/util_output.hpp"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <cstring>
+#include <stdexcept>
 
 #include <optix_function_table_definition.h>
 #include <optix_stubs.h>
@@ -37,6 +41,7 @@ void SolTraceSystem::print_launch_params() {
     std::cout << "height             : " << params.height << std::endl;
     std::cout << "max_depth          : " << params.max_depth << std::endl;
     std::cout << "hit_point_buffer   : " << params.hit_point_buffer << std::endl;
+    std::cout << "hit_power_buffer   : " << params.hit_power_buffer << std::endl;
 	std::cout << "sun_dir_buffer     : " << params.sun_dir_buffer << std::endl;
     std::cout << "sun_vector         : " << params.sun_vector.x << " " <<params.sun_vector.y << " " <<params.sun_vector.z << std::endl;
     std::cout << "max_sun_angle      : " << params.max_sun_angle << std::endl;
@@ -46,15 +51,25 @@ void SolTraceSystem::print_launch_params() {
     std::cout << "sun_v3             : " << params.sun_v3.x << " " <<params.sun_v3.y << " " <<params.sun_v3.z << std::endl;
     std::cout << "sun_box_edge_a     : " << sun_box_edge_a << std::endl;
     std::cout << "sun_box_edge_b     : " << sun_box_edge_b << std::endl;
+    std::cout << "sampler            : " << params.sampler.type << " seed " << params.sampler.seed
+              << " offset " << params.sampler.sample_offset << std::endl;
 }
 
 SolTraceSystem::SolTraceSystem(int numSunPoints)
     : m_num_sunpoints(numSunPoints),
       m_num_hits_receiver(0),
+      m_max_depth(MAX_TRACE_DEPTH),
+      m_flux_nu(0),
+      m_flux_nv(0),
+      m_element_power(false),
+      m_hit_stream_capacity(0),
+      m_hit_stream_passes(0),
+      m_samples_per_pass(0),
       m_verbose(false),
       m_mem_free_before(0),
       m_mem_free_after(0),
       m_sun_angle(0.0),
+      m_dni(1000.0),
       m_timer_setup(),
       m_timer_trace(),
       geometry_manager(std::make_shared<GeometryManager>(m_state)),
@@ -87,6 +102,13 @@ void SolTraceSystem::initialize() {
 	data_manager->launch_params_H.sun_vector = OptixCSP::toFloat3(sun_vec);
     data_manager->launch_params_H.max_sun_angle = (float)(m_sun_angle);
 
+    // every stage is a range of the element arrays
+    std::stable_sort(m_element_list.begin(), m_element_list.end(),
+                     [](const std::shared_ptr<CspElement>& a, const std::shared_ptr<CspElement>& b) {
+                         return a->get_stage() < b->get_stage();
+                     });
+    geometry_manager->set_stage_flags(m_stage_flags);
+
     Timer AABB_timer;
     AABB_timer.start();
 	geometry_manager->collect_geometry_info(m_element_list, data_manager->launch_params_H);
@@ -116,20 +138,34 @@ void SolTraceSystem::initialize() {
     // Initialize launch params
     data_manager->launch_params_H.width = m_num_sunpoints;
     data_manager->launch_params_H.height = 1;
-    data_manager->launch_params_H.max_depth = MAX_TRACE_DEPTH;
+    data_manager->launch_params_H.max_depth = m_max_depth;
 
 
 	// seed for sun ray randomization
     data_manager->launch_params_H.sun_dir_seed = 123456ULL;
+    set_sampler_strata(data_manager->launch_params_H.sampler,
+                       m_samples_per_pass > 0 ? m_samples_per_pass : static_cast<unsigned int>(m_num_sunpoints));
 
-    // Allocate memory for the hit point buffer, size is number of rays launched * depth
-    const size_t hit_point_buffer_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float4) * data_manager->launch_params_H.max_depth;
+    if (m_hit_stream_capacity > 0) {
+        // the records of the hits instead of the hit point buffer
+        data_manager->allocateHitStream(m_hit_stream_capacity);
+    }
+    else {
+        // Allocate memory for the hit point buffer, size is number of rays launched * depth
+        const size_t hit_point_buffer_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float4) * data_manager->launch_params_H.max_depth;
 
-    CUDA_CHECK(cudaMalloc(
-        reinterpret_cast<void**>(&data_manager->launch_params_H.hit_point_buffer),
-        hit_point_buffer_size
-    ));
-    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+        CUDA_CHECK(cudaMalloc(
+            reinterpret_cast<void**>(&data_manager->launch_params_H.hit_point_buffer),
+            hit_point_buffer_size
+        ));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+
+        // power of the ray arriving at each hit point, same layout
+        const size_t hit_power_buffer_size = hit_point_buffer_size / sizeof(float4) * sizeof(float);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.hit_power_buffer), hit_power_buffer_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_power_buffer, 0, hit_power_buffer_size));
+    }
+    update_ray_power();
 
 
 	// Luning TODO: Allocate memory for the direction cosine buffer, size is number of rays launched * depth
@@ -141,9 +177,15 @@ void SolTraceSystem::initialize() {
     // Create a CUDA stream for asynchronous operations.
     CUDA_CHECK(cudaStreamCreate(&m_state.stream));
 
-    // Link the GAS handle.
-    data_manager->launch_params_H.handle = m_state.gas_handle;
+    // Link the IAS handle and the element ranges of the stages.
+    data_manager->launch_params_H.handle = m_state.ias_handle;
+    data_manager->allocateStageDataArray(geometry_manager->get_stage_data());
     data_manager->allocateGeometryDataArray(geometry_manager->get_geometry_data_array());
+    m_flux_layout = layout_flux_maps(m_element_list, geometry_manager->get_geometry_data_array(), m_flux_nu, m_flux_nv,
+                                     m_element_power);
+    data_manager->allocateFluxMaps(m_flux_layout);
+    data_manager->allocateMaterialDataArray(geometry_manager->get_material_data_array());
+    data_manager->allocateSunShape(m_sun_shape);
 
     print_launch_params();
 
@@ -165,8 +207,28 @@ void SolTraceSystem::run() {
     cudaMemGetInfo(&m_mem_free_after, nullptr);
     std::cout << "Memory used by launch: " << (m_mem_free_before - m_mem_free_after) / (1024.0 * 1024.0) << " MB\n";
 
+    data_manager->clearFluxMaps();
+    if (m_hit_stream_capacity > 0) {
+        m_timer_trace.start();
+        run_hit_stream();
+        m_timer_trace.stop();
+        return;
+    }
+
+    // a launch only writes the hits it makes, the paths of the previous one must not show through
+    const size_t num_hits = static_cast<size_t>(width) * height * data_manager->launch_params_H.max_depth;
+    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, num_hits * sizeof(float4)));
+    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_power_buffer, 0, num_hits * sizeof(float)));
+    m_hit_stream_passes = 1;
+
     m_timer_trace.start();
-    // Launch the simulation.
+    launch(width, height);
+	m_timer_trace.stop();
+
+
+}
+
+void SolTraceSystem::launch(unsigned int width, unsigned int height) {
     OPTIX_CHECK(optixLaunch(
         m_state.pipeline,
         m_state.stream,  // Assume this stream is properly created.
@@ -177,10 +239,51 @@ void SolTraceSystem::run() {
         height,
         1));
     CUDA_SYNC_CHECK();
+}
 
-	m_timer_trace.stop();
-
-
+// The first launch traces every ray and deposits the receiver power; after an overflow the later
+// ones trace the rays from the first that lost a record on as a launch of their own, with the
+// sampler, the ray numbers and the sun directions shifted to them and the flux maps off, and only
+// add their records.
+void SolTraceSystem::run_hit_stream() {
+    LaunchParams& params = data_manager->launch_params_H;
+    const LaunchParams saved = params;
+    m_hit_records.clear();
+
+    HitStreamPlanner planner(static_cast<size_t>(m_num_sunpoints), m_hit_stream_capacity);
+    std::vector<HitRecord> records;
+    while (!planner.done()) {
+        const unsigned int begin = static_cast<unsigned int>(planner.begin());
+        params.width = static_cast<unsigned int>(planner.end() - planner.begin());
+        params.height = 1;
+        params.sampler.sample_offset = saved.sampler.sample_offset + begin;
+        params.sun_dir_buffer = saved.sun_dir_buffer + begin;
+        if (planner.pass() > 0)
+            params.flux_map = { nullptr, nullptr, nullptr, 0u, 0u, nullptr };
+        data_manager->clearHitStream(begin);
+        data_manager->updateLaunchParams();
+        launch(params.width, params.height);
+
+        unsigned long long reserved = 0;
+        unsigned int first_lost = 0;
+        CUDA_CHECK(cudaMemcpy(&reserved, data_manager->hit_count_D, sizeof(reserved), cudaMemcpyDeviceToHost));
+        CUDA_CHECK(cudaMemcpy(&first_lost, data_manager->hit_first_lost_D, sizeof(first_lost), cudaMemcpyDeviceToHost));
+        records.resize(static_cast<size_t>(std::min<unsigned long long>(reserved, m_hit_stream_capacity)));
+        if (!records.empty())
+            CUDA_CHECK(cudaMemcpy(records.data(), data_manager->hit_records_D, records.size() * sizeof(HitRecord), cudaMemcpyDeviceToHost));
+        for (const HitRecord& r : records)
+            if (r.ray < first_lost) m_hit_records.push_back(r);
+        planner.finish_pass(reserved, first_lost == 0xFFFFFFFFu ? static_cast<size_t>(m_num_sunpoints) : first_lost);
+    }
+    m_hit_stream_passes = planner.pass();
+
+    params.width = saved.width;
+    params.height = saved.height;
+    params.sampler = saved.sampler;
+    params.sun_dir_buffer = saved.sun_dir_buffer;
+    params.flux_map = saved.flux_map;
+    data_manager->clearHitStream(0u);
+    data_manager->updateLaunchParams();
 }
 
 void SolTraceSystem::update() {
@@ -193,29 +296,62 @@ void SolTraceSystem::update() {
 
     // update data on the device    
 	data_manager->updateGeometryDataArray(geometry_manager->get_geometry_data_array());
-    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+	data_manager->updateMaterialDataArray(geometry_manager->get_material_data_array());
+    data_manager->allocateSunShape(m_sun_shape);
+    // the grids follow the receivers
+    m_flux_layout = layout_flux_maps(m_element_list, geometry_manager->get_geometry_data_array(), m_flux_nu, m_flux_nv,
+                                     m_element_power);
+    data_manager->allocateFluxMaps(m_flux_layout);
+    if (data_manager->launch_params_H.hit_point_buffer) {
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_power_buffer, 0, hit_point_buffer_size / sizeof(float4) * sizeof(float)));
+    }
+    update_ray_power();
 	data_manager->updateLaunchParams();
 }
 
+// the sun plane follows the sun, so the power of a sun ray does too
+void SolTraceSystem::update_ray_power() {
+    LaunchParams& params = data_manager->launch_params_H;
+    const double edge_a = length(params.sun_v0 - params.sun_v1);
+    const double edge_b = length(params.sun_v1 - params.sun_v2);
+    params.ray_power = static_cast<float>(m_dni * edge_a * edge_b / m_num_sunpoints);
+}
+
+void SolTraceSystem::set_max_depth(int depth) {
+    if (depth < 2)
+        throw std::runtime_error("A path holds at least the sun point and one hit point.");
+    m_max_depth = depth;
+}
+
+void SolTraceSystem::set_ray_weighting(RayWeighting weighting) {
+    data_manager->launch_params_H.ray_weighting = weighting;
+    if (data_manager->getDeviceLaunchParams())
+        data_manager->updateLaunchParams();
+}
+
 bool SolTraceSystem::read_st_input(const char* filename) {
-    FILE* fp = fopen(filename, "r");
-	if (!fp)
-	{
-    	printf("failed to open system input file\n");
-	}
+    StInputReader reader;
+    if (!reader.read(filename))
+        return false;
 
-	if ( !read_system( fp ) )
-	{
-		printf("error in system input file.\n");
-		return false;
-	}
-	
-	fclose(fp);
+    set_sun_vector(reader.sun_vector());
+    set_sun_angle(reader.sun_angle());
+    if (reader.sun_shape())
+        set_sun_shape(reader.sun_shape());
+
+    m_stage_flags = reader.stage_flags();
+    for (const std::shared_ptr<CspElement>& element : reader.elements())
+        add_element(element);
 
     return true;
 }
 
 int SolTraceSystem::get_num_hits_receiver() {
+    if (m_hit_stream_capacity > 0) {
+        m_num_hits_receiver = count_receiver_records(m_hit_records);
+        return m_num_hits_receiver;
+    }
 
     int output_size = m_num_sunpoints * data_manager->launch_params_H.max_depth;
     std::vector<float4> hp_output_buffer(output_size);
@@ -224,67 +360,108 @@ int SolTraceSystem::get_num_hits_receiver() {
     // go through the hit point buffer, and only collect data where the first element is 2.0f 
 	// which indicates a hit on the receiver
 
-	m_num_hits_receiver = 0;
-    for (const auto& element : hp_output_buffer) {
-        if (std::abs(element.x - 2.0) < 0.1f) { // x value of 2.0 indicates a hit on the receiver
-            m_num_hits_receiver++;
-        }
-	}
+	m_num_hits_receiver = count_receiver_hits(hp_output_buffer);
     return m_num_hits_receiver;
 }
 
-void SolTraceSystem::write_hp_output(const std::string& filename) {
-    int output_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * data_manager->launch_params_H.max_depth;
-    std::vector<float4> hp_output_buffer(output_size);
-    CUDA_CHECK(cudaMemcpy(hp_output_buffer.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
+// a path ends on the receiver, so it deposits its power at most once
+double SolTraceSystem::get_receiver_power() {
+    if (m_hit_stream_capacity > 0) return hit_record_receiver_power(m_hit_records);
+    const std::vector<float4>& hit_points = get_hit_point_buffer();
+    const std::vector<float>& hit_power = get_hit_power_buffer();
 
-    std::ofstream outFile(filename);
+    double power = 0.0;
+    for (size_t i = 0; i < hit_points.size(); i++)
+        if (hit_points[i].x == 2.0f) power += hit_power[i];
+    return power;
+}
 
-    if (!outFile.is_open()) {
-        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
-        return;
-    }
+const std::vector<float4>& SolTraceSystem::get_hit_point_buffer() {
+    const size_t output_size = data_manager->launch_params_H.hit_point_buffer
+        ? static_cast<size_t>(m_num_sunpoints) * data_manager->launch_params_H.max_depth : 0;
+    m_hit_point_buffer_H.resize(output_size);
+    CUDA_CHECK(cudaMemcpy(m_hit_point_buffer_H.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
+    return m_hit_point_buffer_H;
+}
 
-    // Write header
-	// TODO, if statements to check if one needs to write dir_cos_buffer or not
-    outFile << "number,stage,loc_x,loc_y,loc_z,cosx,cosy,cosz\n";
+const std::vector<float>& SolTraceSystem::get_hit_power_buffer() {
+    const size_t output_size = data_manager->launch_params_H.hit_power_buffer
+        ? static_cast<size_t>(m_num_sunpoints) * data_manager->launch_params_H.max_depth : 0;
+    m_hit_power_buffer_H.resize(output_size);
+    CUDA_CHECK(cudaMemcpy(m_hit_power_buffer_H.data(), data_manager->launch_params_H.hit_power_buffer, output_size * sizeof(float), cudaMemcpyDeviceToHost));
+    return m_hit_power_buffer_H;
+}
 
-    int currentRay = 1;
-    int stage = 0;
+void SolTraceSystem::set_flux_map_resolution(int nu, int nv) {
+    m_flux_nu = std::max(0, nu);
+    m_flux_nv = std::max(0, nv);
+}
 
-    for (const auto& element : hp_output_buffer) {
+const std::vector<FluxMap>& SolTraceSystem::get_flux_maps() {
+    std::vector<float> power(m_flux_layout.num_cells());
+    if (!power.empty())
+        CUDA_CHECK(cudaMemcpy(power.data(), data_manager->flux_power_D, power.size() * sizeof(float), cudaMemcpyDeviceToHost));
+    m_flux_maps = make_flux_maps(m_flux_layout, std::vector<double>(power.begin(), power.end()));
+    return m_flux_maps;
+}
 
-        // Inline check: if y, z, and w are all zero, treat as marker for new ray.
-        if ((element.y == 0) && (element.z == 0) && (element.w == 0)) {
-            if (stage > 0) {
-                currentRay++;
-                stage = 0;
-            }
-            continue;  // Skip printing this marker element.
-        }
+const FluxMap& SolTraceSystem::get_flux_map(size_t receiver) {
+    const std::vector<FluxMap>& maps = get_flux_maps();
+    if (receiver >= maps.size())
+        throw std::runtime_error("No flux map for receiver " + std::to_string(receiver) + ", set_flux_map_resolution before initialize().");
+    return maps[receiver];
+}
 
-        // If we haven't reached max_trace stages for the current ray, print the element.
-        if (stage < data_manager->launch_params_H.max_depth) {
-            outFile << currentRay << ","
-                << element.x << "," << element.y << ","
-                << element.z << "," << element.w << "\n";
-            stage++;
-        }
-        else {
-            // If max_trace stages reached, move to next ray and reset stage counter.
-            currentRay++;
-            stage = 0;
-            outFile << currentRay << ","
-                << element.x << "," << element.y << ","
-                << element.z << "," << element.w << "\n";
-            stage++;
-        }
+std::vector<double> SolTraceSystem::get_receiver_element_power() {
+    if (!m_flux_layout.element_power)
+        throw std::runtime_error("No receiver power per element, set_receiver_element_power before initialize().");
+    std::vector<float> power(m_flux_layout.num_elements());
+    if (!power.empty())
+        CUDA_CHECK(cudaMemcpy(power.data(), data_manager->element_power_D, power.size() * sizeof(float), cudaMemcpyDeviceToHost));
+    return std::vector<double>(power.begin(), power.end());
+}
+
+bool SolTraceSystem::write_receiver_power_vtk(const std::string& filename) {
+    return OptixCSP::write_receiver_power_vtk(filename, m_element_list, geometry_manager->get_geometry_data_array(),
+                                              get_receiver_element_power());
+}
 
+HitFrames SolTraceSystem::get_hit_frames() {
+    const LaunchParams& params = data_manager->launch_params_H;
+    return make_hit_frames(m_element_list, geometry_manager->get_geometry_data_array(), geometry_manager->get_stage_data(),
+                           params.sun_v0, params.sun_v1, params.sun_v3);
+}
 
+std::vector<PackedHit> SolTraceSystem::get_packed_hits() {
+    if (m_hit_stream_capacity == 0)
+        throw std::runtime_error("Packed hits need the element of every hit, set_hit_stream before the run.");
+    return pack_hit_records(get_hit_frames(), m_hit_records, static_cast<size_t>(m_num_sunpoints),
+                            data_manager->launch_params_H.max_depth);
+}
+
+bool SolTraceSystem::write_packed_hits(const std::string& filename) {
+    PackedHitFile file;
+    file.num_rays = static_cast<size_t>(m_num_sunpoints);
+    file.max_depth = data_manager->launch_params_H.max_depth;
+    file.frames = get_hit_frames();
+    file.hits = get_packed_hits();
+    return OptixCSP::write_packed_hits(filename, file);
+}
+
+void SolTraceSystem::write_hp_output(const std::string& filename) {
+    if (m_hit_stream_capacity > 0) {
+        std::vector<float4> hit_points;
+        std::vector<float> hit_power;
+        decode_hit_records(m_hit_records, static_cast<size_t>(m_num_sunpoints), data_manager->launch_params_H.max_depth,
+                           hit_points, hit_power);
+        write_hit_point_csv(hit_points, data_manager->launch_params_H.max_depth, filename);
+        return;
     }
+    int output_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * data_manager->launch_params_H.max_depth;
+    std::vector<float4> hp_output_buffer(output_size);
+    CUDA_CHECK(cudaMemcpy(hp_output_buffer.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
 
-    outFile.close();
-    std::cout << "Data successfully written to " << filename << std::endl;
+    write_hit_point_csv(hp_output_buffer, data_manager->launch_params_H.max_depth, filename);
 }
 
 
@@ -432,11 +609,12 @@ void SolTraceSystem::clean_up() {
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_state.sbt.missRecordBase)));
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_state.sbt.hitgroupRecordBase)));
 
-    // Free OptiX GAS output buffer
-    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_state.d_gas_output_buffer)));
+    // Free the acceleration structures and their inputs
+    geometry_manager->cleanup();
 
     // Free device-side launch parameter memory
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_point_buffer)));
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_power_buffer)));
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.sun_dir_buffer)));
 
     data_manager->cleanup();
@@ -584,6 +762,14 @@ void SolTraceSystem::add_element(std::shared_ptr<CspElement> e)
     m_element_list.push_back(e);
 }
 
+void SolTraceSystem::set_stage_flags(unsigned int stage, unsigned int flags) {
+    if (stage >= MAX_STAGES)
+        throw std::runtime_error("Too many stages, at most " + std::to_string(MAX_STAGES) + ".");
+    if (stage >= m_stage_flags.size())
+        m_stage_flags.resize(stage + 1, STAGE_MULTIHIT);
+    m_stage_flags[stage] = flags;
+}
+
 double SolTraceSystem::get_time_trace() {
     return m_timer_trace.get_time_sec();
 } 
@@ -598,401 +784,30 @@ void SolTraceSystem::set_sun_vector(Vec3d vect) {
 	data_manager->launch_params_H.sun_vector = OptixCSP::toFloat3(sun_v);
 }
 
-std::vector<std::string> SolTraceSystem::split(const std::string& str, const std::string& delim, bool ret_empty, bool ret_delim) {
-	
-    std::vector<std::string> list;
-
-	char cur_delim[2] = {0,0};
-	std::string::size_type m_pos = 0;
-	std::string token;
-	
-	while (m_pos < str.length())
-	{
-		std::string::size_type pos = str.find_first_of(delim, m_pos);
-		if (pos == std::string::npos)
-		{
-			cur_delim[0] = 0;
-			token.assign(str, m_pos, std::string::npos);
-			m_pos = str.length();
-		}
-		else
-		{
-			cur_delim[0] = str[pos];
-			std::string::size_type len = pos - m_pos;			
-			token.assign(str, m_pos, len);
-			m_pos = pos + 1;
-		}
-		
-		if (token.empty() && !ret_empty)
-			continue;
-
-		list.push_back( token );
-		
-		if ( ret_delim && cur_delim[0] != 0 && m_pos < str.length() )
-			list.push_back( std::string( cur_delim ) );
-	}
-	
-	return list;
-}
-
-void SolTraceSystem::read_line(char* buf, int len, FILE* fp) {
-	fgets(buf, len, fp);
-	size_t nch = strlen(buf);
-	if (nch > 0 && buf[nch-1] == '\n')
-		buf[nch-1] = 0;
-	if (nch-1 > 0 && buf[nch-2] == '\r')
-		buf[nch-2] = 0;
-}
-
-bool SolTraceSystem::read_sun(FILE* fp) {
-	
-    if (!fp) return false;
-
-	char buf[1024];
-	int bi = 0, count = 0;
-	char cshape = 'g';
-	double Sigma, HalfWidth;
-	bool PointSource;
-
-	read_line( buf, 1023, fp );
-
-	sscanf(buf, "SUN\tPTSRC\t%d\tSHAPE\t%c\tSIGMA\t%lg\tHALFWIDTH\t%lg",
-		&bi, &cshape, &Sigma, &HalfWidth);
-	PointSource = (bi!=0);
-	cshape = tolower(cshape);
-
-    // TODO: Update if supporting other sun shapes
-    set_sun_angle(Sigma * 0.001);
-
-	read_line( buf, 1023, fp );
-	double X, Y, Z, Latitude, Day, Hour;
-	bool UseLDHSpec;
-	sscanf(buf, "XYZ\t%lg\t%lg\t%lg\tUSELDH\t%d\tLDH\t%lg\t%lg\t%lg",
-		&X, &Y, &Z, &bi, &Latitude, &Day, &Hour);
-	UseLDHSpec = (bi!=0);
-	
-    // TODO: Update if supporting LDHSpec
-	// if ( UseLDHSpec )
-	// {
-	// 	st_sun_position(cxt, Latitude, Day, Hour, &X, &Y, &Z);
-	// }
-
-    Vec3d sun_vector(X, Y, Z);
-	set_sun_vector(sun_vector);
-
-	//printf("sun ps? %d cs: %c  %lg %lg %lg\n", PointSource?1:0, cshape, X, Y, Z);
-
-	read_line( buf, 1023, fp );
-	sscanf(buf, "USER SHAPE DATA\t%d", &count);
-    // TODO: Update if supporting user shape data
-	if (count > 0)
-	{
-		double *angle = new double[count];
-		double *intensity = new double[count];
-
-		for (int i=0;i<count;i++)
-		{
-			double x, y;
-			read_line( buf, 1023, fp );
-			sscanf(buf, "%lg\t%lg", &x, &y);
-			angle[i] = x;
-			intensity[i] = y;
-		}
-
-		//st_sun_userdata(cxt, count, angle, intensity );
-
-		delete [] angle;
-		delete [] intensity;	
-	}
-
-	return true;
-}
-
-bool SolTraceSystem::read_optic_surface(FILE* fp) {
-	
-    if (!fp) return false;
-	char buf[1024];
-	read_line(buf, 1023, fp);
-	std::vector<std::string> parts  = split( std::string(buf), "\t", true, false );
-	if (parts.size() < 15)
-	{
-        printf("too few tokens for optical surface: %zu\n", parts.size());
-		printf("\t>> %s\n", buf);
-		return false;
-	}
-
-	char ErrorDistribution = 'g';
-	if (parts[1].length() > 0)
-		ErrorDistribution = parts[1][0];
-
-    /*
-	int ApertureStopOrGratingType = atoi( parts[2].c_str() );
-	int OpticalSurfaceNumber = atoi( parts[3].c_str() );
-	int DiffractionOrder = atoi( parts[4].c_str() );
-	double Reflectivity = atof( parts[5].c_str() );
-	double Transmissivity = atof( parts[6].c_str() );
-	double RMSSlope = atof( parts[7].c_str() );
-	double RMSSpecularity = atof( parts[8].c_str() );
-	double RefractionIndexReal = atof( parts[9].c_str() );
-	double RefractionIndexImag = atof( parts[10].c_str() );
-	double GratingCoeffs[4];
-	GratingCoeffs[0] = atof( parts[11].c_str() );
-	GratingCoeffs[1] = atof( parts[12].c_str() );
-	GratingCoeffs[2] = atof( parts[13].c_str() );
-	GratingCoeffs[3] = atof( parts[14].c_str() );
-    */
-
-	bool UseReflectivityTable = false;
-	int refl_npoints = 0;
-	double *refl_angles = 0;
-	double *refls = 0;
-
-	bool UseTransmissivityTable = false;
-	int trans_npoints = 0;
-	double* trans_angles = 0;
-	double* transs = 0;
-
-	if (parts.size() >= 17)
-	{
-		UseReflectivityTable = (atoi( parts[15].c_str() ) > 0);
-		refl_npoints = atoi( parts[16].c_str() );
-		if (parts.size() >= 19)
-		{
-			UseTransmissivityTable = (atoi(parts[17].c_str()) > 0);
-			trans_npoints = atoi(parts[18].c_str());
-		}
-	}
-
-	if (UseReflectivityTable)
-	{
-		refl_angles = new double[refl_npoints];
-		refls = new double[refl_npoints];
-
-		for (int i=0;i<refl_npoints;i++)
-		{
-			read_line(buf,1023,fp);
-			sscanf(buf, "%lg %lg", &refl_angles[i], &refls[i]);
-		}
-	}
-	if (UseTransmissivityTable)
-	{
-		trans_angles = new double[trans_npoints];
-		transs = new double[trans_npoints];
-
-		for (int i = 0; i < trans_npoints; i++)
-		{
-			read_line(buf, 1023, fp);
-			sscanf(buf, "%lg %lg", &trans_angles[i], &transs[i]);
-		}
-	}
-
-	// TODO: Update once optical surface params are implemented
-	// st_optic( cxt, iopt, fb, ErrorDistribution,
-	// 	OpticalSurfaceNumber, ApertureStopOrGratingType, DiffractionOrder,
-	// 	RefractionIndexReal, RefractionIndexImag,
-	// 	Reflectivity, Transmissivity,
-	// 	GratingCoeffs, RMSSlope, RMSSpecularity,
-	// 	UseReflectivityTable ? 1 : 0, refl_npoints,
-	// 	refl_angles, refls,
-	// 	UseTransmissivityTable? 1 : 0, trans_npoints,
-	// 	trans_angles, transs
-	// 	);
-
-	if (refl_angles != 0) delete [] refl_angles;
-	if (refls != 0) delete [] refls;
-	if (trans_angles != 0) delete[] trans_angles;
-	if (transs != 0) delete[] transs;
-	return true;
-}
-
-bool SolTraceSystem::read_optic(FILE* fp) {
-	if (!fp) return false;
-	char buf[1024];
-	read_line( buf, 1023, fp );
-
-	if (strncmp( buf, "OPTICAL PAIR", 12) == 0)
-	{
-		read_optic_surface( fp );
-		read_optic_surface( fp );
-		return true;
-	}
-	else return false;
+void SolTraceSystem::set_sun_shape(std::shared_ptr<const SunShape> sun_shape) {
+    m_sun_shape = sun_shape;
+    if (m_sun_shape)
+        m_sun_angle = m_sun_shape->max_angle();
+    data_manager->launch_params_H.max_sun_angle = (float)(m_sun_angle);
 }
 
-bool SolTraceSystem::read_element(FILE* fp) {
-	
-    //int ielm = ::st_add_element( cxt, istage );
-
-    char buf[1024];
-    read_line(buf, 1023, fp);
-
-    std::vector<std::string> tok = split(buf, "\t", true, false);
-    if (tok.size() < 29)
-    {
-        printf("too few tokens for element: %d\n", static_cast<int>(tok.size()));
-        printf("\t>> %s\n", buf);
-        return false;
-    }
-
-    if (tok[8][0] == 'c' && tok[17][0] == 'f')
-    {
-        //printf("Assuming cylindrical element cap. Skipping element. \n");
-        return true;
-    }
-
-    // st_element_enabled( cxt, istage, ielm,  atoi( tok[0].c_str() ) ? 1 : 0 );
-    auto elem = std::make_shared<CspElement>();
-    Vec3d origin(atof(tok[1].c_str()),
-                    atof(tok[2].c_str()),
-                    atof(tok[3].c_str())); // origin of the element
-    if (tok[8][0] == 'l' && tok[17][0] == 't')
-    {
-        // Cylindrical element, offset y coordinate by radius to center the cylinder
-        origin[1] += 1 / atof(tok[18].c_str()); // tok[18] is 1 / radius
-    }
-    Vec3d aim_point(atof(tok[4].c_str()),
-                       atof(tok[5].c_str()),
-                       atof(tok[6].c_str())); // aim point of the element
-    double zrot = atof(tok[7].c_str());       // z rotation of the element
-
-    elem->set_origin(origin);
-    elem->set_aim_point(aim_point);
-    elem->set_zrot(zrot);
-
-    // TODO: Add more aperature and surface types
-    // Aperatures
-    if (tok[8][0] == 'r')
-    {
-        double dim_x = atof(tok[9].c_str());
-        double dim_y = atof(tok[10].c_str());
-        auto aperture = std::make_shared<ApertureRectangle>(dim_x, dim_y);
-        elem->set_aperture(aperture);
-    }
-    else if (tok[8][0] == 'l' && tok[17][0] == 't')
-    {
-        // In SolTrace STINPUT, this is the Single Axis Curvature Section Type
-        // Used for cylindrical elements. TODO: Update if used elsewhere.
-        double dim_x = 2 * (1 / atof(tok[18].c_str())); // tok[18] is 1 / radius
-        double dim_y = atof(tok[11].c_str());           // Length of the cylinder
-        auto aperture = std::make_shared<ApertureRectangle>(dim_x, dim_y);
-        elem->set_aperture(aperture);
-    }
-    else
-    {
-        // Aperature type not implemented
-        printf("Aperture type not implemented: %s\n", tok[8].c_str());
-        return false;
-    }
-
-    // Surfaces
-    if (tok[17][0] == 'p')
-    {
-        double curv_x = atof(tok[18].c_str());
-        double curv_y = atof(tok[19].c_str());
-        auto surface = std::make_shared<SurfaceParabolic>();
-        surface->set_curvature(curv_x, curv_y);
-        elem->set_surface(surface);
-    }
-    else if (tok[8][0] == 'l' && tok[17][0] == 't')
-    {
-        // In SolTrace STINPUT, this is the Cylindrical Type
-        // Used for cylindrical elements.
-        double radius = 1 / atof(tok[18].c_str()); // tok[18] is 1 / radius
-        double half_height = atof(tok[11].c_str()) / 2;
-        auto surface = std::make_shared<SurfaceCylinder>();
-        surface->set_radius(radius);
-        surface->set_half_height(half_height);
-        elem->set_surface(surface);
-    }
-    else if (tok[17][0] == 'f')
-    {
-        auto surface = std::make_shared<SurfaceFlat>();
-        elem->set_surface(surface);
-    }
-    else
-    {
-        // Surface type not implemented
-        printf("Surface type not implemented: %s\n", tok[17].c_str());
-        return false;
-    }
-
-    // st_element_optic( cxt, istage, ielm,  tok[27].c_str() );
-    // st_element_interaction( cxt, istage, ielm,  atoi( tok[28].c_str()) );
-
-    add_element(elem); // Add the element to the system
-
-    return true;
+// between launches only the launch params change, no need for update()
+void SolTraceSystem::set_sun_sampler(SamplerType type, unsigned int seed, unsigned int samples_per_pass) {
+    m_samples_per_pass = samples_per_pass;
+    data_manager->launch_params_H.sampler.type = type;
+    data_manager->launch_params_H.sampler.seed = seed;
+    set_sampler_strata(data_manager->launch_params_H.sampler,
+                       m_samples_per_pass > 0 ? m_samples_per_pass : static_cast<unsigned int>(m_num_sunpoints));
+    if (data_manager->getDeviceLaunchParams())
+        data_manager->updateLaunchParams();
 }
 
-bool SolTraceSystem::read_stage(FILE* fp) {
-	
-    if (!fp) return false;
-
-	char buf[1024];
-	read_line( buf, 1023, fp );
-
-	int virt=0,multi=1,count=0,tr=0;
-	double X, Y, Z, AX, AY, AZ, ZRot;
-
-
-	sscanf(buf, "STAGE\tXYZ\t%lg\t%lg\t%lg\tAIM\t%lg\t%lg\t%lg\tZROT\t%lg\tVIRTUAL\t%d\tMULTIHIT\t%d\tELEMENTS\t%d\tTRACETHROUGH\t%d",
-		&X, &Y, &Z,
-		&AX, &AY, &AZ,
-		&ZRot,
-		&virt,
-		&multi,
-		&count,
-		&tr );
-
-	read_line( buf, 1023, fp ); // read name
-
-	//printf("stage '%s': [%d] %lg %lg %lg   %lg %lg %lg   %lg   %d %d %d\n",
-	//	buf, count, X, Y, Z, AX, AY, AZ, ZRot, virt, multi, tr );
-	
-	for (int i=0;i<count;i++)
-		if (!read_element( fp )) 
-		{ printf("error in element %d\n", i ); return false; }
-
-	return true;
+void SolTraceSystem::set_sample_offset(unsigned long long offset) {
+    data_manager->launch_params_H.sampler.sample_offset = offset;
+    if (data_manager->getDeviceLaunchParams())
+        data_manager->updateLaunchParams();
 }
 
-bool SolTraceSystem::read_system(FILE* fp) {
-	
-    if (!fp) return false;
-
-	char buf[1024];
-
-	char c = fgetc(fp);
-	if ( c == '#' )
-	{
-		int vmaj = 0, vmin = 0, vmic = 0;
-		read_line( buf, 1023, fp ); sscanf( buf, " SOLTRACE VERSION %d.%d.%d INPUT FILE", &vmaj, &vmin, &vmic);
-
-		//unsigned int file_version = vmaj*10000 + vmin*100 + vmic;
-		
-		printf( "loading input file version %d.%d.%d\n", vmaj, vmin, vmic );
-	}
-	else
-	{
-		ungetc( c, fp );
-		printf("input file must start with '#'\n");
-		return false;
-	}
-
-	if ( !read_sun( fp ) ) return false;
-	
-	int count = 0;
-
-	count = 0;
-	read_line( buf, 1023, fp ); sscanf(buf, "OPTICS LIST COUNT\t%d", &count);
-	
-	for (int i=0;i<count;i++)
-		if (!read_optic( fp )) return false;
-
-	count = 0;
-	read_line( buf, 1023, fp ); sscanf(buf, "STAGE LIST COUNT\t%d", &count);
-	for (int i=0;i<count;i++)
-		if (!read_stage( fp )) return false;
-
-	return true;
+unsigned long long SolTraceSystem::get_sample_offset() const {
+    return data_manager->launch_params_H.sampler.sample_offset;
 }
@@ -13,6 +13,13 @@
 #include "core/timer.h"
 #include "core/CspElement.h" // CspElement
 #include "core/Surface.h"    // Surface and derived classes
+#include "core/sun_shape.h"  // SunShape and derived classes
+#include "shaders/SamplerData.h" // SamplerType
+#include "shaders/RayPower.h"    // RayWeighting
+#include "shaders/StageData.h"   // StageFlags
+#include "core/flux_map.h"     // FluxMap
+#include "core/hit_stream.h"   // HitRecord
+#include "core/packed_hits.h"  // PackedHit
 
 namespace OptixCSP {
 
@@ -37,7 +44,7 @@ namespace OptixCSP {
         /// Update launch params
         void update();
 
-        // Read a stinput file for the simulation setup.
+        // Read a stinput file for the simulation setup: the sun, the elements and the flags of the stages.
         bool read_st_input(const char* filename);
 
         // Write sun point to a file
@@ -48,6 +55,52 @@ namespace OptixCSP {
 		void write_simulation_json(const std::string& filename);
 		// get number of rays hitting the receiver
         int get_num_hits_receiver();
+        /// summed power of the rays hitting the receiver, every sun ray starts with dni times the
+        /// sun plane area over the number of rays and loses what the mirrors do not reflect
+        double get_receiver_power();
+        /// host copies of the hit point buffer and of the power arriving at each hit point, same layout;
+        /// empty with a hit stream
+        const std::vector<float4>& get_hit_point_buffer();
+        const std::vector<float>& get_hit_power_buffer();
+
+        /// <summary>
+        /// write the hits to a stream of at most capacity HitRecord on the device, instead of the hit
+        /// point buffer of width * max_depth entries, which is not allocated; 0, the default, keeps the
+        /// buffer. A launch that overflows the stream is followed by launches over the rays that lost
+        /// records, see HitStreamPlanner. Call before initialize().
+        /// </summary>
+        void set_hit_stream(size_t capacity) { m_hit_stream_capacity = capacity; }
+        size_t get_hit_stream() const { return m_hit_stream_capacity; }
+        /// records of the last run, the sun point of every path that hit something and its hits, in no
+        /// particular order; decode_hit_records lays them out as the hit point buffer
+        const std::vector<HitRecord>& get_hit_records() const { return m_hit_records; }
+        /// launches the last run took to fit its records in the hit stream, 1 without an overflow
+        int get_hit_stream_passes() const { return m_hit_stream_passes; }
+        /// frames of the elements and of the sun plane the hits pack on, after initialize
+        HitFrames get_hit_frames();
+        /// records of the last run packed on the frames of their elements, 8 bytes a hit in the layout
+        /// of the hit point buffer; throws without a hit stream, the buffer does not keep the elements
+        std::vector<PackedHit> get_packed_hits();
+        /// write the packed hits of the last run and their frames to a packed hit file
+        bool write_packed_hits(const std::string& filename);
+
+        /// <summary>
+        /// cells of the flux maps the trace fills, nu along the first axis of every flat receiver, or
+        /// around a cylindrical one, and nv along the second, or the cylinder axis; 0 turns them off,
+        /// the default. Call before initialize().
+        /// </summary>
+        void set_flux_map_resolution(int nu, int nv);
+        /// flux maps of the last launch, one per receiver in element order, without reading
+        /// the hit point buffer back
+        const std::vector<FluxMap>& get_flux_maps();
+        const FluxMap& get_flux_map(size_t receiver = 0);
+        /// sum the power of the receiver hits per element as well, one value per facet of a mesh
+        /// receiver instead of a dump of its hits; off by default. Call before initialize().
+        void set_receiver_element_power(bool enable) { m_element_power = enable; }
+        /// power every element absorbed in the last launch, W, in element order, 0 for the mirrors
+        std::vector<double> get_receiver_element_power();
+        /// the flat receivers with their power and flux per element as a VTK polydata file
+        bool write_receiver_power_vtk(const std::string& filename);
 
 
 
@@ -60,6 +113,7 @@ namespace OptixCSP {
         /// </summary>
         /// <param name="numSunPoints"></param>
         void set_sun_points(int num) { m_num_sunpoints = num; }
+        int get_sun_points() const { return m_num_sunpoints; }
 
         /// <summary>
         /// set normalized sun vector
@@ -69,6 +123,42 @@ namespace OptixCSP {
 
         void set_sun_angle(double angle) { m_sun_angle = angle; } // Set the sun angle
 
+        /// <summary>
+        /// hit points per path, the sun point included, MAX_TRACE_DEPTH by default. The raygen
+        /// program loops over the bounces, so a deeper path costs hit buffer memory but no stack.
+        /// Call before initialize().
+        /// </summary>
+        void set_max_depth(int depth);
+        int get_max_depth() const { return m_max_depth; }
+
+        /// direct normal irradiance in W/m2, scales get_receiver_power()
+        void set_dni(double dni) { m_dni = dni; }
+
+        /// <summary>
+        /// how the mirrors reflect the power of a ray: RAY_WEIGHTED scales it by the reflectivity,
+        /// RAY_ROULETTE keeps the ray with the reflectivity as probability. Takes effect right away after initialize().
+        /// </summary>
+        void set_ray_weighting(RayWeighting weighting);
+
+        /// <summary>
+        /// sample the sun rays from a sunshape table instead of the pillbox cone,
+        /// the sun angle becomes the outermost angle of the table; nullptr goes back to the pillbox
+        /// </summary>
+        void set_sun_shape(std::shared_ptr<const SunShape> sun_shape);
+
+        /// <summary>
+        /// sequence the sun rays are drawn from, seed scrambles SOBOL_OWEN and STRATIFIED;
+        /// the strata of STRATIFIED cover samples_per_pass rays, 0 for the rays of one launch
+        /// </summary>
+        void set_sun_sampler(SamplerType type, unsigned int seed = 0, unsigned int samples_per_pass = 0);
+
+        /// <summary>
+        /// first sample of the next launch; a launch of n rays that goes on with the previous one
+        /// starts at get_sample_offset() + n. Takes effect right away after initialize().
+        /// </summary>
+        void set_sample_offset(unsigned long long offset);
+        unsigned long long get_sample_offset() const;
+
 
         /// <summary>
         /// compute number of heliostat CspElements added to the system 
@@ -92,6 +182,14 @@ namespace OptixCSP {
         /// /// </summary>
         void add_element(std::shared_ptr<CspElement> element);
 
+        /// <summary>
+        /// StageFlags of stage, the stages the elements are traced in (CspElement::set_stage); a ray
+        /// goes through them in order and is only tested against the elements of its current stage.
+        /// Without it every element is in stage 0, a single MULTIHIT stage. Call before initialize().
+        /// </summary>
+        void set_stage_flags(unsigned int stage, unsigned int flags);
+        const std::vector<unsigned int>& get_stage_flags() const { return m_stage_flags; }
+
         double get_time_trace();
         double get_time_setup();
 
@@ -107,23 +205,31 @@ namespace OptixCSP {
         int m_num_sunpoints;
         bool m_verbose;
         int m_num_hits_receiver;
+        int m_max_depth;
+        int m_flux_nu;
+        int m_flux_nv;
+        bool m_element_power;
+        FluxMapLayout m_flux_layout;
+        std::vector<FluxMap> m_flux_maps;
+        size_t m_hit_stream_capacity;
+        std::vector<HitRecord> m_hit_records;
+        int m_hit_stream_passes;
 
         OptixCSP::Vec3d m_sun_vector;
         double m_sun_angle;
+        double m_dni;
+        std::shared_ptr<const SunShape> m_sun_shape;
+        unsigned int m_samples_per_pass;
         OptixCSP::SoltraceState m_state;
 
         std::vector<std::shared_ptr<CspElement>> m_element_list;
+        std::vector<float4> m_hit_point_buffer_H;
+        std::vector<float> m_hit_power_buffer_H;
+        std::vector<unsigned int> m_stage_flags;   // StageFlags of every stage
         void create_shader_binding_table();
-
-        // Helper functions to read a stinput file
-        bool read_system(FILE* fp);
-        bool read_stage(FILE* fp);
-        bool read_element(FILE* fp);
-        bool read_optic(FILE* fp);
-        bool read_optic_surface(FILE* fp);
-        bool read_sun(FILE* fp);
-        void read_line(char* buf, int len, FILE* fp);
-        std::vector<std::string> split(const std::string& str, const std::string& delim, bool ret_empty, bool ret_delim);
+        void update_ray_power();
+        void launch(unsigned int width, unsigned int height);
+        void run_hit_stream();
 
         Timer m_timer_setup;
         Timer m_timer_trace;
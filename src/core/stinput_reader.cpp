@@ -0,0 +1,480 @@
+#include "stinput_reader.h"
+#include "solar_position.h"
+#include "utils/math_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace OptixCSP;
+
+StInputReader::StInputReader()
+    : m_sun_vector(0.0, 0.0, 1.0),
+      m_sun_angle(0.0),
+      m_stage_origin(0.0, 0.0, 0.0) {}
+
+bool StInputReader::read(const char* filename) {
+    m_elements.clear();
+    m_stage_flags.clear();
+    m_optics.clear();
+    m_sun_shape = nullptr;
+
+    FILE* fp = fopen(filename, "r");
+	if (!fp)
+	{
+    	printf("failed to open system input file\n");
+		return false;
+	}
+
+	const bool ok = read_system( fp );
+	if ( !ok )
+		printf("error in system input file.\n");
+
+	fclose(fp);
+    return ok;
+}
+
+// origin, aim point and zrot of an element in the stage coordinates to the global ones; the aim
+// point is moved with the origin, and zrot is the roll of the element rotation composed with the stage one
+void StInputReader::place_in_stage(CspElement& element, const Vec3d& origin, const Vec3d& aim_point, double zrot) const {
+    const Vec3d global_origin = local_to_global(origin, m_stage_G2L, m_stage_origin);
+    const Vec3d global_aim = local_to_global(aim_point, m_stage_G2L, m_stage_origin);
+
+    // element G2L of the global frame: element G2L in the stage times the stage G2L; its roll is
+    // atan2(-m01, m11) as in get_rotation_matrix_G2L
+    const Matrix33d element_G2L = get_rotation_matrix_G2L(normal_to_euler(aim_point - origin, zrot)) * m_stage_G2L;
+    const double roll = std::atan2(-element_G2L(0, 1), element_G2L(1, 1));
+
+    element.set_origin(global_origin);
+    element.set_aim_point(global_aim);
+    element.set_zrot(roll * 180.0 / M_PI);
+}
+
+std::vector<std::string> StInputReader::split(const std::string& str, const std::string& delim, bool ret_empty, bool ret_delim) {
+	
+    std::vector<std::string> list;
+
+	char cur_delim[2] = {0,0};
+	std::string::size_type m_pos = 0;
+	std::string token;
+	
+	while (m_pos < str.length())
+	{
+		std::string::size_type pos = str.find_first_of(delim, m_pos);
+		if (pos == std::string::npos)
+		{
+			cur_delim[0] = 0;
+			token.assign(str, m_pos, std::string::npos);
+			m_pos = str.length();
+		}
+		else
+		{
+			cur_delim[0] = str[pos];
+			std::string::size_type len = pos - m_pos;			
+			token.assign(str, m_pos, len);
+			m_pos = pos + 1;
+		}
+		
+		if (token.empty() && !ret_empty)
+			continue;
+
+		list.push_back( token );
+		
+		if ( ret_delim && cur_delim[0] != 0 && m_pos < str.length() )
+			list.push_back( std::string( cur_delim ) );
+	}
+	
+	return list;
+}
+
+void StInputReader::read_line(char* buf, int len, FILE* fp) {
+	fgets(buf, len, fp);
+	size_t nch = strlen(buf);
+	if (nch > 0 && buf[nch-1] == '\n')
+		buf[nch-1] = 0;
+	if (nch-1 > 0 && buf[nch-2] == '\r')
+		buf[nch-2] = 0;
+}
+
+bool StInputReader::read_sun(FILE* fp) {
+	
+    if (!fp) return false;
+
+	char buf[1024];
+	int bi = 0, count = 0;
+	char cshape = 'g';
+	double Sigma, HalfWidth;
+	bool PointSource;
+
+	read_line( buf, 1023, fp );
+
+	sscanf(buf, "SUN\tPTSRC\t%d\tSHAPE\t%c\tSIGMA\t%lg\tHALFWIDTH\t%lg",
+		&bi, &cshape, &Sigma, &HalfWidth);
+	PointSource = (bi!=0);
+	cshape = tolower(cshape);
+
+    // TODO: Update if supporting other sun shapes
+    m_sun_angle = Sigma * 0.001;
+
+	read_line( buf, 1023, fp );
+	double X, Y, Z, Latitude, Day, Hour;
+	bool UseLDHSpec;
+	sscanf(buf, "XYZ\t%lg\t%lg\t%lg\tUSELDH\t%d\tLDH\t%lg\t%lg\t%lg",
+		&X, &Y, &Z, &bi, &Latitude, &Day, &Hour);
+	UseLDHSpec = (bi!=0);
+	
+    Vec3d sun_vector(X, Y, Z);
+	// latitude, day of the year and solar hour instead of a vector: x east, y north, z up
+	if ( UseLDHSpec )
+		sun_vector = sun_vector_ldh(Latitude, Day, Hour);
+	m_sun_vector = sun_vector;
+
+	//printf("sun ps? %d cs: %c  %lg %lg %lg\n", PointSource?1:0, cshape, X, Y, Z);
+
+	read_line( buf, 1023, fp );
+	sscanf(buf, "USER SHAPE DATA\t%d", &count);
+	if (count > 0)
+	{
+		std::vector<double> angle(count);
+		std::vector<double> intensity(count);
+
+		for (int i=0;i<count;i++)
+		{
+			double x, y;
+			read_line( buf, 1023, fp );
+			sscanf(buf, "%lg\t%lg", &x, &y);
+			angle[i] = x;
+			intensity[i] = y;
+		}
+
+		// angles in mrad, the table replaces the pillbox of SIGMA
+		if (cshape == 'u')
+			m_sun_shape = std::make_shared<TabulatedSunShape>(angle, intensity);
+	}
+
+	return true;
+}
+
+bool StInputReader::read_optic_surface(FILE* fp, OpticSurface& surface) {
+	
+    if (!fp) return false;
+	char buf[1024];
+	read_line(buf, 1023, fp);
+	std::vector<std::string> parts  = split( std::string(buf), "\t", true, false );
+	if (parts.size() < 15)
+	{
+        printf("too few tokens for optical surface: %zu\n", parts.size());
+		printf("\t>> %s\n", buf);
+		return false;
+	}
+
+	char ErrorDistribution = 'g';
+	if (parts[1].length() > 0)
+		ErrorDistribution = parts[1][0];
+
+	// mrad in the file; the errors are sampled as gaussians whatever the distribution
+	surface.reflectivity = atof( parts[5].c_str() );
+	surface.slope_error = atof( parts[7].c_str() ) * 1e-3;
+	surface.specularity_error = atof( parts[8].c_str() ) * 1e-3;
+
+    /*
+	int ApertureStopOrGratingType = atoi( parts[2].c_str() );
+	int OpticalSurfaceNumber = atoi( parts[3].c_str() );
+	int DiffractionOrder = atoi( parts[4].c_str() );
+	double Reflectivity = atof( parts[5].c_str() );
+	double Transmissivity = atof( parts[6].c_str() );
+	double RMSSlope = atof( parts[7].c_str() );
+	double RMSSpecularity = atof( parts[8].c_str() );
+	double RefractionIndexReal = atof( parts[9].c_str() );
+	double RefractionIndexImag = atof( parts[10].c_str() );
+	double GratingCoeffs[4];
+	GratingCoeffs[0] = atof( parts[11].c_str() );
+	GratingCoeffs[1] = atof( parts[12].c_str() );
+	GratingCoeffs[2] = atof( parts[13].c_str() );
+	GratingCoeffs[3] = atof( parts[14].c_str() );
+    */
+
+	bool UseReflectivityTable = false;
+	int refl_npoints = 0;
+	double *refl_angles = 0;
+	double *refls = 0;
+
+	bool UseTransmissivityTable = false;
+	int trans_npoints = 0;
+	double* trans_angles = 0;
+	double* transs = 0;
+
+	if (parts.size() >= 17)
+	{
+		UseReflectivityTable = (atoi( parts[15].c_str() ) > 0);
+		refl_npoints = atoi( parts[16].c_str() );
+		if (parts.size() >= 19)
+		{
+			UseTransmissivityTable = (atoi(parts[17].c_str()) > 0);
+			trans_npoints = atoi(parts[18].c_str());
+		}
+	}
+
+	if (UseReflectivityTable)
+	{
+		refl_angles = new double[refl_npoints];
+		refls = new double[refl_npoints];
+
+		for (int i=0;i<refl_npoints;i++)
+		{
+			read_line(buf,1023,fp);
+			sscanf(buf, "%lg %lg", &refl_angles[i], &refls[i]);
+		}
+	}
+	if (UseTransmissivityTable)
+	{
+		trans_angles = new double[trans_npoints];
+		transs = new double[trans_npoints];
+
+		for (int i = 0; i < trans_npoints; i++)
+		{
+			read_line(buf, 1023, fp);
+			sscanf(buf, "%lg %lg", &trans_angles[i], &transs[i]);
+		}
+	}
+
+	// TODO: Update once optical surface params are implemented
+	// st_optic( cxt, iopt, fb, ErrorDistribution,
+	// 	OpticalSurfaceNumber, ApertureStopOrGratingType, DiffractionOrder,
+	// 	RefractionIndexReal, RefractionIndexImag,
+	// 	Reflectivity, Transmissivity,
+	// 	GratingCoeffs, RMSSlope, RMSSpecularity,
+	// 	UseReflectivityTable ? 1 : 0, refl_npoints,
+	// 	refl_angles, refls,
+	// 	UseTransmissivityTable? 1 : 0, trans_npoints,
+	// 	trans_angles, transs
+	// 	);
+
+	if (refl_angles != 0) delete [] refl_angles;
+	if (refls != 0) delete [] refls;
+	if (trans_angles != 0) delete[] trans_angles;
+	if (transs != 0) delete[] transs;
+	return true;
+}
+
+bool StInputReader::read_optic(FILE* fp) {
+	if (!fp) return false;
+	char buf[1024];
+	read_line( buf, 1023, fp );
+
+	if (strncmp( buf, "OPTICAL PAIR", 12) == 0)
+	{
+		std::vector<std::string> parts = split( std::string(buf), "\t", true, false );
+		const std::string name = parts.size() > 1 ? parts[1] : std::string();
+
+		// the front surface reflects, the back one is kept for the file format only
+		OpticSurface front, back;
+		read_optic_surface( fp, front );
+		read_optic_surface( fp, back );
+		m_optics[name] = front;
+		return true;
+	}
+	else return false;
+}
+
+bool StInputReader::read_element(FILE* fp) {
+	
+    //int ielm = ::st_add_element( cxt, istage );
+
+    char buf[1024];
+    read_line(buf, 1023, fp);
+
+    std::vector<std::string> tok = split(buf, "\t", true, false);
+    if (tok.size() < 29)
+    {
+        printf("too few tokens for element: %d\n", static_cast<int>(tok.size()));
+        printf("\t>> %s\n", buf);
+        return false;
+    }
+
+    if (tok[8][0] == 'c' && tok[17][0] == 'f')
+    {
+        //printf("Assuming cylindrical element cap. Skipping element. \n");
+        return true;
+    }
+
+    // st_element_enabled( cxt, istage, ielm,  atoi( tok[0].c_str() ) ? 1 : 0 );
+    auto elem = std::make_shared<CspElement>();
+    Vec3d origin(atof(tok[1].c_str()),
+                    atof(tok[2].c_str()),
+                    atof(tok[3].c_str())); // origin of the element
+    if (tok[8][0] == 'l' && tok[17][0] == 't')
+    {
+        // Cylindrical element, offset y coordinate by radius to center the cylinder
+        origin[1] += 1 / atof(tok[18].c_str()); // tok[18] is 1 / radius
+    }
+    Vec3d aim_point(atof(tok[4].c_str()),
+                       atof(tok[5].c_str()),
+                       atof(tok[6].c_str())); // aim point of the element
+    double zrot = atof(tok[7].c_str());       // z rotation of the element
+
+    place_in_stage(*elem, origin, aim_point, zrot);
+    elem->set_stage(static_cast<unsigned int>(m_stage_flags.size() - 1));
+
+    // TODO: Add more aperature and surface types
+    // Aperatures
+    if (tok[8][0] == 'r')
+    {
+        double dim_x = atof(tok[9].c_str());
+        double dim_y = atof(tok[10].c_str());
+        auto aperture = std::make_shared<ApertureRectangle>(dim_x, dim_y);
+        elem->set_aperture(aperture);
+    }
+    else if (tok[8][0] == 'l' && tok[17][0] == 't')
+    {
+        // In SolTrace STINPUT, this is the Single Axis Curvature Section Type
+        // Used for cylindrical elements. TODO: Update if used elsewhere.
+        double dim_x = 2 * (1 / atof(tok[18].c_str())); // tok[18] is 1 / radius
+        double dim_y = atof(tok[11].c_str());           // Length of the cylinder
+        auto aperture = std::make_shared<ApertureRectangle>(dim_x, dim_y);
+        elem->set_aperture(aperture);
+    }
+    else
+    {
+        // Aperature type not implemented
+        printf("Aperture type not implemented: %s\n", tok[8].c_str());
+        return false;
+    }
+
+    // Surfaces
+    if (tok[17][0] == 'p')
+    {
+        double curv_x = atof(tok[18].c_str());
+        double curv_y = atof(tok[19].c_str());
+        auto surface = std::make_shared<SurfaceParabolic>();
+        surface->set_curvature(curv_x, curv_y);
+        elem->set_surface(surface);
+    }
+    else if (tok[8][0] == 'l' && tok[17][0] == 't')
+    {
+        // In SolTrace STINPUT, this is the Cylindrical Type
+        // Used for cylindrical elements.
+        double radius = 1 / atof(tok[18].c_str()); // tok[18] is 1 / radius
+        double half_height = atof(tok[11].c_str()) / 2;
+        auto surface = std::make_shared<SurfaceCylinder>();
+        surface->set_radius(radius);
+        surface->set_half_height(half_height);
+        elem->set_surface(surface);
+    }
+    else if (tok[17][0] == 'f')
+    {
+        auto surface = std::make_shared<SurfaceFlat>();
+        elem->set_surface(surface);
+    }
+    else
+    {
+        // Surface type not implemented
+        printf("Surface type not implemented: %s\n", tok[17].c_str());
+        return false;
+    }
+
+    // st_element_optic( cxt, istage, ielm,  tok[27].c_str() );
+    auto optic = m_optics.find(tok[27]);
+    if (optic != m_optics.end()) {
+        elem->set_reflectivity(optic->second.reflectivity);
+        elem->set_slope_error(optic->second.slope_error);
+        elem->set_specularity_error(optic->second.specularity_error);
+    }
+    // st_element_interaction( cxt, istage, ielm,  atoi( tok[28].c_str()) );
+
+    m_elements.push_back(elem);
+
+    return true;
+}
+
+bool StInputReader::read_stage(FILE* fp) {
+	
+    if (!fp) return false;
+
+	char buf[1024];
+	read_line( buf, 1023, fp );
+
+	int virt=0,multi=1,count=0,tr=0;
+	double X, Y, Z, AX, AY, AZ, ZRot;
+
+
+	sscanf(buf, "STAGE\tXYZ\t%lg\t%lg\t%lg\tAIM\t%lg\t%lg\t%lg\tZROT\t%lg\tVIRTUAL\t%d\tMULTIHIT\t%d\tELEMENTS\t%d\tTRACETHROUGH\t%d",
+		&X, &Y, &Z,
+		&AX, &AY, &AZ,
+		&ZRot,
+		&virt,
+		&multi,
+		&count,
+		&tr );
+
+	read_line( buf, 1023, fp ); // read name
+
+	//printf("stage '%s': [%d] %lg %lg %lg   %lg %lg %lg   %lg   %d %d %d\n",
+	//	buf, count, X, Y, Z, AX, AY, AZ, ZRot, virt, multi, tr );
+
+	if (m_stage_flags.size() == MAX_STAGES)
+	{
+		printf("too many stages, at most %u\n", MAX_STAGES);
+		return false;
+	}
+	m_stage_flags.push_back( (virt ? STAGE_VIRTUAL : 0u) | (multi ? STAGE_MULTIHIT : 0u) | (tr ? STAGE_TRACETHROUGH : 0u) );
+
+	// the elements are given in the coordinates of the stage
+	const Vec3d stage_origin(X, Y, Z);
+	m_stage_origin = stage_origin;
+	m_stage_G2L = get_rotation_matrix_G2L(normal_to_euler(Vec3d(AX, AY, AZ) - stage_origin, ZRot));
+	
+	for (int i=0;i<count;i++)
+		if (!read_element( fp )) 
+		{ printf("error in element %d\n", i ); return false; }
+
+	return true;
+}
+
+bool StInputReader::read_system(FILE* fp) {
+	
+    if (!fp) return false;
+
+	char buf[1024];
+
+	char c = fgetc(fp);
+	if ( c == '#' )
+	{
+		int vmaj = 0, vmin = 0, vmic = 0;
+		read_line( buf, 1023, fp ); sscanf( buf, " SOLTRACE VERSION %d.%d.%d INPUT FILE", &vmaj, &vmin, &vmic);
+
+		//unsigned int file_version = vmaj*10000 + vmin*100 + vmic;
+		
+		printf( "loading input file version %d.%d.%d\n", vmaj, vmin, vmic );
+	}
+	else
+	{
+		ungetc( c, fp );
+		printf("input file must start with '#'\n");
+		return false;
+	}
+
+	if ( !read_sun( fp ) ) return false;
+	
+	int count = 0;
+
+	count = 0;
+	read_line( buf, 1023, fp ); sscanf(buf, "OPTICS LIST COUNT\t%d", &count);
+	
+	for (int i=0;i<count;i++)
+		if (!read_optic( fp )) return false;
+
+	count = 0;
+	read_line( buf, 1023, fp ); sscanf(buf, "STAGE LIST COUNT\t%d", &count);
+	for (int i=0;i<count;i++)
+		if (!read_stage( fp )) return false;
+
+	// the last stage is the one that absorbs, unless it only records
+	const unsigned int last = static_cast<unsigned int>(m_stage_flags.size()) - 1;
+	if (!m_stage_flags.empty() && !(m_stage_flags[last] & STAGE_VIRTUAL))
+		for (const std::shared_ptr<CspElement>& e : m_elements)
+			if (e->get_stage() == last) e->set_receiver(true);
+
+	return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vec3d.h"
+#include "CspElement.h"
+#include "sun_shape.h"
+#include "shaders/StageData.h"
+
+namespace OptixCSP {
+
+    /**
+     * @class StInputReader
+     * @brief Reads a SolTrace stinput file: the sun, the optics and the stages with their elements,
+     * shared by SolTraceSystem and CpuTracer. The elements come out in global coordinates, placed by
+     * the transform of their stage, in stage order and tagged with their stage; the flags of every
+     * stage (VIRTUAL, MULTIHIT, TRACETHROUGH) come out as StageFlags. The elements of the last stage
+     * are the receivers, unless it is virtual.
+     */
+    class StInputReader {
+    public:
+        StInputReader();
+
+        /// read filename, false when it cannot be opened or has an error
+        bool read(const char* filename);
+
+        const Vec3d& sun_vector() const { return m_sun_vector; }
+        /// half angle of the pillbox sun, radians
+        double sun_angle() const { return m_sun_angle; }
+        /// tabulated sunshape, nullptr for the pillbox
+        std::shared_ptr<const SunShape> sun_shape() const { return m_sun_shape; }
+        const std::vector<std::shared_ptr<CspElement>>& elements() const { return m_elements; }
+        /// StageFlags of every stage, in order
+        const std::vector<unsigned int>& stage_flags() const { return m_stage_flags; }
+
+    private:
+        // optics of one surface of an optical pair of the stinput file
+        struct OpticSurface {
+            double reflectivity = 1.0;
+            double slope_error = 0.0;        // rms, radians
+            double specularity_error = 0.0;  // rms, radians
+        };
+
+        bool read_system(FILE* fp);
+        bool read_stage(FILE* fp);
+        bool read_element(FILE* fp);
+        bool read_optic(FILE* fp);
+        bool read_optic_surface(FILE* fp, OpticSurface& surface);
+        bool read_sun(FILE* fp);
+        void read_line(char* buf, int len, FILE* fp);
+        std::vector<std::string> split(const std::string& str, const std::string& delim, bool ret_empty, bool ret_delim);
+        void place_in_stage(CspElement& element, const Vec3d& origin, const Vec3d& aim_point, double zrot) const;
+
+        Vec3d m_sun_vector;
+        double m_sun_angle;
+        std::shared_ptr<const SunShape> m_sun_shape;
+        std::vector<std::shared_ptr<CspElement>> m_elements;
+        std::vector<unsigned int> m_stage_flags;
+
+        // front surface of each optical pair, the one that reflects
+        std::map<std::string, OpticSurface> m_optics;
+
+        // transform of the stage being read
+        Vec3d m_stage_origin;
+        Matrix33d m_stage_G2L;
+    };
+}
@@ -0,0 +1,354 @@
+#include "sun_position_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace OptixCSP;
+
+namespace {
+    const char CACHE_MAGIC[8] = { 'S', 'T', 'S', 'U', 'N', 'C', 'A', 'C' };
+    const uint32_t CACHE_VERSION = 1;
+    const double RAD = M_PI / 180.0;
+
+    // FNV-1a over the bytes of the values
+    struct Fnv1a {
+        uint64_t h = 14695981039346656037ULL;
+        void add(const void* data, size_t size) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++) {
+                h ^= p[i];
+                h *= 1099511628211ULL;
+            }
+        }
+        void add(double v) { add(&v, sizeof(v)); }
+        void add(uint64_t v) { add(&v, sizeof(v)); }
+        void add(const Vec3d& v) { add(v[0]); add(v[1]); add(v[2]); }
+    };
+}
+
+/// first 64 bytes of the file, the records follow
+struct SunPositionCache::Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t num_values;
+    uint64_t scene_hash;
+    double   azimuth_step;
+    double   elevation_step;
+    int32_t  num_azimuth;
+    int32_t  num_elevation;
+    char     reserved[16];
+};
+
+uint64_t OptixCSP::scene_hash(const std::vector<std::shared_ptr<CspElement>>& elements, uint64_t salt) {
+    return scene_hash(elements, std::vector<unsigned int>(), salt);
+}
+
+uint64_t OptixCSP::scene_hash(const std::vector<std::shared_ptr<CspElement>>& elements,
+                              const std::vector<unsigned int>& stage_flags, uint64_t salt) {
+    Fnv1a f;
+    f.add(salt);
+    f.add(static_cast<uint64_t>(stage_flags.size()));
+    for (unsigned int flags : stage_flags)
+        f.add(static_cast<uint64_t>(flags));
+    f.add(static_cast<uint64_t>(elements.size()));
+    for (const std::shared_ptr<CspElement>& e : elements) {
+        f.add(e->get_origin());
+        f.add(e->get_zrot());
+        f.add(static_cast<uint64_t>(e->is_receiver()));
+        f.add(static_cast<uint64_t>(e->get_stage()));
+        f.add(e->get_reflectivity());
+        f.add(e->get_slope_error());
+        f.add(e->get_specularity_error());
+        if (e->is_receiver())
+            f.add(e->get_aim_point());
+
+        const std::shared_ptr<Aperture> aperture = e->get_aperture();
+        if (aperture) {
+            f.add(static_cast<uint64_t>(aperture->get_aperture_type()));
+            f.add(aperture->get_width());
+            f.add(aperture->get_height());
+            f.add(aperture->get_radius());
+            if (auto triangle = std::dynamic_pointer_cast<ApertureTriangle>(aperture)) {
+                f.add(triangle->get_v0());
+                f.add(triangle->get_v1());
+                f.add(triangle->get_v2());
+            }
+        }
+        const std::shared_ptr<Surface> surface = e->get_surface();
+        if (surface) {
+            f.add(static_cast<uint64_t>(surface->get_surface_type()));
+            f.add(surface->get_curvature_1());
+            f.add(surface->get_curvature_2());
+            if (auto cylinder = std::dynamic_pointer_cast<SurfaceCylinder>(surface)) {
+                f.add(cylinder->get_radius());
+                f.add(cylinder->get_half_height());
+            }
+        }
+    }
+    return f.h;
+}
+
+SunPositionCache::SunPositionCache(const std::string& path, uint64_t scene_hash, size_t num_values,
+                                   double azimuth_step, double elevation_step)
+    : m_num_values(num_values),
+      m_tolerance(0.0),
+      m_size(0),
+      m_data(nullptr),
+#if defined(_WIN32)
+      m_file(nullptr),
+      m_mapping(nullptr)
+#else
+      m_fd(-1)
+#endif
+{
+    static_assert(sizeof(Header) == 64, "cache header is 64 bytes");
+    if (num_values == 0 || !(azimuth_step > 0.0) || !(elevation_step > 0.0))
+        throw std::runtime_error("Sun position cache needs values and positive grid steps.");
+
+    // steps that divide the circle and the quarter
+    m_num_azimuth = std::max(1, static_cast<int>(std::lround(360.0 / azimuth_step)));
+    m_num_elevation = std::max(2, static_cast<int>(std::lround(90.0 / elevation_step)) + 1);
+    m_azimuth_step = 360.0 / m_num_azimuth;
+    m_elevation_step = 90.0 / (m_num_elevation - 1);
+    m_record_floats = 1 + num_values;
+    const size_t size = sizeof(Header) + sizeof(float) * m_record_floats * m_num_azimuth * m_num_elevation;
+
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    const bool exists = fp != nullptr;
+    if (fp) std::fclose(fp);
+
+    m_size = size;
+    map_file(path, !exists);
+
+    Header& h = *reinterpret_cast<Header*>(m_data);
+    if (exists) {
+        const bool valid = std::memcmp(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && h.version == CACHE_VERSION;
+        const bool same = valid && h.scene_hash == scene_hash && h.num_values == num_values &&
+                          h.num_azimuth == m_num_azimuth && h.num_elevation == m_num_elevation;
+        if (!same) {
+            unmap_file();
+            throw std::runtime_error("Sun position cache " + path + " belongs to another scene or grid.");
+        }
+    }
+    else {
+        std::memset(&h, 0, sizeof(Header));
+        std::memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        h.version = CACHE_VERSION;
+        h.num_values = static_cast<uint32_t>(num_values);
+        h.scene_hash = scene_hash;
+        h.azimuth_step = m_azimuth_step;
+        h.elevation_step = m_elevation_step;
+        h.num_azimuth = m_num_azimuth;
+        h.num_elevation = m_num_elevation;
+    }
+}
+
+SunPositionCache::~SunPositionCache() {
+    unmap_file();
+}
+
+std::string SunPositionCache::file_name(const std::string& directory, uint64_t scene_hash) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "suncache_%016llx.bin", static_cast<unsigned long long>(scene_hash));
+    return directory.empty() ? std::string(name) : directory + "/" + name;
+}
+
+#if defined(_WIN32)
+void SunPositionCache::map_file(const std::string& path, bool create) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open sun position cache " + path);
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    if (!create && static_cast<size_t>(size.QuadPart) != m_size) {
+        CloseHandle(file);
+        throw std::runtime_error("Sun position cache " + path + " belongs to another scene or grid.");
+    }
+    LARGE_INTEGER mapped_size;
+    mapped_size.QuadPart = static_cast<LONGLONG>(m_size);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, mapped_size.HighPart, mapped_size.LowPart, nullptr);
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size) : nullptr;
+    if (!data) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map sun position cache " + path);
+    }
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<char*>(data);
+}
+
+void SunPositionCache::unmap_file() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(static_cast<HANDLE>(m_mapping));
+    if (m_file) CloseHandle(static_cast<HANDLE>(m_file));
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+}
+
+void SunPositionCache::sync() {
+    if (m_data) FlushViewOfFile(m_data, m_size);
+}
+#else
+void SunPositionCache::map_file(const std::string& path, bool create) {
+    m_fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Cannot open sun position cache " + path);
+    struct stat st;
+    const bool sized = create ? ::ftruncate(m_fd, static_cast<off_t>(m_size)) == 0
+                              : ::fstat(m_fd, &st) == 0 && static_cast<size_t>(st.st_size) == m_size;
+    void* data = sized ? ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0) : MAP_FAILED;
+    if (data == MAP_FAILED) {
+        ::close(m_fd);
+        m_fd = -1;
+        throw std::runtime_error(sized ? "Cannot map sun position cache " + path
+                                       : "Sun position cache " + path + " belongs to another scene or grid.");
+    }
+    m_data = static_cast<char*>(data);
+}
+
+void SunPositionCache::unmap_file() {
+    if (m_data) ::munmap(m_data, m_size);
+    if (m_fd >= 0) ::close(m_fd);
+    m_data = nullptr;
+    m_fd = -1;
+}
+
+void SunPositionCache::sync() {
+    if (m_data) ::msync(m_data, m_size, MS_SYNC);
+}
+#endif
+
+float* SunPositionCache::record(int azimuth, int elevation) const {
+    const size_t index = static_cast<size_t>(elevation) * m_num_azimuth + azimuth;
+    return reinterpret_cast<float*>(m_data + sizeof(Header)) + index * m_record_floats;
+}
+
+bool SunPositionCache::has(const SunGridNode& node) const {
+    return record(node.azimuth, node.elevation)[0] != 0.0f;
+}
+
+void SunPositionCache::store(const SunGridNode& node, const float* values) {
+    float* r = record(node.azimuth, node.elevation);
+    std::memcpy(r + 1, values, sizeof(float) * m_num_values);
+    r[0] = 1.0f;
+    m_stats.stores++;
+}
+
+size_t SunPositionCache::get_num_stored() const {
+    size_t n = 0;
+    for (int e = 0; e < m_num_elevation; e++)
+        for (int a = 0; a < m_num_azimuth; a++)
+            n += record(a, e)[0] != 0.0f;
+    return n;
+}
+
+Vec3d SunPositionCache::node_sun_vector(const SunGridNode& node) const {
+    const double azimuth = node.azimuth * m_azimuth_step * RAD;
+    const double elevation = node.elevation * m_elevation_step * RAD;
+    return Vec3d(std::cos(elevation) * std::sin(azimuth), std::cos(elevation) * std::cos(azimuth), std::sin(elevation));
+}
+
+void SunPositionCache::sun_angles(const Vec3d& sun_vector, double& azimuth, double& elevation) {
+    const Vec3d s = sun_vector.normalized();
+    azimuth = std::atan2(s[0], s[1]) / RAD;
+    if (azimuth < 0.0) azimuth += 360.0;
+    elevation = std::asin(std::max(-1.0, std::min(1.0, s[2]))) / RAD;
+}
+
+// the four nodes around a position and the fractions of the way to the next ones
+void SunPositionCache::corners(double azimuth, double elevation, SunGridNode nodes[4], double& fa, double& fe) const {
+    double a = std::fmod(azimuth, 360.0) / m_azimuth_step;
+    if (a < 0.0) a += m_num_azimuth;
+    int a0 = static_cast<int>(std::floor(a));
+    fa = a - a0;
+    a0 %= m_num_azimuth;
+    const int a1 = (a0 + 1) % m_num_azimuth;
+
+    const double e = std::max(0.0, std::min(90.0, elevation)) / m_elevation_step;
+    const int e0 = std::min(static_cast<int>(std::floor(e)), m_num_elevation - 2);
+    fe = e - e0;
+
+    nodes[0] = { a0, e0 };
+    nodes[1] = { a1, e0 };
+    nodes[2] = { a0, e0 + 1 };
+    nodes[3] = { a1, e0 + 1 };
+}
+
+std::vector<SunGridNode> SunPositionCache::missing_nodes(double azimuth, double elevation) const {
+    SunGridNode nodes[4];
+    double fa, fe;
+    corners(azimuth, elevation, nodes, fa, fe);
+    const double weights[4] = { (1.0 - fa) * (1.0 - fe), fa * (1.0 - fe), (1.0 - fa) * fe, fa * fe };
+
+    std::vector<SunGridNode> missing;
+    for (int i = 0; i < 4; i++)
+        if (weights[i] > 0.0 && !has(nodes[i]))
+            missing.push_back(nodes[i]);
+    return missing;
+}
+
+void SunPositionCache::interpolate(double azimuth, double elevation, float* values) const {
+    SunGridNode nodes[4];
+    double fa, fe;
+    corners(azimuth, elevation, nodes, fa, fe);
+    const double weights[4] = { (1.0 - fa) * (1.0 - fe), fa * (1.0 - fe), (1.0 - fa) * fe, fa * fe };
+
+    for (size_t v = 0; v < m_num_values; v++) {
+        double sum = 0.0;
+        for (int i = 0; i < 4; i++)
+            if (weights[i] > 0.0)
+                sum += weights[i] * record(nodes[i].azimuth, nodes[i].elevation)[1 + v];
+        values[v] = static_cast<float>(sum);
+    }
+}
+
+bool SunPositionCache::lookup(double azimuth, double elevation, float* values) {
+    SunGridNode nodes[4];
+    double fa, fe;
+    corners(azimuth, elevation, nodes, fa, fe);
+
+    // the nearest node, when it is within the tolerance
+    const SunGridNode nearest = nodes[(fa < 0.5 ? 0 : 1) + (fe < 0.5 ? 0 : 2)];
+    if (m_tolerance > 0.0 && has(nearest)) {
+        const double e = elevation * RAD;
+        const Vec3d s(std::cos(e) * std::sin(azimuth * RAD), std::cos(e) * std::cos(azimuth * RAD), std::sin(e));
+        const double distance = std::acos(std::max(-1.0, std::min(1.0, s.dot(node_sun_vector(nearest))))) / RAD;
+        if (distance <= m_tolerance) {
+            std::memcpy(values, record(nearest.azimuth, nearest.elevation) + 1, sizeof(float) * m_num_values);
+            m_stats.hits++;
+            return true;
+        }
+    }
+
+    if (!missing_nodes(azimuth, elevation).empty()) {
+        m_stats.misses++;
+        return false;
+    }
+    interpolate(azimuth, elevation, values);
+    m_stats.interpolated++;
+    return true;
+}
+
+bool SunPositionCache::lookup(const Vec3d& sun_vector, float* values) {
+    double azimuth, elevation;
+    sun_angles(sun_vector, azimuth, elevation);
+    return lookup(azimuth, elevation, values);
+}
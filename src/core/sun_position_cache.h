@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vec3d.h"
+#include "CspElement.h"
+
+namespace OptixCSP {
+
+    /// Hash of the parts of a scene that do not move with the sun: origins, zrot, apertures,
+    /// surfaces, optics (reflectivity, slope and specularity error), stages and the receiver flags,
+    /// and the aim points of the receivers. The heliostat aim points are left out, they follow the
+    /// sun. salt takes whatever else the results depend on, the number of rays or the sunshape.
+    uint64_t scene_hash(const std::vector<std::shared_ptr<CspElement>>& elements, uint64_t salt = 0);
+    /// the same with the StageFlags of every stage, the stages past the end are MULTIHIT
+    uint64_t scene_hash(const std::vector<std::shared_ptr<CspElement>>& elements,
+                        const std::vector<unsigned int>& stage_flags, uint64_t salt = 0);
+
+    /// node of the (azimuth, elevation) grid of a SunPositionCache
+    struct SunGridNode {
+        int azimuth;
+        int elevation;
+    };
+
+    /// lookups of a SunPositionCache since it was opened
+    struct SunCacheStats {
+        size_t hits = 0;            // answered by the node within the tolerance
+        size_t interpolated = 0;    // answered from the four nodes around the sun
+        size_t misses = 0;
+        size_t stores = 0;
+    };
+
+    /**
+     * @class SunPositionCache
+     * @brief Results per sun position of one scene, on a grid of azimuth (degrees from north,
+     * clockwise, wrapping at 360) and elevation (0 to 90 degrees). A result is num_values floats,
+     * for instance the receiver power per unit dni followed by the efficiency of every heliostat.
+     *
+     * The cache is one file: a header with the scene hash and the grid, then a record per node at
+     * a fixed place, a flag and the values. The file is mapped into memory, a lookup reads the
+     * records in place and a store writes one, so nothing is loaded up front and the results of a
+     * run are in the file when the cache is closed. The file of another scene or grid is refused.
+     *
+     * A sun position within the tolerance of a stored node is answered by that node; otherwise,
+     * when the four nodes around it are stored, by bilinear interpolation between them. A miss
+     * leaves it to the caller to trace the missing nodes (missing_nodes, node_sun_vector) and store
+     * them; evaluate() does all of that with a trace callback.
+     */
+    class SunPositionCache {
+    public:
+        /// open the cache file at path, or create it for the scene and the grid
+        SunPositionCache(const std::string& path, uint64_t scene_hash, size_t num_values,
+                         double azimuth_step = 1.0, double elevation_step = 1.0);
+        ~SunPositionCache();
+
+        SunPositionCache(const SunPositionCache&) = delete;
+        SunPositionCache& operator=(const SunPositionCache&) = delete;
+
+        /// file name of a scene in a cache directory
+        static std::string file_name(const std::string& directory, uint64_t scene_hash);
+
+        /// distance in degrees from a stored node within which the node answers as it is
+        void set_tolerance(double degrees) { m_tolerance = degrees; }
+
+        /// values at a sun position, false and nothing written on a miss
+        bool lookup(double azimuth, double elevation, float* values);
+        bool lookup(const Vec3d& sun_vector, float* values);
+
+        /// nodes around a sun position that have no result yet
+        std::vector<SunGridNode> missing_nodes(double azimuth, double elevation) const;
+        /// unit vector toward the sun at a node, x east, y north, z up
+        Vec3d node_sun_vector(const SunGridNode& node) const;
+        bool has(const SunGridNode& node) const;
+        void store(const SunGridNode& node, const float* values);
+
+        /// lookup; on a miss the missing nodes are traced with trace(sun_vector, values) and stored
+        template <class Trace>
+        void evaluate(double azimuth, double elevation, float* values, Trace trace) {
+            if (lookup(azimuth, elevation, values)) return;
+            std::vector<float> node_values(m_num_values);
+            for (const SunGridNode& node : missing_nodes(azimuth, elevation)) {
+                trace(node_sun_vector(node), node_values.data());
+                store(node, node_values.data());
+            }
+            interpolate(azimuth, elevation, values);
+        }
+
+        /// flush the stored records to the file
+        void sync();
+
+        size_t get_num_values() const { return m_num_values; }
+        size_t get_num_stored() const;
+        const SunCacheStats& get_stats() const { return m_stats; }
+
+        /// azimuth and elevation in degrees of a sun vector, x east, y north, z up
+        static void sun_angles(const Vec3d& sun_vector, double& azimuth, double& elevation);
+
+    private:
+        struct Header;
+
+        float* record(int azimuth, int elevation) const;
+        void corners(double azimuth, double elevation, SunGridNode nodes[4], double& fa, double& fe) const;
+        void interpolate(double azimuth, double elevation, float* values) const;
+        void map_file(const std::string& path, bool create);
+        void unmap_file();
+
+        size_t m_num_values;
+        double m_azimuth_step;
+        double m_elevation_step;
+        int m_num_azimuth;
+        int m_num_elevation;
+        size_t m_record_floats;     // flag and values
+        double m_tolerance;
+
+        size_t m_size;
+        char* m_data;
+#if defined(_WIN32)
+        void* m_file;
+        void* m_mapping;
+#else
+        int m_fd;
+#endif
+
+        SunCacheStats m_stats;
+    };
+}
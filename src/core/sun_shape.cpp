@@ -0,0 +1,202 @@
+#include "sun_shape.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+    const double DISK_ANGLE = 4.65;       // mrad
+    const double AUREOLE_ANGLE = 43.6;    // mrad
+}
+
+// ---------------------------------------------------------------------------
+// SunShape
+// ---------------------------------------------------------------------------
+void SunShape::build_table(double max_angle, int num_bins) {
+    if (num_bins < 1)
+        throw std::runtime_error("Sunshape table needs at least one bin.");
+
+    m_max_angle = static_cast<float>(max_angle);
+    m_total = integrate(0.0, max_angle);
+    if (!(m_total > 0.0))
+        throw std::runtime_error("Sunshape carries no energy.");
+
+    // bins of equal width in angle; the sampler places the points of a bin like the solid angle,
+    // so the integrated weight is all the profile has to provide
+    const double width = max_angle / num_bins;
+    m_bin_prob.resize(num_bins);
+    for (int b = 0; b < num_bins; b++)
+        m_bin_prob[b] = integrate(b * width, (b + 1) * width) / m_total;
+
+    // Vose's alias method: every bin is topped up to 1 / num_bins by one larger bin
+    m_alias_prob.assign(num_bins, 1.0f);
+    m_alias_index.resize(num_bins);
+    std::vector<double> scaled(num_bins);
+    std::vector<int> small, large;
+    for (int b = 0; b < num_bins; b++) {
+        m_alias_index[b] = b;
+        scaled[b] = m_bin_prob[b] * num_bins;
+        (scaled[b] < 1.0 ? small : large).push_back(b);
+    }
+    while (!small.empty() && !large.empty()) {
+        const int s = small.back(); small.pop_back();
+        const int l = large.back(); large.pop_back();
+        m_alias_prob[s] = static_cast<float>(scaled[s]);
+        m_alias_index[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+    // what is left is 1 up to rounding
+    for (int b : small) m_alias_prob[b] = 1.0f;
+    for (int b : large) m_alias_prob[b] = 1.0f;
+}
+
+double SunShape::probability(double theta_lo, double theta_hi) const {
+    return integrate(theta_lo, theta_hi) / m_total;
+}
+
+SunShapeData SunShape::data() const {
+    SunShapeData data;
+    data.num_bins = num_bins();
+    data.max_angle = m_max_angle;
+    data.alias_prob = m_alias_prob.data();
+    data.alias_index = m_alias_index.data();
+    return data;
+}
+
+// ---------------------------------------------------------------------------
+// TabulatedSunShape
+// ---------------------------------------------------------------------------
+TabulatedSunShape::TabulatedSunShape(const std::vector<double>& angles_mrad, const std::vector<double>& intensity,
+                                     int num_bins) {
+    if (angles_mrad.size() != intensity.size() || angles_mrad.size() < 2)
+        throw std::runtime_error("Sunshape table needs at least two angle / intensity pairs.");
+    for (size_t i = 0; i < angles_mrad.size(); i++) {
+        if (angles_mrad[i] < 0.0 || intensity[i] < 0.0)
+            throw std::runtime_error("Sunshape table has a negative angle or intensity.");
+        if (i > 0 && !(angles_mrad[i] > angles_mrad[i - 1]))
+            throw std::runtime_error("Sunshape table angles must increase.");
+    }
+
+    m_angles.resize(angles_mrad.size());
+    for (size_t i = 0; i < angles_mrad.size(); i++)
+        m_angles[i] = angles_mrad[i] * 0.001;
+    m_intensity = intensity;
+
+    build_table(m_angles.back(), num_bins);
+}
+
+double TabulatedSunShape::integrate(double a, double b) const {
+    double sum = 0.0;
+    for (size_t i = 0; i + 1 < m_angles.size(); i++) {
+        const double t0 = std::max(a, m_angles[i]);
+        const double t1 = std::min(b, m_angles[i + 1]);
+        if (!(t1 > t0)) continue;
+
+        // intensity i0 + k (t - t0) over [t0, t1]
+        const double k = (m_intensity[i + 1] - m_intensity[i]) / (m_angles[i + 1] - m_angles[i]);
+        const double i0 = m_intensity[i] + k * (t0 - m_angles[i]);
+        sum += i0 * (t1 * t1 - t0 * t0) / 2.0
+             + k * ((t1 * t1 * t1 - t0 * t0 * t0) / 3.0 - t0 * (t1 * t1 - t0 * t0) / 2.0);
+    }
+    return sum;
+}
+
+// ---------------------------------------------------------------------------
+// BuieSunShape
+// ---------------------------------------------------------------------------
+BuieSunShape::BuieSunShape(double csr, int num_bins) : m_csr(csr), m_kappa(0.0), m_gamma(0.0) {
+    if (!(csr >= 0.0 && csr <= 0.75))
+        throw std::runtime_error("Buie sunshape needs a circumsolar ratio in [0, 0.75].");
+
+    if (csr > 0.0) {
+        // the share of the aureole grows with chi; bisect for the one giving the requested CSR
+        const double disk = integrate_disk(0.0, DISK_ANGLE);
+        double lo = 1e-4, hi = 0.95;
+        for (int it = 0; it < 100; it++) {
+            const double chi = 0.5 * (lo + hi);
+            double kappa, gamma;
+            parameters(chi, kappa, gamma);
+            const double aureole = integrate_aureole(kappa, gamma, DISK_ANGLE, AUREOLE_ANGLE);
+            (aureole / (aureole + disk) < csr ? lo : hi) = chi;
+        }
+        parameters(0.5 * (lo + hi), m_kappa, m_gamma);
+    }
+
+    build_table((csr > 0.0 ? AUREOLE_ANGLE : DISK_ANGLE) * 0.001, num_bins);
+}
+
+namespace {
+    struct BuieCache {
+        std::mutex mutex;
+        std::map<double, std::shared_ptr<const BuieSunShape>> tables;
+    };
+
+    BuieCache& buie_cache() {
+        static BuieCache cache;
+        return cache;
+    }
+}
+
+std::shared_ptr<const BuieSunShape> BuieSunShape::get(double csr) {
+    BuieCache& cache = buie_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    std::shared_ptr<const BuieSunShape>& table = cache.tables[csr];
+    if (!table)
+        table = std::make_shared<BuieSunShape>(csr);
+    return table;
+}
+
+void BuieSunShape::clear_cache() {
+    BuieCache& cache = buie_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.tables.clear();
+}
+
+void BuieSunShape::parameters(double chi, double& kappa, double& gamma) {
+    kappa = 0.9 * std::log(13.5 * chi) * std::pow(chi, -0.3);
+    gamma = 2.2 * std::log(0.52 * chi) * std::pow(chi, 0.43) - 0.1;
+}
+
+double BuieSunShape::radiance(double theta_mrad) const {
+    if (theta_mrad <= DISK_ANGLE)
+        return std::cos(0.326 * theta_mrad) / std::cos(0.308 * theta_mrad);
+    if (m_csr > 0.0 && theta_mrad <= AUREOLE_ANGLE)
+        return std::exp(m_kappa) * std::pow(theta_mrad, m_gamma);
+    return 0.0;
+}
+
+// Simpson on the disk profile, whose denominator falls steeply toward the limb: steps of at most
+// 5 urad keep the integral over the whole disk accurate to about 1e-10
+double BuieSunShape::integrate_disk(double a, double b) {
+    if (!(b > a)) return 0.0;
+    const int n = 2 * std::max(8, static_cast<int>(std::ceil((b - a) / 0.01)));
+    const double h = (b - a) / n;
+    auto f = [](double t) { return std::cos(0.326 * t) / std::cos(0.308 * t) * t; };
+    double sum = f(a) + f(b);
+    for (int i = 1; i < n; i++)
+        sum += f(a + i * h) * (i % 2 ? 4.0 : 2.0);
+    return sum * h / 3.0;
+}
+
+double BuieSunShape::integrate_aureole(double kappa, double gamma, double a, double b) {
+    if (!(b > a)) return 0.0;
+    const double p = gamma + 2.0;
+    if (std::abs(p) < 1e-12)
+        return std::exp(kappa) * std::log(b / a);
+    return std::exp(kappa) * (std::pow(b, p) - std::pow(a, p)) / p;
+}
+
+double BuieSunShape::integrate(double a, double b) const {
+    // the profile works in mrad
+    a *= 1e3;
+    b *= 1e3;
+    double sum = integrate_disk(std::max(a, 0.0), std::min(b, DISK_ANGLE));
+    if (m_csr > 0.0)
+        sum += integrate_aureole(m_kappa, m_gamma, std::max(a, DISK_ANGLE), std::min(b, AUREOLE_ANGLE));
+    return sum;
+}
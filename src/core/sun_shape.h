@@ -0,0 +1,117 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "shaders/SunShapeData.h"
+
+namespace OptixCSP {
+
+    /**
+     * @class SunShape
+     * @brief Radial sunshape, the radiance as a function of the angle from the sun center. Derived
+     * classes provide the profile through integrate(); build_table() turns it once into an alias
+     * table over equal angular bins, weighted by the solid angle, so a sample costs one lookup
+     * whatever the profile (see sample_sun_shape_angle).
+     */
+    class SunShape {
+    public:
+        virtual ~SunShape() = default;
+
+        /// outermost angle in radians, the sun angle the sun plane is widened by
+        float max_angle() const { return m_max_angle; }
+        int num_bins() const { return static_cast<int>(m_alias_prob.size()); }
+
+        /// probability of each bin, for checks against the profile
+        const std::vector<double>& bin_probabilities() const { return m_bin_prob; }
+
+        /// probability of an angle in [theta_lo, theta_hi] radians, integrated from the profile
+        double probability(double theta_lo, double theta_hi) const;
+
+        const std::vector<float>& alias_prob() const { return m_alias_prob; }
+        const std::vector<int>& alias_index() const { return m_alias_index; }
+
+        /// view of the table for host side sampling, valid as long as this object
+        SunShapeData data() const;
+
+    protected:
+        /// integral of radiance * angle over [a, b] radians, up to a constant factor
+        virtual double integrate(double a, double b) const = 0;
+
+        /// fill the alias table, called by the constructor of the derived class
+        void build_table(double max_angle, int num_bins);
+
+    private:
+        double m_total = 0.0;
+        float m_max_angle = 0.0f;
+
+        std::vector<double> m_bin_prob;
+        std::vector<float> m_alias_prob;
+        std::vector<int> m_alias_index;
+    };
+
+    /**
+     * @class TabulatedSunShape
+     * @brief User sunshape given as intensity against angle from the sun center, as in the
+     * USER SHAPE DATA block of a stinput file (angles in mrad). The intensity is linear between the
+     * table points and zero beyond the last one.
+     */
+    class TabulatedSunShape : public SunShape {
+    public:
+        /// throws std::runtime_error when the table has fewer than two points, angles that do not
+        /// increase, negative intensities or no energy at all
+        TabulatedSunShape(const std::vector<double>& angles_mrad, const std::vector<double>& intensity,
+                          int num_bins = 1024);
+
+    protected:
+        /// exact for the piecewise linear intensity
+        double integrate(double a, double b) const override;
+
+    private:
+        std::vector<double> m_angles;       // radians
+        std::vector<double> m_intensity;
+    };
+
+    /**
+     * @class BuieSunShape
+     * @brief Sunshape of Buie et al. (2003): a limb-darkened disk of 4.65 mrad and a circumsolar
+     * aureole e^kappa * theta^gamma out to 43.6 mrad, both set by the circumsolar ratio. The model
+     * parameter is solved for so that the aureole carries exactly the requested share of the
+     * energy; taken as the CSR, the published formulas fall short of it, by 14% at 0.05 and by far
+     * more below. A CSR of 0 is the bare disk.
+     *
+     * Building a table means solving for the model parameter and integrating every bin; get()
+     * keeps one table per CSR for the whole process, so a sweep over the year builds each of them once.
+     */
+    class BuieSunShape : public SunShape {
+    public:
+        /// throws std::runtime_error when the CSR is outside [0, 0.75]
+        explicit BuieSunShape(double csr, int num_bins = 4096);
+
+        /// shared table of the given CSR, built on the first request
+        static std::shared_ptr<const BuieSunShape> get(double csr);
+        /// drop the tables kept by get()
+        static void clear_cache();
+
+        double csr() const { return m_csr; }
+        double kappa() const { return m_kappa; }
+        double gamma() const { return m_gamma; }
+
+        /// radiance relative to the sun center, angle in mrad
+        double radiance(double theta_mrad) const;
+
+    protected:
+        double integrate(double a, double b) const override;
+
+    private:
+        /// integrals of radiance * angle over the disk and the aureole, angles in mrad
+        static double integrate_disk(double a, double b);
+        static double integrate_aureole(double kappa, double gamma, double a, double b);
+        /// kappa and gamma of Buie's formulas for the model parameter chi
+        static void parameters(double chi, double& kappa, double& gamma);
+
+        double m_csr;
+        double m_kappa;
+        double m_gamma;
+    };
+}
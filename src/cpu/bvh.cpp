@@ -0,0 +1,343 @@
+#include "bvh.h"
+#include "simd_math.h"
+
+#include <cfloat>
+#include <limits>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+
+    struct Box {
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        void grow(const Box& b) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], b.lo[a]);
+                hi[a] = std::max(hi[a], b.hi[a]);
+            }
+        }
+
+        void grow(const float p[3]) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], p[a]);
+                hi[a] = std::max(hi[a], p[a]);
+            }
+        }
+
+        float half_area() const {
+            if (lo[0] > hi[0]) return 0.0f;
+            const float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    Box to_box(const OptixAabb& aabb) {
+        Box b;
+        b.lo[0] = aabb.minX; b.lo[1] = aabb.minY; b.lo[2] = aabb.minZ;
+        b.hi[0] = aabb.maxX; b.hi[1] = aabb.maxY; b.hi[2] = aabb.maxZ;
+        return b;
+    }
+
+    struct Bin {
+        Box      box;
+        uint32_t count = 0;
+    };
+
+    struct BuildTask {
+        uint32_t node;
+        uint32_t first;
+        uint32_t count;
+        int      depth;
+    };
+
+    // largest quantized code
+    template <typename Q>
+    constexpr float q_max() { return static_cast<float>(std::numeric_limits<Q>::max()); }
+}
+
+// ---------------------------------------------------------------------------
+// binary BVH, binned SAH
+// ---------------------------------------------------------------------------
+void Bvh::build(const std::vector<OptixAabb>& aabbs, const BvhBuildOptions& options) {
+    if (options.max_leaf_size < 1 || options.max_leaf_size > 255)
+        throw std::runtime_error("Bvh::build: max_leaf_size must be in [1, 255]");
+    if (options.num_bins < 2)
+        throw std::runtime_error("Bvh::build: num_bins must be at least 2");
+
+    m_nodes.clear();
+    m_prim_indices.clear();
+    m_depth = 0;
+
+    const uint32_t n = static_cast<uint32_t>(aabbs.size());
+    if (n == 0) return;
+
+    std::vector<Box> boxes(n);
+    std::vector<float> centroids(3 * static_cast<size_t>(n));
+    m_prim_indices.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        boxes[i] = to_box(aabbs[i]);
+        for (int a = 0; a < 3; a++)
+            centroids[3 * i + a] = 0.5f * (boxes[i].lo[a] + boxes[i].hi[a]);
+        m_prim_indices[i] = i;
+    }
+
+    m_nodes.reserve(2 * static_cast<size_t>(n));
+    m_nodes.push_back(BvhNode());
+
+    const int num_bins = options.num_bins;
+    std::vector<Bin> bins(num_bins);
+    std::vector<float> right_area(num_bins);
+    std::vector<BuildTask> tasks;
+    tasks.push_back({ 0, 0, n, 1 });
+
+    while (!tasks.empty()) {
+        const BuildTask task = tasks.back();
+        tasks.pop_back();
+        m_depth = std::max(m_depth, task.depth);
+
+        Box bounds, centroid_bounds;
+        for (uint32_t k = task.first; k < task.first + task.count; k++) {
+            const uint32_t p = m_prim_indices[k];
+            bounds.grow(boxes[p]);
+            centroid_bounds.grow(&centroids[3 * p]);
+        }
+
+        BvhNode& node = m_nodes[task.node];
+        for (int a = 0; a < 3; a++) {
+            node.lo[a] = bounds.lo[a];
+            node.hi[a] = bounds.hi[a];
+        }
+
+        if (task.count <= static_cast<uint32_t>(options.max_leaf_size)) {
+            node.offset = task.first;
+            node.count = task.count;
+            continue;
+        }
+
+        // best split over all axes, cost = N_left * A_left + N_right * A_right
+        int best_axis = -1, best_split = 0;
+        float best_cost = FLT_MAX;
+        for (int a = 0; a < 3; a++) {
+            const float extent = centroid_bounds.hi[a] - centroid_bounds.lo[a];
+            if (!(extent > 0.0f)) continue;
+            const float bin_scale = num_bins / extent;
+
+            for (auto& b : bins) b = Bin();
+            for (uint32_t k = task.first; k < task.first + task.count; k++) {
+                const uint32_t p = m_prim_indices[k];
+                int b = static_cast<int>((centroids[3 * p + a] - centroid_bounds.lo[a]) * bin_scale);
+                b = std::min(std::max(b, 0), num_bins - 1);
+                bins[b].box.grow(boxes[p]);
+                bins[b].count++;
+            }
+
+            Box acc;
+            for (int b = num_bins - 1; b > 0; b--) {
+                acc.grow(bins[b].box);
+                right_area[b] = acc.half_area();
+            }
+            Box left;
+            uint32_t left_count = 0;
+            for (int b = 0; b < num_bins - 1; b++) {
+                left.grow(bins[b].box);
+                left_count += bins[b].count;
+                const uint32_t right_count = task.count - left_count;
+                if (left_count == 0 || right_count == 0) continue;
+                const float cost = left_count * left.half_area() + right_count * right_area[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_split = b;
+                }
+            }
+        }
+
+        uint32_t mid;
+        if (best_axis >= 0) {
+            const int a = best_axis;
+            const float extent = centroid_bounds.hi[a] - centroid_bounds.lo[a];
+            const float bin_scale = num_bins / extent;
+            auto begin = m_prim_indices.begin() + task.first;
+            auto it = std::partition(begin, begin + task.count, [&](uint32_t p) {
+                int b = static_cast<int>((centroids[3 * p + a] - centroid_bounds.lo[a]) * bin_scale);
+                return std::min(std::max(b, 0), num_bins - 1) <= best_split;
+            });
+            mid = static_cast<uint32_t>(it - m_prim_indices.begin());
+        }
+        else {
+            // all centroids coincide, split the range in half
+            mid = task.first + task.count / 2;
+        }
+
+        const uint32_t left = static_cast<uint32_t>(m_nodes.size());
+        node.offset = left;
+        node.count = 0;
+        m_nodes.push_back(BvhNode());
+        m_nodes.push_back(BvhNode());
+
+        tasks.push_back({ left + 1, mid, task.first + task.count - mid, task.depth + 1 });
+        tasks.push_back({ left, task.first, mid - task.first, task.depth + 1 });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// compressed 8-wide BVH
+// ---------------------------------------------------------------------------
+template <typename Q>
+void WideBvh<Q>::build(const Bvh& binary) {
+    m_nodes.clear();
+    m_prim_indices.clear();
+    if (binary.empty()) return;
+
+    m_nodes.reserve(binary.nodes().size() / 4 + 1);
+    m_prim_indices.reserve(binary.prim_indices().size());
+    m_nodes.resize(1);
+    fill(binary, 0, 0);
+}
+
+template <typename Q>
+void WideBvh<Q>::fill(const Bvh& binary, uint32_t binary_node, uint32_t index) {
+    const std::vector<BvhNode>& bnodes = binary.nodes();
+    constexpr int W = Node::WIDTH;
+
+    // open the child with the largest surface area until the node is full
+    std::vector<uint32_t> children;
+    if (bnodes[binary_node].is_leaf()) {
+        children.push_back(binary_node);
+    }
+    else {
+        children.push_back(bnodes[binary_node].offset);
+        children.push_back(bnodes[binary_node].offset + 1);
+    }
+    while (static_cast<int>(children.size()) < W) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int c = 0; c < static_cast<int>(children.size()); c++) {
+            const BvhNode& bn = bnodes[children[c]];
+            if (bn.is_leaf()) continue;
+            Box b;
+            for (int a = 0; a < 3; a++) { b.lo[a] = bn.lo[a]; b.hi[a] = bn.hi[a]; }
+            if (b.half_area() > best_area) {
+                best_area = b.half_area();
+                best = c;
+            }
+        }
+        if (best < 0) break;
+        const uint32_t opened = children[best];
+        children[best] = bnodes[opened].offset;
+        children.push_back(bnodes[opened].offset + 1);
+    }
+
+    // quantization frame from the node box, grow the scale until the top code reaches the box max
+    Node node = {};
+    const BvhNode& parent = bnodes[binary_node];
+    const float qmax = q_max<Q>();
+    for (int a = 0; a < 3; a++) {
+        const float origin = parent.lo[a];
+        float scale = (parent.hi[a] - origin) / qmax;
+        if (!(scale > 0.0f)) scale = FLT_MIN;
+        while (origin + qmax * scale < parent.hi[a])
+            scale = std::nextafter(scale, FLT_MAX);
+        node.origin[a] = origin;
+        node.scale[a] = scale;
+    }
+
+    node.num_children = static_cast<uint8_t>(children.size());
+    node.child_base = static_cast<uint32_t>(m_nodes.size());
+    node.prim_base = static_cast<uint32_t>(m_prim_indices.size());
+
+    std::vector<uint32_t> inner;
+    for (int c = 0; c < static_cast<int>(children.size()); c++) {
+        const BvhNode& bn = bnodes[children[c]];
+        for (int a = 0; a < 3; a++) {
+            const float origin = node.origin[a], scale = node.scale[a];
+
+            // conservative rounding: decoded lo <= box lo and decoded hi >= box hi, checked with the
+            // same float operations the traversal uses
+            float ql = std::floor((bn.lo[a] - origin) / scale);
+            ql = std::min(std::max(ql, 0.0f), qmax);
+            while (ql > 0.0f && origin + ql * scale > bn.lo[a]) ql -= 1.0f;
+
+            float qh = std::ceil((bn.hi[a] - origin) / scale);
+            qh = std::min(std::max(qh, 0.0f), qmax);
+            while (qh < qmax && origin + qh * scale < bn.hi[a]) qh += 1.0f;
+
+            node.qlo[a][c] = static_cast<Q>(ql);
+            node.qhi[a][c] = static_cast<Q>(qh);
+        }
+
+        if (bn.is_leaf()) {
+            node.count[c] = static_cast<uint8_t>(bn.count);
+            for (uint32_t k = 0; k < bn.count; k++)
+                m_prim_indices.push_back(binary.prim_indices()[bn.offset + k]);
+        }
+        else {
+            node.count[c] = 0;
+            inner.push_back(children[c]);
+        }
+    }
+
+    // reserve the block of inner children before descending so they stay contiguous
+    m_nodes.resize(m_nodes.size() + inner.size());
+    m_nodes[index] = node;
+    for (size_t k = 0; k < inner.size(); k++)
+        fill(binary, inner[k], node.child_base + static_cast<uint32_t>(k));
+}
+
+template class OptixCSP::WideBvh<uint8_t>;
+template class OptixCSP::WideBvh<uint16_t>;
+
+namespace {
+#if defined(OPTIXCSP_HAS_AVX2)
+    inline simd::vfloat8 load_codes(const uint8_t* q) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q))));
+    }
+    inline simd::vfloat8 load_codes(const uint16_t* q) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q))));
+    }
+#endif
+
+    template <typename Q>
+    inline void intersect_children_of(const WideBvhNode<Q>& node, const detail::BvhRay& r, float t_child[8]) {
+#if defined(OPTIXCSP_HAS_AVX2)
+        using simd::vfloat8;
+        vfloat8 t0(r.tmin), t1(r.tmax);
+        for (int a = 0; a < 3; a++) {
+            const vfloat8 origin(node.origin[a]), scale(node.scale[a]);
+            const vfloat8 org(r.org[a]), inv(r.inv_dir[a]);
+            const vfloat8 lo = origin + load_codes(node.qlo[a]) * scale;
+            const vfloat8 hi = origin + load_codes(node.qhi[a]) * scale;
+            const vfloat8 tn = (lo - org) * inv;
+            const vfloat8 tf = (hi - org) * inv;
+            t0 = max(t0, min(tn, tf));
+            t1 = min(t1, max(tn, tf));
+        }
+        const auto hit = (t0 <= t1) & simd::lanes_below(t0, node.num_children);
+        simd::select(hit, t0, vfloat8(INFINITY)).store(t_child);
+#else
+        for (int c = 0; c < 8; c++) {
+            float t0 = r.tmin, t1 = r.tmax;
+            for (int a = 0; a < 3; a++) {
+                const float lo = node.origin[a] + static_cast<float>(node.qlo[a][c]) * node.scale[a];
+                const float hi = node.origin[a] + static_cast<float>(node.qhi[a][c]) * node.scale[a];
+                const float tn = (lo - r.org[a]) * r.inv_dir[a];
+                const float tf = (hi - r.org[a]) * r.inv_dir[a];
+                t0 = std::max(t0, std::min(tn, tf));
+                t1 = std::min(t1, std::max(tn, tf));
+            }
+            t_child[c] = (c < node.num_children && t0 <= t1) ? t0 : INFINITY;
+        }
+#endif
+    }
+}
+
+void OptixCSP::detail::intersect_children(const WideBvhNode<uint8_t>& node, const BvhRay& r, float t_child[8]) {
+    intersect_children_of(node, r, t_child);
+}
+
+void OptixCSP::detail::intersect_children(const WideBvhNode<uint16_t>& node, const BvhRay& r, float t_child[8]) {
+    intersect_children_of(node, r, t_child);
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <optix.h>
+
+#include "cpu/host_intersection.h"
+
+namespace OptixCSP {
+
+    /// node of the binary host BVH, 32 bytes
+    struct BvhNode {
+        float    lo[3];
+        float    hi[3];
+        uint32_t offset;   // inner node: index of the left child (right child is offset + 1), leaf: first entry of the primitive list
+        uint32_t count;    // number of primitives of a leaf, 0 for inner nodes
+
+        bool is_leaf() const { return count > 0; }
+    };
+
+    struct BvhBuildOptions {
+        int max_leaf_size = 4;   // at most 255, the wide nodes store the leaf size in one byte
+        int num_bins = 16;       // SAH bins per axis
+    };
+
+    /// closest hit returned by the BVH traversals, prim is the index into the AABB list used for the build
+    struct BvhHit {
+        float    t = INFINITY;
+        uint32_t prim = UINT32_MAX;
+
+        bool valid() const { return prim != UINT32_MAX; }
+    };
+
+    namespace detail {
+        /// ray data reused by every box test
+        struct BvhRay {
+            float org[3];
+            float inv_dir[3];
+            float tmin;
+            float tmax;
+
+            explicit BvhRay(const HostRay& ray) {
+                org[0] = ray.orig.x; org[1] = ray.orig.y; org[2] = ray.orig.z;
+                inv_dir[0] = 1.0f / ray.dir.x; inv_dir[1] = 1.0f / ray.dir.y; inv_dir[2] = 1.0f / ray.dir.z;
+                tmin = ray.tmin;
+                tmax = ray.tmax;
+            }
+        };
+
+        // slab test, returns the entry distance or +inf when the box is missed
+        inline float intersect_box(const float lo[3], const float hi[3], const BvhRay& r) {
+            float t0 = r.tmin, t1 = r.tmax;
+            for (int a = 0; a < 3; a++) {
+                float tn = (lo[a] - r.org[a]) * r.inv_dir[a];
+                float tf = (hi[a] - r.org[a]) * r.inv_dir[a];
+                if (tn > tf) std::swap(tn, tf);
+                t0 = tn > t0 ? tn : t0;
+                t1 = tf < t1 ? tf : t1;
+            }
+            return t0 <= t1 ? t0 : INFINITY;
+        }
+
+        /// traversal stack with inline storage, spills to the heap only for very deep trees
+        template <class T, int N = 128>
+        class TraversalStack {
+        public:
+            bool empty() const { return m_size == 0; }
+
+            void push(const T& v) {
+                if (m_size < N) m_inline[m_size] = v;
+                else m_heap.push_back(v);
+                m_size++;
+            }
+
+            T pop() {
+                m_size--;
+                if (m_size < N) return m_inline[m_size];
+                T v = m_heap.back();
+                m_heap.pop_back();
+                return v;
+            }
+
+        private:
+            T m_inline[N];
+            std::vector<T> m_heap;
+            int m_size = 0;
+        };
+
+        struct StackEntry {
+            uint32_t node;
+            float    t;   // entry distance of the node box, used to skip nodes behind the current hit
+        };
+    }
+
+    /**
+     * @class Bvh
+     * @brief Binary BVH over a list of OptixAabb, built with binned SAH on the host.
+     *
+     * The traversals take a primitive test `bool test(uint32_t prim, const HostRay& ray, float& t)`
+     * that reports hits with tmin < t < tmax, e.g. intersect_geometry() on the geometry data array.
+     */
+    class Bvh {
+    public:
+        void build(const std::vector<OptixAabb>& boxes, const BvhBuildOptions& options = BvhBuildOptions());
+
+        bool empty() const { return m_nodes.empty(); }
+        const std::vector<BvhNode>& nodes() const { return m_nodes; }
+        /// primitive list referenced by the leaves
+        const std::vector<uint32_t>& prim_indices() const { return m_prim_indices; }
+        int depth() const { return m_depth; }
+        /// bytes used by the nodes and the primitive list
+        size_t memory_bytes() const { return m_nodes.size() * sizeof(BvhNode) + m_prim_indices.size() * sizeof(uint32_t); }
+
+        template <class PrimTest>
+        BvhHit closest_hit(const HostRay& ray, PrimTest&& test) const;
+
+        /// true as soon as any primitive is hit, for occlusion queries
+        template <class PrimTest>
+        bool any_hit(const HostRay& ray, PrimTest&& test) const;
+
+    private:
+        template <bool AnyHit, class PrimTest>
+        BvhHit traverse(const HostRay& ray, PrimTest& test) const;
+
+        std::vector<BvhNode>  m_nodes;
+        std::vector<uint32_t> m_prim_indices;
+        int m_depth = 0;
+    };
+
+    /// 8-wide node with the child boxes quantized to Q (uint8_t or uint16_t) relative to the node box.
+    /// A child box decodes to origin + q * scale, with lo rounded down and hi rounded up on build so the
+    /// decoded box always encloses the original one. Inner children are stored contiguously from
+    /// child_base and the primitives of the leaf children contiguously from prim_base, both in slot order.
+    template <typename Q>
+    struct WideBvhNode {
+        static constexpr int WIDTH = 8;
+
+        float    origin[3];
+        float    scale[3];
+        uint32_t child_base;
+        uint32_t prim_base;
+        Q        qlo[3][WIDTH];
+        Q        qhi[3][WIDTH];
+        uint8_t  count[WIDTH];   // primitives of a leaf child, 0 for an inner child
+        uint8_t  num_children;
+    };
+
+    /**
+     * @class WideBvh
+     * @brief Compressed 8-wide BVH obtained by collapsing a binary Bvh. The primitive tests are
+     * the same as for the binary tree.
+     */
+    template <typename Q>
+    class WideBvh {
+    public:
+        using Node = WideBvhNode<Q>;
+
+        void build(const Bvh& binary);
+
+        bool empty() const { return m_nodes.empty(); }
+        const std::vector<Node>& nodes() const { return m_nodes; }
+        const std::vector<uint32_t>& prim_indices() const { return m_prim_indices; }
+        size_t memory_bytes() const { return m_nodes.size() * sizeof(Node) + m_prim_indices.size() * sizeof(uint32_t); }
+
+        template <class PrimTest>
+        BvhHit closest_hit(const HostRay& ray, PrimTest&& test) const;
+
+        template <class PrimTest>
+        bool any_hit(const HostRay& ray, PrimTest&& test) const;
+
+    private:
+        template <bool AnyHit, class PrimTest>
+        BvhHit traverse(const HostRay& ray, PrimTest& test) const;
+
+        void fill(const Bvh& binary, uint32_t binary_node, uint32_t index);
+
+        std::vector<Node>     m_nodes;
+        std::vector<uint32_t> m_prim_indices;
+    };
+
+    using WideBvh8 = WideBvh<uint8_t>;
+    using WideBvh16 = WideBvh<uint16_t>;
+
+    // ---------------------------------------------------------------------------
+    // traversal
+    // ---------------------------------------------------------------------------
+    template <class PrimTest>
+    BvhHit Bvh::closest_hit(const HostRay& ray, PrimTest&& test) const {
+        return traverse<false>(ray, test);
+    }
+
+    template <class PrimTest>
+    bool Bvh::any_hit(const HostRay& ray, PrimTest&& test) const {
+        return traverse<true>(ray, test).valid();
+    }
+
+    template <bool AnyHit, class PrimTest>
+    BvhHit Bvh::traverse(const HostRay& ray, PrimTest& test) const {
+        BvhHit hit;
+        if (m_nodes.empty()) return hit;
+
+        detail::BvhRay r(ray);
+        HostRay prim_ray = ray;
+        detail::TraversalStack<detail::StackEntry> stack;
+
+        const float t_root = detail::intersect_box(m_nodes[0].lo, m_nodes[0].hi, r);
+        if (t_root == INFINITY) return hit;
+        stack.push({ 0, t_root });
+
+        while (!stack.empty()) {
+            const detail::StackEntry entry = stack.pop();
+            if (entry.t > r.tmax) continue;
+            const BvhNode& node = m_nodes[entry.node];
+
+            if (node.is_leaf()) {
+                for (uint32_t k = 0; k < node.count; k++) {
+                    const uint32_t prim = m_prim_indices[node.offset + k];
+                    float t;
+                    if (test(prim, prim_ray, t) && t < hit.t) {
+                        hit.t = t;
+                        hit.prim = prim;
+                        if (AnyHit) return hit;
+                        r.tmax = t;
+                        prim_ray.tmax = t;
+                    }
+                }
+                continue;
+            }
+
+            const uint32_t left = node.offset, right = node.offset + 1;
+            float tl = detail::intersect_box(m_nodes[left].lo, m_nodes[left].hi, r);
+            float tr = detail::intersect_box(m_nodes[right].lo, m_nodes[right].hi, r);
+            // push the far child first so the near one is visited next
+            if (tl <= tr) {
+                if (tr != INFINITY) stack.push({ right, tr });
+                if (tl != INFINITY) stack.push({ left, tl });
+            }
+            else {
+                if (tl != INFINITY) stack.push({ left, tl });
+                if (tr != INFINITY) stack.push({ right, tr });
+            }
+        }
+        return hit;
+    }
+
+    template <typename Q>
+    template <class PrimTest>
+    BvhHit WideBvh<Q>::closest_hit(const HostRay& ray, PrimTest&& test) const {
+        return traverse<false>(ray, test);
+    }
+
+    template <typename Q>
+    template <class PrimTest>
+    bool WideBvh<Q>::any_hit(const HostRay& ray, PrimTest&& test) const {
+        return traverse<true>(ray, test).valid();
+    }
+
+    namespace detail {
+        /// entry distances of the 8 children of a wide node, +inf for missed and empty slots; in
+        /// bvh.cpp, the one source of the tree built for the vector ISA (OPTIXCSP_CPU_SIMD)
+        void intersect_children(const WideBvhNode<uint8_t>& node, const BvhRay& r, float t_child[8]);
+        void intersect_children(const WideBvhNode<uint16_t>& node, const BvhRay& r, float t_child[8]);
+    }
+
+    template <typename Q>
+    template <bool AnyHit, class PrimTest>
+    BvhHit WideBvh<Q>::traverse(const HostRay& ray, PrimTest& test) const {
+        constexpr int W = Node::WIDTH;
+        BvhHit hit;
+        if (m_nodes.empty()) return hit;
+
+        detail::BvhRay r(ray);
+        HostRay prim_ray = ray;
+        detail::TraversalStack<detail::StackEntry> stack;
+        stack.push({ 0, r.tmin });
+
+        while (!stack.empty()) {
+            const detail::StackEntry entry = stack.pop();
+            if (entry.t > r.tmax) continue;
+            const Node& node = m_nodes[entry.node];
+
+            alignas(32) float t_child[W];
+            detail::intersect_children(node, r, t_child);
+
+            // leaves right away, inner children sorted far to near onto the stack
+            detail::StackEntry order[W];
+            int num_inner = 0;
+            uint32_t inner = node.child_base;
+            uint32_t prim = node.prim_base;
+            for (int c = 0; c < node.num_children; c++) {
+                const bool visit = t_child[c] <= r.tmax;
+                if (node.count[c] > 0) {
+                    if (visit) {
+                        for (uint32_t k = 0; k < node.count[c]; k++) {
+                            const uint32_t p = m_prim_indices[prim + k];
+                            float t;
+                            if (test(p, prim_ray, t) && t < hit.t) {
+                                hit.t = t;
+                                hit.prim = p;
+                                if (AnyHit) return hit;
+                                r.tmax = t;
+                                prim_ray.tmax = t;
+                            }
+                        }
+                    }
+                    prim += node.count[c];
+                    continue;
+                }
+                if (visit) {
+                    int k = num_inner++;
+                    while (k > 0 && order[k - 1].t < t_child[c]) {
+                        order[k] = order[k - 1];
+                        k--;
+                    }
+                    order[k] = { inner, t_child[c] };
+                }
+                inner++;
+            }
+            for (int k = 0; k < num_inner; k++) {
+                if (order[k].t <= r.tmax) stack.push(order[k]);
+            }
+        }
+        return hit;
+    }
+}
@@ -0,0 +1,866 @@
+#include "cpu_tracer.h"
+
+#include "core/geometry_manager.h"
+#include "core/stinput_reader.h"
+#include "core/Aperture.h"
+#include "core/Surface.h"
+#include "shaders/Philox.h"
+#include "shaders/SurfaceError.h"
+#include "utils/math_util.h"
+#include "utils/util_output.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+    // sampleDirectionRandoms of shaders/sun.cu, the same Philox stream as on the device
+    float2 direction_randoms(unsigned long long seed, unsigned long long sample_index) {
+        const float4 rand = random_uniform4(seed, sample_index, 0);
+        return make_float2(rand.x, rand.y);
+    }
+
+    // sampleRayDirectionInCone_Pillbox of shaders/sun.cu
+    float3 sample_pillbox(const float3& dir, float half_angle, float rand1, float rand2) {
+        float3 w = normalize(dir);
+        float3 u = normalize(cross(std::fabs(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
+        float3 v = cross(w, u);
+
+        float cosTheta = cosf(half_angle);
+        float phi = 2.0f * M_PIf * rand1;
+        float z = cosTheta + (1.0f - cosTheta) * rand2;
+        float r = sqrtf(1.0f - z * z);
+
+        return normalize(r * (cosf(phi) * u + sinf(phi) * v) + z * w);
+    }
+
+    // spread the lower 10 bits so that two zero bits separate each of them
+    uint32_t expand_bits_10(uint32_t x) {
+        x &= 0x3FF;
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    uint32_t quantize_10(float x, float lo, float scale) {
+        float q = (x - lo) * scale;
+        if (!(q > 0.0f)) return 0;
+        if (q > 1023.0f) return 1023;
+        return static_cast<uint32_t>(q);
+    }
+
+    void grow(float3& lo, float3& hi, const float3& p) {
+        lo = make_float3(fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z));
+        hi = make_float3(fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z));
+    }
+}
+
+CpuTracer::CpuTracer(int num_sun_points)
+    : m_num_sunpoints(num_sun_points),
+      m_max_depth(MAX_TRACE_DEPTH),
+      m_flux_nu(0),
+      m_flux_nv(0),
+      m_element_power(false),
+      m_verbose(false),
+      m_dni(1000.0),
+      m_ray_weighting(RAY_WEIGHTED),
+      m_sun_sampling(CpuSunSampling::PARALLELOGRAM),
+      m_mode(CpuTraceMode::WAVEFRONT),
+      m_sort_rays(true),
+      m_use_neighbours(false),
+      m_num_threads(0),
+      m_pin_threads(true),
+      m_work_stealing(true),
+      m_batch_size(1024),
+      m_sun_vector(0.0, 0.0, 1.0),
+      m_sun_angle(0.0),
+      m_sun_vector_f(make_float3(0.0f, 0.0f, 1.0f)),
+      m_sun_dir_seed(123456ULL),
+      m_sampler({ SAMPLER_HALTON, 0u, 0ULL, 1u, 1u }),
+      m_samples_per_pass(0),
+      m_bounds_lo(make_float3(0.0f, 0.0f, 0.0f)),
+      m_bounds_hi(make_float3(0.0f, 0.0f, 0.0f)),
+      m_hit_stream_capacity(0),
+      m_hit_stream_count(0),
+      m_hit_stream_lost(0),
+      m_hit_stream_passes(0),
+      m_deposit(true),
+      m_scheduler_threads(-1),
+      m_scheduler_pinned(false),
+      m_cache_misses(-1),
+      m_cache_references(-1) {
+    m_geometry_manager = std::make_shared<GeometryManager>(m_state);
+}
+
+CpuTracer::~CpuTracer() {}
+
+void CpuTracer::add_element(std::shared_ptr<CspElement> element) {
+    element->update_euler_angles();
+    m_element_list.push_back(element);
+}
+
+void CpuTracer::set_stage_flags(unsigned int stage, unsigned int flags) {
+    if (stage >= MAX_STAGES)
+        throw std::runtime_error("Too many stages, at most " + std::to_string(MAX_STAGES) + ".");
+    if (stage >= m_stage_flags.size())
+        m_stage_flags.resize(stage + 1, STAGE_MULTIHIT);
+    m_stage_flags[stage] = flags;
+}
+
+bool CpuTracer::read_st_input(const char* filename) {
+    StInputReader reader;
+    if (!reader.read(filename))
+        return false;
+
+    set_sun_vector(reader.sun_vector());
+    set_sun_angle(reader.sun_angle());
+    if (reader.sun_shape())
+        set_sun_shape(reader.sun_shape());
+
+    m_stage_flags = reader.stage_flags();
+    for (const std::shared_ptr<CspElement>& element : reader.elements())
+        add_element(element);
+    return true;
+}
+
+void CpuTracer::set_max_depth(int depth) {
+    if (depth < 2)
+        throw std::runtime_error("A path holds at least the sun point and one hit point.");
+    m_max_depth = depth;
+}
+
+void CpuTracer::set_flux_map_resolution(int nu, int nv) {
+    m_flux_nu = std::max(0, nu);
+    m_flux_nv = std::max(0, nv);
+}
+
+const FluxMap& CpuTracer::get_flux_map(size_t receiver) const {
+    if (receiver >= m_flux_maps.size())
+        throw std::runtime_error("No flux map for receiver " + std::to_string(receiver) + ", set_flux_map_resolution before initialize().");
+    return m_flux_maps[receiver];
+}
+
+const std::vector<double>& CpuTracer::get_receiver_element_power() const {
+    if (!m_flux_layout.element_power)
+        throw std::runtime_error("No receiver power per element, set_receiver_element_power before initialize().");
+    return m_receiver_element_power;
+}
+
+bool CpuTracer::write_receiver_power_vtk(const std::string& filename) const {
+    return OptixCSP::write_receiver_power_vtk(filename, m_element_list, m_geometry, get_receiver_element_power());
+}
+
+void CpuTracer::set_sun_shape(std::shared_ptr<const SunShape> sun_shape) {
+    m_sun_shape = sun_shape;
+    if (m_sun_shape)
+        m_sun_angle = m_sun_shape->max_angle();
+}
+
+void CpuTracer::initialize() {
+    m_timer_setup.start();
+
+    m_sun_vector_f = OptixCSP::toFloat3(m_sun_vector.normalized());
+    build_scene();
+
+    allocate_hit_buffers();
+    m_sun_dir_buffer.assign(m_num_sunpoints, make_float3(0.0f, 0.0f, 0.0f));
+    m_ray_power_buffer.assign(m_num_sunpoints, 0.0f);
+
+    m_timer_setup.stop();
+    size_t bvh_bytes = 0;
+    for (const WideBvh8& bvh : m_stage_bvh) bvh_bytes += bvh.memory_bytes();
+    if (m_verbose)
+        std::cout << "CPU tracer setup: " << m_geometry.size() << " elements in " << m_stages.size() << " stages, BVH "
+                  << bvh_bytes / (1024.0 * 1024.0) << " MB, "
+                  << m_timer_setup.get_time_sec() << " seconds" << std::endl;
+}
+
+void CpuTracer::update() {
+    m_sun_vector_f = OptixCSP::toFloat3(m_sun_vector.normalized());
+    build_scene();
+    allocate_hit_buffers();
+    m_sun_dir_buffer.assign(m_num_sunpoints, make_float3(0.0f, 0.0f, 0.0f));
+    m_ray_power_buffer.assign(m_num_sunpoints, 0.0f);
+}
+
+// the hit point buffer, or the slots of the hit stream, which leaves the buffer empty
+void CpuTracer::allocate_hit_buffers() {
+    const size_t num_slots = m_hit_stream_capacity > 0 ? 0 : static_cast<size_t>(m_num_sunpoints) * m_max_depth;
+    m_hit_point_buffer.assign(num_slots, make_float4(0.0f, 0.0f, 0.0f, 0.0f));
+    m_hit_power_buffer.assign(num_slots, 0.0f);
+    if (m_hit_stream_capacity == 0) {
+        std::vector<HitRecord>().swap(m_hit_stream);
+        m_hit_records.clear();
+    }
+    else {
+        m_hit_stream.resize(m_hit_stream_capacity);
+    }
+}
+
+void CpuTracer::build_scene() {
+    // every stage is a range of the element arrays
+    std::stable_sort(m_element_list.begin(), m_element_list.end(),
+                     [](const std::shared_ptr<CspElement>& a, const std::shared_ptr<CspElement>& b) {
+                         return a->get_stage() < b->get_stage();
+                     });
+    m_geometry_manager->set_stage_flags(m_stage_flags);
+
+    LaunchParams params = {};
+    params.sun_vector = m_sun_vector_f;
+    params.max_sun_angle = static_cast<float>(m_sun_angle);
+    m_geometry_manager->collect_geometry_info(m_element_list, params);
+
+    m_geometry = m_geometry_manager->get_geometry_data_array();
+    m_materials = m_geometry_manager->get_material_data_array();
+    m_sbt_index = m_geometry_manager->get_sbt_index_list();
+    m_stages = m_geometry_manager->get_stage_data();
+    m_flux_layout = layout_flux_maps(m_element_list, m_geometry, m_flux_nu, m_flux_nv, m_element_power);
+    const std::vector<OptixAabb>& aabbs = m_geometry_manager->get_aabb_list();
+
+    m_stage_bvh.assign(m_stages.size(), WideBvh8());
+    for (size_t s = 0; s < m_stages.size(); s++) {
+        if (m_stages[s].num_elements == 0) continue;
+        const std::vector<OptixAabb> stage_aabbs(aabbs.begin() + m_stages[s].first_element,
+                                                 aabbs.begin() + m_stages[s].first_element + m_stages[s].num_elements);
+        Bvh bvh;
+        bvh.build(stage_aabbs);
+        m_stage_bvh[s].build(bvh);
+    }
+
+    // the sun rays start in the first stage, its elements are all the sun plane and the footprints
+    // have to cover; the elements of a single stage are the whole list
+    const std::vector<OptixAabb> first_stage(aabbs.begin(), aabbs.begin() + m_geometry_manager->get_num_sun_elements());
+    m_sun_plane_tree.sync(first_stage, m_sun_vector_f, static_cast<float>(m_sun_angle), m_scheduler.get());
+    m_sun_plane = m_sun_plane_tree.plane();
+    m_sun_footprints.build(first_stage, m_sun_vector_f, static_cast<float>(m_sun_angle), m_sun_plane);
+    if (use_neighbours())
+        build_neighbour_lists();
+
+    m_bounds_lo = make_float3(FLT_MAX, FLT_MAX, FLT_MAX);
+    m_bounds_hi = make_float3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const OptixAabb& aabb : aabbs) {
+        grow(m_bounds_lo, m_bounds_hi, make_float3(aabb.minX, aabb.minY, aabb.minZ));
+        grow(m_bounds_lo, m_bounds_hi, make_float3(aabb.maxX, aabb.maxY, aabb.maxZ));
+    }
+    grow(m_bounds_lo, m_bounds_hi, m_sun_plane.v0);
+    grow(m_bounds_lo, m_bounds_hi, m_sun_plane.v1);
+    grow(m_bounds_lo, m_bounds_hi, m_sun_plane.v2);
+    grow(m_bounds_lo, m_bounds_hi, m_sun_plane.v3);
+}
+
+// a rectangle turns about its origin, the center of the aperture, so the sphere through its corners
+// raised by the sag of the surface holds it in every orientation; the other elements keep the
+// sphere around their box
+void CpuTracer::build_neighbour_lists() {
+    const std::vector<OptixAabb>& aabbs = m_geometry_manager->get_aabb_list();
+    const size_t n = m_element_list.size();
+    std::vector<ElementSphere> spheres(n);
+    std::vector<bool> receivers(n);
+    for (size_t i = 0; i < n; i++) {
+        const CspElement& e = *m_element_list[i];
+        receivers[i] = e.is_receiver();
+        if (e.get_aperture_type() == ApertureType::RECTANGLE && e.get_surface_type() != SurfaceType::CYLINDER) {
+            const double hw = 0.5 * e.get_aperture()->get_width();
+            const double hh = 0.5 * e.get_aperture()->get_height();
+            const double sag = 0.5 * (std::fabs(e.get_surface()->get_curvature_1()) * hw * hw
+                                    + std::fabs(e.get_surface()->get_curvature_2()) * hh * hh);
+            spheres[i].center = OptixCSP::toFloat3(e.get_origin());
+            spheres[i].radius = static_cast<float>(std::sqrt(hw * hw + hh * hh + sag * sag));
+        }
+        else {
+            const OptixAabb& b = aabbs[i];
+            const float3 lo = make_float3(b.minX, b.minY, b.minZ);
+            const float3 hi = make_float3(b.maxX, b.maxY, b.maxZ);
+            spheres[i].center = 0.5f * (lo + hi);
+            spheres[i].radius = 0.5f * length(hi - lo);
+        }
+    }
+    m_neighbours.update_blocking(spheres, receivers);
+    m_neighbours.build_shading(m_sun_footprints, n);
+}
+
+// __raygen__sun_source, power is the part of the sun the ray carries
+CpuTraceRay CpuTracer::generate_sun_ray(uint32_t ray_number, float& power) const {
+    const unsigned long long sample_index = m_sampler.sample_offset + ray_number;
+    const float2 uv = sample_sun_plane(m_sampler, sample_index);
+    const float u = uv.x;
+    const float v = uv.y;
+
+    CpuTraceRay ray;
+    ray.element = NO_ELEMENT;
+    if (m_sun_sampling == CpuSunSampling::FOOTPRINTS && m_sun_footprints.size() > 0) {
+        double area;
+        ray.orig = m_sun_footprints.sample(u, v, static_cast<size_t>(m_num_sunpoints), area, &ray.element);
+        power = static_cast<float>(m_dni * area);
+    }
+    else {
+        float3 edge1 = m_sun_plane.v1 - m_sun_plane.v0;
+        float3 edge2 = m_sun_plane.v3 - m_sun_plane.v0;
+        ray.orig = m_sun_plane.v0 + u * edge1 + v * edge2;
+        power = static_cast<float>(m_dni * double(m_sun_plane.u_max - m_sun_plane.u_min)
+                                         * double(m_sun_plane.v_max - m_sun_plane.v_min) / m_num_sunpoints);
+    }
+    const float2 rand = m_sampler.type == SAMPLER_HALTON
+        ? direction_randoms(m_sun_dir_seed, sample_index)
+        : sample_sun_direction(m_sampler, sample_index);
+    if (m_sun_shape)
+        ray.dir = sample_sun_shape_direction(m_sun_shape->data(), -normalize(m_sun_vector_f), rand.x, rand.y);
+    else
+        ray.dir = sample_pillbox(-normalize(m_sun_vector_f), static_cast<float>(m_sun_angle), rand.x, rand.y);
+    ray.tmin = 0.001f;
+    ray.path = ray_number;
+    ray.depth = 0;
+    ray.power = power;
+    ray.stage = 0;
+    return ray;
+}
+
+// closest hit and shading of one ray, returns true and writes the reflected ray to next when the path goes on
+bool CpuTracer::trace_ray(const CpuTraceRay& ray, CpuTraceRay& next, CpuThreadState& ts) {
+    CpuRayHit hit;
+    intersect_ray(ray, hit);
+    return shade_ray(ray, hit, next, ts);
+}
+
+// the traversal of optixTrace and the stage hand-off of __miss__ms
+void CpuTracer::intersect_ray(const CpuTraceRay& ray, CpuRayHit& ray_hit) const {
+    const HostRay host_ray = { ray.orig, ray.dir, ray.tmin, 1e16f };
+    uint32_t ray_stage = ray.stage;
+    ray_hit.prim = NO_ELEMENT;
+
+    // the traversal shrinks tmax to the closest hit so far, every reported hit replaces the previous one
+    float3 normal = make_float3(0.0f, 0.0f, 0.0f);
+    auto intersect = [&](uint32_t prim, const HostRay& r, float& t) {
+        float3 n;
+        if (!intersect_geometry(m_geometry[prim], r, t, n)) return false;
+        normal = n;
+        return true;
+    };
+    BvhHit hit;
+    if (use_neighbours() && ray.element != NO_ELEMENT && ray.element < m_neighbours.num_elements()) {
+        // a sun ray can hit its own element or a shading candidate, the light its mirror sends to the
+        // receivers a blocking candidate or a receiver
+        HostRay r = host_ray;
+        auto test = [&](uint32_t prim) {
+            float t;
+            if (intersect(prim, r, t) && t < hit.t) {
+                r.tmax = t;
+                hit.t = t;
+                hit.prim = prim;
+            }
+        };
+        // own element too, a curved mirror can hit itself near the reflection point as it does in the BVH
+        test(ray.element);
+        if (ray.depth == 0) {
+            for (const uint32_t* p = m_neighbours.shading_begin(ray.element); p != m_neighbours.shading_end(ray.element); p++)
+                test(*p);
+        }
+        else {
+            for (const uint32_t* p = m_neighbours.blocking_begin(ray.element); p != m_neighbours.blocking_end(ray.element); p++)
+                test(*p);
+            for (uint32_t receiver : m_neighbours.receivers())
+                test(receiver);
+        }
+    }
+    else {
+        // the elements of the stage of the ray only, a ray that misses them all goes on to the next
+        // stage from the same origin or is lost, as in __miss__ms
+        while (true) {
+            const uint32_t stage = ray_stage & STAGE_INDEX_MASK;
+            const uint32_t first = m_stages[stage].first_element;
+            hit = m_stage_bvh[stage].closest_hit(host_ray, [&](uint32_t prim, const HostRay& r, float& t) {
+                return intersect(first + prim, r, t);
+            });
+            if (hit.valid()) {
+                hit.prim += first;
+                break;
+            }
+            const uint32_t next_stage = stage_after_miss(m_stages.data(), static_cast<unsigned int>(m_stages.size()),
+                                                         stage, (ray_stage & STAGE_HIT) != 0);
+            if (next_stage >= m_stages.size()) return;
+            ray_stage = next_stage;
+        }
+    }
+    if (!hit.valid()) return;   // __miss__ms does nothing
+
+    ray_hit.t = hit.t;
+    ray_hit.prim = hit.prim;
+    ray_hit.normal = normal;
+    ray_hit.stage = ray_stage;
+}
+
+// the closest-hit programs, returns true and writes the ray that goes on to next
+bool CpuTracer::shade_ray(const CpuTraceRay& ray, const CpuRayHit& hit, CpuTraceRay& next, CpuThreadState& ts) {
+    if (hit.prim == NO_ELEMENT) return false;
+    const float3& normal = hit.normal;
+
+    const float3 hit_point = ray.orig + hit.t * ray.dir;
+    const int new_depth = ray.depth + 1;
+    const size_t hit_index = static_cast<size_t>(m_max_depth) * ray.path + new_depth;
+
+    // the hit stream only holds the sun point of the paths that hit something, written with the
+    // first hit as __raygen__sun_source does once the path ended
+    auto record = [&](float tag) {
+        if (ray.depth == 0 && m_hit_stream_capacity > 0)
+            record_hit(ts, static_cast<size_t>(m_max_depth) * ray.path, make_float4(0.0f, ray.orig), ray.power, NO_ELEMENT);
+        record_hit(ts, hit_index, make_float4(tag, hit_point), ray.power, hit.prim);
+    };
+
+    // the stage a ray goes on in after it interacted here, past the last one it leaves the system
+    const uint32_t stage = hit.stage & STAGE_INDEX_MASK;
+    const uint32_t next_stage = stage_after_interaction(m_stages.data(), stage);
+
+    // passVirtualStage: the element records the ray, which goes on unchanged
+    if (m_stages[stage].flags & STAGE_VIRTUAL) {
+        if (new_depth >= m_max_depth) return false;
+        record(HIT_TAG_VIRTUAL);
+        if (next_stage >= m_stages.size()) return false;
+        next = ray;
+        next.orig = hit_point;
+        next.tmin = 0.01f;
+        next.depth = new_depth;
+        next.element = NO_ELEMENT;
+        next.stage = stage_state(next_stage, stage);
+        return true;
+    }
+
+    switch (m_sbt_index[hit.prim]) {
+    case OpticalEntityType::RECTANGLE_FLAT_MIRROR:
+    case OpticalEntityType::RECTANGLE_PARABOLIC_MIRROR: {
+        float3 world_normal = normalize(normal);
+        float3 ffnormal = faceforward(world_normal, -ray.dir, world_normal);
+        float3 reflected_dir = reflect(ray.dir, ffnormal);
+        if (new_depth < m_max_depth) {
+            // the slope and specularity errors and the reflectivity of __closesthit__mirror, from the
+            // same Philox stream
+            const MaterialData::Mirror& mirror = m_materials[hit.prim].mirror;
+            const float sigma = surface_error_sigma(mirror);
+            float4 rand = make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+            if (sigma > 0.0f || m_ray_weighting == RAY_ROULETTE)
+                rand = bounce_randoms(m_sun_dir_seed, m_sampler.sample_offset + ray.path, new_depth);
+            if (sigma > 0.0f)
+                reflected_dir = apply_surface_error(reflected_dir, ffnormal, sigma, rand.x, rand.y);
+            record(1.0f);
+
+            next.power = reflected_power(m_ray_weighting, ray.power, mirror.reflectivity, rand.z);
+            if (!(next.power > 0.0f)) return false;   // absorbed by the roulette
+            if (next_stage >= m_stages.size()) return false;
+            next.orig = hit_point;
+            next.dir = reflected_dir;
+            next.tmin = 0.01f;
+            next.path = ray.path;
+            next.depth = new_depth;
+            // only the front of the mirror sends light toward the aim point, the blocking candidates hold
+            // for that light alone
+            next.element = ray.depth == 0 && dot(ray.dir, world_normal) < 0.0f ? hit.prim : NO_ELEMENT;
+            next.stage = stage_state(next_stage, stage);
+            return true;
+        }
+        return false;
+    }
+    case OpticalEntityType::RECTANGLE_FLAT_RECEIVER:
+    case OpticalEntityType::TRIANGLE_FLAT_RECEIVER:
+        if (dot(ray.dir, normal) < 0.0f && new_depth < m_max_depth) {
+            record(2.0f);
+            deposit_flux(ts, hit.prim, hit_point, ray.power);
+        }
+        return false;
+    case OpticalEntityType::CYLINDRICAL_RECEIVER:
+        if (new_depth < m_max_depth) {
+            record(2.0f);
+            deposit_flux(ts, hit.prim, hit_point, ray.power);
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+// depositFlux, into the partials of the thread
+void CpuTracer::deposit_flux(CpuThreadState& ts, uint32_t element, const float3& hit_point, float power) {
+    if (!m_deposit) return;
+    if (!ts.element_power.empty()) ts.element_power[element] += power;
+    if (ts.flux.empty()) return;
+    const int map = m_flux_layout.map_index[element];
+    if (map < 0) return;
+    const int cell = flux_map_cell(m_flux_layout.device_grids[map], hit_point, m_flux_layout.nu, m_flux_layout.nv);
+    if (cell >= 0)
+        ts.flux[map * m_flux_layout.cells_per_map() + cell] += power;
+}
+
+void CpuTracer::record_hit(CpuThreadState& ts, size_t index, const float4& value, float power, uint32_t element) {
+    if (ts.num_hits == ts.hits.size()) flush_hits(ts);
+    ts.hits[ts.num_hits++] = { index, value, power, element };
+}
+
+// the records of different threads never share an index, so the threads scatter concurrently; in
+// the hit stream a thread reserves the slots of all its staged records with one atomic add, and the
+// records past the capacity only lower the first lost ray, as appendHitRecord does
+void CpuTracer::flush_hits(CpuThreadState& ts) {
+    if (m_hit_stream_capacity == 0) {
+        for (size_t i = 0; i < ts.num_hits; i++) {
+            m_hit_point_buffer[ts.hits[i].index] = ts.hits[i].value;
+            m_hit_power_buffer[ts.hits[i].index] = ts.hits[i].power;
+        }
+        ts.num_hits = 0;
+        return;
+    }
+
+    const uint64_t first_slot = m_hit_stream_count.fetch_add(ts.num_hits, std::memory_order_relaxed);
+    uint32_t lost = 0xFFFFFFFFu;
+    for (size_t i = 0; i < ts.num_hits; i++) {
+        const CpuHitRecord& h = ts.hits[i];
+        const uint32_t ray = static_cast<uint32_t>(h.index / m_max_depth);
+        if (first_slot + i >= m_hit_stream_capacity) {
+            lost = std::min(lost, ray);
+            continue;
+        }
+        HitRecord& r = m_hit_stream[first_slot + i];
+        r.position = make_float3(h.value.y, h.value.z, h.value.w);
+        r.power = h.power;
+        r.ray = ray;
+        r.element = h.element;
+        r.depth = static_cast<unsigned short>(h.index % m_max_depth);
+        r.tag = static_cast<unsigned short>(h.value.x);
+    }
+    uint32_t current = m_hit_stream_lost.load(std::memory_order_relaxed);
+    while (lost < current && !m_hit_stream_lost.compare_exchange_weak(current, lost, std::memory_order_relaxed)) {}
+    ts.num_hits = 0;
+}
+
+// (re)create the workers when the thread settings changed; the per-thread state is allocated by its
+// own pinned worker, so the first touch places it on the worker's NUMA node
+void CpuTracer::start_threads() {
+    if (m_scheduler && m_scheduler_threads == m_num_threads && m_scheduler_pinned == m_pin_threads) return;
+
+    m_thread_states.clear();
+    m_scheduler.reset();
+    m_scheduler = std::make_unique<WorkStealingScheduler>(m_num_threads, m_pin_threads);
+    m_scheduler_threads = m_num_threads;
+    m_scheduler_pinned = m_pin_threads;
+
+    constexpr size_t HIT_RECORDS_PER_THREAD = 1 << 14;
+    m_thread_states.resize(m_scheduler->num_threads());
+    m_scheduler->run_on_each_thread([&](int t) {
+        auto ts = std::make_unique<CpuThreadState>();
+        ts->hits.resize(HIT_RECORDS_PER_THREAD);
+        ts->counters = std::make_unique<PerfCounters>();   // counts the thread that opens it
+        m_thread_states[t] = std::move(ts);
+    });
+
+    if (m_verbose)
+        std::cout << "CPU tracer: " << m_scheduler->num_threads() << " threads"
+                  << (m_pin_threads ? ", pinned" : "") << std::endl;
+}
+
+void CpuTracer::start_counters() {
+    m_scheduler->run_on_each_thread([&](int t) { m_thread_states[t]->counters->start(); });
+}
+
+// sum of the counters of all the workers, -1 when they are not available
+void CpuTracer::stop_counters(int64_t& cache_misses, int64_t& cache_references) {
+    m_scheduler->run_on_each_thread([&](int t) { m_thread_states[t]->counters->stop(); });
+    cache_misses = -1;
+    cache_references = -1;
+    for (const auto& ts : m_thread_states) {
+        if (!ts->counters->available()) return;
+    }
+    cache_misses = 0;
+    cache_references = 0;
+    for (const auto& ts : m_thread_states) {
+        cache_misses += ts->counters->cache_misses();
+        cache_references += ts->counters->cache_references();
+    }
+}
+
+void CpuTracer::set_sun_sampler(SamplerType type, unsigned int seed, unsigned int samples_per_pass) {
+    m_sampler.type = type;
+    m_sampler.seed = seed;
+    m_samples_per_pass = samples_per_pass;
+}
+
+void CpuTracer::run() {
+    start_threads();
+    set_sampler_strata(m_sampler, m_samples_per_pass > 0 ? m_samples_per_pass : static_cast<unsigned int>(m_num_sunpoints));
+    // sized here as well, the depth and the hit stream can change between runs
+    allocate_hit_buffers();
+    m_bounce_stats.clear();
+    m_scheduler->run_on_each_thread([&](int t) {
+        m_thread_states[t]->flux.assign(m_flux_layout.num_cells(), 0.0);
+        m_thread_states[t]->element_power.assign(m_flux_layout.element_power ? m_flux_layout.num_elements() : 0, 0.0);
+    });
+
+    m_timer_trace.reset();
+    m_timer_trace.start();
+    if (m_hit_stream_capacity == 0) {
+        m_hit_stream_passes = 1;
+        if (m_mode == CpuTraceMode::RECURSIVE)
+            run_recursive(0, static_cast<size_t>(m_num_sunpoints));
+        else
+            run_wavefront(0, static_cast<size_t>(m_num_sunpoints));
+    }
+    else {
+        // the first pass traces every ray and deposits their power, the later ones trace the rays
+        // whose records did not fit again and only keep the records
+        m_hit_records.clear();
+        HitStreamPlanner planner(static_cast<size_t>(m_num_sunpoints), m_hit_stream_capacity);
+        while (!planner.done()) {
+            m_hit_stream_count = 0;
+            m_hit_stream_lost = 0xFFFFFFFFu;
+            m_deposit = planner.pass() == 0;
+            if (m_mode == CpuTraceMode::RECURSIVE)
+                run_recursive(planner.begin(), planner.end());
+            else
+                run_wavefront(planner.begin(), planner.end());
+
+            const uint64_t reserved = m_hit_stream_count;
+            const size_t first_lost = m_hit_stream_lost == 0xFFFFFFFFu ? static_cast<size_t>(m_num_sunpoints) : m_hit_stream_lost.load();
+            const size_t num_written = static_cast<size_t>(std::min<uint64_t>(reserved, m_hit_stream_capacity));
+            for (size_t i = 0; i < num_written; i++)
+                if (m_hit_stream[i].ray < first_lost) m_hit_records.push_back(m_hit_stream[i]);
+            planner.finish_pass(reserved, first_lost);
+        }
+        m_hit_stream_passes = planner.pass();
+        m_deposit = true;
+    }
+    m_timer_trace.stop();
+
+    // the tiles of the threads merge into the maps
+    std::vector<double> flux_power(m_flux_layout.num_cells(), 0.0);
+    for (const auto& ts : m_thread_states)
+        for (size_t c = 0; c < flux_power.size(); c++) flux_power[c] += ts->flux[c];
+    m_flux_maps = make_flux_maps(m_flux_layout, flux_power);
+    m_receiver_element_power.assign(m_thread_states.empty() ? 0 : m_thread_states[0]->element_power.size(), 0.0);
+    for (const auto& ts : m_thread_states)
+        for (size_t e = 0; e < m_receiver_element_power.size(); e++) m_receiver_element_power[e] += ts->element_power[e];
+
+    if (m_verbose)
+        std::cout << "CPU trace: " << m_num_sunpoints << " sun rays in " << m_timer_trace.get_time_sec() << " seconds"
+                  << (m_hit_stream_capacity > 0 ? ", " + std::to_string(m_hit_records.size()) + " hit records in "
+                                                  + std::to_string(m_hit_stream_passes) + " passes" : "") << std::endl;
+}
+
+// the sun rays ray_begin to ray_end, numbered as in a run over all of them
+void CpuTracer::run_recursive(size_t ray_begin, size_t ray_end) {
+    const size_t batch_size = static_cast<size_t>(std::max(1, m_batch_size));
+    const size_t num_batches = (ray_end - ray_begin + batch_size - 1) / batch_size;
+
+    start_counters();
+    m_scheduler->parallel_for(num_batches, [&](size_t batch, int thread) {
+        CpuThreadState& ts = *m_thread_states[thread];
+        const size_t end = std::min(ray_end, ray_begin + (batch + 1) * batch_size);
+        for (size_t i = ray_begin + batch * batch_size; i < end; i++) {
+            CpuTraceRay ray = generate_sun_ray(static_cast<uint32_t>(i), m_ray_power_buffer[i]);
+            if (m_hit_stream_capacity == 0)
+                record_hit(ts, static_cast<size_t>(m_max_depth) * i, make_float4(0.0f, ray.orig), ray.power, NO_ELEMENT);
+            m_sun_dir_buffer[i] = ray.dir;
+
+            CpuTraceRay next;
+            while (trace_ray(ray, next, ts))
+                ray = next;
+        }
+    }, m_work_stealing);
+    m_scheduler->run_on_each_thread([&](int t) { flush_hits(*m_thread_states[t]); });
+    stop_counters(m_cache_misses, m_cache_references);
+}
+
+// generate, then per bounce sort, intersect, shade and compact, every pass over the whole queue;
+// the sun rays ray_begin to ray_end, numbered as in a run over all of them
+void CpuTracer::run_wavefront(size_t ray_begin, size_t ray_end) {
+    const size_t batch_size = static_cast<size_t>(std::max(1, m_batch_size));
+    const int num_threads = m_scheduler->num_threads();
+    m_cache_misses = 0;
+    m_cache_references = 0;
+
+    Timer generate_timer;
+    generate_timer.start();
+    std::vector<CpuTraceRay> queue(ray_end - ray_begin);
+    const size_t num_sun_batches = (queue.size() + batch_size - 1) / batch_size;
+    m_scheduler->parallel_for(num_sun_batches, [&](size_t batch, int thread) {
+        CpuThreadState& ts = *m_thread_states[thread];
+        const size_t end = std::min(queue.size(), (batch + 1) * batch_size);
+        for (size_t q = batch * batch_size; q < end; q++) {
+            const size_t i = ray_begin + q;
+            queue[q] = generate_sun_ray(static_cast<uint32_t>(i), m_ray_power_buffer[i]);
+            if (m_hit_stream_capacity == 0)
+                record_hit(ts, static_cast<size_t>(m_max_depth) * i, make_float4(0.0f, queue[q].orig), queue[q].power, NO_ELEMENT);
+            m_sun_dir_buffer[i] = queue[q].dir;
+        }
+    }, m_work_stealing);
+    generate_timer.stop();
+
+    std::vector<size_t> offsets(num_threads + 1);
+    for (int depth = 0; !queue.empty(); depth++) {
+        CpuBounceStats stats;
+        stats.depth = depth;
+        stats.num_rays = queue.size();
+        if (depth == 0) stats.generate_time = generate_timer.get_time_sec();
+
+        if (m_sort_rays) {
+            Timer sort_timer;
+            sort_timer.start();
+            sort_rays(queue);
+            sort_timer.stop();
+            stats.sort_time = sort_timer.get_time_sec();
+        }
+
+        const size_t num_batches = (queue.size() + batch_size - 1) / batch_size;
+        start_counters();
+
+        Timer intersect_timer;
+        intersect_timer.start();
+        m_ray_hits.resize(queue.size());
+        m_scheduler->parallel_for(num_batches, [&](size_t batch, int) {
+            const size_t end = std::min(queue.size(), (batch + 1) * batch_size);
+            for (size_t i = batch * batch_size; i < end; i++)
+                intersect_ray(queue[i], m_ray_hits[i]);
+        }, m_work_stealing);
+        intersect_timer.stop();
+
+        Timer shade_timer;
+        shade_timer.start();
+        m_scheduler->parallel_for(num_batches, [&](size_t batch, int thread) {
+            CpuThreadState& ts = *m_thread_states[thread];
+            const size_t end = std::min(queue.size(), (batch + 1) * batch_size);
+            CpuTraceRay next;
+            for (size_t i = batch * batch_size; i < end; i++) {
+                if (shade_ray(queue[i], m_ray_hits[i], next, ts))
+                    ts.next_rays.push_back(next);
+            }
+        }, m_work_stealing);
+        shade_timer.stop();
+        stop_counters(stats.cache_misses, stats.cache_references);
+
+        stats.intersect_time = intersect_timer.get_time_sec();
+        stats.shade_time = shade_timer.get_time_sec();
+        stats.trace_time = stats.intersect_time + stats.shade_time;
+        if (stats.cache_misses >= 0 && m_cache_misses >= 0) {
+            m_cache_misses += stats.cache_misses;
+            m_cache_references += stats.cache_references;
+        }
+        else {
+            m_cache_misses = -1;
+            m_cache_references = -1;
+        }
+
+        // compaction: the next queue is the concatenation of the rays every thread kept
+        Timer compact_timer;
+        compact_timer.start();
+        offsets[0] = 0;
+        for (int t = 0; t < num_threads; t++)
+            offsets[t + 1] = offsets[t] + m_thread_states[t]->next_rays.size();
+        queue.resize(offsets[num_threads]);
+        m_scheduler->run_on_each_thread([&](int t) {
+            std::vector<CpuTraceRay>& next_rays = m_thread_states[t]->next_rays;
+            std::copy(next_rays.begin(), next_rays.end(), queue.begin() + offsets[t]);
+            next_rays.clear();
+            flush_hits(*m_thread_states[t]);
+        });
+        compact_timer.stop();
+        stats.compact_time = compact_timer.get_time_sec();
+        m_bounce_stats.push_back(stats);
+    }
+}
+
+// Reorder the rays by a 33 bit key: the direction octant on top of the 30 bit Morton code of the
+// origin quantized to 1024 cells per axis of the scene bounds. LSD radix sort on 11 bit digits,
+// stable, so rays with equal keys keep their relative order.
+void CpuTracer::sort_rays(std::vector<CpuTraceRay>& rays) {
+    const size_t n = rays.size();
+    m_keys.resize(n);
+    m_keys_tmp.resize(n);
+    m_order.resize(n);
+    m_order_tmp.resize(n);
+
+    const float3 extent = m_bounds_hi - m_bounds_lo;
+    const float sx = extent.x > 0.0f ? 1024.0f / extent.x : 0.0f;
+    const float sy = extent.y > 0.0f ? 1024.0f / extent.y : 0.0f;
+    const float sz = extent.z > 0.0f ? 1024.0f / extent.z : 0.0f;
+
+    for (size_t i = 0; i < n; i++) {
+        const CpuTraceRay& ray = rays[i];
+        const uint32_t morton = (expand_bits_10(quantize_10(ray.orig.x, m_bounds_lo.x, sx)) << 2)
+                              | (expand_bits_10(quantize_10(ray.orig.y, m_bounds_lo.y, sy)) << 1)
+                              |  expand_bits_10(quantize_10(ray.orig.z, m_bounds_lo.z, sz));
+        const uint32_t octant = (std::signbit(ray.dir.x) ? 4u : 0u) | (std::signbit(ray.dir.y) ? 2u : 0u) | (std::signbit(ray.dir.z) ? 1u : 0u);
+        m_keys[i] = (static_cast<uint64_t>(octant) << 30) | morton;
+        m_order[i] = static_cast<uint32_t>(i);
+    }
+
+    constexpr int DIGIT_BITS = 11;
+    constexpr uint32_t NUM_BUCKETS = 1u << DIGIT_BITS;
+    std::vector<uint32_t> offsets(NUM_BUCKETS);
+    for (int shift = 0; shift < 33; shift += DIGIT_BITS) {
+        std::fill(offsets.begin(), offsets.end(), 0u);
+        for (size_t i = 0; i < n; i++)
+            offsets[(m_keys[i] >> shift) & (NUM_BUCKETS - 1)]++;
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+            const uint32_t count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            const uint32_t dst = offsets[(m_keys[i] >> shift) & (NUM_BUCKETS - 1)]++;
+            m_keys_tmp[dst] = m_keys[i];
+            m_order_tmp[dst] = m_order[i];
+        }
+        m_keys.swap(m_keys_tmp);
+        m_order.swap(m_order_tmp);
+    }
+
+    m_sorted.resize(n);
+    for (size_t i = 0; i < n; i++)
+        m_sorted[i] = rays[m_order[i]];
+    rays.swap(m_sorted);
+}
+
+void CpuTracer::write_hp_output(const std::string& filename) {
+    if (m_hit_stream_capacity == 0) {
+        write_hit_point_csv(m_hit_point_buffer, m_max_depth, filename);
+        return;
+    }
+    std::vector<float4> hit_points;
+    std::vector<float> hit_power;
+    decode_hit_records(m_hit_records, static_cast<size_t>(m_num_sunpoints), m_max_depth, hit_points, hit_power);
+    write_hit_point_csv(hit_points, m_max_depth, filename);
+}
+
+HitFrames CpuTracer::get_hit_frames() const {
+    return make_hit_frames(m_element_list, m_geometry, m_stages, m_sun_plane.v0, m_sun_plane.v1, m_sun_plane.v3);
+}
+
+std::vector<PackedHit> CpuTracer::get_packed_hits() const {
+    if (m_hit_stream_capacity == 0)
+        throw std::runtime_error("Packed hits need the element of every hit, set_hit_stream before the run.");
+    return pack_hit_records(get_hit_frames(), m_hit_records, static_cast<size_t>(m_num_sunpoints), m_max_depth);
+}
+
+bool CpuTracer::write_packed_hits(const std::string& filename) const {
+    PackedHitFile file;
+    file.num_rays = static_cast<size_t>(m_num_sunpoints);
+    file.max_depth = m_max_depth;
+    file.frames = get_hit_frames();
+    file.hits = get_packed_hits();
+    return OptixCSP::write_packed_hits(filename, file);
+}
+
+int CpuTracer::get_num_hits_receiver() {
+    if (m_hit_stream_capacity > 0) return count_receiver_records(m_hit_records);
+    return count_receiver_hits(m_hit_point_buffer);
+}
+
+// a path ends on the receiver, so it deposits its power at most once
+double CpuTracer::get_receiver_power() const {
+    if (m_hit_stream_capacity > 0) return hit_record_receiver_power(m_hit_records);
+    double power = 0.0;
+    for (size_t i = 0; i < m_hit_point_buffer.size(); i++)
+        if (m_hit_point_buffer[i].x == 2.0f) power += m_hit_power_buffer[i];
+    return power;
+}
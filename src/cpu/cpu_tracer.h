@@ -0,0 +1,345 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/vec3d.h"
+#include "core/timer.h"
+#include "core/CspElement.h"
+#include "core/soltrace_state.h"
+#include "core/sun_shape.h"
+#include "core/flux_map.h"
+#include "core/hit_stream.h"
+#include "core/packed_hits.h"
+#include "shaders/Soltrace.h"
+#include "cpu/bvh.h"
+#include "cpu/sun_plane.h"
+#include "cpu/sun_footprints.h"
+#include "cpu/neighbour_lists.h"
+#include "cpu/perf_counters.h"
+#include "cpu/work_stealing.h"
+
+namespace OptixCSP {
+
+    class GeometryManager;
+
+    /// How the CPU tracer walks the ray paths.
+    enum class CpuTraceMode {
+        RECURSIVE,  // every path is followed to the end before the next one starts, like the OptiX launch
+        WAVEFRONT   // all rays of one bounce are traced before the next bounce starts
+    };
+
+    /// Where the sun rays are launched from.
+    enum class CpuSunSampling {
+        PARALLELOGRAM,  // uniformly over the sun plane bounding the whole scene, like __raygen__sun_source
+        FOOTPRINTS      // over the footprints of the elements on the sun plane, see SunFootprints
+    };
+
+    /// timings and counters of one wavefront bounce, in seconds
+    struct CpuBounceStats {
+        int     depth = 0;              // 0 for the sun rays
+        size_t  num_rays = 0;
+        double  generate_time = 0.0;    // sun rays, bounce 0 only
+        double  sort_time = 0.0;        // keys, sort and gather
+        double  intersect_time = 0.0;   // traversal, closest hit of every ray of the queue
+        double  shade_time = 0.0;       // hit points and reflected rays
+        double  compact_time = 0.0;     // surviving rays gathered into the next queue, hit points scattered
+        double  trace_time = 0.0;       // intersect and shade
+        int64_t cache_misses = -1;      // over intersect and shade, -1 when the counters are not available
+        int64_t cache_references = -1;
+    };
+
+    /// ray of the wavefront queues, path is the ray_path_index of the launch; element is the element
+    /// the ray leaves, the footprint of a sun ray or the mirror that reflected it toward its aim point,
+    /// NO_ELEMENT for the other rays; power is what the ray carries, in W; stage is the stage it is
+    /// traced in, with STAGE_HIT as in PerRayData
+    struct CpuTraceRay {
+        float3   orig;
+        float3   dir;
+        float    tmin;
+        uint32_t path;
+        int      depth;
+        uint32_t element;
+        float    power;
+        uint32_t stage;
+    };
+
+    constexpr uint32_t NO_ELEMENT = 0xFFFFFFFFu;
+
+    /// closest hit of a ray of the wavefront queue, prim is NO_ELEMENT when the ray leaves the
+    /// system; stage is the one the element belongs to, after the hand-offs of the stages it missed
+    struct CpuRayHit {
+        float    t;
+        uint32_t prim;
+        float3   normal;
+        uint32_t stage;
+    };
+
+    /// hit point written by a worker, index into the hit point buffer, power of the ray arriving there,
+    /// element it landed on, NO_ELEMENT for the sun point
+    struct CpuHitRecord {
+        size_t   index;
+        float4   value;
+        float    power;
+        uint32_t element;
+    };
+
+    /// data owned by one worker thread, allocated and first touched by that thread so it lives on its NUMA node
+    struct CpuThreadState {
+        std::vector<CpuHitRecord> hits;       // staged hit points, scattered to the hit point buffer or
+                                              // appended to the hit stream when full
+        size_t num_hits = 0;
+        std::vector<CpuTraceRay> next_rays;   // rays continuing to the next wavefront bounce
+        std::vector<double> flux;             // tile of the flux maps, power of every cell, merged after the run
+        std::vector<double> element_power;    // partial receiver power per element, reduced after the run
+        std::unique_ptr<PerfCounters> counters;
+    };
+
+    /**
+     * @class CpuTracer
+     * @brief Host backend of SolTraceSystem. It traces the same scene with the same sun sampling and
+     * reproduces the raygen, intersection and closest-hit programs on the CPU, on top of the host BVH.
+     * The hit point buffer has the layout of the GPU one, so both are written with the same routine.
+     *
+     * In WAVEFRONT mode every bounce runs as separate passes over an explicit ray queue: the sun
+     * rays are generated once, then each bounce intersects the whole queue, shades the hits and
+     * compacts the rays that go on into the next queue; each pass is timed in get_bounce_stats().
+     * Neither mode recurses, so the depth is a plain run time setting.
+     *
+     * The rays of one bounce can be sorted by a key made of the direction octant
+     * and the Morton code of the origin before they are traced; the results are scattered back by
+     * ray_path_index, so the output does not depend on the order.
+     *
+     * Rays are traced in batches on a WorkStealingScheduler: paths in RECURSIVE mode, slices of the
+     * bounce queue in WAVEFRONT mode.
+     *
+     * Every stage has its own BVH and a ray only tests the elements of the stage it is in, handed to
+     * the next stage as __miss__ms and the closest-hit programs do; the sun plane covers the first stage.
+     *
+     * With set_hit_stream the hits go to a stream of compact records instead of the hit point buffer,
+     * each worker reserving the slots of its staged records at once; an overflow is traced again in
+     * later passes planned by HitStreamPlanner.
+     */
+    class CpuTracer {
+    public:
+        CpuTracer(int num_sun_points);
+        ~CpuTracer();
+
+        /// collect the geometry, build the BVH and compute the sun plane
+        void initialize();
+
+        /// trace all the sun rays
+        void run();
+
+        /// collect the geometry again after the elements moved, rebuild the BVH and the sun plane
+        void update();
+
+        /// add element, its orientation is computed from the aim point and zrot as in SolTraceSystem
+        void add_element(std::shared_ptr<CspElement> element);
+        /// StageFlags of stage, as SolTraceSystem::set_stage_flags; call before initialize()
+        void set_stage_flags(unsigned int stage, unsigned int flags);
+        const std::vector<unsigned int>& get_stage_flags() const { return m_stage_flags; }
+        /// sun, elements and stages of a stinput file, as SolTraceSystem::read_st_input
+        bool read_st_input(const char* filename);
+
+        void set_sun_vector(OptixCSP::Vec3d vect) { m_sun_vector = vect; }
+        void set_sun_angle(double angle) { m_sun_angle = angle; }
+        /// tabulated sunshape instead of the pillbox cone, the sun angle becomes its outermost angle
+        void set_sun_shape(std::shared_ptr<const SunShape> sun_shape);
+        void set_sun_points(int num) { m_num_sunpoints = num; }
+        int get_sun_points() const { return m_num_sunpoints; }
+        /// hit points per path, the sun point included, as SolTraceSystem::set_max_depth; takes effect at the next run
+        void set_max_depth(int depth);
+        int get_max_depth() const { return m_max_depth; }
+        void set_verbose(bool verbose) { m_verbose = verbose; }
+        /// direct normal irradiance, the power of a sun ray is dni times the sun plane area it stands for
+        void set_dni(double dni) { m_dni = dni; }
+        /// how the mirrors reflect the power of a ray, as in __closesthit__mirror
+        void set_ray_weighting(RayWeighting weighting) { m_ray_weighting = weighting; }
+        void set_sun_sampling(CpuSunSampling sampling) { m_sun_sampling = sampling; }
+        /// sequence of the sun rays, seed scrambles SOBOL_OWEN and STRATIFIED; the strata of STRATIFIED
+        /// cover samples_per_pass rays, 0 for the rays of one run
+        void set_sun_sampler(SamplerType type, unsigned int seed = 0, unsigned int samples_per_pass = 0);
+        /// first sample of the next run; a run of n rays that goes on with the previous one starts
+        /// at get_sample_offset() + n
+        void set_sample_offset(unsigned long long offset) { m_sampler.sample_offset = offset; }
+        unsigned long long get_sample_offset() const { return m_sampler.sample_offset; }
+        const SamplerData& get_sampler() const { return m_sampler; }
+
+        void set_trace_mode(CpuTraceMode mode) { m_mode = mode; }
+        /// sort the rays of every wavefront bounce, ignored in RECURSIVE mode
+        void set_ray_sorting(bool sort) { m_sort_rays = sort; }
+        /// test the rays that know their element against its shading or blocking candidates and the
+        /// receivers only, instead of the BVH; the sun rays know theirs with FOOTPRINTS sampling.
+        /// Ignored with more than one stage
+        void set_neighbour_lists(bool use) { m_use_neighbours = use; }
+
+        /// number of worker threads, 0 uses every logical cpu
+        void set_num_threads(int num) { m_num_threads = num; }
+        /// pin the workers to cpus, filling one NUMA node after the other
+        void set_thread_pinning(bool pin) { m_pin_threads = pin; }
+        /// false gives every worker a fixed share of the batches (static partitioning)
+        void set_work_stealing(bool steal) { m_work_stealing = steal; }
+        /// rays per scheduler batch
+        void set_batch_size(int size) { m_batch_size = size; }
+
+        /// worker threads of the last run, nullptr before the first one
+        const WorkStealingScheduler* get_scheduler() const { return m_scheduler.get(); }
+
+        /// write all the hit points to a file, same format as SolTraceSystem::write_hp_output
+        void write_hp_output(const std::string& filename);
+        /// write the hits to a stream of at most capacity HitRecord instead of the hit point buffer,
+        /// which stays empty; 0, the default, goes back to the buffer. Takes effect at the next run
+        void set_hit_stream(size_t capacity) { m_hit_stream_capacity = capacity; }
+        size_t get_hit_stream() const { return m_hit_stream_capacity; }
+        /// records of the last run with a hit stream, the sun point of every path that hit something
+        /// and its hits, in no particular order; decode_hit_records lays them out as the hit point buffer
+        const std::vector<HitRecord>& get_hit_records() const { return m_hit_records; }
+        /// passes the last run took to fit its records in the hit stream, 1 without an overflow
+        int get_hit_stream_passes() const { return m_hit_stream_passes; }
+        /// frames of the elements and of the sun plane the hits pack on, after initialize
+        HitFrames get_hit_frames() const;
+        /// records of the last run packed on the frames of their elements, 8 bytes a hit in the layout
+        /// of the hit point buffer; throws without a hit stream, the buffer does not keep the elements
+        std::vector<PackedHit> get_packed_hits() const;
+        /// write the packed hits of the last run and their frames to a packed hit file
+        bool write_packed_hits(const std::string& filename) const;
+        /// number of rays hitting the receiver
+        int get_num_hits_receiver();
+
+        /// hit point buffer of the last run, empty when it wrote the hit stream
+        const std::vector<float4>& get_hit_point_buffer() const { return m_hit_point_buffer; }
+        const std::vector<float3>& get_sun_dir_buffer() const { return m_sun_dir_buffer; }
+        /// power carried by each sun ray (path) of the last run
+        const std::vector<float>& get_ray_power_buffer() const { return m_ray_power_buffer; }
+        /// power of the ray arriving at each hit point, layout of the hit point buffer
+        const std::vector<float>& get_hit_power_buffer() const { return m_hit_power_buffer; }
+        /// summed power of the rays hitting the receiver, from the hit stream when there is one
+        double get_receiver_power() const;
+        /// cells of the flux maps, as SolTraceSystem::set_flux_map_resolution; call before initialize()
+        void set_flux_map_resolution(int nu, int nv);
+        /// flux maps of the last run, one per receiver in element order
+        const std::vector<FluxMap>& get_flux_maps() const { return m_flux_maps; }
+        const FluxMap& get_flux_map(size_t receiver = 0) const;
+        /// receiver power per element, as SolTraceSystem::set_receiver_element_power; call before initialize()
+        void set_receiver_element_power(bool enable) { m_element_power = enable; }
+        /// power every element absorbed in the last run, W, in element order, 0 for the mirrors
+        const std::vector<double>& get_receiver_element_power() const;
+        /// the flat receivers with their power and flux per element as a VTK polydata file
+        bool write_receiver_power_vtk(const std::string& filename) const;
+        const SunPlane& get_sun_plane() const { return m_sun_plane; }
+        const SunFootprints& get_sun_footprints() const { return m_sun_footprints; }
+        /// candidate lists of the last initialize or update with set_neighbour_lists(true)
+        const NeighbourLists& get_neighbour_lists() const { return m_neighbours; }
+        /// element range and flags of every stage, after initialize
+        const std::vector<StageData>& get_stage_data() const { return m_stages; }
+
+        /// one entry per bounce of the last WAVEFRONT run
+        const std::vector<CpuBounceStats>& get_bounce_stats() const { return m_bounce_stats; }
+        /// counters over the whole last run, -1 when not available
+        int64_t get_cache_misses() const { return m_cache_misses; }
+        int64_t get_cache_references() const { return m_cache_references; }
+
+        double get_time_trace() const { return m_timer_trace.get_time_sec(); }
+        double get_time_setup() const { return m_timer_setup.get_time_sec(); }
+
+    private:
+        void build_scene();
+        void allocate_hit_buffers();
+        void build_neighbour_lists();
+        void start_threads();
+        CpuTraceRay generate_sun_ray(uint32_t ray_number, float& power) const;
+        bool trace_ray(const CpuTraceRay& ray, CpuTraceRay& next, CpuThreadState& ts);
+        void intersect_ray(const CpuTraceRay& ray, CpuRayHit& hit) const;
+        bool shade_ray(const CpuTraceRay& ray, const CpuRayHit& hit, CpuTraceRay& next, CpuThreadState& ts);
+        bool use_neighbours() const { return m_use_neighbours && m_stages.size() == 1; }
+        void record_hit(CpuThreadState& ts, size_t index, const float4& value, float power, uint32_t element);
+        void deposit_flux(CpuThreadState& ts, uint32_t element, const float3& hit_point, float power);
+        void flush_hits(CpuThreadState& ts);
+        void sort_rays(std::vector<CpuTraceRay>& rays);
+
+        void start_counters();
+        void stop_counters(int64_t& cache_misses, int64_t& cache_references);
+
+        void run_recursive(size_t ray_begin, size_t ray_end);
+        void run_wavefront(size_t ray_begin, size_t ray_end);
+
+        int m_num_sunpoints;
+        int m_max_depth;
+        int m_flux_nu;
+        int m_flux_nv;
+        bool m_element_power;
+        bool m_verbose;
+        double m_dni;
+        RayWeighting m_ray_weighting;
+        CpuSunSampling m_sun_sampling;
+        CpuTraceMode m_mode;
+        bool m_sort_rays;
+        bool m_use_neighbours;
+        int m_num_threads;
+        bool m_pin_threads;
+        bool m_work_stealing;
+        int m_batch_size;
+
+        OptixCSP::Vec3d m_sun_vector;
+        double m_sun_angle;
+        std::shared_ptr<const SunShape> m_sun_shape;
+        float3 m_sun_vector_f;
+        unsigned long long m_sun_dir_seed;
+        SamplerData m_sampler;
+        unsigned int m_samples_per_pass;
+
+        std::vector<std::shared_ptr<CspElement>> m_element_list;
+        std::vector<unsigned int> m_stage_flags;
+
+        OptixCSP::SoltraceState m_state;
+        std::shared_ptr<GeometryManager> m_geometry_manager;
+        std::vector<GeometryDataST> m_geometry;
+        std::vector<MaterialData> m_materials;
+        std::vector<uint32_t> m_sbt_index;
+        std::vector<StageData> m_stages;
+        std::vector<WideBvh8> m_stage_bvh;   // over the elements of every stage, primitive 0 is its first element
+        SunPlaneTree m_sun_plane_tree;
+        SunPlane m_sun_plane;
+        SunFootprints m_sun_footprints;
+        NeighbourLists m_neighbours;
+        FluxMapLayout m_flux_layout;
+        std::vector<FluxMap> m_flux_maps;
+        std::vector<double> m_receiver_element_power;
+        float3 m_bounds_lo;   // bounds of the scene and the sun plane, used to quantize the sort keys
+        float3 m_bounds_hi;
+
+        std::vector<float4> m_hit_point_buffer;
+        std::vector<float> m_hit_power_buffer;
+        size_t m_hit_stream_capacity;
+        std::vector<HitRecord> m_hit_stream;        // capacity slots, written by flush_hits
+        std::atomic<uint64_t> m_hit_stream_count;   // slots reserved in the pass, past capacity on an overflow
+        std::atomic<uint32_t> m_hit_stream_lost;    // lowest ray that lost a record in the pass
+        std::vector<HitRecord> m_hit_records;       // records kept from the passes of the last run
+        int m_hit_stream_passes;
+        bool m_deposit;                             // false in the passes that only collect records
+        std::vector<float3> m_sun_dir_buffer;
+        std::vector<float> m_ray_power_buffer;
+        std::vector<CpuRayHit> m_ray_hits;   // closest hits of the wavefront queue
+        std::vector<CpuTraceRay> m_sorted;   // scratch of sort_rays
+        std::vector<uint64_t> m_keys;
+        std::vector<uint64_t> m_keys_tmp;
+        std::vector<uint32_t> m_order;
+        std::vector<uint32_t> m_order_tmp;
+
+        std::unique_ptr<WorkStealingScheduler> m_scheduler;
+        std::vector<std::unique_ptr<CpuThreadState>> m_thread_states;
+        int m_scheduler_threads;
+        bool m_scheduler_pinned;
+
+        std::vector<CpuBounceStats> m_bounce_stats;
+        int64_t m_cache_misses;
+        int64_t m_cache_references;
+
+        Timer m_timer_setup;
+        Timer m_timer_trace;
+    };
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "shaders/GeometryDataST.h"
+
+namespace OptixCSP {
+
+    /// Ray as seen by the host intersection routines, same convention as optixTrace:
+    /// a hit is only reported for tmin < t < tmax (see each routine for the exact bounds).
+    struct HostRay {
+        float3 orig;
+        float3 dir;
+        float  tmin;
+        float  tmax;
+    };
+
+    // Host ports of the intersection programs in shaders/intersection.cu. They perform the
+    // same floating point operations in the same order, so they serve as the scalar reference
+    // for the batched SIMD kernels (cpu/simd_intersection.h) and as the narrow phase of the
+    // CPU tracer. Each returns true on a hit and writes the distance and the reported normal.
+
+    inline bool intersect_parallelogram(const GeometryDataST::Parallelogram& parallelogram,
+                                        const HostRay& ray, float& t_hit, float3& normal) {
+        float3 n = make_float3(parallelogram.plane);
+        float  dt = dot(ray.dir, n);
+        float  t = (parallelogram.plane.w - dot(n, ray.orig)) / dt;
+
+        if (t > ray.tmin && t < ray.tmax) {
+            float3 p = ray.orig + ray.dir * t;
+            float3 vi = p - parallelogram.anchor;
+            float  a1 = dot(parallelogram.v1, vi);
+            if (a1 >= 0 && a1 <= 1) {
+                float a2 = dot(parallelogram.v2, vi);
+                if (a2 >= 0 && a2 <= 1) {
+                    t_hit = t;
+                    normal = n;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    inline bool intersect_rectangle_flat(const GeometryDataST::Rectangle_Flat& rectangle,
+                                         const HostRay& ray, float& t_hit, float3& normal) {
+        float3 n = make_float3(rectangle.plane);
+        float dt = dot(ray.dir, n);
+        float t = (rectangle.plane.w - dot(n, ray.orig)) / dt;
+
+        if (t > ray.tmin && t < ray.tmax) {
+            float3 p = ray.orig + ray.dir * t;
+            float3 v = p - rectangle.center;
+            float x = dot(rectangle.x, v);
+            float y = dot(rectangle.y, v);
+
+            if (x >= -rectangle.width / 2 && x <= rectangle.width / 2 &&
+                y >= -rectangle.height / 2 && y <= rectangle.height / 2) {
+                t_hit = t;
+                normal = n;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// local y axis of a Cylinder_Y, the device code recomputes this on every call
+    inline float3 cylinder_y_axis(const GeometryDataST::Cylinder_Y& cyl) {
+        return cross(cyl.base_z, cyl.base_x);
+    }
+
+    // open cylinder, __intersection__cylinder_y
+    inline bool intersect_cylinder_y(const GeometryDataST::Cylinder_Y& cyl,
+                                     const HostRay& ray, float& t_hit, float3& normal) {
+        const float3 ray_dir = normalize(ray.dir);
+
+        float3 local_x = cyl.base_x;
+        float3 local_z = cyl.base_z;
+        float3 local_y = cylinder_y_axis(cyl);
+
+        float3 o = ray.orig - cyl.center;
+        float3 lo = make_float3(dot(o, local_x), dot(o, local_y), dot(o, local_z));
+        float3 ld = make_float3(dot(ray_dir, local_x), dot(ray_dir, local_y), dot(ray_dir, local_z));
+
+        float A = ld.x * ld.x + ld.z * ld.z;
+        float B = 2.0f * (lo.x * ld.x + lo.z * ld.z);
+        float C = lo.x * lo.x + lo.z * lo.z - cyl.radius * cyl.radius;
+
+        float determinant = B * B - 4.0f * A * C;
+        if (determinant < 0.0f)
+            return false;
+
+        float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+        float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+
+        float t = t1 > 0.0f ? t1 : t2;
+        if (t < ray.tmin || t > ray.tmax)
+            return false;
+
+        float3 local_hit = lo + t * ld;
+        if (fabsf(local_hit.y) > cyl.half_height) {
+            t = t2;
+            local_hit = lo + t * ld;
+            if (t < ray.tmin || t > ray.tmax || fabsf(local_hit.y) > cyl.half_height)
+                return false;
+        }
+
+        float3 local_normal = normalize(make_float3(local_hit.x, 0.0f, local_hit.z));
+        normal = local_normal.x * local_x + local_normal.y * local_y + local_normal.z * local_z;
+        t_hit = t;
+        return true;
+    }
+
+    // cylinder with top and bottom caps, __intersection__cylinder_y_capped (used by the receiver program)
+    inline bool intersect_cylinder_y_capped(const GeometryDataST::Cylinder_Y& cyl,
+                                            const HostRay& ray, float& t_hit, float3& normal) {
+        const float3 ray_dir = normalize(ray.dir);
+
+        float3 local_x = cyl.base_x;
+        float3 local_z = cyl.base_z;
+        float3 local_y = cylinder_y_axis(cyl);
+
+        float3 o = ray.orig - cyl.center;
+        float3 lo = make_float3(dot(o, local_x), dot(o, local_y), dot(o, local_z));
+        float3 ld = make_float3(dot(ray_dir, local_x), dot(ray_dir, local_y), dot(ray_dir, local_z));
+
+        float A = ld.x * ld.x + ld.z * ld.z;
+        float B = 2.0f * (lo.x * ld.x + lo.z * ld.z);
+        float C = lo.x * lo.x + lo.z * lo.z - cyl.radius * cyl.radius;
+
+        float determinant = B * B - 4.0f * A * C;
+
+        float t_curved = ray.tmax + 1.0f;
+        if (determinant >= 0.0f) {
+            float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+            float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+
+            if (t1 > ray.tmin && t1 < ray.tmax && fabsf(lo.y + t1 * ld.y) <= cyl.half_height)
+                t_curved = t1;
+            else if (t2 > ray.tmin && t2 < ray.tmax && fabsf(lo.y + t2 * ld.y) <= cyl.half_height)
+                t_curved = t2;
+        }
+
+        float t_caps = ray.tmax + 1.0f;
+        if (fabsf(ld.y) > 1e-6f) {
+            // bottom cap, y = -half_height
+            float t = (-cyl.half_height - lo.y) / ld.y;
+            float2 p = make_float2(lo.x + t * ld.x, lo.z + t * ld.z);
+            if (t > ray.tmin && t < ray.tmax && dot(p, p) <= cyl.radius * cyl.radius)
+                t_caps = t;
+
+            // top cap, y = +half_height
+            t = (cyl.half_height - lo.y) / ld.y;
+            p = make_float2(lo.x + t * ld.x, lo.z + t * ld.z);
+            if (t > ray.tmin && t < ray.tmax && dot(p, p) <= cyl.radius * cyl.radius)
+                t_caps = fminf(t_caps, t);
+        }
+
+        float t = fminf(t_curved, t_caps);
+        if (t >= ray.tmax || t <= ray.tmin)
+            return false;
+
+        float3 local_hit = lo + t * ld;
+        float3 local_normal;
+        if (t == t_curved)
+            local_normal = normalize(make_float3(local_hit.x, 0.0f, local_hit.z));
+        else
+            local_normal = make_float3(0.0f, std::signbit(local_hit.y) ? -1.0f : 1.0f, 0.0f);
+
+        normal = local_normal.x * local_x + local_normal.y * local_y + local_normal.z * local_z;
+        t_hit = t;
+        return true;
+    }
+
+    /// frame of a Rectangle_Parabolic, recovered from the reciprocal edge vectors
+    /// exactly like __intersection__rectangle_parabolic does on every call
+    struct ParabolicFrame {
+        float3 e1, e2, n;
+        float3 center;
+        float  L1, L2;
+    };
+
+    inline ParabolicFrame parabolic_frame(const GeometryDataST::Rectangle_Parabolic& rect) {
+        ParabolicFrame f;
+        f.L1 = 1.0f / length(rect.v1);
+        f.L2 = 1.0f / length(rect.v2);
+        f.e1 = rect.v1 * f.L1;
+        f.e2 = rect.v2 * f.L2;
+        f.n = normalize(cross(f.e2, f.e1));
+        f.center = rect.anchor + (f.L1 / 2.0f) * f.e1 + (f.L2 / 2.0f) * f.e2;
+        return f;
+    }
+
+    inline bool intersect_rectangle_parabolic(const GeometryDataST::Rectangle_Parabolic& rect,
+                                              const HostRay& ray, float& t_hit, float3& normal) {
+        const ParabolicFrame f = parabolic_frame(rect);
+
+        float3 d = ray.orig - f.center;
+        float ox = dot(d, f.e1);
+        float oy = dot(d, f.e2);
+        float oz = dot(d, f.n);
+
+        float dx = dot(ray.dir, f.e1);
+        float dy = dot(ray.dir, f.e2);
+        float dz = dot(ray.dir, f.n);
+
+        const float curv_x = rect.curv_x;
+        const float curv_y = rect.curv_y;
+
+        float A = (curv_x * 0.5f) * (dx * dx) + (curv_y * 0.5f) * (dy * dy);
+        float B = curv_x * (ox * dx) + curv_y * (oy * dy) - dz;
+        float C = (curv_x * 0.5f) * (ox * ox) + (curv_y * 0.5f) * (oy * oy) - oz;
+
+        float t = 0.0f;
+        const float eps = 1e-12f;
+        bool valid = false;
+
+        if (fabsf(A) < eps) {
+            t = -C / B;
+            valid = (t > 0.0f);
+        }
+        else {
+            float discr = B * B - 4.0f * A * C;
+            if (discr >= 0.0f) {
+                float sqrt_discr = sqrtf(discr);
+                float t1 = (-B - sqrt_discr) / (2.0f * A);
+                float t2 = (-B + sqrt_discr) / (2.0f * A);
+                if (t1 > 0.0f && t1 < t2) {
+                    t = t1;
+                    valid = true;
+                }
+                else if (t2 > 0.0f) {
+                    t = t2;
+                    valid = true;
+                }
+            }
+        }
+
+        if (!valid || t < ray.tmin || t > ray.tmax)
+            return false;
+
+        float x_hit = ox + t * dx;
+        float y_hit = oy + t * dy;
+
+        // divided in double and rounded back to float like the device code, which equals
+        // a plain float division (double rounding is innocuous for a single division)
+        float a1 = x_hit / (f.L1 / 2.);
+        float a2 = y_hit / (f.L2 / 2.);
+        if (a1 < -1.0f || a1 > 1.0f || a2 < -1.0f || a2 > 1.0f)
+            return false;
+
+        float3 N_local = normalize(make_float3(-curv_x * x_hit, -curv_y * y_hit, 1.0f));
+        normal = normalize(N_local.x * f.e1 + N_local.y * f.e2 + N_local.z * f.n);
+        t_hit = t;
+        return true;
+    }
+
+    // Moller-Trumbore, single sided like __intersection__triangle_flat
+    inline bool intersect_triangle_flat(const GeometryDataST::Triangle_Flat& tri,
+                                        const HostRay& ray, float& t_hit, float3& normal) {
+        const float3 pvec = cross(ray.dir, tri.e2);
+        const float  det = dot(tri.e1, pvec);
+
+        const float eps = 1e-8f;
+        if (det <= eps) return false;
+
+        const float inv_det = 1.0f / det;
+
+        const float3 tvec = ray.orig - tri.v0;
+        const float  u = dot(tvec, pvec) * inv_det;
+        if (u < 0.0f || u > 1.0f) return false;
+
+        const float3 qvec = cross(tvec, tri.e1);
+        const float  v = dot(ray.dir, qvec) * inv_det;
+        if (v < 0.0f || (u + v) > 1.0f) return false;
+
+        const float t = dot(tri.e2, qvec) * inv_det;
+        if (t < ray.tmin || t > ray.tmax) return false;
+
+        t_hit = t;
+        normal = tri.normal;
+        return true;
+    }
+
+    /// Dispatch on the stored primitive type. Cylinders use the capped variant, which is
+    /// the one bound to the cylindrical receiver program.
+    inline bool intersect_geometry(const GeometryDataST& geometry, const HostRay& ray,
+                                   float& t_hit, float3& normal) {
+        switch (geometry.type) {
+        case GeometryDataST::PARALLELOGRAM:
+            return intersect_parallelogram(geometry.getParallelogram(), ray, t_hit, normal);
+        case GeometryDataST::RECTANGLE_FLAT:
+            return intersect_rectangle_flat(geometry.getRectangle_Flat(), ray, t_hit, normal);
+        case GeometryDataST::RECTANGLE_PARABOLIC:
+            return intersect_rectangle_parabolic(geometry.getRectangleParabolic(), ray, t_hit, normal);
+        case GeometryDataST::CYLINDER_Y:
+            return intersect_cylinder_y_capped(geometry.getCylinder_Y(), ray, t_hit, normal);
+        case GeometryDataST::TRIANGLE_FLAT:
+            return intersect_triangle_flat(geometry.getTriangle_Flat(), ray, t_hit, normal);
+        default:
+            return false;
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#include "neighbour_lists.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace OptixCSP;
+
+namespace {
+    bool same_sphere(const ElementSphere& a, const ElementSphere& b) {
+        return a.center.x == b.center.x && a.center.y == b.center.y && a.center.z == b.center.z && a.radius == b.radius;
+    }
+
+    // distance in x and y from p to the segment from a to b
+    float distance_to_segment_xy(float px, float py, const float3& a, const float3& b) {
+        const float dx = b.x - a.x, dy = b.y - a.y;
+        const float len2 = dx * dx + dy * dy;
+        float t = len2 > 0.0f ? ((px - a.x) * dx + (py - a.y) * dy) / len2 : 0.0f;
+        t = std::min(1.0f, std::max(0.0f, t));
+        const float ex = a.x + t * dx - px, ey = a.y + t * dy - py;
+        return std::sqrt(ex * ex + ey * ey);
+    }
+}
+
+NeighbourLists::NeighbourLists()
+    : m_target({ make_float3(0.0f, 0.0f, 0.0f), 0.0f }),
+      m_num_rebuilt(0),
+      m_grid_x0(0.0f), m_grid_y0(0.0f), m_grid_cell(1.0f),
+      m_grid_nx(0), m_grid_ny(0),
+      m_stamp_value(0) {
+    m_shading_begin.assign(1, 0u);
+    m_blocking_begin.assign(1, 0u);
+}
+
+void NeighbourLists::build_shading(const SunFootprints& footprints, size_t num_elements) {
+    std::vector<std::vector<uint32_t>> lists(num_elements);
+    std::vector<uint32_t> overlapping;
+    for (size_t k = 0; k < footprints.size(); k++) {
+        footprints.overlapping(k, overlapping);
+        lists[footprints.element(k)] = overlapping;
+    }
+
+    m_shading_begin.assign(num_elements + 1, 0u);
+    m_shading_items.clear();
+    for (size_t e = 0; e < num_elements; e++) {
+        m_shading_items.insert(m_shading_items.end(), lists[e].begin(), lists[e].end());
+        m_shading_begin[e + 1] = static_cast<uint32_t>(m_shading_items.size());
+    }
+}
+
+void NeighbourLists::update_blocking(const std::vector<ElementSphere>& spheres, const std::vector<bool>& receivers) {
+    const size_t n = spheres.size();
+
+    // one sphere around all the receivers
+    std::vector<uint32_t> receiver_list;
+    for (uint32_t e = 0; e < n; e++)
+        if (receivers[e]) receiver_list.push_back(e);
+    ElementSphere target = { make_float3(0.0f, 0.0f, 0.0f), 0.0f };
+    if (!receiver_list.empty()) {
+        for (uint32_t r : receiver_list)
+            target.center = target.center + spheres[r].center;
+        target.center = (1.0f / static_cast<float>(receiver_list.size())) * target.center;
+        for (uint32_t r : receiver_list)
+            target.radius = std::max(target.radius, length(spheres[r].center - target.center) + spheres[r].radius);
+    }
+
+    std::vector<uint32_t> changed;
+    const bool full = n != m_spheres.size() || receiver_list != m_receivers || !same_sphere(target, m_target);
+    if (!full) {
+        for (uint32_t e = 0; e < n; e++)
+            if (!same_sphere(spheres[e], m_spheres[e])) changed.push_back(e);
+        if (changed.empty()) {
+            m_num_rebuilt = 0;
+            return;
+        }
+    }
+
+    m_spheres = spheres;
+    m_is_receiver = receivers;
+    m_receivers = receiver_list;
+    m_target = target;
+    m_stamp.assign(n, 0u);
+    build_grid();
+
+    m_num_rebuilt = 0;
+    if (full || changed.size() * 4 > n) {
+        m_blocking.assign(n, std::vector<uint32_t>());
+        for (uint32_t e = 0; e < n; e++) {
+            if (m_is_receiver[e]) continue;
+            collect_blocking(e, m_blocking[e]);
+            m_num_rebuilt++;
+        }
+    }
+    else {
+        std::vector<bool> is_changed(n, false);
+        for (uint32_t c : changed) is_changed[c] = true;
+        for (uint32_t e = 0; e < n; e++) {
+            if (m_is_receiver[e]) continue;
+            std::vector<uint32_t>& list = m_blocking[e];
+            if (is_changed[e]) {
+                collect_blocking(e, list);
+                m_num_rebuilt++;
+                continue;
+            }
+            // the others only lose or gain the elements that moved
+            list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t j) { return is_changed[j]; }), list.end());
+            for (uint32_t c : changed)
+                if (blocks(e, c)) list.push_back(c);
+        }
+    }
+    flatten_blocking();
+}
+
+// the sphere of candidate comes within the hull of the spheres of from and the receivers
+bool NeighbourLists::blocks(uint32_t from, uint32_t candidate) const {
+    if (candidate == from || m_is_receiver[candidate]) return false;
+    const ElementSphere& a = m_spheres[from];
+    const ElementSphere& c = m_spheres[candidate];
+    const float3 d = m_target.center - a.center;
+    const float len = length(d);
+    if (!(len > 0.0f)) return length(c.center - a.center) <= a.radius + c.radius;
+
+    // the hull is a cone tangent to both spheres; its radius at the axial position t is at most the
+    // linear interpolation of the two radii over the cosine of the half angle
+    const float3 axis = (1.0f / len) * d;
+    const float t = std::min(len, std::max(0.0f, dot(c.center - a.center, axis)));
+    const float sin_half = std::min(0.999f, std::fabs(m_target.radius - a.radius) / len);
+    const float hull = (a.radius + (m_target.radius - a.radius) * (t / len)) / std::sqrt(1.0f - sin_half * sin_half);
+    return length(c.center - (a.center + t * axis)) <= hull + c.radius;
+}
+
+void NeighbourLists::collect_blocking(uint32_t from, std::vector<uint32_t>& list) {
+    list.clear();
+    if (m_receivers.empty() || m_grid_nx == 0) return;
+
+    float max_radius = 0.0f;
+    for (const ElementSphere& s : m_spheres) max_radius = std::max(max_radius, s.radius);
+    const ElementSphere& a = m_spheres[from];
+    const float len = length(m_target.center - a.center);
+    const float sin_half = len > 0.0f ? std::min(0.999f, std::fabs(m_target.radius - a.radius) / len) : 0.0f;
+    const float reach = std::max(a.radius, m_target.radius) / std::sqrt(1.0f - sin_half * sin_half) + max_radius;
+    const float cell_reach = reach + 0.7072f * m_grid_cell;
+
+    auto cell_x = [&](float x) { return std::min(m_grid_nx - 1, std::max(0, static_cast<int>((x - m_grid_x0) / m_grid_cell))); };
+    auto cell_y = [&](float y) { return std::min(m_grid_ny - 1, std::max(0, static_cast<int>((y - m_grid_y0) / m_grid_cell))); };
+    const float3& p = a.center;
+    const float3& q = m_target.center;
+
+    m_stamp_value++;
+    for (int j = cell_y(std::min(p.y, q.y) - reach); j <= cell_y(std::max(p.y, q.y) + reach); j++) {
+        for (int i = cell_x(std::min(p.x, q.x) - reach); i <= cell_x(std::max(p.x, q.x) + reach); i++) {
+            const float cx = m_grid_x0 + (i + 0.5f) * m_grid_cell;
+            const float cy = m_grid_y0 + (j + 0.5f) * m_grid_cell;
+            if (distance_to_segment_xy(cx, cy, p, q) > cell_reach) continue;
+            const size_t cell = static_cast<size_t>(j) * m_grid_nx + i;
+            for (uint32_t k = m_cell_begin[cell]; k < m_cell_begin[cell + 1]; k++) {
+                const uint32_t e = m_cell_items[k];
+                if (m_stamp[e] == m_stamp_value) continue;
+                m_stamp[e] = m_stamp_value;
+                if (blocks(from, e)) list.push_back(e);
+            }
+        }
+    }
+    std::sort(list.begin(), list.end());
+}
+
+// cells of about the size of the largest sphere, each sphere listed in the cells its disk touches
+void NeighbourLists::build_grid() {
+    m_grid_nx = m_grid_ny = 0;
+    m_cell_begin.assign(1, 0u);
+    m_cell_items.clear();
+    if (m_spheres.empty()) return;
+
+    float x0 = FLT_MAX, x1 = -FLT_MAX, y0 = FLT_MAX, y1 = -FLT_MAX, max_radius = 0.0f;
+    for (const ElementSphere& s : m_spheres) {
+        x0 = std::min(x0, s.center.x - s.radius); x1 = std::max(x1, s.center.x + s.radius);
+        y0 = std::min(y0, s.center.y - s.radius); y1 = std::max(y1, s.center.y + s.radius);
+        max_radius = std::max(max_radius, s.radius);
+    }
+    const float area = std::max(1e-6f, (x1 - x0) * (y1 - y0));
+    m_grid_cell = std::max({ 2.0f * max_radius, std::sqrt(area / m_spheres.size()), 1e-3f });
+    m_grid_nx = std::max(1, std::min(1 << 14, static_cast<int>((x1 - x0) / m_grid_cell) + 1));
+    m_grid_ny = std::max(1, std::min(1 << 14, static_cast<int>((y1 - y0) / m_grid_cell) + 1));
+    m_grid_cell = std::max(m_grid_cell, std::max((x1 - x0) / m_grid_nx, (y1 - y0) / m_grid_ny));
+    m_grid_x0 = x0;
+    m_grid_y0 = y0;
+
+    auto cell_x = [&](float x) { return std::min(m_grid_nx - 1, std::max(0, static_cast<int>((x - m_grid_x0) / m_grid_cell))); };
+    auto cell_y = [&](float y) { return std::min(m_grid_ny - 1, std::max(0, static_cast<int>((y - m_grid_y0) / m_grid_cell))); };
+
+    // count, prefix sum, fill
+    const size_t total_cells = static_cast<size_t>(m_grid_nx) * m_grid_ny;
+    m_cell_begin.assign(total_cells + 1, 0u);
+    for (const ElementSphere& s : m_spheres)
+        for (int j = cell_y(s.center.y - s.radius); j <= cell_y(s.center.y + s.radius); j++)
+            for (int i = cell_x(s.center.x - s.radius); i <= cell_x(s.center.x + s.radius); i++)
+                m_cell_begin[static_cast<size_t>(j) * m_grid_nx + i + 1]++;
+    for (size_t c = 0; c < total_cells; c++)
+        m_cell_begin[c + 1] += m_cell_begin[c];
+
+    m_cell_items.resize(m_cell_begin[total_cells]);
+    std::vector<uint32_t> fill(m_cell_begin.begin(), m_cell_begin.end() - 1);
+    for (uint32_t e = 0; e < m_spheres.size(); e++) {
+        const ElementSphere& s = m_spheres[e];
+        for (int j = cell_y(s.center.y - s.radius); j <= cell_y(s.center.y + s.radius); j++)
+            for (int i = cell_x(s.center.x - s.radius); i <= cell_x(s.center.x + s.radius); i++)
+                m_cell_items[fill[static_cast<size_t>(j) * m_grid_nx + i]++] = e;
+    }
+}
+
+void NeighbourLists::flatten_blocking() {
+    m_blocking_begin.assign(m_blocking.size() + 1, 0u);
+    m_blocking_items.clear();
+    for (size_t e = 0; e < m_blocking.size(); e++) {
+        m_blocking_items.insert(m_blocking_items.end(), m_blocking[e].begin(), m_blocking[e].end());
+        m_blocking_begin[e + 1] = static_cast<uint32_t>(m_blocking_items.size());
+    }
+}
+
+double NeighbourLists::mean_shading() const {
+    const size_t n = m_shading_begin.size() - 1;
+    return n ? static_cast<double>(m_shading_items.size()) / n : 0.0;
+}
+
+double NeighbourLists::mean_blocking() const {
+    const size_t n = m_blocking_begin.size() - 1;
+    return n ? static_cast<double>(m_blocking_items.size()) / n : 0.0;
+}
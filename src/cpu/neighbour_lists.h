@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "shaders/Soltrace.h"
+#include "cpu/sun_footprints.h"
+
+namespace OptixCSP {
+
+    /// sphere around an element that holds it in any orientation, so tracking does not change it
+    struct ElementSphere {
+        float3 center;
+        float  radius;
+    };
+
+    /**
+     * @class NeighbourLists
+     * @brief Candidates of the shading and blocking interactions of every element, in compressed rows.
+     *
+     * Shading: a sun ray drawn from the footprint of element i can only hit the elements whose sun
+     * plane footprints overlap that of i (SunFootprints), so these, and i, are all it has to be tested
+     * against. The lists follow the footprints and are rebuilt with them when the sun moves.
+     *
+     * Blocking: light leaving mirror i toward the receivers stays in the hull of the sphere of i and
+     * the sphere around the receivers; the candidates are the elements whose spheres come within
+     * that hull. The spheres do not depend on the orientation, so these lists do not depend on the
+     * sun: an update only recomputes what involves the elements whose sphere moved. Light that
+     * leaves the hull, a mirror aimed away from the receivers, only sees the candidates and the
+     * receivers.
+     */
+    class NeighbourLists {
+    public:
+        NeighbourLists();
+
+        /// shading candidates from the footprints of the elements on the sun plane
+        void build_shading(const SunFootprints& footprints, size_t num_elements);
+
+        /// blocking candidates; spheres and receivers are per element, only the lists touched by the
+        /// elements whose sphere changed since the last call are recomputed, all of them when the
+        /// receivers changed
+        void update_blocking(const std::vector<ElementSphere>& spheres, const std::vector<bool>& receivers);
+
+        size_t num_elements() const { return m_blocking.size(); }
+        const uint32_t* shading_begin(uint32_t e) const { return m_shading_items.data() + m_shading_begin[e]; }
+        const uint32_t* shading_end(uint32_t e) const { return m_shading_items.data() + m_shading_begin[e + 1]; }
+        const uint32_t* blocking_begin(uint32_t e) const { return m_blocking_items.data() + m_blocking_begin[e]; }
+        const uint32_t* blocking_end(uint32_t e) const { return m_blocking_items.data() + m_blocking_begin[e + 1]; }
+        /// receivers, tested with every blocking list
+        const std::vector<uint32_t>& receivers() const { return m_receivers; }
+
+        /// mean length of the lists
+        double mean_shading() const;
+        double mean_blocking() const;
+        /// blocking lists recomputed by the last update_blocking
+        size_t num_blocking_rebuilt() const { return m_num_rebuilt; }
+
+    private:
+        bool blocks(uint32_t from, uint32_t candidate) const;
+        void collect_blocking(uint32_t from, std::vector<uint32_t>& list);
+        void build_grid();
+        void flatten_blocking();
+
+        // shading, compressed rows
+        std::vector<uint32_t> m_shading_begin;
+        std::vector<uint32_t> m_shading_items;
+
+        // blocking, one list per element while they are updated, then compressed rows
+        std::vector<ElementSphere> m_spheres;
+        std::vector<bool> m_is_receiver;
+        std::vector<uint32_t> m_receivers;
+        ElementSphere m_target;
+        std::vector<std::vector<uint32_t>> m_blocking;
+        std::vector<uint32_t> m_blocking_begin;
+        std::vector<uint32_t> m_blocking_items;
+        size_t m_num_rebuilt;
+
+        // uniform grid over x and y of the sphere centers, compressed rows
+        float m_grid_x0, m_grid_y0, m_grid_cell;
+        int m_grid_nx, m_grid_ny;
+        std::vector<uint32_t> m_cell_begin;
+        std::vector<uint32_t> m_cell_items;
+        std::vector<uint32_t> m_stamp;
+        uint32_t m_stamp_value;
+    };
+}
@@ -0,0 +1,69 @@
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace OptixCSP;
+
+#if defined(__linux__)
+namespace {
+    int open_counter(uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = group_fd < 0 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+
+    int64_t read_counter(int fd) {
+        if (fd < 0) return -1;
+        int64_t value = 0;
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+        return value;
+    }
+}
+
+PerfCounters::PerfCounters() {
+    m_fd_cache_misses = open_counter(PERF_COUNT_HW_CACHE_MISSES, -1);
+    if (m_fd_cache_misses >= 0)
+        m_fd_cache_references = open_counter(PERF_COUNT_HW_CACHE_REFERENCES, m_fd_cache_misses);
+}
+
+PerfCounters::~PerfCounters() {
+    if (m_fd_cache_references >= 0) close(m_fd_cache_references);
+    if (m_fd_cache_misses >= 0) close(m_fd_cache_misses);
+}
+
+void PerfCounters::start() {
+    if (!available()) return;
+    ioctl(m_fd_cache_misses, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_fd_cache_misses, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PerfCounters::stop() {
+    if (!available()) return;
+    ioctl(m_fd_cache_misses, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+int64_t PerfCounters::cache_misses() const { return read_counter(m_fd_cache_misses); }
+int64_t PerfCounters::cache_references() const { return read_counter(m_fd_cache_references); }
+
+#else
+
+PerfCounters::PerfCounters() {}
+PerfCounters::~PerfCounters() {}
+void PerfCounters::start() {}
+void PerfCounters::stop() {}
+int64_t PerfCounters::cache_misses() const { return -1; }
+int64_t PerfCounters::cache_references() const { return -1; }
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+namespace OptixCSP {
+
+    /// Hardware counters of the calling thread (Linux perf_event_open). On other platforms,
+    /// or when the kernel does not allow access (perf_event_paranoid), available() is false
+    /// and every read returns -1.
+    class PerfCounters {
+    public:
+        PerfCounters();
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        bool available() const { return m_fd_cache_misses >= 0; }
+
+        /// reset and enable the counters
+        void start();
+        /// disable the counters, the values stay readable
+        void stop();
+
+        /// last level cache misses
+        int64_t cache_misses() const;
+        /// cache references, misses / references gives the miss rate
+        int64_t cache_references() const;
+
+    private:
+        int m_fd_cache_misses = -1;
+        int m_fd_cache_references = -1;
+    };
+}
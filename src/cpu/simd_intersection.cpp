@@ -0,0 +1,487 @@
+#include "simd_intersection.h"
+#include "simd_math.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace OptixCSP;
+using namespace OptixCSP::simd;
+
+namespace {
+
+    inline int lowest_bit(uint32_t b) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, b);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(b);
+#endif
+    }
+
+    // Sinks receive one vector of results at a time, the kernels are shared between them.
+    template <class V>
+    struct StoreSink {
+        float* t_out;
+
+        void consume(size_t base, V t, typename V::mask m) {
+            select(m, t, V(INFINITY)).store(t_out + base);
+        }
+    };
+
+    template <class V>
+    struct ClosestSink {
+        HostHit hit;
+
+        void consume(size_t base, V t, typename V::mask m) {
+            m = m & (t < V(hit.t));
+            if (!any(m)) return;
+
+            alignas(64) float lanes[V::width];
+            t.store(lanes);
+            uint32_t b = bits(m);
+            while (b) {
+                const int lane = lowest_bit(b);
+                b &= b - 1;
+                if (lanes[lane] < hit.t) {
+                    hit.t = lanes[lane];
+                    hit.index = static_cast<int64_t>(base + lane);
+                }
+            }
+        }
+    };
+
+    // ------------------------------------------------------------------
+    // kernels, one per primitive type. Each line mirrors the scalar reference in
+    // host_intersection.h operation for operation; rejections of the form
+    // "if (a || b) return" become "m = m & !(a | b)" so NaN lanes behave the same.
+    // ------------------------------------------------------------------
+
+    template <class V, class Sink>
+    void kernel_parallelogram(const ParallelogramSoA& s, const HostRay& ray, Sink& sink) {
+        using F = ParallelogramSoA;
+        const V ox(ray.orig.x), oy(ray.orig.y), oz(ray.orig.z);
+        const V dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+        const V tmin(ray.tmin), tmax(ray.tmax);
+        const V zero(0.0f), one(1.0f);
+        const int count = static_cast<int>(s.size());
+
+        for (int i = 0; i < count; i += V::width) {
+            const V nx = V::load(s.field(F::NX) + i), ny = V::load(s.field(F::NY) + i), nz = V::load(s.field(F::NZ) + i);
+            const V d = V::load(s.field(F::D) + i);
+
+            V dt = dx * nx + dy * ny + dz * nz;
+            V t = (d - (nx * ox + ny * oy + nz * oz)) / dt;
+            auto m = (t > tmin) & (t < tmax) & lanes_below(t, count - i);
+
+            V px = ox + dx * t, py = oy + dy * t, pz = oz + dz * t;
+            V vx = px - V::load(s.field(F::AX) + i);
+            V vy = py - V::load(s.field(F::AY) + i);
+            V vz = pz - V::load(s.field(F::AZ) + i);
+
+            V a1 = V::load(s.field(F::V1X) + i) * vx + V::load(s.field(F::V1Y) + i) * vy + V::load(s.field(F::V1Z) + i) * vz;
+            V a2 = V::load(s.field(F::V2X) + i) * vx + V::load(s.field(F::V2Y) + i) * vy + V::load(s.field(F::V2Z) + i) * vz;
+            m = m & (a1 >= zero) & (a1 <= one) & (a2 >= zero) & (a2 <= one);
+
+            sink.consume(i, t, m);
+        }
+    }
+
+    template <class V, class Sink>
+    void kernel_rectangle_flat(const RectangleFlatSoA& s, const HostRay& ray, Sink& sink) {
+        using F = RectangleFlatSoA;
+        const V ox(ray.orig.x), oy(ray.orig.y), oz(ray.orig.z);
+        const V dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+        const V tmin(ray.tmin), tmax(ray.tmax);
+        const int count = static_cast<int>(s.size());
+
+        for (int i = 0; i < count; i += V::width) {
+            const V nx = V::load(s.field(F::NX) + i), ny = V::load(s.field(F::NY) + i), nz = V::load(s.field(F::NZ) + i);
+            const V d = V::load(s.field(F::D) + i);
+
+            V dt = dx * nx + dy * ny + dz * nz;
+            V t = (d - (nx * ox + ny * oy + nz * oz)) / dt;
+            auto m = (t > tmin) & (t < tmax) & lanes_below(t, count - i);
+
+            V px = ox + dx * t, py = oy + dy * t, pz = oz + dz * t;
+            V vx = px - V::load(s.field(F::CX) + i);
+            V vy = py - V::load(s.field(F::CY) + i);
+            V vz = pz - V::load(s.field(F::CZ) + i);
+
+            V x = V::load(s.field(F::XX) + i) * vx + V::load(s.field(F::XY) + i) * vy + V::load(s.field(F::XZ) + i) * vz;
+            V y = V::load(s.field(F::YX) + i) * vx + V::load(s.field(F::YY) + i) * vy + V::load(s.field(F::YZ) + i) * vz;
+
+            const V hw = V::load(s.field(F::HALF_W) + i);
+            const V hh = V::load(s.field(F::HALF_H) + i);
+            m = m & (x >= -hw) & (x <= hw) & (y >= -hh) & (y <= hh);
+
+            sink.consume(i, t, m);
+        }
+    }
+
+    template <class V, class Sink>
+    void kernel_cylinder_y(const CylinderYSoA& s, const HostRay& ray, Sink& sink) {
+        using F = CylinderYSoA;
+        const float3 rd = normalize(ray.dir);
+        const V ox(ray.orig.x), oy(ray.orig.y), oz(ray.orig.z);
+        const V dx(rd.x), dy(rd.y), dz(rd.z);
+        const V tmin(ray.tmin), tmax(ray.tmax), t_none(ray.tmax + 1.0f);
+        const V zero(0.0f), two(2.0f), four(4.0f), cap_eps(1e-6f);
+        const int count = static_cast<int>(s.size());
+
+        for (int i = 0; i < count; i += V::width) {
+            V wx = ox - V::load(s.field(F::CX) + i);
+            V wy = oy - V::load(s.field(F::CY) + i);
+            V wz = oz - V::load(s.field(F::CZ) + i);
+
+            const V lxx = V::load(s.field(F::LXX) + i), lxy = V::load(s.field(F::LXY) + i), lxz = V::load(s.field(F::LXZ) + i);
+            const V lyx = V::load(s.field(F::LYX) + i), lyy = V::load(s.field(F::LYY) + i), lyz = V::load(s.field(F::LYZ) + i);
+            const V lzx = V::load(s.field(F::LZX) + i), lzy = V::load(s.field(F::LZY) + i), lzz = V::load(s.field(F::LZZ) + i);
+
+            V lox = wx * lxx + wy * lxy + wz * lxz;
+            V loy = wx * lyx + wy * lyy + wz * lyz;
+            V loz = wx * lzx + wy * lzy + wz * lzz;
+            V ldx = dx * lxx + dy * lxy + dz * lxz;
+            V ldy = dx * lyx + dy * lyy + dz * lyz;
+            V ldz = dx * lzx + dy * lzy + dz * lzz;
+
+            const V r2 = V::load(s.field(F::RADIUS2) + i);
+            const V hh = V::load(s.field(F::HALF_HEIGHT) + i);
+
+            V A = ldx * ldx + ldz * ldz;
+            V B = two * (lox * ldx + loz * ldz);
+            V C = lox * lox + loz * loz - r2;
+            V det = B * B - four * A * C;
+            V sq = sqrt(det);
+            V t1 = (-B - sq) / (two * A);
+            V t2 = (-B + sq) / (two * A);
+
+            auto m = lanes_below(t1, count - i);
+            V t;
+
+            if (!s.capped) {
+                m = m & !(det < zero);
+                t = select(t1 > zero, t1, t2);
+                m = m & !((t < tmin) | (t > tmax));
+
+                V hy = loy + t * ldy;
+                auto outside = abs(hy) > hh;
+                V hy2 = loy + t2 * ldy;
+                auto second_ok = !((t2 < tmin) | (t2 > tmax) | (abs(hy2) > hh));
+                m = m & ((!outside) | second_ok);
+                t = select(outside, t2, t);
+            }
+            else {
+                auto has = det >= zero;
+                auto c1 = has & (t1 > tmin) & (t1 < tmax) & (abs(loy + t1 * ldy) <= hh);
+                auto c2 = has & !c1 & (t2 > tmin) & (t2 < tmax) & (abs(loy + t2 * ldy) <= hh);
+                V t_curved = select(c1, t1, select(c2, t2, t_none));
+
+                V t_caps = t_none;
+                auto caps = abs(ldy) > cap_eps;
+
+                V tb = (-hh - loy) / ldy;
+                V bx = lox + tb * ldx, bz = loz + tb * ldz;
+                auto ok_b = caps & (tb > tmin) & (tb < tmax) & (bx * bx + bz * bz <= r2);
+                t_caps = select(ok_b, tb, t_caps);
+
+                V tt = (hh - loy) / ldy;
+                V qx = lox + tt * ldx, qz = loz + tt * ldz;
+                auto ok_t = caps & (tt > tmin) & (tt < tmax) & (qx * qx + qz * qz <= r2);
+                t_caps = select(ok_t, min(t_caps, tt), t_caps);
+
+                t = min(t_curved, t_caps);
+                m = m & !((t >= tmax) | (t <= tmin));
+            }
+
+            sink.consume(i, t, m);
+        }
+    }
+
+    template <class V, class Sink>
+    void kernel_rectangle_parabolic(const RectangleParabolicSoA& s, const HostRay& ray, Sink& sink) {
+        using F = RectangleParabolicSoA;
+        const V ox(ray.orig.x), oy(ray.orig.y), oz(ray.orig.z);
+        const V rx(ray.dir.x), ry(ray.dir.y), rz(ray.dir.z);
+        const V tmin(ray.tmin), tmax(ray.tmax);
+        const V zero(0.0f), half(0.5f), one(1.0f), two(2.0f), four(4.0f), eps(1e-12f);
+        const int count = static_cast<int>(s.size());
+
+        for (int i = 0; i < count; i += V::width) {
+            V wx = ox - V::load(s.field(F::CX) + i);
+            V wy = oy - V::load(s.field(F::CY) + i);
+            V wz = oz - V::load(s.field(F::CZ) + i);
+
+            const V e1x = V::load(s.field(F::E1X) + i), e1y = V::load(s.field(F::E1Y) + i), e1z = V::load(s.field(F::E1Z) + i);
+            const V e2x = V::load(s.field(F::E2X) + i), e2y = V::load(s.field(F::E2Y) + i), e2z = V::load(s.field(F::E2Z) + i);
+            const V nx = V::load(s.field(F::NX) + i), ny = V::load(s.field(F::NY) + i), nz = V::load(s.field(F::NZ) + i);
+
+            V lox = wx * e1x + wy * e1y + wz * e1z;
+            V loy = wx * e2x + wy * e2y + wz * e2z;
+            V loz = wx * nx + wy * ny + wz * nz;
+            V ldx = rx * e1x + ry * e1y + rz * e1z;
+            V ldy = rx * e2x + ry * e2y + rz * e2z;
+            V ldz = rx * nx + ry * ny + rz * nz;
+
+            const V cx = V::load(s.field(F::CURV_X) + i);
+            const V cy = V::load(s.field(F::CURV_Y) + i);
+            const V hcx = cx * half;
+            const V hcy = cy * half;
+
+            V A = hcx * (ldx * ldx) + hcy * (ldy * ldy);
+            V B = cx * (lox * ldx) + cy * (loy * ldy) - ldz;
+            V C = hcx * (lox * lox) + hcy * (loy * loy) - loz;
+
+            auto linear = abs(A) < eps;
+            V t_lin = -C / B;
+            auto valid_lin = t_lin > zero;
+
+            V discr = B * B - four * A * C;
+            V sq = sqrt(discr);
+            V t1 = (-B - sq) / (two * A);
+            V t2 = (-B + sq) / (two * A);
+            auto q = discr >= zero;
+            auto c1 = q & (t1 > zero) & (t1 < t2);
+            auto c2 = q & !c1 & (t2 > zero);
+
+            V t = select(linear, t_lin, select(c1, t1, t2));
+            auto valid = (linear & valid_lin) | ((!linear) & (c1 | c2));
+            auto m = valid & !((t < tmin) | (t > tmax)) & lanes_below(t, count - i);
+
+            V x_hit = lox + t * ldx;
+            V y_hit = loy + t * ldy;
+            V a1 = x_hit / V::load(s.field(F::HALF_L1) + i);
+            V a2 = y_hit / V::load(s.field(F::HALF_L2) + i);
+            m = m & !((a1 < -one) | (a1 > one) | (a2 < -one) | (a2 > one));
+
+            sink.consume(i, t, m);
+        }
+    }
+
+    template <class V, class Sink>
+    void kernel_triangle_flat(const TriangleFlatSoA& s, const HostRay& ray, Sink& sink) {
+        using F = TriangleFlatSoA;
+        const V ox(ray.orig.x), oy(ray.orig.y), oz(ray.orig.z);
+        const V dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+        const V tmin(ray.tmin), tmax(ray.tmax);
+        const V zero(0.0f), one(1.0f), eps(1e-8f);
+        const int count = static_cast<int>(s.size());
+
+        for (int i = 0; i < count; i += V::width) {
+            const V e1x = V::load(s.field(F::E1X) + i), e1y = V::load(s.field(F::E1Y) + i), e1z = V::load(s.field(F::E1Z) + i);
+            const V e2x = V::load(s.field(F::E2X) + i), e2y = V::load(s.field(F::E2Y) + i), e2z = V::load(s.field(F::E2Z) + i);
+
+            V px = dy * e2z - dz * e2y;
+            V py = dz * e2x - dx * e2z;
+            V pz = dx * e2y - dy * e2x;
+            V det = e1x * px + e1y * py + e1z * pz;
+            auto m = (!(det <= eps)) & lanes_below(det, count - i);
+
+            V inv_det = one / det;
+
+            V tx = ox - V::load(s.field(F::V0X) + i);
+            V ty = oy - V::load(s.field(F::V0Y) + i);
+            V tz = oz - V::load(s.field(F::V0Z) + i);
+            V u = (tx * px + ty * py + tz * pz) * inv_det;
+            m = m & !((u < zero) | (u > one));
+
+            V qx = ty * e1z - tz * e1y;
+            V qy = tz * e1x - tx * e1z;
+            V qz = tx * e1y - ty * e1x;
+            V v = (dx * qx + dy * qy + dz * qz) * inv_det;
+            m = m & !((v < zero) | (u + v > one));
+
+            V t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+            m = m & !((t < tmin) | (t > tmax));
+
+            sink.consume(i, t, m);
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // dispatch on the requested vector width
+    // ------------------------------------------------------------------
+    template <class V> void run_kernel(const ParallelogramSoA& s, const HostRay& r, StoreSink<V>& k)        { kernel_parallelogram<V>(s, r, k); }
+    template <class V> void run_kernel(const RectangleFlatSoA& s, const HostRay& r, StoreSink<V>& k)        { kernel_rectangle_flat<V>(s, r, k); }
+    template <class V> void run_kernel(const CylinderYSoA& s, const HostRay& r, StoreSink<V>& k)            { kernel_cylinder_y<V>(s, r, k); }
+    template <class V> void run_kernel(const RectangleParabolicSoA& s, const HostRay& r, StoreSink<V>& k)   { kernel_rectangle_parabolic<V>(s, r, k); }
+    template <class V> void run_kernel(const TriangleFlatSoA& s, const HostRay& r, StoreSink<V>& k)         { kernel_triangle_flat<V>(s, r, k); }
+    template <class V> void run_kernel(const ParallelogramSoA& s, const HostRay& r, ClosestSink<V>& k)      { kernel_parallelogram<V>(s, r, k); }
+    template <class V> void run_kernel(const RectangleFlatSoA& s, const HostRay& r, ClosestSink<V>& k)      { kernel_rectangle_flat<V>(s, r, k); }
+    template <class V> void run_kernel(const CylinderYSoA& s, const HostRay& r, ClosestSink<V>& k)          { kernel_cylinder_y<V>(s, r, k); }
+    template <class V> void run_kernel(const RectangleParabolicSoA& s, const HostRay& r, ClosestSink<V>& k) { kernel_rectangle_parabolic<V>(s, r, k); }
+    template <class V> void run_kernel(const TriangleFlatSoA& s, const HostRay& r, ClosestSink<V>& k)       { kernel_triangle_flat<V>(s, r, k); }
+
+    template <class V, class SoA>
+    void batch_width(const SoA& soa, const HostRay& ray, float* t_out) {
+        StoreSink<V> sink{ t_out };
+        run_kernel<V>(soa, ray, sink);
+    }
+
+    template <class V, class SoA>
+    HostHit closest_width(const SoA& soa, const HostRay& ray) {
+        ClosestSink<V> sink;
+        run_kernel<V>(soa, ray, sink);
+        if (sink.hit.valid()) sink.hit.id = soa.id(static_cast<size_t>(sink.hit.index));
+        return sink.hit;
+    }
+
+    // requests for a level that was not compiled in fall back to the widest available one
+    SimdLevel clamp_level(SimdLevel level) {
+        return static_cast<int>(level) > static_cast<int>(best_simd_level()) ? best_simd_level() : level;
+    }
+
+    template <class SoA>
+    void batch_entry(const SoA& soa, const HostRay& ray, float* t_out, SimdLevel level) {
+        switch (clamp_level(level)) {
+#if defined(OPTIXCSP_HAS_AVX512)
+        case SimdLevel::AVX512: batch_width<vfloat16>(soa, ray, t_out); return;
+#endif
+#if defined(OPTIXCSP_HAS_AVX2)
+        case SimdLevel::AVX2:   batch_width<vfloat8>(soa, ray, t_out); return;
+#endif
+        default:                batch_width<vfloat1>(soa, ray, t_out); return;
+        }
+    }
+
+    template <class SoA>
+    HostHit closest_entry(const SoA& soa, const HostRay& ray, SimdLevel level) {
+        if (soa.empty()) return HostHit();
+        switch (clamp_level(level)) {
+#if defined(OPTIXCSP_HAS_AVX512)
+        case SimdLevel::AVX512: return closest_width<vfloat16>(soa, ray);
+#endif
+#if defined(OPTIXCSP_HAS_AVX2)
+        case SimdLevel::AVX2:   return closest_width<vfloat8>(soa, ray);
+#endif
+        default:                return closest_width<vfloat1>(soa, ray);
+        }
+    }
+}
+
+SimdLevel OptixCSP::best_simd_level() {
+#if defined(OPTIXCSP_HAS_AVX512)
+    return SimdLevel::AVX512;
+#elif defined(OPTIXCSP_HAS_AVX2)
+    return SimdLevel::AVX2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+const char* OptixCSP::simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX512: return "avx512";
+    case SimdLevel::AVX2:   return "avx2";
+    default:                return "scalar";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// SoA construction
+// ---------------------------------------------------------------------------
+void ParallelogramSoA::add(const GeometryDataST::Parallelogram& p, uint32_t id) {
+    append({ p.plane.x, p.plane.y, p.plane.z, p.plane.w,
+             p.v1.x, p.v1.y, p.v1.z,
+             p.v2.x, p.v2.y, p.v2.z,
+             p.anchor.x, p.anchor.y, p.anchor.z }, id);
+}
+
+void RectangleFlatSoA::add(const GeometryDataST::Rectangle_Flat& r, uint32_t id) {
+    append({ r.plane.x, r.plane.y, r.plane.z, r.plane.w,
+             r.center.x, r.center.y, r.center.z,
+             r.x.x, r.x.y, r.x.z,
+             r.y.x, r.y.y, r.y.z,
+             r.width / 2, r.height / 2 }, id);
+}
+
+void CylinderYSoA::add(const GeometryDataST::Cylinder_Y& c, uint32_t id) {
+    const float3 local_y = cylinder_y_axis(c);
+    append({ c.center.x, c.center.y, c.center.z,
+             c.base_x.x, c.base_x.y, c.base_x.z,
+             local_y.x, local_y.y, local_y.z,
+             c.base_z.x, c.base_z.y, c.base_z.z,
+             c.radius * c.radius, c.half_height }, id);
+}
+
+void RectangleParabolicSoA::add(const GeometryDataST::Rectangle_Parabolic& r, uint32_t id) {
+    const ParabolicFrame f = parabolic_frame(r);
+    append({ f.center.x, f.center.y, f.center.z,
+             f.e1.x, f.e1.y, f.e1.z,
+             f.e2.x, f.e2.y, f.e2.z,
+             f.n.x, f.n.y, f.n.z,
+             r.curv_x, r.curv_y,
+             f.L1 / 2.0f, f.L2 / 2.0f }, id);
+}
+
+void TriangleFlatSoA::add(const GeometryDataST::Triangle_Flat& t, uint32_t id) {
+    append({ t.v0.x, t.v0.y, t.v0.z,
+             t.e1.x, t.e1.y, t.e1.z,
+             t.e2.x, t.e2.y, t.e2.z }, id);
+}
+
+void GeometrySoA::clear() {
+    parallelograms.clear();
+    rectangles_flat.clear();
+    cylinders.clear();
+    rectangles_parabolic.clear();
+    triangles.clear();
+}
+
+void GeometrySoA::add(const GeometryDataST& geometry, uint32_t id) {
+    switch (geometry.type) {
+    case GeometryDataST::PARALLELOGRAM:       parallelograms.add(geometry.getParallelogram(), id); break;
+    case GeometryDataST::RECTANGLE_FLAT:      rectangles_flat.add(geometry.getRectangle_Flat(), id); break;
+    case GeometryDataST::CYLINDER_Y:          cylinders.add(geometry.getCylinder_Y(), id); break;
+    case GeometryDataST::RECTANGLE_PARABOLIC: rectangles_parabolic.add(geometry.getRectangleParabolic(), id); break;
+    case GeometryDataST::TRIANGLE_FLAT:       triangles.add(geometry.getTriangle_Flat(), id); break;
+    default:
+        throw std::runtime_error("GeometrySoA: unknown geometry type");
+    }
+}
+
+GeometrySoA GeometrySoA::build(const std::vector<GeometryDataST>& geometry_data_array) {
+    GeometrySoA scene;
+    for (size_t i = 0; i < geometry_data_array.size(); i++)
+        scene.add(geometry_data_array[i], static_cast<uint32_t>(i));
+    return scene;
+}
+
+// ---------------------------------------------------------------------------
+// public entry points
+// ---------------------------------------------------------------------------
+void OptixCSP::intersect_batch(const ParallelogramSoA& soa, const HostRay& ray, float* t_out, SimdLevel level)      { batch_entry(soa, ray, t_out, level); }
+void OptixCSP::intersect_batch(const RectangleFlatSoA& soa, const HostRay& ray, float* t_out, SimdLevel level)      { batch_entry(soa, ray, t_out, level); }
+void OptixCSP::intersect_batch(const CylinderYSoA& soa, const HostRay& ray, float* t_out, SimdLevel level)          { batch_entry(soa, ray, t_out, level); }
+void OptixCSP::intersect_batch(const RectangleParabolicSoA& soa, const HostRay& ray, float* t_out, SimdLevel level) { batch_entry(soa, ray, t_out, level); }
+void OptixCSP::intersect_batch(const TriangleFlatSoA& soa, const HostRay& ray, float* t_out, SimdLevel level)       { batch_entry(soa, ray, t_out, level); }
+
+HostHit OptixCSP::closest_hit(const ParallelogramSoA& soa, const HostRay& ray, SimdLevel level)      { return closest_entry(soa, ray, level); }
+HostHit OptixCSP::closest_hit(const RectangleFlatSoA& soa, const HostRay& ray, SimdLevel level)      { return closest_entry(soa, ray, level); }
+HostHit OptixCSP::closest_hit(const CylinderYSoA& soa, const HostRay& ray, SimdLevel level)          { return closest_entry(soa, ray, level); }
+HostHit OptixCSP::closest_hit(const RectangleParabolicSoA& soa, const HostRay& ray, SimdLevel level) { return closest_entry(soa, ray, level); }
+HostHit OptixCSP::closest_hit(const TriangleFlatSoA& soa, const HostRay& ray, SimdLevel level)       { return closest_entry(soa, ray, level); }
+
+HostHit OptixCSP::closest_hit(const GeometrySoA& scene, const HostRay& ray, SimdLevel level) {
+    HostHit best;
+    HostRay r = ray;
+
+    // shrink tmax after each list so the later ones reject farther hits early
+    auto take = [&](const HostHit& h) {
+        if (h.valid() && h.t < best.t) {
+            best = h;
+            r.tmax = best.t;
+        }
+    };
+
+    take(closest_hit(scene.parallelograms, r, level));
+    take(closest_hit(scene.rectangles_flat, r, level));
+    take(closest_hit(scene.rectangles_parabolic, r, level));
+    take(closest_hit(scene.cylinders, r, level));
+    take(closest_hit(scene.triangles, r, level));
+    return best;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu/host_intersection.h"
+
+namespace OptixCSP {
+
+    /// Vector width used by the batched host intersection kernels.
+    /// SCALAR is always available, the others only when the library is compiled for them
+    /// (see OPTIXCSP_CPU_SIMD in src/CMakeLists.txt).
+    enum class SimdLevel {
+        SCALAR = 0,
+        AVX2 = 1,
+        AVX512 = 2
+    };
+
+    /// widest level compiled into the library
+    SimdLevel best_simd_level();
+    const char* simd_level_name(SimdLevel level);
+
+    /// structure-of-arrays storage padded to a multiple of the widest vector width
+    template <int NumFields>
+    class PrimitiveSoA {
+    public:
+        static constexpr size_t PADDING = 16;
+
+        size_t size() const { return m_ids.size(); }
+        size_t padded_size() const { return m_fields[0].size(); }
+        bool empty() const { return m_ids.empty(); }
+
+        /// element index (into the geometry data array) of primitive i
+        uint32_t id(size_t i) const { return m_ids[i]; }
+        const float* field(int f) const { return m_fields[f].data(); }
+
+        void clear() {
+            for (auto& f : m_fields) f.clear();
+            m_ids.clear();
+        }
+
+    protected:
+        void append(const std::array<float, NumFields>& values, uint32_t id) {
+            // drop the zero padding of the previous append, then pad again
+            for (int f = 0; f < NumFields; f++) {
+                m_fields[f].resize(m_ids.size());
+                m_fields[f].push_back(values[f]);
+            }
+            m_ids.push_back(id);
+            const size_t padded = (m_ids.size() + PADDING - 1) / PADDING * PADDING;
+            for (auto& f : m_fields) f.resize(padded, 0.0f);
+        }
+
+    private:
+        std::array<std::vector<float>, NumFields> m_fields;
+        std::vector<uint32_t> m_ids;
+    };
+
+    struct ParallelogramSoA : PrimitiveSoA<13> {
+        enum Field { NX, NY, NZ, D, V1X, V1Y, V1Z, V2X, V2Y, V2Z, AX, AY, AZ };
+        void add(const GeometryDataST::Parallelogram& p, uint32_t id);
+    };
+
+    struct RectangleFlatSoA : PrimitiveSoA<15> {
+        enum Field { NX, NY, NZ, D, CX, CY, CZ, XX, XY, XZ, YX, YY, YZ, HALF_W, HALF_H };
+        void add(const GeometryDataST::Rectangle_Flat& r, uint32_t id);
+    };
+
+    /// the local frame (including the y axis) is stored per primitive instead of
+    /// being rebuilt with a cross product for every ray
+    struct CylinderYSoA : PrimitiveSoA<14> {
+        enum Field { CX, CY, CZ, LXX, LXY, LXZ, LYX, LYY, LYZ, LZX, LZY, LZZ, RADIUS2, HALF_HEIGHT };
+        void add(const GeometryDataST::Cylinder_Y& c, uint32_t id);
+
+        /// true: __intersection__cylinder_y_capped, false: __intersection__cylinder_y
+        bool capped = true;
+    };
+
+    /// the frame recovered by parabolic_frame() is stored instead of the reciprocal edges
+    struct RectangleParabolicSoA : PrimitiveSoA<16> {
+        enum Field { CX, CY, CZ, E1X, E1Y, E1Z, E2X, E2Y, E2Z, NX, NY, NZ, CURV_X, CURV_Y, HALF_L1, HALF_L2 };
+        void add(const GeometryDataST::Rectangle_Parabolic& r, uint32_t id);
+    };
+
+    struct TriangleFlatSoA : PrimitiveSoA<9> {
+        enum Field { V0X, V0Y, V0Z, E1X, E1Y, E1Z, E2X, E2Y, E2Z };
+        void add(const GeometryDataST::Triangle_Flat& t, uint32_t id);
+    };
+
+    /// all primitives of a scene, split by type
+    struct GeometrySoA {
+        ParallelogramSoA      parallelograms;
+        RectangleFlatSoA      rectangles_flat;
+        CylinderYSoA          cylinders;
+        RectangleParabolicSoA rectangles_parabolic;
+        TriangleFlatSoA       triangles;
+
+        void clear();
+        /// append element i of the geometry data array to the list of its type
+        void add(const GeometryDataST& geometry, uint32_t id);
+        static GeometrySoA build(const std::vector<GeometryDataST>& geometry_data_array);
+    };
+
+    /// closest hit of one ray against a list of primitives
+    struct HostHit {
+        float    t = INFINITY;
+        int64_t  index = -1;      // index within the SoA list, -1 on a miss
+        uint32_t id = 0;          // element index of the primitive hit
+
+        bool valid() const { return index >= 0; }
+    };
+
+    // Test one ray against all primitives of a list. The batch variant writes the hit distance
+    // of every primitive to t_out (padded_size() entries, +inf on a miss); the results are bit
+    // identical to the scalar reference in host_intersection.h for every SimdLevel.
+    void intersect_batch(const ParallelogramSoA& soa, const HostRay& ray, float* t_out, SimdLevel level = best_simd_level());
+    void intersect_batch(const RectangleFlatSoA& soa, const HostRay& ray, float* t_out, SimdLevel level = best_simd_level());
+    void intersect_batch(const CylinderYSoA& soa, const HostRay& ray, float* t_out, SimdLevel level = best_simd_level());
+    void intersect_batch(const RectangleParabolicSoA& soa, const HostRay& ray, float* t_out, SimdLevel level = best_simd_level());
+    void intersect_batch(const TriangleFlatSoA& soa, const HostRay& ray, float* t_out, SimdLevel level = best_simd_level());
+
+    // Closest hit within the list, ties resolve to the lowest index.
+    HostHit closest_hit(const ParallelogramSoA& soa, const HostRay& ray, SimdLevel level = best_simd_level());
+    HostHit closest_hit(const RectangleFlatSoA& soa, const HostRay& ray, SimdLevel level = best_simd_level());
+    HostHit closest_hit(const CylinderYSoA& soa, const HostRay& ray, SimdLevel level = best_simd_level());
+    HostHit closest_hit(const RectangleParabolicSoA& soa, const HostRay& ray, SimdLevel level = best_simd_level());
+    HostHit closest_hit(const TriangleFlatSoA& soa, const HostRay& ray, SimdLevel level = best_simd_level());
+
+    /// closest hit over every list of the scene, the returned index is into the list of that type
+    HostHit closest_hit(const GeometrySoA& scene, const HostRay& ray, SimdLevel level = best_simd_level());
+}
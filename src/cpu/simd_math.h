@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Thin wrappers around the host vector registers so the batched intersection kernels
+// can be written once (as templates) and instantiated for scalar, AVX2 and AVX-512.
+// Every operation maps to a single IEEE operation with the same rounding as the scalar
+// code, and no FMA is emitted, so all widths give bit-identical results.
+// Only the sources of src/cpu include it, never a header: they are the ones built with the
+// ISA flags of OPTIXCSP_CPU_SIMD (src/CMakeLists.txt), the rest of the library and its users
+// are not.
+
+#if defined(__AVX512F__)
+#define OPTIXCSP_HAS_AVX512 1
+#endif
+#if defined(__AVX2__)
+#define OPTIXCSP_HAS_AVX2 1
+#endif
+
+namespace OptixCSP {
+namespace simd {
+
+    // ------------------------------------------------------------------
+    // width 1, plain C++ fallback
+    // ------------------------------------------------------------------
+    struct vmask1 {
+        bool v;
+    };
+
+    struct vfloat1 {
+        static constexpr int width = 1;
+        using mask = vmask1;
+
+        float v;
+
+        vfloat1() = default;
+        vfloat1(float s) : v(s) {}
+
+        static vfloat1 load(const float* p) { return vfloat1(*p); }
+        void store(float* p) const { *p = v; }
+    };
+
+    inline vfloat1 operator+(vfloat1 a, vfloat1 b) { return vfloat1(a.v + b.v); }
+    inline vfloat1 operator-(vfloat1 a, vfloat1 b) { return vfloat1(a.v - b.v); }
+    inline vfloat1 operator*(vfloat1 a, vfloat1 b) { return vfloat1(a.v * b.v); }
+    inline vfloat1 operator/(vfloat1 a, vfloat1 b) { return vfloat1(a.v / b.v); }
+    inline vfloat1 operator-(vfloat1 a) { return vfloat1(-a.v); }
+
+    inline vmask1 operator<(vfloat1 a, vfloat1 b)  { return { a.v < b.v }; }
+    inline vmask1 operator<=(vfloat1 a, vfloat1 b) { return { a.v <= b.v }; }
+    inline vmask1 operator>(vfloat1 a, vfloat1 b)  { return { a.v > b.v }; }
+    inline vmask1 operator>=(vfloat1 a, vfloat1 b) { return { a.v >= b.v }; }
+    inline vmask1 operator==(vfloat1 a, vfloat1 b) { return { a.v == b.v }; }
+
+    inline vmask1 operator&(vmask1 a, vmask1 b) { return { a.v && b.v }; }
+    inline vmask1 operator|(vmask1 a, vmask1 b) { return { a.v || b.v }; }
+    inline vmask1 operator!(vmask1 a) { return { !a.v }; }
+
+    inline vfloat1 select(vmask1 m, vfloat1 a, vfloat1 b) { return m.v ? a : b; }
+    inline vfloat1 sqrt(vfloat1 a) { return vfloat1(sqrtf(a.v)); }
+    inline vfloat1 abs(vfloat1 a) { return vfloat1(fabsf(a.v)); }
+    inline vfloat1 min(vfloat1 a, vfloat1 b) { return vfloat1(fminf(a.v, b.v)); }
+    inline vfloat1 max(vfloat1 a, vfloat1 b) { return vfloat1(fmaxf(a.v, b.v)); }
+    inline bool any(vmask1 m) { return m.v; }
+    inline uint32_t bits(vmask1 m) { return m.v ? 1u : 0u; }
+    inline vmask1 signbit(vfloat1 a) { return { std::signbit(a.v) }; }
+    // mask with the first n lanes set
+    inline vmask1 lanes_below(vfloat1, int n) { return { n > 0 }; }
+
+#if defined(OPTIXCSP_HAS_AVX2)
+    // ------------------------------------------------------------------
+    // width 8, AVX2
+    // ------------------------------------------------------------------
+    struct vmask8 {
+        __m256 v;
+    };
+
+    struct vfloat8 {
+        static constexpr int width = 8;
+        using mask = vmask8;
+
+        __m256 v;
+
+        vfloat8() = default;
+        vfloat8(__m256 x) : v(x) {}
+        vfloat8(float s) : v(_mm256_set1_ps(s)) {}
+
+        static vfloat8 load(const float* p) { return vfloat8(_mm256_loadu_ps(p)); }
+        void store(float* p) const { _mm256_storeu_ps(p, v); }
+    };
+
+    inline vfloat8 operator+(vfloat8 a, vfloat8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline vfloat8 operator-(vfloat8 a, vfloat8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline vfloat8 operator*(vfloat8 a, vfloat8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline vfloat8 operator/(vfloat8 a, vfloat8 b) { return _mm256_div_ps(a.v, b.v); }
+    inline vfloat8 operator-(vfloat8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+    inline vmask8 operator<(vfloat8 a, vfloat8 b)  { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask8 operator<=(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask8 operator>(vfloat8 a, vfloat8 b)  { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    inline vmask8 operator>=(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    inline vmask8 operator==(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+
+    inline vmask8 operator&(vmask8 a, vmask8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+    inline vmask8 operator|(vmask8 a, vmask8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+    inline vmask8 operator!(vmask8 a) { return { _mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+
+    inline vfloat8 select(vmask8 m, vfloat8 a, vfloat8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+    inline vfloat8 sqrt(vfloat8 a) { return _mm256_sqrt_ps(a.v); }
+    inline vfloat8 abs(vfloat8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    // same NaN rule as fminf for the operands used here (callers never pass NaN)
+    inline vfloat8 min(vfloat8 a, vfloat8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline vfloat8 max(vfloat8 a, vfloat8 b) { return _mm256_max_ps(a.v, b.v); }
+    inline bool any(vmask8 m) { return _mm256_movemask_ps(m.v) != 0; }
+    inline uint32_t bits(vmask8 m) { return static_cast<uint32_t>(_mm256_movemask_ps(m.v)); }
+    inline vmask8 signbit(vfloat8 a) { return { _mm256_castsi256_ps(_mm256_srai_epi32(_mm256_castps_si256(a.v), 31)) }; }
+    inline vmask8 lanes_below(vfloat8, int n) {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane)) };
+    }
+#endif
+
+#if defined(OPTIXCSP_HAS_AVX512)
+    // ------------------------------------------------------------------
+    // width 16, AVX-512F
+    // ------------------------------------------------------------------
+    struct vmask16 {
+        __mmask16 v;
+    };
+
+    struct vfloat16 {
+        static constexpr int width = 16;
+        using mask = vmask16;
+
+        __m512 v;
+
+        vfloat16() = default;
+        vfloat16(__m512 x) : v(x) {}
+        vfloat16(float s) : v(_mm512_set1_ps(s)) {}
+
+        static vfloat16 load(const float* p) { return vfloat16(_mm512_loadu_ps(p)); }
+        void store(float* p) const { _mm512_storeu_ps(p, v); }
+    };
+
+    inline vfloat16 operator+(vfloat16 a, vfloat16 b) { return _mm512_add_ps(a.v, b.v); }
+    inline vfloat16 operator-(vfloat16 a, vfloat16 b) { return _mm512_sub_ps(a.v, b.v); }
+    inline vfloat16 operator*(vfloat16 a, vfloat16 b) { return _mm512_mul_ps(a.v, b.v); }
+    inline vfloat16 operator/(vfloat16 a, vfloat16 b) { return _mm512_div_ps(a.v, b.v); }
+    inline vfloat16 operator-(vfloat16 a) {
+        return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(INT32_MIN)));
+    }
+
+    inline vmask16 operator<(vfloat16 a, vfloat16 b)  { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask16 operator<=(vfloat16 a, vfloat16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask16 operator>(vfloat16 a, vfloat16 b)  { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+    inline vmask16 operator>=(vfloat16 a, vfloat16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+    inline vmask16 operator==(vfloat16 a, vfloat16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ) }; }
+
+    inline vmask16 operator&(vmask16 a, vmask16 b) { return { static_cast<__mmask16>(a.v & b.v) }; }
+    inline vmask16 operator|(vmask16 a, vmask16 b) { return { static_cast<__mmask16>(a.v | b.v) }; }
+    inline vmask16 operator!(vmask16 a) { return { static_cast<__mmask16>(~a.v) }; }
+
+    inline vfloat16 select(vmask16 m, vfloat16 a, vfloat16 b) { return _mm512_mask_blend_ps(m.v, b.v, a.v); }
+    inline vfloat16 sqrt(vfloat16 a) { return _mm512_sqrt_ps(a.v); }
+    inline vfloat16 abs(vfloat16 a) {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(INT32_MAX)));
+    }
+    inline vfloat16 min(vfloat16 a, vfloat16 b) { return _mm512_min_ps(a.v, b.v); }
+    inline vfloat16 max(vfloat16 a, vfloat16 b) { return _mm512_max_ps(a.v, b.v); }
+    inline bool any(vmask16 m) { return m.v != 0; }
+    inline uint32_t bits(vmask16 m) { return static_cast<uint32_t>(m.v); }
+    inline vmask16 signbit(vfloat16 a) {
+        return { _mm512_test_epi32_mask(_mm512_castps_si512(a.v), _mm512_set1_epi32(INT32_MIN)) };
+    }
+    inline vmask16 lanes_below(vfloat16, int n) {
+        return { static_cast<__mmask16>(n >= 16 ? 0xFFFFu : ((1u << (n > 0 ? n : 0)) - 1u)) };
+    }
+#endif
+
+} // namespace simd
+} // namespace OptixCSP
@@ -0,0 +1,145 @@
+#include "sun_footprints.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace OptixCSP;
+
+SunFootprints::SunFootprints()
+    : m_sun_vector(make_float3(0.0f, 0.0f, 1.0f)),
+      m_total_area(0.0),
+      m_grid_u0(0.0f), m_grid_v0(0.0f),
+      m_grid_inv_du(0.0f), m_grid_inv_dv(0.0f),
+      m_grid_nu(0), m_grid_nv(0) {}
+
+void SunFootprints::build(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                          const SunPlane& plane) {
+    m_sun_vector = sun_vector;
+    m_plane = plane;
+    m_footprints.clear();
+    m_elements.clear();
+    m_cdf.assign(1, 0.0);
+    m_total_area = 0.0;
+
+    // a ray leaving the plane at the sun angle drifts sideways by (distance to the corner) * tan
+    const float tan_sun_angle = std::tan(max_sun_angle);
+    for (uint32_t e = 0; e < aabbs.size(); e++) {
+        const OptixAabb& b = aabbs[e];
+        if (!(b.minX <= b.maxX && b.minY <= b.maxY && b.minZ <= b.maxZ)) continue;
+
+        SunFootprint f = { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+        for (int c = 0; c < 8; c++) {
+            const float3 pt = make_float3(c & 1 ? b.maxX : b.minX, c & 2 ? b.maxY : b.minY, c & 4 ? b.maxZ : b.minZ);
+            const float buffer = std::max(0.0f, plane.distance - dot(pt, sun_vector)) * tan_sun_angle;
+            const float u = dot(pt, plane.sun_u);
+            const float v = dot(pt, plane.sun_v);
+            f.u_min = std::min(f.u_min, u - buffer);
+            f.u_max = std::max(f.u_max, u + buffer);
+            f.v_min = std::min(f.v_min, v - buffer);
+            f.v_max = std::max(f.v_max, v + buffer);
+        }
+        if (!(f.area() > 0.0f)) continue;
+
+        m_footprints.push_back(f);
+        m_elements.push_back(e);
+        m_total_area += f.area();
+        m_cdf.push_back(m_total_area);
+    }
+
+    m_grid_nu = m_grid_nv = 0;
+    m_cell_begin.assign(1, 0u);
+    m_cell_items.clear();
+    if (m_footprints.empty()) return;
+
+    // about one cell per footprint, square cells over the union of the footprints
+    float u0 = FLT_MAX, u1 = -FLT_MAX, v0 = FLT_MAX, v1 = -FLT_MAX;
+    for (const SunFootprint& f : m_footprints) {
+        u0 = std::min(u0, f.u_min); u1 = std::max(u1, f.u_max);
+        v0 = std::min(v0, f.v_min); v1 = std::max(v1, f.v_max);
+    }
+    const double width = std::max(1e-6f, u1 - u0);
+    const double height = std::max(1e-6f, v1 - v0);
+    const double num_cells = std::min<double>(m_footprints.size(), 1 << 22);
+    m_grid_nu = std::max(1, std::min(1 << 16, static_cast<int>(std::sqrt(num_cells * width / height))));
+    m_grid_nv = std::max(1, std::min(1 << 16, static_cast<int>(num_cells / m_grid_nu)));
+    m_grid_u0 = u0;
+    m_grid_v0 = v0;
+    m_grid_inv_du = static_cast<float>(m_grid_nu / width);
+    m_grid_inv_dv = static_cast<float>(m_grid_nv / height);
+
+    auto cell_u = [&](float u) { return std::min(m_grid_nu - 1, std::max(0, static_cast<int>((u - m_grid_u0) * m_grid_inv_du))); };
+    auto cell_v = [&](float v) { return std::min(m_grid_nv - 1, std::max(0, static_cast<int>((v - m_grid_v0) * m_grid_inv_dv))); };
+
+    // count, prefix sum, fill
+    const size_t total_cells = static_cast<size_t>(m_grid_nu) * m_grid_nv;
+    m_cell_begin.assign(total_cells + 1, 0u);
+    for (const SunFootprint& f : m_footprints) {
+        for (int j = cell_v(f.v_min); j <= cell_v(f.v_max); j++)
+            for (int i = cell_u(f.u_min); i <= cell_u(f.u_max); i++)
+                m_cell_begin[static_cast<size_t>(j) * m_grid_nu + i + 1]++;
+    }
+    for (size_t c = 0; c < total_cells; c++)
+        m_cell_begin[c + 1] += m_cell_begin[c];
+
+    m_cell_items.resize(m_cell_begin[total_cells]);
+    std::vector<uint32_t> fill(m_cell_begin.begin(), m_cell_begin.end() - 1);
+    for (uint32_t k = 0; k < m_footprints.size(); k++) {
+        const SunFootprint& f = m_footprints[k];
+        for (int j = cell_v(f.v_min); j <= cell_v(f.v_max); j++)
+            for (int i = cell_u(f.u_min); i <= cell_u(f.u_max); i++)
+                m_cell_items[fill[static_cast<size_t>(j) * m_grid_nu + i]++] = k;
+    }
+}
+
+float3 SunFootprints::sample(float a, float b, size_t num_samples, double& area, uint32_t* element) const {
+    const double x = static_cast<double>(a) * m_total_area;
+    size_t k = std::upper_bound(m_cdf.begin() + 1, m_cdf.end(), x) - (m_cdf.begin() + 1);
+    k = std::min(k, m_footprints.size() - 1);
+
+    const SunFootprint& f = m_footprints[k];
+    const double a_k = std::min(1.0, std::max(0.0, (x - m_cdf[k]) / (m_cdf[k + 1] - m_cdf[k])));
+    const float u = f.u_min + static_cast<float>(a_k) * (f.u_max - f.u_min);
+    const float v = f.v_min + b * (f.v_max - f.v_min);
+
+    // the point lies in footprint k, rounding at its border must not make the coverage 0
+    const int covered = std::max(1, coverage(u, v));
+    area = m_total_area / (static_cast<double>(num_samples) * covered);
+    if (element) *element = m_elements[k];
+
+    return u * m_plane.sun_u + v * m_plane.sun_v + m_plane.distance * m_sun_vector;
+}
+
+int SunFootprints::coverage(float u, float v) const {
+    if (m_grid_nu == 0) return 0;
+    const float cu = (u - m_grid_u0) * m_grid_inv_du;
+    const float cv = (v - m_grid_v0) * m_grid_inv_dv;
+    if (!(cu >= 0.0f && cv >= 0.0f && cu <= m_grid_nu && cv <= m_grid_nv)) return 0;
+
+    const size_t cell = static_cast<size_t>(std::min(m_grid_nv - 1, static_cast<int>(cv))) * m_grid_nu
+                      + std::min(m_grid_nu - 1, static_cast<int>(cu));
+    int count = 0;
+    for (uint32_t i = m_cell_begin[cell]; i < m_cell_begin[cell + 1]; i++)
+        count += m_footprints[m_cell_items[i]].contains(u, v);
+    return count;
+}
+
+void SunFootprints::overlapping(size_t k, std::vector<uint32_t>& elements) const {
+    elements.clear();
+    const SunFootprint& f = m_footprints[k];
+    auto cell_u = [&](float u) { return std::min(m_grid_nu - 1, std::max(0, static_cast<int>((u - m_grid_u0) * m_grid_inv_du))); };
+    auto cell_v = [&](float v) { return std::min(m_grid_nv - 1, std::max(0, static_cast<int>((v - m_grid_v0) * m_grid_inv_dv))); };
+    for (int j = cell_v(f.v_min); j <= cell_v(f.v_max); j++) {
+        for (int i = cell_u(f.u_min); i <= cell_u(f.u_max); i++) {
+            const size_t cell = static_cast<size_t>(j) * m_grid_nu + i;
+            for (uint32_t c = m_cell_begin[cell]; c < m_cell_begin[cell + 1]; c++) {
+                const uint32_t other = m_cell_items[c];
+                const SunFootprint& g = m_footprints[other];
+                if (other != k && g.u_min <= f.u_max && f.u_min <= g.u_max && g.v_min <= f.v_max && f.v_min <= g.v_max)
+                    elements.push_back(m_elements[other]);
+            }
+        }
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+}
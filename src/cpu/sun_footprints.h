@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <optix.h>
+
+#include "cpu/sun_plane.h"
+
+namespace OptixCSP {
+
+    /// rectangle of the sun plane, in the sun_u / sun_v coordinates of the plane
+    struct SunFootprint {
+        float u_min, u_max;
+        float v_min, v_max;
+
+        float area() const { return (u_max - u_min) * (v_max - v_min); }
+        bool contains(float u, float v) const { return u >= u_min && u <= u_max && v >= v_min && v <= v_max; }
+    };
+
+    /**
+     * @class SunFootprints
+     * @brief Sun plane sampling restricted to the footprints of the elements. Every AABB is projected
+     * onto the sun plane along the sun vector and widened by the lateral drift of a ray tilted by the
+     * sun angle between the plane and the corner; a sun ray launched outside every footprint cannot
+     * hit anything.
+     *
+     * A sample picks a footprint with probability proportional to its area and a uniform point in
+     * it, so the density on the plane is c(x) / A, with c(x) the number of footprints covering x and
+     * A the summed area. Each of N rays therefore stands for A / (N c(x)) of the sun plane, and the
+     * overlaps, where the shading and blocking happen, are not counted twice. c(x) is looked up in a
+     * uniform grid over the footprints.
+     */
+    class SunFootprints {
+    public:
+        SunFootprints();
+
+        /// footprints of the boxes on the given sun plane, empty boxes are skipped
+        void build(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                   const SunPlane& plane);
+
+        size_t size() const { return m_footprints.size(); }
+        const std::vector<SunFootprint>& footprints() const { return m_footprints; }
+        /// index of the box of footprint k
+        uint32_t element(size_t k) const { return m_elements[k]; }
+
+        /// summed area of the footprints
+        double total_area() const { return m_total_area; }
+
+        /// point of the sun plane for the sample (a, b) in [0, 1)^2 out of num_samples; a picks the
+        /// footprint and is rescaled to place the point in it, so stratified samples stay stratified
+        /// per footprint. area is the part of the sun plane the sample stands for, element the box
+        /// of the footprint the point was drawn from.
+        float3 sample(float a, float b, size_t num_samples, double& area, uint32_t* element = nullptr) const;
+
+        /// boxes of the other footprints overlapping footprint k, in increasing order
+        void overlapping(size_t k, std::vector<uint32_t>& elements) const;
+
+        /// number of footprints containing the point (u, v) of the sun plane
+        int coverage(float u, float v) const;
+
+    private:
+        float3 m_sun_vector;
+        SunPlane m_plane;
+
+        std::vector<SunFootprint> m_footprints;
+        std::vector<uint32_t> m_elements;  // box of every footprint
+        std::vector<double> m_cdf;         // m_cdf[k] is the area of the footprints before k, size() + 1 entries
+        double m_total_area;
+
+        // footprints overlapping each grid cell, compressed rows
+        float m_grid_u0, m_grid_v0;
+        float m_grid_inv_du, m_grid_inv_dv;
+        int m_grid_nu, m_grid_nv;
+        std::vector<uint32_t> m_cell_begin;
+        std::vector<uint32_t> m_cell_items;
+    };
+}
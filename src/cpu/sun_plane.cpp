@@ -0,0 +1,239 @@
+#include "sun_plane.h"
+#include "simd_math.h"
+#include "work_stealing.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace OptixCSP;
+
+namespace {
+    inline void aabb_corners(const OptixAabb& aabb, float3 corners[8]) {
+        corners[0] = make_float3(aabb.minX, aabb.minY, aabb.minZ);
+        corners[1] = make_float3(aabb.maxX, aabb.minY, aabb.minZ);
+        corners[2] = make_float3(aabb.minX, aabb.maxY, aabb.minZ);
+        corners[3] = make_float3(aabb.maxX, aabb.maxY, aabb.minZ);
+        corners[4] = make_float3(aabb.minX, aabb.minY, aabb.maxZ);
+        corners[5] = make_float3(aabb.maxX, aabb.minY, aabb.maxZ);
+        corners[6] = make_float3(aabb.minX, aabb.maxY, aabb.maxZ);
+        corners[7] = make_float3(aabb.maxX, aabb.maxY, aabb.maxZ);
+    }
+}
+
+void OptixCSP::sun_plane_basis(const float3& sun_vector, float3& sun_u, float3& sun_v) {
+    float3 axis = (std::abs(sun_vector.x) < 0.9f) ? make_float3(1.0f, 0.0f, 0.0f) : make_float3(0.0f, 1.0f, 0.0f);
+    sun_u = normalize(cross(axis, sun_vector));
+    sun_v = normalize(cross(sun_vector, sun_u));
+}
+
+void OptixCSP::set_sun_plane_corners(SunPlane& plane, const float3& sun_vector) {
+    const float d = plane.distance;
+    plane.v0 = plane.u_min * plane.sun_u + plane.v_min * plane.sun_v + d * sun_vector;
+    plane.v1 = plane.u_max * plane.sun_u + plane.v_min * plane.sun_v + d * sun_vector;
+    plane.v2 = plane.u_max * plane.sun_u + plane.v_max * plane.sun_v + d * sun_vector;
+    plane.v3 = plane.u_min * plane.sun_u + plane.v_max * plane.sun_v + d * sun_vector;
+}
+
+SunPlane OptixCSP::compute_sun_plane(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle) {
+    SunPlane plane;
+    sun_plane_basis(sun_vector, plane.sun_u, plane.sun_v);
+
+    float3 corners[8];
+    float max_d = 0.0f;
+    for (const OptixAabb& aabb : aabbs) {
+        aabb_corners(aabb, corners);
+        for (int i = 0; i < 8; i++)
+            max_d = fmaxf(max_d, std::abs(dot(corners[i], sun_vector)));
+    }
+    plane.distance = max_d;
+
+    const float tan_sun_angle = std::tan(max_sun_angle);
+    const float3 plane_center = max_d * sun_vector;
+    float u_min = FLT_MAX, u_max = -FLT_MAX;
+    float v_min = FLT_MAX, v_max = -FLT_MAX;
+    for (const OptixAabb& aabb : aabbs) {
+        aabb_corners(aabb, corners);
+        for (int i = 0; i < 8; ++i) {
+            float3 pt = corners[i];
+
+            float dist_along_sun_axis = std::abs(dot(pt, sun_vector));
+            float buffer = dist_along_sun_axis * tan_sun_angle;
+
+            float3 projected = pt - dot(pt - plane_center, sun_vector) * sun_vector;
+
+            float u = dot(projected, plane.sun_u);
+            float v = dot(projected, plane.sun_v);
+
+            u_min = fminf(u_min, u - buffer);
+            u_max = fmaxf(u_max, u + buffer);
+            v_min = fminf(v_min, v - buffer);
+            v_max = fmaxf(v_max, v + buffer);
+        }
+    }
+    plane.u_min = u_min;
+    plane.u_max = u_max;
+    plane.v_min = v_min;
+    plane.v_max = v_max;
+
+    set_sun_plane_corners(plane, sun_vector);
+    return plane;
+}
+
+// ---------------------------------------------------------------------------
+// incremental sun plane
+// ---------------------------------------------------------------------------
+SunPlaneExtent SunPlaneExtent::empty() {
+    return { 0.0f, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+}
+
+SunPlaneExtent SunPlaneExtent::combine(const SunPlaneExtent& a, const SunPlaneExtent& b) {
+    return { std::max(a.max_d, b.max_d),
+             std::min(a.u_min, b.u_min), std::max(a.u_max, b.u_max),
+             std::min(a.v_min, b.v_min), std::max(a.v_max, b.v_max) };
+}
+
+namespace {
+    // one lane per element, the 8 corners are folded in the same order on every width
+    template <class V>
+    void extent_kernel(const OptixAabb* aabbs, size_t begin, size_t end, const float3& s,
+                       const float3& su, const float3& sv, float tan_sun_angle, SunPlaneExtent* out) {
+        constexpr int W = V::width;
+        const V sx(s.x), sy(s.y), sz(s.z);
+        const V ux(su.x), uy(su.y), uz(su.z);
+        const V vx(sv.x), vy(sv.y), vz(sv.z);
+        const V tan_angle(tan_sun_angle);
+
+        alignas(64) float lo[3][W], hi[3][W];
+        alignas(64) float res[5][W];
+        for (size_t i = begin; i + W <= end; i += W) {
+            for (int l = 0; l < W; l++) {
+                const OptixAabb& b = aabbs[i + l];
+                lo[0][l] = b.minX; lo[1][l] = b.minY; lo[2][l] = b.minZ;
+                hi[0][l] = b.maxX; hi[1][l] = b.maxY; hi[2][l] = b.maxZ;
+            }
+            const V x[2] = { V::load(lo[0]), V::load(hi[0]) };
+            const V y[2] = { V::load(lo[1]), V::load(hi[1]) };
+            const V z[2] = { V::load(lo[2]), V::load(hi[2]) };
+
+            V max_d(0.0f);
+            V u_min(FLT_MAX), u_max(-FLT_MAX), v_min(FLT_MAX), v_max(-FLT_MAX);
+            for (int c = 0; c < 8; c++) {
+                const V& px = x[c & 1];
+                const V& py = y[(c >> 1) & 1];
+                const V& pz = z[c >> 2];
+
+                const V d = simd::abs(px * sx + py * sy + pz * sz);
+                const V buffer = d * tan_angle;
+                const V u = px * ux + py * uy + pz * uz;
+                const V v = px * vx + py * vy + pz * vz;
+
+                max_d = simd::max(max_d, d);
+                u_min = simd::min(u_min, u - buffer);
+                u_max = simd::max(u_max, u + buffer);
+                v_min = simd::min(v_min, v - buffer);
+                v_max = simd::max(v_max, v + buffer);
+            }
+            max_d.store(res[0]);
+            u_min.store(res[1]); u_max.store(res[2]);
+            v_min.store(res[3]); v_max.store(res[4]);
+            for (int l = 0; l < W; l++)
+                out[i + l] = { res[0][l], res[1][l], res[2][l], res[3][l], res[4][l] };
+        }
+    }
+
+    void compute_extents(const OptixAabb* aabbs, size_t begin, size_t end, const float3& s,
+                         const float3& su, const float3& sv, float tan_sun_angle, SunPlaneExtent* out) {
+        size_t done = begin;
+#if defined(OPTIXCSP_HAS_AVX512)
+        const size_t n16 = begin + (end - begin) / 16 * 16;
+        extent_kernel<simd::vfloat16>(aabbs, done, n16, s, su, sv, tan_sun_angle, out);
+        done = n16;
+#elif defined(OPTIXCSP_HAS_AVX2)
+        const size_t n8 = begin + (end - begin) / 8 * 8;
+        extent_kernel<simd::vfloat8>(aabbs, done, n8, s, su, sv, tan_sun_angle, out);
+        done = n8;
+#endif
+        extent_kernel<simd::vfloat1>(aabbs, done, end, s, su, sv, tan_sun_angle, out);
+    }
+}
+
+void OptixCSP::compute_sun_plane_extents(const OptixAabb* aabbs, size_t count, const float3& sun_vector,
+                                         const float3& sun_u, const float3& sun_v, float tan_sun_angle,
+                                         SunPlaneExtent* extents) {
+    compute_extents(aabbs, 0, count, sun_vector, sun_u, sun_v, tan_sun_angle, extents);
+}
+
+SunPlaneTree::SunPlaneTree() : m_nodes(2, SunPlaneExtent::empty()) {}
+
+void SunPlaneTree::build(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                         WorkStealingScheduler* scheduler) {
+    m_sun_vector = sun_vector;
+    m_max_sun_angle = max_sun_angle;
+    m_tan_sun_angle = std::tan(max_sun_angle);
+    sun_plane_basis(sun_vector, m_sun_u, m_sun_v);
+    m_aabbs = aabbs;
+
+    const size_t n = aabbs.size();
+    m_leaf_base = 1;
+    while (m_leaf_base < n) m_leaf_base <<= 1;
+    m_nodes.assign(2 * m_leaf_base, SunPlaneExtent::empty());
+
+    SunPlaneExtent* leaves = m_nodes.data() + m_leaf_base;
+    constexpr size_t BATCH = 4096;
+    if (scheduler && n > BATCH) {
+        scheduler->parallel_for((n + BATCH - 1) / BATCH, [&](size_t batch, int) {
+            compute_extents(m_aabbs.data(), batch * BATCH, std::min(n, (batch + 1) * BATCH),
+                            m_sun_vector, m_sun_u, m_sun_v, m_tan_sun_angle, leaves);
+        });
+    }
+    else {
+        compute_extents(m_aabbs.data(), 0, n, m_sun_vector, m_sun_u, m_sun_v, m_tan_sun_angle, leaves);
+    }
+
+    for (size_t k = m_leaf_base - 1; k >= 1; k--)
+        m_nodes[k] = SunPlaneExtent::combine(m_nodes[2 * k], m_nodes[2 * k + 1]);
+}
+
+void SunPlaneTree::update(size_t element, const OptixAabb& aabb) {
+    m_aabbs[element] = aabb;
+    size_t k = m_leaf_base + element;
+    compute_extents(m_aabbs.data(), element, element + 1, m_sun_vector, m_sun_u, m_sun_v, m_tan_sun_angle,
+                    m_nodes.data() + m_leaf_base);
+    for (k >>= 1; k >= 1; k >>= 1)
+        m_nodes[k] = SunPlaneExtent::combine(m_nodes[2 * k], m_nodes[2 * k + 1]);
+}
+
+size_t SunPlaneTree::sync(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                          WorkStealingScheduler* scheduler) {
+    const bool same_sun = sun_vector.x == m_sun_vector.x && sun_vector.y == m_sun_vector.y &&
+                          sun_vector.z == m_sun_vector.z && max_sun_angle == m_max_sun_angle;
+    if (!same_sun || aabbs.size() != m_aabbs.size()) {
+        build(aabbs, sun_vector, max_sun_angle, scheduler);
+        return aabbs.size();
+    }
+
+    size_t changed = 0;
+    for (size_t i = 0; i < aabbs.size(); i++) {
+        if (std::memcmp(&aabbs[i], &m_aabbs[i], sizeof(OptixAabb)) != 0) {
+            update(i, aabbs[i]);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+SunPlane SunPlaneTree::plane() const {
+    const SunPlaneExtent& e = extent();
+    SunPlane plane;
+    plane.distance = e.max_d;
+    plane.sun_u = m_sun_u;
+    plane.sun_v = m_sun_v;
+    plane.u_min = e.u_min;
+    plane.u_max = e.u_max;
+    plane.v_min = e.v_min;
+    plane.v_max = e.v_max;
+    set_sun_plane_corners(plane, m_sun_vector);
+    return plane;
+}
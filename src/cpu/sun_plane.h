@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <optix.h>
+
+#include "shaders/device_util.h"
+
+namespace OptixCSP {
+
+    /// Sun plane of the host tracers: the parallelogram sun_v0..sun_v3 the sun rays are launched
+    /// from, same construction as GeometryManager::compute_sun_plane_H.
+    struct SunPlane {
+        float  distance = 0.0f;   // max |dot(corner, sun_vector)| over all AABB corners
+        float3 sun_u;             // in-plane basis
+        float3 sun_v;
+        float  u_min = 0.0f, u_max = 0.0f, v_min = 0.0f, v_max = 0.0f;
+
+        float3 v0, v1, v2, v3;
+    };
+
+    /// in-plane basis used for a given (normalized) sun vector
+    void sun_plane_basis(const float3& sun_vector, float3& sun_u, float3& sun_v);
+
+    /// corners of the sun plane from its distance and uv bounds
+    void set_sun_plane_corners(SunPlane& plane, const float3& sun_vector);
+
+    /// brute force evaluation over all AABB corners
+    SunPlane compute_sun_plane(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle);
+
+    class WorkStealingScheduler;
+
+    /// What one AABB contributes to the sun plane: the largest |dot(corner, sun_vector)| and the
+    /// in-plane bounds of its corners widened by the sun angle. The in-plane coordinates are taken
+    /// as dot(corner, sun_u), which does not depend on the plane distance, so the extents of the
+    /// elements combine with min / max alone. compute_sun_plane projects the corners onto the
+    /// plane first; both agree up to rounding.
+    struct SunPlaneExtent {
+        float max_d;
+        float u_min, u_max;
+        float v_min, v_max;
+
+        /// neutral element of combine
+        static SunPlaneExtent empty();
+        static SunPlaneExtent combine(const SunPlaneExtent& a, const SunPlaneExtent& b);
+    };
+
+    /// extents of aabbs[0, count), vectorized over the elements with the widest ISA of the build
+    void compute_sun_plane_extents(const OptixAabb* aabbs, size_t count, const float3& sun_vector,
+                                   const float3& sun_u, const float3& sun_v, float tan_sun_angle,
+                                   SunPlaneExtent* extents);
+
+    /**
+     * @class SunPlaneTree
+     * @brief Sun plane maintained over a changing set of AABBs. The element extents are the leaves
+     * of a segment tree whose root is the extent of the whole scene, so moving one element costs
+     * O(log N) instead of a pass over all corners. A new sun vector or sun angle changes every
+     * extent and rebuilds the tree.
+     */
+    class SunPlaneTree {
+    public:
+        SunPlaneTree();
+
+        /// compute all the extents (in parallel when a scheduler is given) and build the tree
+        void build(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                   WorkStealingScheduler* scheduler = nullptr);
+
+        /// new box of one element, O(log N)
+        void update(size_t element, const OptixAabb& aabb);
+
+        /// bring the tree in line with the given boxes: rebuild when the sun or the element count
+        /// changed, otherwise update the elements whose box differs. Returns the number of elements
+        /// that were recomputed.
+        size_t sync(const std::vector<OptixAabb>& aabbs, const float3& sun_vector, float max_sun_angle,
+                    WorkStealingScheduler* scheduler = nullptr);
+
+        size_t size() const { return m_aabbs.size(); }
+        const SunPlaneExtent& extent() const { return m_nodes[1]; }
+
+        /// plane of the current extent, same corners as compute_sun_plane
+        SunPlane plane() const;
+
+    private:
+        float3 m_sun_vector = { 0.0f, 0.0f, 0.0f };
+        float  m_max_sun_angle = 0.0f;
+        float  m_tan_sun_angle = 0.0f;
+        float3 m_sun_u = { 0.0f, 0.0f, 0.0f };
+        float3 m_sun_v = { 0.0f, 0.0f, 0.0f };
+
+        std::vector<OptixAabb> m_aabbs;        // boxes the leaves were computed from
+        size_t m_leaf_base = 1;                // leaf i is node m_leaf_base + i
+        std::vector<SunPlaneExtent> m_nodes;   // node 1 is the root, the children of k are 2k and 2k + 1
+    };
+}
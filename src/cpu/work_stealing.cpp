@@ -0,0 +1,238 @@
+#include "work_stealing.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+using namespace OptixCSP;
+
+namespace {
+#if defined(__linux__)
+    // "0-3,8-11" -> 0 1 2 3 8 9 10 11
+    std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty() || item == "\n") continue;
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int c = first; c <= last; c++) cpus.push_back(c);
+        }
+        return cpus;
+    }
+#endif
+
+    void pin_current_thread(int cpu) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+        if (cpu < 64) SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#else
+        (void)cpu;
+#endif
+    }
+}
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topo;
+#if defined(__linux__)
+    // only the cpus this process may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    int num_nodes = 0;
+    for (int node = 0; node < 256; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file.is_open()) continue;
+        std::string list;
+        std::getline(file, list);
+
+        bool any = false;
+        for (int cpu : parse_cpu_list(list)) {
+            if (have_mask && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))) continue;
+            topo.cpus.push_back(cpu);
+            topo.cpu_node.push_back(num_nodes);
+            any = true;
+        }
+        if (any) num_nodes++;
+    }
+    if (!topo.cpus.empty()) {
+        topo.num_nodes = num_nodes;
+        return topo;
+    }
+    if (have_mask) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            topo.cpus.push_back(cpu);
+            topo.cpu_node.push_back(0);
+        }
+        if (!topo.cpus.empty()) return topo;
+    }
+#endif
+    const int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; cpu++) {
+        topo.cpus.push_back(cpu);
+        topo.cpu_node.push_back(0);
+    }
+    return topo;
+}
+
+WorkStealingScheduler::WorkStealingScheduler(int num_threads, bool pin_threads) {
+    const CpuTopology topo = CpuTopology::detect();
+    if (num_threads <= 0) num_threads = static_cast<int>(topo.cpus.size());
+
+    m_workers.resize(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        m_workers[i] = std::make_unique<Worker>();
+        const size_t slot = static_cast<size_t>(i) % topo.cpus.size();
+        if (pin_threads) {
+            m_workers[i]->cpu = topo.cpus[slot];
+            m_workers[i]->node = topo.cpu_node[slot];
+        }
+    }
+
+    // victims on the same node first, each list rotated so the thieves do not all start at worker 0
+    for (int i = 0; i < num_threads; i++) {
+        std::vector<int>& victims = m_workers[i]->victims;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int k = 1; k < num_threads; k++) {
+                const int j = (i + k) % num_threads;
+                const bool local = m_workers[j]->node == m_workers[i]->node;
+                if (local == (pass == 0)) victims.push_back(j);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++)
+        m_workers[i]->thread = std::thread(&WorkStealingScheduler::worker_loop, this, i);
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start_cv.notify_all();
+    for (auto& w : m_workers)
+        w->thread.join();
+}
+
+void WorkStealingScheduler::parallel_for(size_t num_batches, const std::function<void(size_t, int)>& func, bool steal) {
+    const size_t n = m_workers.size();
+    for (size_t i = 0; i < n; i++) {
+        Worker& w = *m_workers[i];
+        std::lock_guard<std::mutex> lock(w.range_mutex);
+        w.begin = num_batches * i / n;
+        w.end = num_batches * (i + 1) / n;
+        w.stats = WorkerStats();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_steal = steal;
+    m_batch_func = &func;
+    m_thread_func = nullptr;
+    m_active = static_cast<int>(n);
+    m_generation++;
+    m_start_cv.notify_all();
+    m_done_cv.wait(lock, [this] { return m_active == 0; });
+    m_batch_func = nullptr;
+}
+
+void WorkStealingScheduler::run_on_each_thread(const std::function<void(int)>& func) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_batch_func = nullptr;
+    m_thread_func = &func;
+    m_active = static_cast<int>(m_workers.size());
+    m_generation++;
+    m_start_cv.notify_all();
+    m_done_cv.wait(lock, [this] { return m_active == 0; });
+    m_thread_func = nullptr;
+}
+
+void WorkStealingScheduler::worker_loop(int index) {
+    Worker& w = *m_workers[index];
+    if (w.cpu >= 0) pin_current_thread(w.cpu);
+
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start_cv.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop) return;
+            seen = m_generation;
+        }
+
+        if (m_thread_func)
+            (*m_thread_func)(index);
+        else
+            run_batches(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_active == 0) m_done_cv.notify_one();
+    }
+}
+
+void WorkStealingScheduler::run_batches(int index) {
+    Worker& w = *m_workers[index];
+    const std::function<void(size_t, int)>& func = *m_batch_func;
+    size_t batch;
+    for (;;) {
+        if (pop_local(w, batch) || (m_steal && steal(index, batch))) {
+            func(batch, index);
+            w.stats.batches++;
+        }
+        else {
+            // nothing left anywhere: the ranges only shrink during a parallel_for
+            return;
+        }
+    }
+}
+
+bool WorkStealingScheduler::pop_local(Worker& w, size_t& batch) {
+    std::lock_guard<std::mutex> lock(w.range_mutex);
+    if (w.begin >= w.end) return false;
+    batch = w.begin++;
+    return true;
+}
+
+bool WorkStealingScheduler::steal(int index, size_t& batch) {
+    Worker& self = *m_workers[index];
+    for (int v : self.victims) {
+        Worker& victim = *m_workers[v];
+        size_t first, last;
+        {
+            std::lock_guard<std::mutex> lock(victim.range_mutex);
+            if (victim.begin >= victim.end) continue;
+            const size_t remaining = victim.end - victim.begin;
+            // take the back half, the victim keeps working on the front
+            const size_t take = (remaining + 1) / 2;
+            first = victim.end - take;
+            last = victim.end;
+            victim.end = first;
+        }
+        {
+            std::lock_guard<std::mutex> lock(self.range_mutex);
+            self.begin = first + 1;
+            self.end = last;
+        }
+        self.stats.steals++;
+        if (victim.node != self.node) self.stats.remote_steals++;
+        batch = first;
+        return true;
+    }
+    return false;
+}
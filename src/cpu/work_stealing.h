@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OptixCSP {
+
+    /// logical cpus grouped by NUMA node, read from /sys/devices/system/node on Linux;
+    /// a single node with std::thread::hardware_concurrency() cpus elsewhere
+    struct CpuTopology {
+        std::vector<int> cpus;        // cpu ids, all cpus of node 0 first, then node 1, ...
+        std::vector<int> cpu_node;    // NUMA node of cpus[i]
+        int num_nodes = 1;
+
+        static CpuTopology detect();
+    };
+
+    /// per-thread counters of the last parallel_for
+    struct WorkerStats {
+        size_t batches = 0;        // batches executed by the thread
+        size_t steals = 0;         // successful steals
+        size_t remote_steals = 0;  // steals from a thread on another NUMA node
+    };
+
+    /**
+     * @class WorkStealingScheduler
+     * @brief Persistent pool of pinned worker threads running batch loops.
+     *
+     * parallel_for splits [0, num_batches) into one contiguous range per worker. A worker executes its
+     * own range front to back; once it is empty it steals the back half of another worker's range,
+     * trying the workers on its own NUMA node before the remote ones. Workers are pinned to the cpus
+     * of CpuTopology in order, so the first threads fill node 0 before node 1 is used; memory a worker
+     * touches first (see run_on_each_thread) is therefore allocated on its node by the OS.
+     */
+    class WorkStealingScheduler {
+    public:
+        /// num_threads <= 0 uses every logical cpu
+        explicit WorkStealingScheduler(int num_threads = 0, bool pin_threads = true);
+        ~WorkStealingScheduler();
+
+        WorkStealingScheduler(const WorkStealingScheduler&) = delete;
+        WorkStealingScheduler& operator=(const WorkStealingScheduler&) = delete;
+
+        int num_threads() const { return static_cast<int>(m_workers.size()); }
+        /// NUMA node the worker is pinned to, 0 when not pinned
+        int thread_node(int thread) const { return m_workers[thread]->node; }
+
+        /// call func(batch, thread) for every batch, returns once all of them are done;
+        /// with steal = false every worker only runs its own range (static partitioning)
+        void parallel_for(size_t num_batches, const std::function<void(size_t, int)>& func, bool steal = true);
+
+        /// call func(thread) once on every worker, used to allocate and first touch per-thread data
+        void run_on_each_thread(const std::function<void(int)>& func);
+
+        const WorkerStats& get_stats(int thread) const { return m_workers[thread]->stats; }
+
+    private:
+        struct Worker {
+            std::thread thread;
+            int cpu = -1;
+            int node = 0;
+            std::vector<int> victims;   // other workers, same node first
+
+            std::mutex range_mutex;     // guards [begin, end)
+            size_t begin = 0;
+            size_t end = 0;
+
+            WorkerStats stats;
+        };
+
+        void worker_loop(int index);
+        void run_batches(int index);
+        bool pop_local(Worker& w, size_t& batch);
+        bool steal(int index, size_t& batch);
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+
+        // job handshake: a new generation wakes the workers, m_active counts the ones still busy
+        std::mutex m_mutex;
+        std::condition_variable m_start_cv;
+        std::condition_variable m_done_cv;
+        uint64_t m_generation = 0;
+        int m_active = 0;
+        bool m_stop = false;
+
+        bool m_steal = true;
+        const std::function<void(size_t, int)>* m_batch_func = nullptr;
+        const std::function<void(int)>* m_thread_func = nullptr;
+    };
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// Surface a flux grid covers.
+    enum FluxMapShape : unsigned int {
+        FLUX_MAP_FLAT     = 0u,   // a rectangle in the plane of axis_u and axis_v
+        FLUX_MAP_CYLINDER = 1u    // the side of a cylinder along axis_v, unwrapped
+    };
+
+    /// Frame of the flux grid of one receiver: nx by ny cells over a width by height rectangle
+    /// centered at center and spanned by the unit axes u and v. The rectangle of a rectangle receiver,
+    /// the bounding rectangle of a triangle one, whose cells outside the triangle stay empty. For a
+    /// cylinder u is the azimuth, from axis_u (base_x) towards base_z over width = 2 pi radius, and v
+    /// the height along the axis.
+    struct FluxMapGrid {
+        float3 center;
+        float3 axis_u;
+        float3 axis_v;
+        float  width;
+        float  height;
+        float  radius;
+        unsigned int shape;
+    };
+
+    /// Receiver flux maps filled during the trace, one grid of nx * ny cells per receiver, row by
+    /// row along u, holding the power of the receiver hits in W. power == nullptr turns them off.
+    /// element_power sums the same hits per element, the facets of a mesh receiver, without the
+    /// grids; nullptr turns it off.
+    struct FluxMapData {
+        float*             power;          // num_maps grids one after the other
+        const int*         map_index;      // per element, index of its grid, -1 for the elements without one
+        const FluxMapGrid* grids;
+        unsigned int       nx;
+        unsigned int       ny;
+        float*             element_power;  // per element
+    };
+
+    /// Cell of the grid holding point p, -1 when p is outside the rectangle, or on a cap of the
+    /// cylinder, which lies inside its radius.
+    INLINE HOSTDEVICE int flux_map_cell(const FluxMapGrid& grid, const float3& p, unsigned int nx, unsigned int ny)
+    {
+        const float3 d = p - grid.center;
+        float u;
+        if (grid.shape == FLUX_MAP_CYLINDER) {
+            const float x = dot(d, grid.axis_u);
+            const float z = dot(d, cross(grid.axis_u, grid.axis_v));   // base_z, axis_v = base_z x base_x
+            if (x * x + z * z < 0.998f * grid.radius * grid.radius) return -1;
+            const float theta = atan2f(z, x);
+            u = (theta < 0.0f ? theta + 2.0f * M_PIf : theta) / (2.0f * M_PIf);
+            if (u >= 1.0f) u = 0.0f;   // a tiny negative azimuth rounds up to 2 pi
+        }
+        else {
+            u = dot(d, grid.axis_u) / grid.width + 0.5f;
+        }
+        float v = dot(d, grid.axis_v) / grid.height + 0.5f;
+        if (grid.shape == FLUX_MAP_CYLINDER)
+            v = fminf(fmaxf(v, 0.0f), 0.999999f);   // a hit on the side rounds past its rims
+        if (!(u >= 0.0f && u < 1.0f && v >= 0.0f && v < 1.0f)) return -1;
+        unsigned int iu = static_cast<unsigned int>(u * nx);
+        unsigned int iv = static_cast<unsigned int>(v * ny);
+        if (iu >= nx) iu = nx - 1;   // u * nx rounds up to nx just below 1
+        if (iv >= ny) iv = ny - 1;
+        return static_cast<int>(iv * nx + iu);
+    }
+}
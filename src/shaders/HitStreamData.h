@@ -0,0 +1,44 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// HitRecord::element of the sun point of a path, which lies on no element.
+    const unsigned int HIT_NO_ELEMENT = 0xffffffffu;
+
+    /// One interaction of a path in the hit stream: where, on which element and with which power
+    /// the ray arrived, and its place in the path, the slot (ray, depth) of the fixed hit point
+    /// buffer. The tag is the one of the hit point buffer: sun 0, mirror 1, receiver 2, virtual 3.
+    struct HitRecord {
+        float3         position;
+        float          power;     // W, of the ray arriving there
+        unsigned int   ray;       // index of the sun ray of the path in the run
+        unsigned int   element;   // in stage order, HIT_NO_ELEMENT for the sun point
+        unsigned short depth;
+        unsigned short tag;
+    };
+
+    /// Append-only stream of the hit records of a launch, replacing the fixed width * height *
+    /// max_depth hit point buffer when records != nullptr. Every interaction reserves the next slot
+    /// through the counter; once it passes the capacity the record is dropped and the lowest ray
+    /// that lost one is kept, so that the rays from it on can be traced again into a cleared stream.
+    struct HitStreamData {
+        HitRecord*          records;
+        unsigned long long* count;            // slots reserved, past capacity once the stream overflowed
+        unsigned int*       first_lost_ray;   // lowest ray that lost a record, 0xffffffff when none did
+        unsigned long long  capacity;
+        unsigned int        ray_offset;       // ray of launch index 0, past 0 in a resumed pass
+    };
+
+#ifdef __CUDACC__
+    /// Reserve a slot and write record to it, or note the loss of its ray when the stream is full.
+    static __device__ __inline__ void appendHitRecord(const HitStreamData& stream, const HitRecord& record)
+    {
+        const unsigned long long slot = atomicAdd(stream.count, 1ull);
+        if (slot < stream.capacity)
+            stream.records[slot] = record;
+        else
+            atomicMin(stream.first_lost_ray, record.ray);
+    }
+#endif
+}
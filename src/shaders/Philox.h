@@ -0,0 +1,71 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// multipliers and Weyl constants of Philox4x32
+    const unsigned int PHILOX_M0 = 0xD2511F53u;
+    const unsigned int PHILOX_M1 = 0xCD9E8D57u;
+    const unsigned int PHILOX_W0 = 0x9E3779B9u;
+    const unsigned int PHILOX_W1 = 0xBB67AE85u;
+
+    INLINE HOSTDEVICE unsigned int mul_hi_u32(unsigned int a, unsigned int b)
+    {
+#ifdef __CUDA_ARCH__
+        return __umulhi(a, b);
+#else
+        return static_cast<unsigned int>((static_cast<unsigned long long>(a) * b) >> 32);
+#endif
+    }
+
+    /// Philox4x32-10 of Salmon et al. (Random123, SC 2011)
+    INLINE HOSTDEVICE uint4 philox4x32_10(uint4 ctr, uint2 key)
+    {
+        for (int round = 0; round < 10; round++) {
+            if (round > 0) {
+                key.x += PHILOX_W0;
+                key.y += PHILOX_W1;
+            }
+            const unsigned int hi0 = mul_hi_u32(PHILOX_M0, ctr.x);
+            const unsigned int lo0 = PHILOX_M0 * ctr.x;
+            const unsigned int hi1 = mul_hi_u32(PHILOX_M1, ctr.z);
+            const unsigned int lo1 = PHILOX_M1 * ctr.z;
+            ctr = make_uint4(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+        }
+        return ctr;
+    }
+
+    /// Four random words of draw number draw of the stream (seed, index, bounce). Counter words 0-1
+    /// hold the ray or sample index, word 2 the bounce and word 3 the draw; the seed is the key.
+    /// Every stream is there at the cost of ten rounds, without state to set up, and the words are
+    /// the same on the host and the device.
+    INLINE HOSTDEVICE uint4 philox_random(unsigned long long seed, unsigned long long index, unsigned int bounce,
+                                          unsigned int draw = 0)
+    {
+        const uint4 ctr = make_uint4(static_cast<unsigned int>(index), static_cast<unsigned int>(index >> 32), bounce, draw);
+        const uint2 key = make_uint2(static_cast<unsigned int>(seed), static_cast<unsigned int>(seed >> 32));
+        return philox4x32_10(ctr, key);
+    }
+
+    /// random word to a float in (0, 1], the range of curand_uniform
+    INLINE HOSTDEVICE float philox_uniform(unsigned int x)
+    {
+        return ((x >> 8) + 1) * (1.0f / 16777216.0f);
+    }
+
+    /// four uniform numbers in (0, 1] of draw number draw of the stream (seed, index, bounce)
+    INLINE HOSTDEVICE float4 random_uniform4(unsigned long long seed, unsigned long long index, unsigned int bounce,
+                                             unsigned int draw = 0)
+    {
+        const uint4 r = philox_random(seed, index, bounce, draw);
+        return make_float4(philox_uniform(r.x), philox_uniform(r.y), philox_uniform(r.z), philox_uniform(r.w));
+    }
+
+    /// two standard normal numbers from two uniform ones in (0, 1] (Box-Muller)
+    INLINE HOSTDEVICE float2 box_muller(float u1, float u2)
+    {
+        const float r = sqrtf(-2.0f * logf(u1));
+        const float phi = 2.0f * M_PIf * u2;
+        return make_float2(r * cosf(phi), r * sinf(phi));
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// How the reflectivity of a mirror acts on the power a ray carries.
+    enum RayWeighting : unsigned int {
+        RAY_WEIGHTED = 0,   // every reflected ray goes on with its power times the reflectivity
+        RAY_ROULETTE = 1    // the ray goes on with all its power with the reflectivity as probability
+    };
+
+    /// Power of the ray reflected by a mirror, 0 ends the path. Both keep the mean power; the weighted
+    /// one deposits a fraction of every ray where the roulette deposits all of a few, so a receiver
+    /// sees the same flux with less variance. u is uniform in (0, 1], only the roulette draws it.
+    INLINE HOSTDEVICE float reflected_power(unsigned int weighting, float power, float reflectivity, float u)
+    {
+        if (weighting == RAY_ROULETTE)
+            return u <= reflectivity ? power : 0.0f;
+        return power * reflectivity;
+    }
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// Sequence the sun rays are drawn from. Every sample is addressed by its index alone, so a
+    /// launch can start anywhere in the sequence at no cost.
+    enum SamplerType : unsigned int {
+        SAMPLER_HALTON = 0,      // radical inverse in bases 2 and 3 for the position, pseudo random directions
+        SAMPLER_SOBOL_OWEN = 1,  // Owen scrambled Sobol points for the position and, scrambled apart, the direction
+        SAMPLER_STRATIFIED = 2   // jittered strata, visited in a random order by every pass over them
+    };
+
+    /// Sampler of a launch. Ray i of the launch takes sample sample_offset + i, a launch that goes on
+    /// with the rays of an earlier one only moves the offset.
+    struct SamplerData {
+        unsigned int       type;
+        unsigned int       seed;            // scrambling of SOBOL_OWEN and STRATIFIED
+        unsigned long long sample_offset;
+        unsigned int       strata_x;        // strata of STRATIFIED, a pass covers strata_x * strata_y samples
+        unsigned int       strata_y;
+    };
+
+    /// strata of STRATIFIED for launches of num_samples rays: the squarest grid of at most that many cells
+    INLINE HOSTDEVICE void set_sampler_strata(SamplerData& s, unsigned int num_samples)
+    {
+        unsigned int nx = static_cast<unsigned int>(sqrtf(static_cast<float>(num_samples)));
+        while (nx > 1 && nx * nx > num_samples) nx--;
+        while ((nx + 1) * (nx + 1) <= num_samples) nx++;
+        s.strata_x = nx > 0 ? nx : 1;
+        s.strata_y = num_samples / s.strata_x > 0 ? num_samples / s.strata_x : 1;
+    }
+
+    INLINE HOSTDEVICE unsigned int reverse_bits(unsigned int x)
+    {
+#ifdef __CUDA_ARCH__
+        return __brev(x);
+#else
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+#endif
+    }
+
+    /// 32 bit integer hash (lowbias32)
+    INLINE HOSTDEVICE unsigned int hash_u32(unsigned int x)
+    {
+        x ^= x >> 16;
+        x *= 0x21f0aaadu;
+        x ^= x >> 15;
+        x *= 0x735a2d97u;
+        x ^= x >> 15;
+        return x;
+    }
+
+    INLINE HOSTDEVICE unsigned int hash_combine(unsigned int seed, unsigned int v)
+    {
+        return seed ^ (hash_u32(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+    }
+
+    /// fixed point fraction to a float in [0, 1)
+    INLINE HOSTDEVICE float u32_to_unit_float(unsigned int x)
+    {
+        return (x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /// radical inverse of index in the given base, the digits are peeled off one division at a time
+    INLINE HOSTDEVICE float halton(unsigned long long index, unsigned int base)
+    {
+        float f = 1.0f, result = 0.0f;
+        while (index > 0) {
+            f = f / base;
+            result = result + f * (index % base);
+            index = index / base;
+        }
+        return result;
+    }
+
+    /// Dimension 0 to 3 of the Sobol sequence as 32 bit fractions. Dimension 0 is the bit reversal
+    /// of the index, the others use the direction numbers of Joe and Kuo, generated on the fly from
+    /// their polynomials x + 1 (m = 1), x^2 + x + 1 (m = 1, 3) and x^3 + x + 1 (m = 1, 3, 1).
+    INLINE HOSTDEVICE unsigned int sobol_dimension(unsigned int index, int dim)
+    {
+        if (dim == 0) return reverse_bits(index);
+
+        unsigned int a = 1u << 31, b = 3u << 30, c = 1u << 29;   // the next direction numbers
+        unsigned int result = 0;
+        for (; index; index >>= 1) {
+            if (index & 1) result ^= a;
+            if (dim == 1) {
+                a = a ^ (a >> 1);
+            }
+            else if (dim == 2) {
+                const unsigned int next = b ^ a ^ (a >> 2);
+                a = b;
+                b = next;
+            }
+            else {
+                const unsigned int next = b ^ a ^ (a >> 3);
+                a = b;
+                b = c;
+                c = next;
+            }
+        }
+        return result;
+    }
+
+    /// Owen scrambling of a 32 bit fraction: every bit is flipped depending on the bits above it.
+    /// Hash of Laine and Karras, applied to the reversed bits (Burley 2020).
+    INLINE HOSTDEVICE unsigned int nested_uniform_scramble(unsigned int x, unsigned int seed)
+    {
+        x = reverse_bits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverse_bits(x);
+    }
+
+    /// Two dimensions of an Owen scrambled Sobol point, every dimension under its own scramble. The
+    /// index is scrambled too, which only reorders the points inside every aligned block of 2^k, so
+    /// any such block is still a net.
+    INLINE HOSTDEVICE float2 sobol_owen_2d(unsigned long long index, unsigned int seed, int first_dim)
+    {
+        // beyond 2^32 points a new scramble of the sequence starts
+        seed = hash_combine(seed, static_cast<unsigned int>(index >> 32));
+        const unsigned int i = nested_uniform_scramble(static_cast<unsigned int>(index), seed);
+        const unsigned int x = nested_uniform_scramble(sobol_dimension(i, first_dim), hash_combine(seed, first_dim + 1));
+        const unsigned int y = nested_uniform_scramble(sobol_dimension(i, first_dim + 1), hash_combine(seed, first_dim + 2));
+        return make_float2(u32_to_unit_float(x), u32_to_unit_float(y));
+    }
+
+    /// Position of i in a pseudo random permutation of [0, n), Kensler's cycle walking hash
+    /// (Correlated Multi-Jittered Sampling, 2013).
+    INLINE HOSTDEVICE unsigned int permute(unsigned int i, unsigned int n, unsigned int seed)
+    {
+        unsigned int w = n - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= seed;
+            i *= 0xe170893du;
+            i ^= seed >> 16;
+            i ^= (i & w) >> 4;
+            i ^= seed >> 8;
+            i *= 0x0929eb3fu;
+            i ^= seed >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | seed >> 27;
+            i *= 0x6935fa69u;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303u;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3u;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3dfu;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= n);
+        return (i + seed) % n;
+    }
+
+    /// Jittered stratum. Sample index falls into pass index / (strata_x * strata_y), each pass
+    /// visits all the strata in its own random order, so a pass is stratified and a part of one is
+    /// a uniform random subset of the strata.
+    INLINE HOSTDEVICE float2 stratified_2d(const SamplerData& s, unsigned long long index, unsigned int seed)
+    {
+        const unsigned int num_strata = s.strata_x * s.strata_y;
+        const unsigned long long pass = index / num_strata;
+        const unsigned int pass_seed = hash_combine(hash_combine(seed, static_cast<unsigned int>(pass)),
+                                                    static_cast<unsigned int>(pass >> 32));
+        const unsigned int stratum = permute(static_cast<unsigned int>(index % num_strata), num_strata, pass_seed);
+
+        const unsigned int jitter = hash_combine(pass_seed, static_cast<unsigned int>(index % num_strata));
+        const float jx = u32_to_unit_float(hash_u32(jitter));
+        const float jy = u32_to_unit_float(hash_u32(jitter ^ 0x5bd1e995u));
+        const float x = ((stratum % s.strata_x) + jx) / s.strata_x;
+        const float y = ((stratum / s.strata_x) + jy) / s.strata_y;
+        return make_float2(fminf(x, 0.99999994f), fminf(y, 0.99999994f));
+    }
+
+    /// position of a sample on the sun plane, in units of its two edges
+    INLINE HOSTDEVICE float2 sample_sun_plane(const SamplerData& s, unsigned long long index)
+    {
+        if (s.type == SAMPLER_SOBOL_OWEN)
+            return sobol_owen_2d(index, s.seed, 0);
+        if (s.type == SAMPLER_STRATIFIED)
+            return stratified_2d(s, index, hash_combine(s.seed, 0));
+        return make_float2(halton(index, 2), halton(index, 3));
+    }
+
+    /// Random numbers of the direction of a sample, in [0, 1). SOBOL_OWEN takes dimensions 2 and 3 of
+    /// the point of the position, so both are stratified together; STRATIFIED visits the strata in
+    /// an order of their own. Not for HALTON, which takes the direction from the pseudo random
+    /// stream of the ray.
+    INLINE HOSTDEVICE float2 sample_sun_direction(const SamplerData& s, unsigned long long index)
+    {
+        if (s.type == SAMPLER_STRATIFIED)
+            return stratified_2d(s, index, hash_combine(s.seed, 1));
+        return sobol_owen_2d(index, s.seed, 2);
+    }
+}
@@ -2,6 +2,12 @@
 
 #include "GeometryDataST.h"
 #include "MaterialDataST.h"
+#include "SunShapeData.h"
+#include "SamplerData.h"
+#include "RayPower.h"
+#include "StageData.h"
+#include "FluxMapData.h"
+#include "HitStreamData.h"
 
 #include <vector_types.h>
 #include <optix.h>
@@ -9,8 +15,8 @@
 namespace OptixCSP{
 
     const unsigned int NUM_ATTRIBUTE_VALUES = 4u;
-    const unsigned int NUM_PAYLOAD_VALUES   = 2u;
-    const unsigned int MAX_TRACE_DEPTH      = 5u;
+    const unsigned int NUM_PAYLOAD_VALUES   = 10u;
+    const unsigned int MAX_TRACE_DEPTH      = 5u;   // default hit points per path, the sun point included
     
     struct HitGroupData
     {
@@ -36,11 +42,12 @@ namespace OptixCSP{
     {
         unsigned int                width;   // essentially number of rays launched and sun points 
         unsigned int                height;
-        int                         max_depth;
+        int                         max_depth;    // hit points per path, a launch parameter: the raygen loop does not recurse
 
-        float4*                     hit_point_buffer;
+        float4*                     hit_point_buffer;   // nullptr when the hits go to hit_stream
+        float*                      hit_power_buffer;   // power of the ray arriving at each hit point, same layout
         float3*                     sun_dir_buffer;
-        OptixTraversableHandle      handle;
+        OptixTraversableHandle      handle;       // IAS over one GAS per stage, the visibility mask bit of a stage is 1 << stage
 
         float3                      sun_vector;
         float                       max_sun_angle;
@@ -51,13 +58,28 @@ namespace OptixCSP{
         float3                      sun_v2;
         float3                      sun_v3;
 
+        SunShapeData                sun_shape;    // num_bins == 0: pillbox cone of max_sun_angle
+        SamplerData                 sampler;      // sun plane positions and, unless Halton, directions
+        float                       ray_power;    // power of a sun ray, dni times the sun plane area over the rays
+        unsigned int                ray_weighting;  // RayWeighting, how the mirrors reflect the power
+
 	    GeometryDataST*             geometry_data_array;
+        MaterialData*               material_data_array;  // per element like geometry_data_array, optics of the mirrors
+        StageData*                  stage_data_array;     // element range and flags of every stage
+        unsigned int                num_stages;
+        FluxMapData                 flux_map;             // receiver flux grids the receiver hits are deposited in
+        HitStreamData               hit_stream;           // compact hit records, records == nullptr when off
     };
 
     struct PerRayData
     {
         unsigned int ray_path_index;  // Index of the ray in the ray path buffer
         unsigned int depth;           // Trace depth
+        float        power;           // Power the ray carries, W
+        unsigned int stage;           // Stage the ray is traced in, STAGE_HIT once it interacted there;
+                                      // num_stages ends the path
+        float3       origin;          // next segment of the path, written by the closest-hit programs
+        float3       direction;
     };
 
 } // end namespace OptixCSP
\ No newline at end of file
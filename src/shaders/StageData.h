@@ -0,0 +1,55 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// stages of a scene, one visibility mask bit each
+    const unsigned int MAX_STAGES = 8u;
+
+    /// Interaction rules of a stage, the flags of a STAGE line of a stinput file.
+    enum StageFlags : unsigned int {
+        STAGE_VIRTUAL      = 1u,    // the elements record the rays crossing them and leave them as they are
+        STAGE_MULTIHIT     = 2u,    // a ray can interact with several elements of the stage, one after the other
+        STAGE_TRACETHROUGH = 4u     // a ray that misses every element of the stage goes on to the next one
+    };
+
+    /// Bit of PerRayData::stage set once the ray interacted with an element of the stage it is in,
+    /// below it the index of the stage.
+    const unsigned int STAGE_HIT        = 1u << 16;
+    const unsigned int STAGE_INDEX_MASK = STAGE_HIT - 1u;
+
+    /// Elements of a stage, a range of the element arrays since the elements are ordered by stage.
+    struct StageData {
+        unsigned int first_element;
+        unsigned int num_elements;
+        unsigned int flags;
+    };
+
+    /// Tag of the hit points recorded on the elements of a virtual stage, after the sun (0), the
+    /// mirrors (1) and the receivers (2).
+    const float HIT_TAG_VIRTUAL = 3.0f;
+
+    /// Stage a ray is traced against after it interacted with an element of stage, the number of
+    /// stages when it leaves the last one: the same stage when MULTIHIT, the next one otherwise.
+    INLINE HOSTDEVICE unsigned int stage_after_interaction(const StageData* stages, unsigned int stage)
+    {
+        return (stages[stage].flags & STAGE_MULTIHIT) ? stage : stage + 1;
+    }
+
+    /// PerRayData::stage of a ray that goes on in stage after an interaction in previous: it has
+    /// interacted in stage when both are the same.
+    INLINE HOSTDEVICE unsigned int stage_state(unsigned int stage, unsigned int previous)
+    {
+        return stage == previous ? (stage | STAGE_HIT) : stage;
+    }
+
+    /// Stage a ray goes on in after it missed every element of stage, num_stages when it is lost: the
+    /// next stage when the ray already interacted in this one, which is how it leaves a MULTIHIT
+    /// stage, or when the stage traces through.
+    INLINE HOSTDEVICE unsigned int stage_after_miss(const StageData* stages, unsigned int num_stages,
+                                                    unsigned int stage, bool hit_in_stage)
+    {
+        if (hit_in_stage || (stages[stage].flags & STAGE_TRACETHROUGH)) return stage + 1;
+        return num_stages;
+    }
+}
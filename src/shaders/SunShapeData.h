@@ -0,0 +1,57 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    /// Radial sunshape as an alias table over num_bins equal bins of the angle from the sun center,
+    /// [0, max_angle]. Built on the host by SunShape, sampled in O(1) by the host tracer
+    /// and by the raygen program. num_bins == 0 means no table: the pillbox cone is used.
+    struct SunShapeData {
+        int          num_bins;
+        float        max_angle;     // radians
+        const float* alias_prob;    // probability of keeping the bin instead of its alias
+        const int*   alias_index;
+    };
+
+    /// Angle from the sun center for the uniform number r in (0, 1]. The integer part of r * num_bins
+    /// picks the bin, the fraction decides between the bin and its alias and is then reused for the
+    /// position in the bin, where the density grows like the solid angle, i.e. like the angle.
+    INLINE HOSTDEVICE float sample_sun_shape_angle(const SunShapeData& s, float r)
+    {
+        const float x = r * s.num_bins;
+        int bin = static_cast<int>(x);
+        if (bin > s.num_bins - 1) bin = s.num_bins - 1;
+        float frac = x - bin;
+        if (frac > 0.99999994f) frac = 0.99999994f;
+
+        const float p = s.alias_prob[bin];
+        if (frac < p) {
+            frac = frac / p;
+        }
+        else {
+            frac = (frac - p) / (1.0f - p);
+            bin = s.alias_index[bin];
+        }
+
+        const float width = s.max_angle / s.num_bins;
+        const float lo = bin * width;
+        const float hi = lo + width;
+        return sqrtf(lo * lo + frac * (hi * hi - lo * lo));
+    }
+
+    /// Direction around dir following the sunshape, r1 gives the azimuth and r2 the angle, the
+    /// same roles as in sampleRayDirectionInCone_Pillbox.
+    INLINE HOSTDEVICE float3 sample_sun_shape_direction(const SunShapeData& s, float3 dir, float r1, float r2)
+    {
+        float3 w = normalize(dir);
+        float3 u = normalize(cross(fabsf(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
+        float3 v = cross(w, u);
+
+        const float theta = sample_sun_shape_angle(s, r2);
+        const float phi = 2.0f * M_PIf * r1;
+        const float r = sinf(theta);
+        const float z = cosf(theta);
+
+        return normalize(r * (cosf(phi) * u + sinf(phi) * v) + z * w);
+    }
+}
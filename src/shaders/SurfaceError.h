@@ -0,0 +1,46 @@
+#pragma once
+#include "device_util.h"
+#include "MaterialDataST.h"
+#include "Philox.h"
+
+namespace OptixCSP {
+
+    /// Angular spread (radians, per axis) of the light reflected by a mirror. The slope error tilts
+    /// the normal, which turns the reflection by twice the angle, and the specularity error spreads
+    /// the reflection itself; both are gaussian and independent, so the reflection sees one gaussian
+    /// of sqrt(4 slope^2 + specularity^2), the total optical error of SolTrace.
+    INLINE HOSTDEVICE float surface_error_sigma(const MaterialData::Mirror& mirror)
+    {
+        return sqrtf(4.0f * mirror.slope_error * mirror.slope_error
+                     + mirror.specularity_error * mirror.specularity_error);
+    }
+
+    /// Uniform random numbers in (0, 1] of a bounce: the Philox stream of the sun sample, the bounce
+    /// being the depth of the hit (the sun direction uses bounce 0). x and y turn the reflection by
+    /// the surface error, z decides the roulette of RAY_ROULETTE.
+    INLINE HOSTDEVICE float4 bounce_randoms(unsigned long long seed, unsigned long long sample_index,
+                                            unsigned int bounce)
+    {
+        return random_uniform4(seed, sample_index, bounce);
+    }
+
+    /// Reflected direction turned by a gaussian of sigma per axis around it, one draw (r1, r2) per
+    /// bounce. A direction that ends up behind the mirror, which only grazing light can give, keeps
+    /// the ideal reflection.
+    INLINE HOSTDEVICE float3 apply_surface_error(float3 reflected, float3 ffnormal, float sigma, float r1, float r2)
+    {
+        if (!(sigma > 0.0f)) return reflected;
+
+        float3 w = normalize(reflected);
+        float3 u = normalize(cross(fabsf(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
+        float3 v = cross(w, u);
+
+        const float2 g = box_muller(r1, r2);
+        const float g_len = sqrtf(g.x * g.x + g.y * g.y);
+        if (!(g_len > 0.0f)) return w;
+        const float theta = sigma * g_len;
+        const float s = sinf(theta) / g_len;
+        const float3 d = normalize(s * (g.x * u + g.y * v) + cosf(theta) * w);
+        return dot(d, ffnormal) > 0.0f ? d : w;
+    }
+}
@@ -1,6 +1,7 @@
 #include <optix_device.h>
 #include <vector_types.h>
 #include "Soltrace.h"
+#include "SurfaceError.h"
 
 
 namespace OptixCSP {
@@ -9,6 +10,12 @@ namespace OptixCSP {
         OptixCSP::PerRayData prd;
         prd.ray_path_index = optixGetPayload_0();
         prd.depth = optixGetPayload_1();
+        prd.power = __uint_as_float(optixGetPayload_2());
+        prd.stage = optixGetPayload_3();
+        prd.origin = make_float3(__uint_as_float(optixGetPayload_4()), __uint_as_float(optixGetPayload_5()),
+                                 __uint_as_float(optixGetPayload_6()));
+        prd.direction = make_float3(__uint_as_float(optixGetPayload_7()), __uint_as_float(optixGetPayload_8()),
+                                    __uint_as_float(optixGetPayload_9()));
         return prd;
     }
 
@@ -16,6 +23,14 @@ namespace OptixCSP {
     {
         optixSetPayload_0(prd.ray_path_index);
         optixSetPayload_1(prd.depth);
+        optixSetPayload_2(__float_as_uint(prd.power));
+        optixSetPayload_3(prd.stage);
+        optixSetPayload_4(__float_as_uint(prd.origin.x));
+        optixSetPayload_5(__float_as_uint(prd.origin.y));
+        optixSetPayload_6(__float_as_uint(prd.origin.z));
+        optixSetPayload_7(__float_as_uint(prd.direction.x));
+        optixSetPayload_8(__float_as_uint(prd.direction.y));
+        optixSetPayload_9(__float_as_uint(prd.direction.z));
     }
 
 }
@@ -28,10 +43,86 @@ extern "C" {
     __constant__ OptixCSP::LaunchParams params;
 }
 
+namespace OptixCSP {
+    // The path goes on from origin along direction in stage next_stage, after an interaction in
+    // stage; past the last stage it leaves the system. __raygen__sun_source traces the next segment.
+    static __device__ __inline__ void continuePath(OptixCSP::PerRayData& prd, const float3& origin, const float3& direction,
+                                                   unsigned int next_stage, unsigned int stage)
+    {
+        prd.origin = origin;
+        prd.direction = direction;
+        prd.stage = next_stage < params.num_stages ? OptixCSP::stage_state(next_stage, stage) : params.num_stages;
+    }
+
+    static __device__ __inline__ void endPath(OptixCSP::PerRayData& prd)
+    {
+        prd.stage = params.num_stages;
+    }
+
+    // Record the interaction at depth of the path in the fixed hit point buffer, or, when the launch
+    // writes the hit stream instead, append it there with the element it landed on.
+    static __device__ __inline__ void recordHit(const OptixCSP::PerRayData& prd, int depth, float tag,
+                                                const float3& hit_point, unsigned int element)
+    {
+        if (params.hit_point_buffer) {
+            params.hit_point_buffer[params.max_depth * prd.ray_path_index + depth] = make_float4(tag, hit_point);
+            params.hit_power_buffer[params.max_depth * prd.ray_path_index + depth] = prd.power;
+        }
+        if (params.hit_stream.records) {
+            OptixCSP::HitRecord record;
+            record.position = hit_point;
+            record.power = prd.power;
+            record.ray = params.hit_stream.ray_offset + prd.ray_path_index;
+            record.element = element;
+            record.depth = static_cast<unsigned short>(depth);
+            record.tag = static_cast<unsigned short>(tag);
+            OptixCSP::appendHitRecord(params.hit_stream, record);
+        }
+    }
+
+    // The power of a receiver hit goes to its element and to the cell of the flux map of the
+    // receiver it lands in; atomics merge the deposits of all the threads in the one array and grid.
+    static __device__ __inline__ void depositFlux(unsigned int element, const float3& hit_point, float power)
+    {
+        const OptixCSP::FluxMapData& flux_map = params.flux_map;
+        if (flux_map.element_power)
+            atomicAdd(&flux_map.element_power[element], power);
+        if (!flux_map.power) return;
+        const int map = flux_map.map_index[element];
+        if (map < 0) return;
+        const int cell = OptixCSP::flux_map_cell(flux_map.grids[map], hit_point, flux_map.nx, flux_map.ny);
+        if (cell >= 0)
+            atomicAdd(&flux_map.power[static_cast<size_t>(map) * flux_map.nx * flux_map.ny + cell], power);
+    }
+
+    // The elements of a virtual stage record the ray crossing them and let it go on unchanged, in
+    // the same stage when it is MULTIHIT and in the next one otherwise. Returns false, and does
+    // nothing, when the stage of the ray is not virtual.
+    static __device__ __inline__ bool passVirtualStage(OptixCSP::PerRayData& prd, const float3& hit_point, const float3& ray_dir)
+    {
+        const unsigned int stage = prd.stage & OptixCSP::STAGE_INDEX_MASK;
+        if (!(params.stage_data_array[stage].flags & OptixCSP::STAGE_VIRTUAL)) return false;
+
+        const int new_depth = prd.depth + 1;
+        if (new_depth < params.max_depth) {
+            recordHit(prd, new_depth, OptixCSP::HIT_TAG_VIRTUAL, hit_point, optixGetPrimitiveIndex());
+            prd.depth = new_depth;
+            continuePath(prd, hit_point, ray_dir,
+                         OptixCSP::stage_after_interaction(params.stage_data_array, stage), stage);
+        }
+        else {
+            endPath(prd);
+        }
+
+        setPayload(prd);
+        return true;
+    }
+}
+
 extern "C" __global__ void __closesthit__mirror()
 {
-    //const OptixCSP::HitGroupData* sbt_data = reinterpret_cast<OptixCSP::HitGroupData*>(optixGetSbtDataPointer());
-    //const MaterialData::Mirror& mirror = sbt_data->material_data.mirror;
+    // optics of this element, the hit group record only holds the defaults of the type
+    const OptixCSP::MaterialData::Mirror& mirror = params.material_data_array[optixGetPrimitiveIndex()].mirror;
 
     // Fetch the normal vector from the hit attributes passed by OptiX
     float3 object_normal = make_float3( __uint_as_float( optixGetAttribute_0() ), __uint_as_float( optixGetAttribute_1() ),
@@ -50,39 +141,44 @@ extern "C" __global__ void __closesthit__mirror()
     const float3 hit_point = ray_orig + ray_t * ray_dir;
 
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    if (OptixCSP::passVirtualStage(prd, hit_point, ray_dir)) return;
     const int new_depth = prd.depth + 1;    // Increment the ray depth for recursive tracing
 
     // Calculate ideal reflection direction using OptiX's built-in reflect function
     float3 reflected_dir = reflect(ray_dir, ffnormal);
 
-    // TODO: Add some noise here
-
-    // Check if the maximum recursion depth has not been reached
+    // Turn it by the slope and specularity errors and scale the power by the reflectivity, one draw of
+    // the Philox stream of the sun sample per bounce
+    const float sigma = OptixCSP::surface_error_sigma(mirror);
+    float4 rand = make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    if (sigma > 0.0f || params.ray_weighting == OptixCSP::RAY_ROULETTE)
+        rand = OptixCSP::bounce_randoms(params.sun_dir_seed, params.sampler.sample_offset + prd.ray_path_index, new_depth);
+    if (sigma > 0.0f)
+        reflected_dir = OptixCSP::apply_surface_error(reflected_dir, ffnormal, sigma, rand.x, rand.y);
+    const float reflected_power = OptixCSP::reflected_power(params.ray_weighting, prd.power, mirror.reflectivity, rand.z);
+
+    // Check if the maximum depth has not been reached
     if (new_depth < params.max_depth) {
         // Store the hit point in the hit point buffer (used for visualization or further calculations)
-        params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(1.0f, hit_point);
+        OptixCSP::recordHit(prd, new_depth, 1.0f, hit_point, optixGetPrimitiveIndex());
         // Store the reflected direction in its buffer (used for visualization or further calculations)
         /*
         params.reflected_dir_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(1.0f, reflected_dir);
         */
 
-        // Trace the reflected ray
+        // The reflected ray goes on, unless the roulette absorbed it, in the same stage when it is
+        // MULTIHIT and in the next one otherwise; past the last stage the ray leaves the system
         prd.depth = new_depth;
-        optixTrace(
-            params.handle,          // The handle to the acceleration structure
-            hit_point,              // The starting point of the reflected ray
-            reflected_dir,          // The direction of the reflected ray
-            0.01f,                  // A small offset to avoid self-intersection (shadow acne)
-            1e16f,                  // Maximum distance the ray can travel
-            0.0f,                   // Ray time (used for time-dependent effects)
-            OptixVisibilityMask(1), // Visibility mask (defines what the ray can interact with)
-            OPTIX_RAY_FLAG_NONE,    // Ray flags (no special flags for now)
-            OptixCSP::RAY_TYPE_RADIANCE,  // Use the radiance ray type
-            OptixCSP::RAY_TYPE_COUNT,     // Total number of ray types
-            OptixCSP::RAY_TYPE_RADIANCE,  // The ray type's offset into the SBT
-            reinterpret_cast<unsigned int&>(prd.ray_path_index), // Pass the ray path index
-            reinterpret_cast<unsigned int&>(prd.depth)           // Pass the updated depth
-        );
+        prd.power = reflected_power;
+        const unsigned int stage = prd.stage & OptixCSP::STAGE_INDEX_MASK;
+        if (reflected_power > 0.0f)
+            OptixCSP::continuePath(prd, hit_point, reflected_dir,
+                                   OptixCSP::stage_after_interaction(params.stage_data_array, stage), stage);
+        else
+            OptixCSP::endPath(prd);
+    }
+    else {
+        OptixCSP::endPath(prd);
     }
 
     setPayload(prd);
@@ -105,16 +201,20 @@ extern "C" __global__ void __closesthit__receiver()
     float3 hit_point = ray_orig + ray_t * ray_dir;
 
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    if (OptixCSP::passVirtualStage(prd, hit_point, ray_dir)) return;
     const int new_depth = prd.depth + 1;
 
     // Check if the ray hits the receiver surface (dot product negative means ray is hitting the front face)
     if (dot_product < 0.0f) {
         if (new_depth < params.max_depth) {
-            params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(2.0f, hit_point);
+            OptixCSP::recordHit(prd, new_depth, 2.0f, hit_point, optixGetPrimitiveIndex());
             prd.depth = new_depth;
+            OptixCSP::depositFlux(optixGetPrimitiveIndex(), hit_point, prd.power);
         }
     }
 
+    // the receiver absorbs the ray, front or back
+    OptixCSP::endPath(prd);
     setPayload(prd);
 }
 
@@ -147,16 +247,19 @@ extern "C" __global__ void __closesthit__receiver__cylinder__y()
     float3 hit_point = ray_orig + ray_t * ray_dir;
 
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    if (OptixCSP::passVirtualStage(prd, hit_point, ray_dir)) return;
     const int new_depth = prd.depth + 1;
 
     // Check if the ray hits the receiver surface (dot product negative means ray is hitting the front face)
     //if (dot_product < 0.0f) {
         if (new_depth < params.max_depth) {
-            params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(2.0f, hit_point);
+            OptixCSP::recordHit(prd, new_depth, 2.0f, hit_point, optixGetPrimitiveIndex());
             prd.depth = new_depth;
+            OptixCSP::depositFlux(optixGetPrimitiveIndex(), hit_point, prd.power);
         }
     //}
 
+    OptixCSP::endPath(prd);
     setPayload(prd);
 }
 
@@ -167,9 +270,8 @@ extern "C" __global__ void __closesthit__receiver__cylinder__y()
 // __intersection__rectangle_parabolic) reports a normal that already accounts for the curvature.
 extern "C" __global__ void __closesthit__mirror__parabolic()
 {
-    // Optionally, you can access material data if needed:
-    // const OptixCSP::HitGroupData* sbt_data = reinterpret_cast<OptixCSP::HitGroupData*>( optixGetSbtDataPointer() );
-    // const MaterialData::Mirror& mirror = sbt_data->material_data.mirror;
+    // Optics of this element.
+    const OptixCSP::MaterialData::Mirror& mirror = params.material_data_array[optixGetPrimitiveIndex()].mirror;
 
     // Retrieve the hit normal from the attributes.
     // The intersection shader for the parabolic surface reported the normal (using float3_as_args)
@@ -194,34 +296,38 @@ extern "C" __global__ void __closesthit__mirror__parabolic()
 
     // Retrieve per�ray payload.
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    if (OptixCSP::passVirtualStage(prd, hit_point, ray_dir)) return;
     const int new_depth = prd.depth + 1; // Increase recursion depth.
 
     // Compute the reflected ray direction.
     float3 reflected_dir = reflect(ray_dir, ffnormal);
 
-    // (Optional: Add noise to reflected_dir if desired.)
+    // Apply the slope and specularity errors and the reflectivity, as in __closesthit__mirror().
+    const float sigma = OptixCSP::surface_error_sigma(mirror);
+    float4 rand = make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    if (sigma > 0.0f || params.ray_weighting == OptixCSP::RAY_ROULETTE)
+        rand = OptixCSP::bounce_randoms(params.sun_dir_seed, params.sampler.sample_offset + prd.ray_path_index, new_depth);
+    if (sigma > 0.0f)
+        reflected_dir = OptixCSP::apply_surface_error(reflected_dir, ffnormal, sigma, rand.x, rand.y);
+    const float reflected_power = OptixCSP::reflected_power(params.ray_weighting, prd.power, mirror.reflectivity, rand.z);
 
-    // If the new depth is below the maximum, trace the reflected ray.
+    // If the new depth is below the maximum, the path goes on with the reflected ray.
     if (new_depth < params.max_depth) {
-        // Save the hit point (for visualization or further processing).
-        params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(1.0f, hit_point);
+        // Save the hit point and the power arriving there (for visualization or further processing).
+        OptixCSP::recordHit(prd, new_depth, 1.0f, hit_point, optixGetPrimitiveIndex());
 
+        // Go on in the stage after this one, as in __closesthit__mirror().
         prd.depth = new_depth;
-        optixTrace(
-            params.handle,          // Acceleration structure handle.
-            hit_point,              // Ray origin.
-            reflected_dir,          // Ray direction.
-            0.01f,                  // Minimum t to avoid self-intersection.
-            1e16f,                  // Maximum t.
-            0.0f,                   // Ray time.
-            OptixVisibilityMask(1), // Visibility mask.
-            OPTIX_RAY_FLAG_NONE,    // Ray flags.
-            OptixCSP::RAY_TYPE_RADIANCE,  // Ray type.
-            OptixCSP::RAY_TYPE_COUNT,     // Number of ray types.
-            OptixCSP::RAY_TYPE_RADIANCE,  // SBT offset for this ray type.
-            reinterpret_cast<unsigned int&>(prd.ray_path_index), // Ray path index.
-            reinterpret_cast<unsigned int&>(prd.depth)           // Current recursion depth.
-        );
+        prd.power = reflected_power;
+        const unsigned int stage = prd.stage & OptixCSP::STAGE_INDEX_MASK;
+        if (reflected_power > 0.0f)    // the roulette absorbed it otherwise
+            OptixCSP::continuePath(prd, hit_point, reflected_dir,
+                                   OptixCSP::stage_after_interaction(params.stage_data_array, stage), stage);
+        else
+            OptixCSP::endPath(prd);
+    }
+    else {
+        OptixCSP::endPath(prd);
     }
 
     // Store the updated payload.
@@ -233,11 +339,15 @@ extern "C" __global__ void __closesthit__mirror__parabolic()
 
 extern "C" __global__ void __miss__ms()
 {
-    // No action is taken here.
-    // This function simply acts as a terminator for rays that miss all geometry.
-    
+    // A ray that misses every element of its stage goes on to the next stage, from the same origin,
+    // when it interacted in this one or the stage traces through. Otherwise it is lost. The origin
+    // and direction of the payload are those of this segment, __raygen__sun_source traces it again.
+    OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    const unsigned int stage = prd.stage & OptixCSP::STAGE_INDEX_MASK;
+    prd.stage = OptixCSP::stage_after_miss(params.stage_data_array, params.num_stages, stage,
+                                           (prd.stage & OptixCSP::STAGE_HIT) != 0);
+
     /*
-    OptixCSP::PerRayData prd = getPayload();
     const int new_depth = prd.depth + 1;
 
     if (new_depth < params.max_depth) {
@@ -245,7 +355,5 @@ extern "C" __global__ void __miss__ms()
     }
     */
 
-    // Set the payload values to 0, indicating that the ray missed all geometry.
-    optixSetPayload_0(0);  // Default value
-    optixSetPayload_1(0);
-}
\ No newline at end of file
+    optixSetPayload_3(prd.stage);
+}
@@ -1,12 +1,10 @@
 #include <optix_device.h>
-#include <curand_kernel.h>
 #include <vector_types.h>
 
-// todo: move curand initializatin to global function
-
 //#include <cuda/helpers.h>
 //#include <cuda/random.h>
 #include "Soltrace.h"
+#include "Philox.h"
 
 // Launch parameters for soltrace
 extern "C" {
@@ -15,37 +13,24 @@ extern "C" {
 
 namespace OptixCSP {
 
-    // Halton sequence generator, used for quasi-random sampling
-    // Generates a Halton sequence value for a given index and base
-    __device__ float halton(int index, int base) {
-        float f = 1.0f, result = 0.0f;
-        while (index > 0) {
-            f = f / base;
-            result = result + f * (index % base);
-            index = index / base;
-        }
-        return result;
-    }
-
-    // Generate a sample point within a parallelogram defined by the AABB (Axis-Aligned Bounding Box)
-    // Uses the Halton sequence for sampling
-    __device__ float3 haltonSampleInParallelogram(unsigned int sample_index) {
-        // Generate Halton sequence values
-        float u = halton(sample_index, 2); // Base 2 for x
-        float v = halton(sample_index, 3); // Base 3 for y
-
+    // Point of the sun plane parallelogram for a sample position in units of its edges
+    __device__ float3 sampleInParallelogram(float2 uv) {
         // Compute the two edge vectors of the parallelogram
         float3 edge1 = params.sun_v1 - params.sun_v0; // First edge vector
         float3 edge2 = params.sun_v3 - params.sun_v0; // Second edge vector
 
-        return params.sun_v0 + u * edge1 + v * edge2;
+        return params.sun_v0 + uv.x * edge1 + uv.y * edge2;
     }
 
-    // Sample a random ray direction within a cone defined by a maximum angle
-    __device__ float3 sampleRayDirectionInCone_Pillbox(float3 dir, float half_angle, unsigned int ray_number) {
-        curandState rng_state;
-        curand_init(params.sun_dir_seed, ray_number, 0, &rng_state);
+    // Two uniform random numbers in (0, 1] from the Philox stream of a sample at bounce 0, for the
+    // directions of the Halton sampler
+    __device__ float2 sampleDirectionRandoms(unsigned long long sample_index) {
+        const float4 rand = OptixCSP::random_uniform4(params.sun_dir_seed, sample_index, 0);
+        return make_float2(rand.x, rand.y);
+    }
 
+    // Sample a ray direction within a cone defined by a maximum angle, rand1 gives the azimuth and rand2 the angle
+    __device__ float3 sampleRayDirectionInCone_Pillbox(float3 dir, float half_angle, float rand1, float rand2) {
         // Build an orthonormal basis
         float3 w = normalize(dir);
         float3 u = normalize(cross(fabs(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
@@ -53,8 +38,6 @@ namespace OptixCSP {
 
         // Random angles
         float cosTheta = cosf(half_angle);
-        float rand1 = curand_uniform(&rng_state);
-        float rand2 = curand_uniform(&rng_state);
         float phi = 2.0f * M_PIf * rand1;
         float z = cosTheta + (1.0f - cosTheta) * rand2;
         float r = sqrtf(1.0f - z * z);
@@ -64,16 +47,15 @@ namespace OptixCSP {
     }
 
     __device__ float3 sampleRayDirectionInCone_Gaussian(float3 dir, float half_angle, unsigned int ray_number) {
-        curandState rng;
-        curand_init(params.sun_dir_seed, ray_number, 0, &rng);
-
         // Build an orthonormal basis
         float3 w = normalize(dir);
         float3 u = normalize(cross(fabs(w.x) > 0.99f ? make_float3(0, 1, 0) : make_float3(1, 0, 0), w));
         float3 v = cross(w, u);
 
-        float gx = curand_normal(&rng);
-        float gy = curand_normal(&rng);
+        const float4 rand = OptixCSP::random_uniform4(params.sun_dir_seed, ray_number, 0);
+        const float2 g = OptixCSP::box_muller(rand.x, rand.y);
+        float gx = g.x;
+        float gy = g.y;
 
 
         float thetax = half_angle * gx;
@@ -96,39 +78,82 @@ extern "C" __global__ void __raygen__sun_source()
     const uint3 launch_dims = optixGetLaunchDimensions();   // Dimensions of the launch grid
     const unsigned int ray_number = launch_idx.y * launch_dims.x + launch_idx.x;  // Unique ray ID
 
-    float3 sun_sample_pos = OptixCSP::haltonSampleInParallelogram(ray_number);
+    // index in the sequence of the sampler, launches that go on with earlier ones start at the offset
+    const unsigned long long sample_index = params.sampler.sample_offset + ray_number;
+
+    float3 sun_sample_pos = OptixCSP::sampleInParallelogram(OptixCSP::sample_sun_plane(params.sampler, sample_index));
 
     // Sample emission angle here - capturing sun distribution
     const float3 ray_gen_pos = sun_sample_pos;
 
+    const float2 rand = params.sampler.type == OptixCSP::SAMPLER_HALTON
+        ? OptixCSP::sampleDirectionRandoms(sample_index)
+        : OptixCSP::sample_sun_direction(params.sampler, sample_index);
     float3 init_ray_dir = -normalize(params.sun_vector);
-    float3 ray_dir = OptixCSP::sampleRayDirectionInCone_Pillbox(init_ray_dir, params.max_sun_angle, ray_number);
+    float3 ray_dir = params.sun_shape.num_bins > 0
+        ? OptixCSP::sample_sun_shape_direction(params.sun_shape, init_ray_dir, rand.x, rand.y)
+        : OptixCSP::sampleRayDirectionInCone_Pillbox(init_ray_dir, params.max_sun_angle, rand.x, rand.y);
     //float3 ray_dir = OptixCSP::sampleRayDirectionInCone_Gaussian(init_ray_dir, params.max_sun_angle, ray_number);
 
-    // Create the PerRayData structure to track ray state (e.g., path index and recursion depth)
+    // Create the PerRayData structure to track ray state (e.g., path index and depth)
     OptixCSP::PerRayData prd;
     prd.ray_path_index = ray_number;
     prd.depth = 0;
+    prd.power = params.ray_power;
+    prd.stage = 0;    // the sun rays start in the first stage
+    prd.origin = ray_gen_pos;
+    prd.direction = ray_dir;
 
     // TODO make this a launch parameter
-    params.hit_point_buffer[params.max_depth * prd.ray_path_index] = make_float4(0.0f, ray_gen_pos);
+    if (params.hit_point_buffer) {
+        params.hit_point_buffer[params.max_depth * prd.ray_path_index] = make_float4(0.0f, ray_gen_pos);
+        params.hit_power_buffer[params.max_depth * prd.ray_path_index] = prd.power;
+    }
     params.sun_dir_buffer[prd.ray_path_index] = ray_dir;
     
 
-    // Cast and trace the ray through the scene
-    optixTrace(
-        params.handle,               // Acceleration structure handle
-        ray_gen_pos,                 // Ray origin
-        ray_dir,                     // Ray direction
-        0.001f,                      // Minimum ray distance (near hit distance)
-        1e16f,                       // Maximum ray distance (far hit distance)
-        0.0f,                        // Time parameter (static for now)
-        OptixVisibilityMask(1),      // Visibility mask (e.g., to restrict ray interactions)
-        OPTIX_RAY_FLAG_NONE,         // Ray flags (no special flags)
-        OptixCSP::RAY_TYPE_RADIANCE, // Ray type (radiance for sunlight)
-        OptixCSP::RAY_TYPE_COUNT,    // Number of ray types
-        OptixCSP::RAY_TYPE_RADIANCE, // SBT offset (ray type to launch)
-        reinterpret_cast<unsigned int&>(prd.ray_path_index),
-        reinterpret_cast<unsigned int&>(prd.depth)  
-    );
-}
\ No newline at end of file
+    // Trace the path one segment at a time: the closest-hit programs write the next segment to the
+    // payload and the miss program hands the segment to the next stage, none of them traces, so the
+    // stack does not grow with the depth. A path ends when its stage is past the last one; every
+    // segment adds a hit point or moves to a later stage, so the loop ends.
+    while ((prd.stage & OptixCSP::STAGE_INDEX_MASK) < params.num_stages) {
+        const float3 origin = prd.origin;
+        const float3 direction = prd.direction;
+        optixTrace(
+            params.handle,               // Acceleration structure handle
+            origin,                      // Ray origin
+            direction,                   // Ray direction
+            prd.depth == 0 ? 0.001f : 0.01f,  // Minimum ray distance, off the element the segment leaves
+            1e16f,                       // Maximum ray distance (far hit distance)
+            0.0f,                        // Time parameter (static for now)
+            OptixVisibilityMask(1u << (prd.stage & OptixCSP::STAGE_INDEX_MASK)),  // the elements of the stage of the ray
+            OPTIX_RAY_FLAG_NONE,         // Ray flags (no special flags)
+            OptixCSP::RAY_TYPE_RADIANCE, // Ray type (radiance for sunlight)
+            OptixCSP::RAY_TYPE_COUNT,    // Number of ray types
+            OptixCSP::RAY_TYPE_RADIANCE, // SBT offset (ray type to launch)
+            reinterpret_cast<unsigned int&>(prd.ray_path_index),
+            reinterpret_cast<unsigned int&>(prd.depth),
+            reinterpret_cast<unsigned int&>(prd.power),
+            reinterpret_cast<unsigned int&>(prd.stage),
+            reinterpret_cast<unsigned int&>(prd.origin.x),
+            reinterpret_cast<unsigned int&>(prd.origin.y),
+            reinterpret_cast<unsigned int&>(prd.origin.z),
+            reinterpret_cast<unsigned int&>(prd.direction.x),
+            reinterpret_cast<unsigned int&>(prd.direction.y),
+            reinterpret_cast<unsigned int&>(prd.direction.z)
+        );
+    }
+
+    // The hit stream holds the sun point of the paths that hit something, a ray lost on its way
+    // into the field leaves no record at all.
+    if (params.hit_stream.records && prd.depth > 0) {
+        OptixCSP::HitRecord record;
+        record.position = ray_gen_pos;
+        record.power = params.ray_power;
+        record.ray = params.hit_stream.ray_offset + ray_number;
+        record.element = OptixCSP::HIT_NO_ELEMENT;
+        record.depth = 0;
+        record.tag = 0;
+        OptixCSP::appendHitRecord(params.hit_stream, record);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <vector_types.h>
+
+namespace OptixCSP {
+
+    /// Writes hit point buffers (max_depth float4 per ray, stage tag in x, point in yzw) to a csv file
+    /// one after the other, numbering the rays on across them, so the buffers of consecutive launches
+    /// make the file of a single launch over all their rays. All-zero points mark unused entries.
+    class HitPointCsvWriter {
+    public:
+        bool open(const std::string& filename) {
+            m_out.open(filename);
+            if (!m_out.is_open()) {
+                std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+                return false;
+            }
+            m_current_ray = 1;
+            m_stage = 0;
+
+            // Write header
+            // TODO, if statements to check if one needs to write dir_cos_buffer or not
+            m_out << "number,stage,loc_x,loc_y,loc_z,cosx,cosy,cosz\n";
+            return true;
+        }
+
+        void append(const std::vector<float4>& hp_output_buffer, int max_depth) {
+            for (const auto& element : hp_output_buffer) {
+
+                // Inline check: if y, z, and w are all zero, treat as marker for new ray.
+                if ((element.y == 0) && (element.z == 0) && (element.w == 0)) {
+                    if (m_stage > 0) {
+                        m_current_ray++;
+                        m_stage = 0;
+                    }
+                    continue;  // Skip printing this marker element.
+                }
+
+                // If we haven't reached max_trace stages for the current ray, print the element.
+                if (m_stage < max_depth) {
+                    m_out << m_current_ray << ","
+                        << element.x << "," << element.y << ","
+                        << element.z << "," << element.w << "\n";
+                    m_stage++;
+                }
+                else {
+                    // If max_trace stages reached, move to next ray and reset stage counter.
+                    m_current_ray++;
+                    m_stage = 0;
+                    m_out << m_current_ray << ","
+                        << element.x << "," << element.y << ","
+                        << element.z << "," << element.w << "\n";
+                    m_stage++;
+                }
+            }
+        }
+
+        void close() { m_out.close(); }
+
+    private:
+        std::ofstream m_out;
+        int m_current_ray = 1;
+        int m_stage = 0;
+    };
+
+    /// Write a hit point buffer to a csv file, shared by the GPU and the CPU tracers.
+    inline bool write_hit_point_csv(const std::vector<float4>& hp_output_buffer, int max_depth, const std::string& filename) {
+        HitPointCsvWriter writer;
+        if (!writer.open(filename))
+            return false;
+        writer.append(hp_output_buffer, max_depth);
+        writer.close();
+        std::cout << "Data successfully written to " << filename << std::endl;
+        return true;
+    }
+
+    /// number of receiver hits (stage tag 2) in a hit point buffer
+    inline int count_receiver_hits(const std::vector<float4>& hp_output_buffer) {
+        int num_hits = 0;
+        for (const auto& element : hp_output_buffer) {
+            if (std::abs(element.x - 2.0) < 0.1f) { // x value of 2.0 indicates a hit on the receiver
+                num_hits++;
+            }
+        }
+        return num_hits;
+    }
+}